@@ -216,7 +216,7 @@ def main():
         non_ref_sequences = args.show_these_sequences.split()
         logging.info(f"Selecting {args.show_these_sequences} as non-reference sequences")
     with taffy.lib.AlignmentReader(args.alignment_file, sequence_intervals=sequence_intervals,
-                                   taf_index=taf_index) as ar:
+                                   taf_index=taf_index, skip_bases=True) as ar:  # Only coordinates are needed
         for i, block in enumerate(ar):  # For each block in alignment
             if i % args.sample_every_nth_block:  # Only considered every nth block
                 total_ref_gap_length += block.first_row().length()  # Add the length of the block to the total ref
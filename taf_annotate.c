@@ -22,7 +22,7 @@ static void usage(void) {
     fprintf(stderr, "-s --repeatCoordinatesEveryNColumns : Repeat coordinates of each sequence at least every n columns. By default: %" PRIi64 "\n", repeat_coordinates_every_n_columns);
     fprintf(stderr, "-c --useCompression : Write the output using bgzip compression.\n");
     fprintf(stderr, "-r --refPrefix : Prefix to prepend to chrom names in annotation file to form the sequence name.\n");
-    fprintf(stderr, "-T --threads N : Use N threads for bgzf I/O (default 1, only effective on bgzipped streams)\n");
+    fprintf(stderr, "-T --threads N : Use N threads for bgzf I/O, for reading and parsing the input and for writing the output (default 1, bgzf threads are only effective on bgzipped streams)\n");
     fprintf(stderr, "-l --logLevel : Set the log level\n");
     fprintf(stderr, "-h --help : Print this help message\n");
 }
@@ -41,11 +41,10 @@ static void label_alignment(Alignment *alignment, stHash *labels, char *tag_name
                 if (ref_row->bases[i] != '-') { // If a reference coordinate (not a gap)
                     double *label = stHash_search(seq_labels, (void *) start++);
                     if (label) {
-                        assert(tag_find(alignment->column_tags[i], tag_name) ==
-                               NULL); // No existing tag with this label
+                        Tag *tags = alignment_get_column_tags(alignment, i);
+                        assert(tag_find(tags, tag_name) == NULL); // No existing tag with this label
                         // Add the tag
-                        alignment->column_tags[i] = tag_construct(tag_name, stString_print("%f", label[0]),
-                                                                  alignment->column_tags[i]);
+                        alignment->column_tags[i] = tag_construct(tag_name, stString_print("%f", label[0]), tags);
                     }
                 }
             }
@@ -141,6 +140,8 @@ int taf_annotate_main(int argc, char *argv[]) {
 
     st_setLogLevelFromString(logLevelString);
     LI_set_bgzf_threads(bgzf_threads);
+    LI_set_read_ahead(bgzf_threads > 1); // Read the input on its own thread too
+    LW_set_write_behind(bgzf_threads > 1); // And write the output on its own thread
     st_logInfo("Input file string : %s\n", taf_file);
     st_logInfo("Output file string : %s\n", output_file);
     st_logInfo("Wig file string : %s\n", wig_file);
@@ -164,6 +165,7 @@ int taf_annotate_main(int argc, char *argv[]) {
         if (taf_file != NULL) fclose(taf_fh);
         return 1;
     }
+    block_reader_set_threads(reader, bgzf_threads);
     // Output is TAF regardless of input format. For MAF input we won't run-length encode the
     // body (annotate has no flag to opt in); for TAF input we preserve the input's RLE setting.
     bool run_length_encode_bases = block_reader_run_length_encoded(reader);
@@ -222,8 +222,8 @@ int taf_coverage_main(int argc, char *argv[]) {
 void update_block_coverage(Alignment* aln, Alignment* prev_aln, const string& ref_name, stHash* genome_names,
                            ContigCoverageMap& contig_cov_map) {
     
-    // random access rows
-    vector<Alignment_Row*> rows(aln->row_number, NULL);
+    // random access rows, from the alignment's row index
+    Alignment_Row** rows = alignment_get_rows(aln);
 
     // remember parsed names
     vector<string> row_to_name(aln->row_number);
@@ -257,8 +257,6 @@ void update_block_coverage(Alignment* aln, Alignment* prev_aln, const string& re
         const string& name_str = row_to_name[row_idx];        
         free(name);
 
-        rows[row_idx] = row;
-        
         // update the ref row
         if (ref_row_idx == -1 && (ref_name.empty() || name_str == ref_name)) {
             ref_row_idx = row_idx;
@@ -14,7 +14,10 @@ static void usage(void) {
     fprintf(stderr, "Index a TAF or MAF file, output goes in <file>.tai\n");
     fprintf(stderr, "-i --inputFile : Input taf or maf file [REQUIRED]\n");
     fprintf(stderr, "-b --blockSize : Write an index line for intervals of this many bp [default:10000]\n");
-    fprintf(stderr, "-T --threads N : Use N threads for bgzf I/O (default 1, only effective on bgzipped streams)\n");
+    fprintf(stderr, "-B --binary : Write the index in the binary format, which is memory mapped rather than parsed when loaded\n");
+    fprintf(stderr, "-k --indexEveryKBlocks K : Also index every Kth block between the anchor lines of a TAF, with the coordinates of its rows, so a region query reads at most K blocks before the region (requires -B)\n");
+    fprintf(stderr, "-T --threads N : Use N threads for bgzf I/O and for reading the input (default 1, bgzf threads are only effective on bgzipped streams)\n");
+    fprintf(stderr, "-c --computeThreads N : Scan the input for the lines to index on N threads, each reading its own part of the file (default 1, only used for TAF input without -k)\n");
     fprintf(stderr, "-l --logLevel : Set the log level\n");
     fprintf(stderr, "-h --help : Print this help message\n");
 }
@@ -28,7 +31,10 @@ int taf_index_main(int argc, char *argv[]) {
     char *logLevelString = NULL;
     char *taf_fn = NULL;
     int64_t block_size = 10000;
+    bool binary = 0;
+    int64_t index_every_k_blocks = 0;
     int bgzf_threads = 1;
+    int64_t compute_threads = 1;
 
     ///////////////////////////////////////////////////////////////////////////
     // Parse the inputs
@@ -38,12 +44,15 @@ int taf_index_main(int argc, char *argv[]) {
         static struct option long_options[] = { { "logLevel", required_argument, 0, 'l' },
                                                 { "inputFile", required_argument, 0, 'i' },
                                                 { "blockSize", required_argument, 0, 'b' },
+                                                { "binary", no_argument, 0, 'B' },
+                                                { "indexEveryKBlocks", required_argument, 0, 'k' },
                                                 { "threads", required_argument, 0, 'T' },
+                                                { "computeThreads", required_argument, 0, 'c' },
                                                 { "help", no_argument, 0, 'h' },
                                                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
-        int64_t key = getopt_long(argc, argv, "l:i:b:hT:", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:i:b:Bk:hT:c:", long_options, &option_index);
         if (key == -1) {
             break;
         }
@@ -58,9 +67,18 @@ int taf_index_main(int argc, char *argv[]) {
             case 'b':
                 block_size = atoi(optarg);
                 break;
+            case 'B':
+                binary = 1;
+                break;
+            case 'k':
+                index_every_k_blocks = atol(optarg);
+                break;
             case 'T':
                 bgzf_threads = atoi(optarg);
                 break;
+            case 'c':
+                compute_threads = atol(optarg);
+                break;
             case 'h':
                 usage();
                 return 0;
@@ -76,8 +94,12 @@ int taf_index_main(int argc, char *argv[]) {
 
     st_setLogLevelFromString(logLevelString);
     LI_set_bgzf_threads(bgzf_threads);
+    LI_set_read_ahead(bgzf_threads > 1); // Read the input on its own thread too
     st_logInfo("Input file string : %s\n", taf_fn);
     st_logInfo("Block size : %" PRIi64 "\n", block_size);
+    st_logInfo("Binary index : %s\n", binary ? "true" : "false");
+    st_logInfo("Index every k blocks : %" PRIi64 "\n", index_every_k_blocks);
+    st_logInfo("Compute threads : %" PRIi64 "\n", compute_threads);
     
     //////////////////////////////////////////////
     // Make the .tai index
@@ -87,6 +109,10 @@ int taf_index_main(int argc, char *argv[]) {
         fprintf(stderr, "Input file must be specified with -i\n");
         return 1;        
     }
+    if (index_every_k_blocks > 0 && !binary) {
+        fprintf(stderr, "-k/--indexEveryKBlocks requires the binary index, given with -B\n");
+        return 1;
+    }
     FILE *taf_fh = fopen(taf_fn, "r");
     if (taf_fh == NULL) {
         fprintf(stderr, "Unable to open input file: %s\n", taf_fn);
@@ -101,7 +127,7 @@ int taf_index_main(int argc, char *argv[]) {
         return 1;
     }
 
-    tai_create(li, tai_fh, block_size);
+    tai_create3(li, taf_fn, tai_fh, block_size, binary, index_every_k_blocks, compute_threads);
 
     //////////////////////////////////////////////
     // Cleanup
@@ -6,6 +6,7 @@
 
 #include "taf.h"
 #include "block_reader.h"
+#include "tai.h"
 #include "sonLib.h"
 #include <getopt.h>
 #include <time.h>
@@ -33,10 +34,13 @@ static void usage(void) {
     fprintf(stderr, "-Q --minimumSharedRows : The minimum number of rows between two blocks that need to be shared for a merge, default: %" PRIi64 "\n", minimum_shared_rows);
     fprintf(stderr, "-q --fractionSharedRows : The fraction of rows between two blocks that need to be shared for a merge, default: %f\n", fraction_shared_rows);
     fprintf(stderr, "-u --unnormalize : Reverse of the normal merging: split each block at every run of columns in which the reference (first) row has a gap, removing those columns, so that no output block has a reference gap. The bases in the removed columns are not aligned to the reference and are dropped. Can not be combined with -d, -a or -b, and the -m, -n, -Q and -q merging options are not used.\n");
+    fprintf(stderr, "-g --sparseGapRows : Hold the rows of merged blocks that are mostly gaps as runs of gaps rather than as a base per column, which saves memory when merging blocks with many rows that are missing from most of them\n");
     fprintf(stderr, "-d --filterGapCausingDupes : Reduce the number of MAF blocks by filtering out rows that induce gaps > maximumGapLength. Rows are only filtered out if they are duplications (contig of same name appears elsewhere in block, or contig with same prefix up to \".\" appears in the same block).\n");
     fprintf(stderr, "-s --repeatCoordinatesEveryNColumns : Repeat coordinates of each sequence at least every n columns. By default: %" PRIi64 "\n", repeat_coordinates_every_n_columns);
     fprintf(stderr, "-c --useCompression : Write the output using bgzip compression.\n");
-    fprintf(stderr, "-T --threads N : Use N threads for bgzf I/O (default 1, only effective on bgzipped streams)\n");
+    fprintf(stderr, "-A --anchorEveryNBytes N : Start each anchor line (a line giving the coordinates of every row, written at the start of each contig and every -s columns) in a new BGZF block when writing with -c, so region queries against the index only decompress the blocks they need, and also write an anchor about every N compressed bytes (0 for only every -s columns)\n");
+    fprintf(stderr, "-I --index N : Index the output as it is written, as taffy index -b N would, writing the index alongside it (requires -o and TAF output)\n");
+    fprintf(stderr, "-T --threads N : Use N threads for bgzf I/O, for reading and parsing the input and for writing the output (default 1, bgzf threads are only effective on bgzipped streams)\n");
     fprintf(stderr, "-a --halFile : HAL file for extracting gap sequence (MAF must be created with hal2maf *without* --onlySequenceNames)\n");
     fprintf(stderr, "-b --seqFiles : Fasta files for extracting gap sequence. Do not specify both this option and --halFile\n");
     fprintf(stderr, "-h --help : Print this help message\n");
@@ -198,6 +202,7 @@ static bool greedy_prune_by_gap(Alignment *alignment, int64_t maximum_gap_length
                 p_row_ptr = &((*p_row_ptr)->n_row);
             }
         }
+        alignment_index_rows(alignment);
     }
     stHash_destruct(row_to_sample_name);
     stHash_destruct(sample_to_count);
@@ -259,8 +264,11 @@ int taf_norm_main(int argc, char *argv[]) {
     bool run_length_encode_bases = 0;
     bool output_maf = 0;
     bool use_compression = 0;
+    int64_t anchor_every_n_bytes = -1; // If not negative, see LW_set_block_aligned_anchors
+    int64_t index_block_size = 0; // If positive, index the output as it is written, see tai_writer_construct_for_lw
     bool filter_gap_causing_dupes = 0;
     bool unnormalize = 0;
+    bool sparse_gap_rows = 0;
     stList *fasta_files = stList_construct();
     char *hal_file = NULL;
     int bgzf_threads = 1;
@@ -281,15 +289,18 @@ int taf_norm_main(int argc, char *argv[]) {
                                                 { "minimumSharedRows", required_argument, 0, 'Q' },
                                                 { "filterGapCausingDupes", no_argument, 0, 'd' },
                                                 { "unnormalize", no_argument, 0, 'u' },
+                                                { "sparseGapRows", no_argument, 0, 'g' },
                                                 { "repeatCoordinatesEveryNColumns", required_argument, 0, 's' },
                                                 { "useCompression", no_argument, 0, 'c' },
+                                                { "anchorEveryNBytes", required_argument, 0, 'A' },
+                                                { "index", required_argument, 0, 'I' },
                                                 { "halFile", required_argument, 0, 'a' },
                                                 { "seqFiles", required_argument, 0, 'b' },
                                                 { "threads", required_argument, 0, 'T' },
                                                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
-        int64_t key = getopt_long(argc, argv, "l:i:o:hcm:n:dukQ:q:s:a:b:T:", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:i:o:hcm:n:dukgQ:q:s:a:b:T:A:I:", long_options, &option_index);
         if (key == -1) {
             break;
         }
@@ -322,6 +333,9 @@ int taf_norm_main(int argc, char *argv[]) {
             case 'u':
                 unnormalize = 1;
                 break;
+            case 'g':
+                sparse_gap_rows = 1;
+                break;
             case 'Q':
                 minimum_shared_rows = atol(optarg);
                 break;
@@ -331,6 +345,12 @@ int taf_norm_main(int argc, char *argv[]) {
             case 'c':
                 use_compression = 1;
                 break;
+            case 'A':
+                anchor_every_n_bytes = atol(optarg);
+                break;
+            case 'I':
+                index_block_size = atol(optarg);
+                break;
             case 's':
                 repeat_coordinates_every_n_columns = atol(optarg);
                 break;
@@ -363,13 +383,21 @@ int taf_norm_main(int argc, char *argv[]) {
         return 1;
     }
 
+    if(index_block_size > 0 && (outputFile == NULL || output_maf)) {
+        fprintf(stderr, "-I/--index requires a TAF output file given with -o\n");
+        return 1;
+    }
+
     st_setLogLevelFromString(logLevelString);
     LI_set_bgzf_threads(bgzf_threads);
+    LI_set_read_ahead(bgzf_threads > 1); // Read the input on its own thread too
+    LW_set_write_behind(bgzf_threads > 1); // And write the output on its own thread
     st_logInfo("Input file string : %s\n", inputFile);
     st_logInfo("Output file string : %s\n", outputFile);
     st_logInfo("Maximum block length to merge : %" PRIi64 "\n", maximum_block_length_to_merge);
     st_logInfo("Maximum gap length : %" PRIi64 "\n", maximum_gap_length);
     st_logInfo("Filter gap-causing dupes : %d\n", (int)filter_gap_causing_dupes);
+    st_logInfo("Sparse gap rows : %s\n", sparse_gap_rows ? "true" : "false");
     st_logInfo("Output maf : %s\n", output_maf ? "true" : "false");
     st_logInfo("Repeat coordinates every n bases : %" PRIi64 "\n", repeat_coordinates_every_n_columns);
     st_logInfo("Fraction shared rows to merge adjacent blocks : %f\n", fraction_shared_rows);
@@ -401,6 +429,10 @@ int taf_norm_main(int argc, char *argv[]) {
 
     FILE *input = inputFile == NULL ? stdin : fopen(inputFile, "r");
     LW *output = LW_construct(outputFile == NULL ? stdout : fopen(outputFile, "w"), use_compression);
+    if (anchor_every_n_bytes >= 0) {
+        LW_set_block_aligned_anchors(output, anchor_every_n_bytes);
+    }
+    Tai_Writer *index = index_block_size > 0 ? tai_writer_construct_for_lw(output, outputFile, index_block_size) : NULL;
     LI *li = LI_construct(input);
 
     // Open a format-agnostic reader; for MAF input the reader transparently links adjacent
@@ -409,10 +441,14 @@ int taf_norm_main(int argc, char *argv[]) {
     BlockReader *reader = block_reader_open(li);
     if (reader == NULL) {
         LW_destruct(output, outputFile != NULL);
+        if (index != NULL) {
+            tai_writer_destruct(index);
+        }
         LI_destruct(li);
         if (inputFile != NULL) fclose(input);
         return 1;
     }
+    block_reader_set_threads(reader, bgzf_threads);
     run_length_encode_bases = block_reader_run_length_encoded(reader);
     Tag *tag = block_reader_take_header(reader);
     if(output_maf && run_length_encode_bases) { // Remove this tag from the maf output as not relevant
@@ -468,6 +504,9 @@ int taf_norm_main(int argc, char *argv[]) {
             fclose(input);
         }
         LW_destruct(output, outputFile != NULL);
+        if (index != NULL) {
+            tai_writer_destruct(index);
+        }
         if (fastas_map) {
             stHash_destruct(fastas_map);
         }
@@ -508,7 +547,7 @@ int taf_norm_main(int argc, char *argv[]) {
                     if(hal_species || fastas_map) { // Now add in any gap bases if sequences are provided
                         alignment_add_gap_strings(p_alignment, alignment, fastas_map, hal_handle, hal_species, -1);
                     }
-                    p_alignment = alignment_merge_adjacent(p_alignment, alignment);
+                    p_alignment = alignment_merge_adjacent2(p_alignment, alignment, sparse_gap_rows);
                     alignment_sort_the_rows(p_p_alignment, p_alignment, NULL, 1, 1); // Resort the rows, because the
                     // merge can make them out of order
                     merged = true;
@@ -547,6 +586,9 @@ int taf_norm_main(int argc, char *argv[]) {
         fclose(input);
     }
     LW_destruct(output, outputFile != NULL);
+    if (index != NULL) {
+        tai_writer_destruct(index);
+    }
 
     if (fastas_map) {
         stHash_destruct(fastas_map);
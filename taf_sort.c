@@ -22,12 +22,15 @@ static void usage(void) {
                     "with any ties broken by lexicographic sort of the suffixes.\n");
     fprintf(stderr, "-f --filterFile : Remove any rows with sequences matching a prefix in this file\n");
     fprintf(stderr, "-p --padFile : Add a padding row for any sequence in this file that is not a prefix of an existing row\n");
+    fprintf(stderr, "-g --sparseGapRows : Hold the padding rows added by -p as runs of gaps rather than as a base per column, which saves memory when padding many blocks with many sequences\n");
     fprintf(stderr, "-d --dupFilterFile : Remove duplicate sequences matching any prefix in this file\n");
     fprintf(stderr, "-r --dontIgnoreFirstRow : Do consider the first (reference) row of each maf block - by default we "
                     "don't alter the sort of the reference row\n");
     fprintf(stderr, "-s --repeatCoordinatesEveryNColumns : Repeat TAF coordinates of each sequence at least every n columns. By default: %" PRIi64 "\n", repeat_coordinates_every_n_columns);
     fprintf(stderr, "-c --useCompression : Write the output using bgzip compression.\n");
-    fprintf(stderr, "-T --threads N : Use N threads for bgzf I/O (default 1, only effective on bgzipped streams)\n");
+    fprintf(stderr, "-A --anchorEveryNBytes N : Start each anchor line (a line giving the coordinates of every row, written at the start of each contig and every -s columns) in a new BGZF block when writing with -c, so region queries against the index only decompress the blocks they need, and also write an anchor about every N compressed bytes (0 for only every -s columns)\n");
+    fprintf(stderr, "-I --index N : Index the output as it is written, as taffy index -b N would, writing the index alongside it (requires -o)\n");
+    fprintf(stderr, "-T --threads N : Use N threads for bgzf I/O, for reading and parsing the input and for writing the output (default 1, bgzf threads are only effective on bgzipped streams)\n");
     fprintf(stderr, "-l --logLevel : Set the log level\n");
     fprintf(stderr, "-h --help : Print this help message\n");
 }
@@ -50,15 +53,16 @@ stList *load_sort_file(char *sort_file) {
 
 void process_alignment_block(Alignment *pp_alignment, Alignment *p_alignment, stList *prefixes_to_filter_by,
                              stList * prefixes_to_pad, stList *prefixes_to_sort_by, stList *prefixes_to_dup_filter,
-                             bool run_length_encode_bases, bool ignore_first_row, LW *output) {
+                             bool run_length_encode_bases, bool ignore_first_row, bool sparse_gap_rows,
+                             LW *output) {
     if(p_alignment) {
         if(prefixes_to_filter_by) { //Remove rows matching a prefix
             alignment_filter_the_rows(p_alignment, prefixes_to_filter_by, ignore_first_row);
         }
         if(prefixes_to_pad) {
-            alignment_pad_the_rows(prefixes_to_sort_by ? NULL : pp_alignment,p_alignment,
-                                   prefixes_to_pad); // Note we only reconnect to the prior alignment
-                                   // if we are not sorting - this is for efficiency (avoid runing O(ND) twice)
+            alignment_pad_the_rows2(prefixes_to_sort_by ? NULL : pp_alignment,p_alignment,
+                                    prefixes_to_pad, sparse_gap_rows); // Note we only reconnect to the prior alignment
+                                    // if we are not sorting - this is for efficiency (avoid runing O(ND) twice)
         }
         if(prefixes_to_sort_by) { // Sort the alignment block rows
             alignment_sort_the_rows(pp_alignment, p_alignment,
@@ -90,7 +94,10 @@ int taf_sort_main(int argc, char *argv[]) {
     char *pad_file = NULL;
     char *dup_filter_file = NULL;
     bool ignore_first_row = 1;
+    bool sparse_gap_rows = 0;
     bool use_compression = 0;
+    int64_t anchor_every_n_bytes = -1; // If not negative, see LW_set_block_aligned_anchors
+    int64_t index_block_size = 0; // If positive, index the output as it is written, see tai_writer_construct_for_lw
     int bgzf_threads = 1;
 
     ///////////////////////////////////////////////////////////////////////////
@@ -105,15 +112,18 @@ int taf_sort_main(int argc, char *argv[]) {
                                                {"filterFile", required_argument, 0, 'f'},
                                                {"padFile", required_argument, 0, 'p'},
                                                {"dupFilterFile", required_argument, 0, 'd'},
+                                               {"sparseGapRows", no_argument, 0, 'g'},
                                                {"dontIgnoreFirstRow", no_argument, 0, 'r'},
                                                {"repeatCoordinatesEveryNColumns", required_argument, 0, 's'},
                                                {"useCompression", no_argument, 0, 'c'},
+                                               {"anchorEveryNBytes", required_argument, 0, 'A'},
+                                               {"index", required_argument, 0, 'I'},
                                                {"threads", required_argument, 0, 'T'},
                                                {"help",       no_argument,       0, 'h'},
                                                {0, 0,                            0, 0}};
 
         int option_index = 0;
-        int64_t key = getopt_long(argc, argv, "l:i:o:n:hrf:p:d:s:cT:", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:i:o:n:hrf:p:gd:s:cT:A:I:", long_options, &option_index);
         if (key == -1) {
             break;
         }
@@ -140,6 +150,9 @@ int taf_sort_main(int argc, char *argv[]) {
             case 'd':
                 dup_filter_file = optarg;
                 break;
+            case 'g':
+                sparse_gap_rows = 1;
+                break;
             case 'r':
                 ignore_first_row = 0;
                 break;
@@ -149,6 +162,12 @@ int taf_sort_main(int argc, char *argv[]) {
             case 'c':
                 use_compression = 1;
                 break;
+            case 'A':
+                anchor_every_n_bytes = atol(optarg);
+                break;
+            case 'I':
+                index_block_size = atol(optarg);
+                break;
             case 'T':
                 bgzf_threads = atoi(optarg);
                 break;
@@ -167,6 +186,8 @@ int taf_sort_main(int argc, char *argv[]) {
 
     st_setLogLevelFromString(logLevelString);
     LI_set_bgzf_threads(bgzf_threads);
+    LI_set_read_ahead(bgzf_threads > 1); // Read the input on its own thread too
+    LW_set_write_behind(bgzf_threads > 1); // And write the output on its own thread
     st_logInfo("Input file string : %s\n", input_file);
     st_logInfo("Output file string : %s\n", output_file);
     st_logInfo("Sort file string : %s\n", sort_file);
@@ -174,11 +195,17 @@ int taf_sort_main(int argc, char *argv[]) {
     st_logInfo("Pad file string : %s\n", pad_file);
     st_logInfo("Dup filter file string : %s\n", dup_filter_file);
     st_logInfo("Ignore first row : %s\n", ignore_first_row ? "True" : "False");
+    st_logInfo("Sparse gap rows : %s\n", sparse_gap_rows ? "True" : "False");
 
     //////////////////////////////////////////////
     // Read in the taf/maf blocks and sort order file
     //////////////////////////////////////////////
 
+    if (index_block_size > 0 && output_file == NULL) {
+        fprintf(stderr, "-I/--index requires a TAF output file given with -o\n");
+        return 1;
+    }
+
     // Input taf
     FILE *input = input_file == NULL ? stdin : fopen(input_file, "r");
     if (input == NULL) {
@@ -194,6 +221,10 @@ int taf_sort_main(int argc, char *argv[]) {
         return 1;
     }
     LW *output = LW_construct(output_fh, use_compression);
+    if (anchor_every_n_bytes >= 0) {
+        LW_set_block_aligned_anchors(output, anchor_every_n_bytes);
+    }
+    Tai_Writer *index = index_block_size > 0 ? tai_writer_construct_for_lw(output, output_file, index_block_size) : NULL;
 
     // Sort/filter/pad files
     stList *prefixes_to_filter_by = load_sort_file(filter_file);
@@ -209,6 +240,7 @@ int taf_sort_main(int argc, char *argv[]) {
         if (input_file != NULL) fclose(input);
         return 1;
     }
+    block_reader_set_threads(reader, bgzf_threads);
     bool run_length_encode_bases = block_reader_run_length_encoded(reader);
     Tag *tag = block_reader_take_header(reader);
 
@@ -220,13 +252,15 @@ int taf_sort_main(int argc, char *argv[]) {
     Alignment *alignment, *p_alignment = NULL, *pp_alignment = NULL;
     while ((alignment = block_reader_next(reader, p_alignment)) != NULL) {
         process_alignment_block(pp_alignment, p_alignment, prefixes_to_filter_by, prefixes_to_pad,
-                                prefixes_to_sort_by, prefixes_to_dup_filter, run_length_encode_bases, ignore_first_row, output);
+                                prefixes_to_sort_by, prefixes_to_dup_filter, run_length_encode_bases, ignore_first_row,
+                                sparse_gap_rows, output);
         pp_alignment = p_alignment;
         p_alignment = alignment;
     }
     if(p_alignment) { // Write the final block
         process_alignment_block(pp_alignment, p_alignment, prefixes_to_filter_by, prefixes_to_pad,
-                                prefixes_to_sort_by, prefixes_to_dup_filter, run_length_encode_bases, ignore_first_row, output);
+                                prefixes_to_sort_by, prefixes_to_dup_filter, run_length_encode_bases, ignore_first_row,
+                                sparse_gap_rows, output);
         alignment_destruct(p_alignment, 1);
     }
 
@@ -241,6 +275,9 @@ int taf_sort_main(int argc, char *argv[]) {
         fclose(input);
     }
     LW_destruct(output, output_file != NULL);
+    if (index != NULL) {
+        tai_writer_destruct(index);
+    }
 
     st_logInfo("taffy sort is done, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
 
@@ -18,7 +18,7 @@ static void usage(void) {
     fprintf(stderr, "-s --sequenceLengths : Print length of each *reference* sequence in the (indexed) alignment\n");
     fprintf(stderr, "-a --alignmentStats : Print stats about block number, aligned bases, etc.\n");
     fprintf(stderr, "-b --sequenceIntervals : Print the BED intervals of each *reference* sequence covered by the alignment\n");
-    fprintf(stderr, "-T --threads N : Use N threads for bgzf I/O (default 1, only effective on bgzipped streams)\n");
+    fprintf(stderr, "-T --threads N : Use N threads for bgzf I/O and for reading and parsing the input (default 1, bgzf threads are only effective on bgzipped streams)\n");
     fprintf(stderr, "-l --logLevel : Set the log level\n");
     fprintf(stderr, "-h --help : Print this help message\n");
 }
@@ -94,6 +94,7 @@ int taf_stats_main(int argc, char *argv[]) {
 
     st_setLogLevelFromString(logLevelString);
     LI_set_bgzf_threads(bgzf_threads);
+    LI_set_read_ahead(bgzf_threads > 1); // Read the input on its own thread too
     st_logInfo("Input file string : %s\n", taf_fn);
 
     //////////////////////////////////////////////
@@ -127,6 +128,8 @@ int taf_stats_main(int argc, char *argv[]) {
         }
         input_is_maf = block_reader_is_maf(reader);
         tag_destruct(block_reader_take_header(reader));
+        block_reader_set_skip_bases(reader, 1); // -b and -a only need the coordinates and lengths of the rows
+        block_reader_set_threads(reader, bgzf_threads);
     } else {
         // for -s we still need to know the format to load the index correctly
         int input_format = check_input_format(LI_peek_at_next_line(li));
@@ -211,14 +214,9 @@ int taf_stats_main(int argc, char *argv[]) {
             total_columns += alignment_length(alignment);
             total_column_depth += alignment_length(alignment) * alignment->row_number;
             Alignment_Row *row = alignment->row;
-            while (row != NULL) {
-                for (int64_t i = 0; i < alignment_length(alignment); i++) {
-                    if (row->bases[i] == '-') {
-                        total_gaps++;
-                    } else {
-                        total_aligned_bases++;
-                    }
-                }
+            while (row != NULL) { // The length of a row is its number of non-gap bases
+                total_aligned_bases += row->length;
+                total_gaps += alignment_length(alignment) - row->length;
                 row = row->n_row;
             }
             if(p_alignment != NULL) {
@@ -28,6 +28,9 @@ static void usage(void) {
     fprintf(stderr, "-P --paf-all : Output in all-to-all PAF format [default=TAF format]\n");
     fprintf(stderr, "-C --cs : Output PAF cigars in cs instead of cg format\n");
     fprintf(stderr, "-r --region  : Print only SEQ:START-END, where SEQ is a row-0 sequence name, and START-END are 0-based open-ended like BED\n");
+    fprintf(stderr, "-R --regions : Print only the regions in the given BED file, in sorted order with overlapping and adjacent regions merged, reading on between regions rather than seeking where possible\n");
+    fprintf(stderr, "-k --keepRegionOrder : With -R, print the regions in the order of the BED file, each whole, rather than sorted and merged\n");
+    fprintf(stderr, "-O --regionsOutputPrefix PREFIX : With -R, write each region to its own file, PREFIX followed by the index of the region in the BED file (counting from 0) and .taf, .maf or .paf, rather than to the output. Implies -k, so overlapping regions each get their file\n");
     fprintf(stderr, "-s --repeatCoordinatesEveryNColumns : Repeat TAF coordinates of each sequence at least every n columns. By default: %" PRIi64 "\n", repeat_coordinates_every_n_columns);
     fprintf(stderr, "-u --runLengthEncodeBases : Run length encode output bases in TAF\n");
     fprintf(stderr, "-a --showOnlyReferenceDifferences : Replace matches with the reference (first row) with a * character\n");
@@ -37,8 +40,10 @@ static void usage(void) {
     fprintf(stderr, "-t --phylogeny [newick tree file] : Specify a file containing the phylogeny for the alignment, where species names must be prefixes of sequence names\n");
     fprintf(stderr, "-d --omitCoordinates : When printing TAF, just print the columns omitting the coordinates. THIS IS FOR VISUALIZATION ONLY - DOES NOT PRODUCE A VALID TAF \n");
     fprintf(stderr, "-c --useCompression : Write the output using bgzip compression.\n");
+    fprintf(stderr, "-A --anchorEveryNBytes N : Start each anchor line (a line giving the coordinates of every row, written at the start of each contig and every -s columns) in a new BGZF block when writing with -c, so region queries against the index only decompress the blocks they need, and also write an anchor about every N compressed bytes (0 for only every -s columns)\n");
+    fprintf(stderr, "-I --index N : Index the output as it is written, as taffy index -b N would, writing the index alongside it (requires -o and TAF output)\n");
     fprintf(stderr, "-n --nameMapFile : Apply the given two-column tab-separated name mapping to all assembly names in alignment\n");
-    fprintf(stderr, "-T --threads N : Use N threads for bgzf I/O (default 1, only effective on bgzipped streams)\n");
+    fprintf(stderr, "-T --threads N : Use N threads for bgzf I/O, for reading and parsing the input and for writing the output, and with -R to read N regions at once, each through its own handle on the input (default 1, bgzf threads are only effective on bgzipped streams)\n");
     fprintf(stderr, "-l --logLevel : Set the log level\n");
     fprintf(stderr, "-h --help : Print this help message\n");
 }
@@ -65,6 +70,30 @@ void get_sequence_prefixes_for_tree_nodes(void) {
     stList_sort(sequence_prefixes, (int (*)(const void *, const void *))sequence_prefix_cmp_fn);
 }
 
+/*
+ * Open the file of a region for -O and write the header to it.
+ */
+static LW *region_output_construct(const char *prefix, int64_t region_index, bool maf_output, bool taf_output,
+                                   bool use_compression, int64_t anchor_every_n_bytes, Tag *tag) {
+    char *file = stString_print("%s%" PRIi64 ".%s", prefix, region_index, maf_output ? "maf" : (taf_output ? "taf" : "paf"));
+    FILE *fh = fopen(file, "w");
+    if (fh == NULL) {
+        fprintf(stderr, "Unable to open output file: %s\n", file);
+        exit(1);
+    }
+    free(file);
+    LW *lw = LW_construct(fh, use_compression);
+    if (anchor_every_n_bytes >= 0) {
+        LW_set_block_aligned_anchors(lw, anchor_every_n_bytes);
+    }
+    if (maf_output) {
+        maf_write_header(tag, lw);
+    } else if (taf_output) {
+        taf_write_header(tag, lw);
+    }
+    return lw;
+}
+
 static void modify_alignment(Alignment *alignment) {
     if(show_only_reference_differences) {
         alignment_mask_reference_bases(alignment, '*');
@@ -89,7 +118,12 @@ int taf_view_main(int argc, char *argv[]) {
     bool all_to_all_paf = false;
     bool paf_cs = false;
     char *region = NULL;
+    char *regions_file = NULL;
+    bool keep_region_order = false;
+    char *regions_output_prefix = NULL;
     bool use_compression = false;
+    int64_t anchor_every_n_bytes = -1; // If not negative, see LW_set_block_aligned_anchors
+    int64_t index_block_size = 0; // If positive, index the output as it is written, see tai_writer_construct_for_lw
     char *nameMapFile = NULL;
     char *phylogeny_file = NULL;
     static bool color_bases = false;
@@ -116,14 +150,19 @@ int taf_view_main(int argc, char *argv[]) {
                                                 { "omitCoordinates", required_argument, 0, 'd' },
                                                 { "repeatCoordinatesEveryNColumns", required_argument, 0, 's' },
                                                 { "region", required_argument, 0, 'r' },
+                                                { "regions", required_argument, 0, 'R' },
+                                                { "keepRegionOrder", no_argument, 0, 'k' },
+                                                { "regionsOutputPrefix", required_argument, 0, 'O' },
                                                 { "useCompression", no_argument, 0, 'c' },
+                                                { "anchorEveryNBytes", required_argument, 0, 'A' },
+                                                { "index", required_argument, 0, 'I' },
                                                 { "nameMapFile", required_argument, 0, 'n' },
                                                 { "threads", required_argument, 0, 'T' },
                                                 { "help", no_argument, 0, 'h' },
                                                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
-        int64_t key = getopt_long(argc, argv, "l:i:o:mPpCaucs:r:n:habxt:dT:", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:i:o:mPpCaucs:r:R:kO:n:habxt:dT:A:I:", long_options, &option_index);
         if (key == -1) {
             break;
         }
@@ -175,9 +214,24 @@ int taf_view_main(int argc, char *argv[]) {
             case 'r':
                 region = optarg;
                 break;
+            case 'R':
+                regions_file = optarg;
+                break;
+            case 'k':
+                keep_region_order = true;
+                break;
+            case 'O':
+                regions_output_prefix = optarg;
+                break;
             case 'c':
                 use_compression = 1;
                 break;
+            case 'A':
+                anchor_every_n_bytes = atol(optarg);
+                break;
+            case 'I':
+                index_block_size = atol(optarg);
+                break;
             case 'n':
                 nameMapFile = optarg;
                 break;
@@ -199,6 +253,8 @@ int taf_view_main(int argc, char *argv[]) {
 
     st_setLogLevelFromString(logLevelString);
     LI_set_bgzf_threads(bgzf_threads);
+    LI_set_read_ahead(bgzf_threads > 1); // Read the input on its own thread too
+    LW_set_write_behind(bgzf_threads > 1); // And write the output on its own thread
     st_logInfo("Input file string : %s\n", inputFile);
     st_logInfo("Output file string : %s\n", outputFile);
     st_logInfo("Write compressed output : %s\n", use_compression ? "true" : "false");
@@ -221,6 +277,25 @@ int taf_view_main(int argc, char *argv[]) {
         return 1;
     }
 
+    if (region != NULL && regions_file != NULL) {
+        fprintf(stderr, "-r/--region and -R/--regions cannot be used together\n");
+        return 1;
+    }
+
+    if (regions_output_prefix != NULL && (regions_file == NULL || outputFile != NULL || index_block_size > 0)) {
+        fprintf(stderr, "-O/--regionsOutputPrefix requires -R and cannot be used with -o or -I\n");
+        return 1;
+    }
+    if (regions_output_prefix != NULL) {
+        // Merging overlapping regions would leave all but the first of them without a file, so each is read whole
+        keep_region_order = true;
+    }
+
+    if (index_block_size > 0 && (outputFile == NULL || maf_output || paf_output || omit_coordinates)) {
+        fprintf(stderr, "-I/--index requires a TAF output file given with -o\n");
+        return 1;
+    }
+
     /* For URL inputs (only meaningful with -r region queries) we'll skip the
      * local fopen; LI is constructed via bgzf_open which goes through htslib's
      * URL-aware backend. */
@@ -232,8 +307,8 @@ int taf_view_main(int argc, char *argv[]) {
             fprintf(stderr, "Unable to open input file: %s\n", inputFile);
             return 1;
         }
-    } else if (region == NULL) {
-        fprintf(stderr, "URL inputs are only supported with -r region queries\n");
+    } else if (region == NULL && regions_file == NULL) {
+        fprintf(stderr, "URL inputs are only supported with -r or -R region queries\n");
         return 1;
     }
 
@@ -259,6 +334,10 @@ int taf_view_main(int argc, char *argv[]) {
     }
     
     LW *output = LW_construct(output_fh, use_compression);
+    if (anchor_every_n_bytes >= 0) {
+        LW_set_block_aligned_anchors(output, anchor_every_n_bytes);
+    }
+    Tai_Writer *index = index_block_size > 0 ? tai_writer_construct_for_lw(output, outputFile, index_block_size) : NULL;
     LI *li = input_is_url ? LI_construct_from_path(inputFile) : LI_construct(input);
     if (li == NULL) {
         return 1;
@@ -297,39 +376,46 @@ int taf_view_main(int argc, char *argv[]) {
         }
     }
 
-    if (region && inputFile == NULL) {
+    // read the regions before writing anything
+    stList *regions = NULL;
+    if (regions_file) {
+        FILE *regions_fh = fopen(regions_file, "r");
+        if (regions_fh == NULL) {
+            fprintf(stderr, "Unable to open regions file: %s\n", regions_file);
+            return 1;
+        }
+        regions = tai_read_bed(regions_fh);
+        fclose(regions_fh);
+        // apply the name mapping to the regions
+        for (int64_t i = 0; genome_name_map != NULL && i < stList_length(regions); ++i) {
+            Tai_Region *r = stList_get(regions, i);
+            char *mapped_contig = apply_genome_name_mapping(genome_name_map, r->contig);
+            if (mapped_contig != NULL) {
+                free(r->contig);
+                r->contig = mapped_contig;
+            }
+        }
+        st_logInfo("Read %" PRIi64 " regions from %s\n", stList_length(regions), regions_file);
+    }
+
+    if ((region || regions) && inputFile == NULL) {
         fprintf(stderr, "An input file must be specified with -i in order to perform region queries.\n");
         return 1;
     }
     
-    if (maf_output) {
-        maf_write_header(tag, output);
-    } else if (taf_output) {
-        taf_write_header(tag, output);
+    if (regions_output_prefix == NULL) { // else the header is written to the file of each region
+        if (maf_output) {
+            maf_write_header(tag, output);
+        } else if (taf_output) {
+            taf_write_header(tag, output);
+        }
     }
-    tag_destruct(tag);
 
     // three cases below:
     // 1) generic maf/taf index lookup if (region)
     // 2) scan whole taf
     // 3) scan whole maf    
-    if (region) {
-        int64_t region_start;
-        int64_t region_length;
-        char *region_seq = tai_parse_region(region, &region_start, &region_length);
-        if (region_seq == NULL) {
-            fprintf(stderr, "Invalid region: %s\n", region);
-            return 1;
-        }
-        // apply the name mapping to the region
-        char *mapped_region_seq = genome_name_map != NULL ? apply_genome_name_mapping(genome_name_map, region_seq) : NULL;
-        if (mapped_region_seq != NULL) {
-            free(region_seq);
-            region_seq = mapped_region_seq;
-        }
-        
-        st_logInfo("Region: contig=%s start=%" PRIi64 " length=%" PRIi64 "\n", region_seq, region_start, region_length);
-
+    if (region || regions) {
         char *tai_fn = input_is_url ? tai_path_for(inputFile) : tai_path(inputFile);
         FILE *tai_fh = open_tai_for_reading(tai_fn);
 
@@ -340,22 +426,71 @@ int taf_view_main(int argc, char *argv[]) {
 
         Tai* tai = tai_load(tai_fh, !taf_input);
 
-        TaiIt *tai_it = tai_iterator(tai, li, run_length_encode_input_bases, region_seq, region_start, region_length);
-        if (!tai_has_next(tai_it)) {
-            // No overlapping blocks were found. This can happen when the contig is missing from the
-            // index, when the index has a stub entry for a contig with no blocks, or when the queried
-            // sub-range simply doesn't intersect any indexed block. In all cases we exit cleanly so
-            // batch callers don't have to special-case empty regions; the header was already written
-            // above and the loop below is a no-op since tai_next returns NULL. We must NOT early-return
-            // here -- the bgzip writer is only flushed/closed by LW_destruct in the cleanup at the end
-            // of the function, so an early return would leave a 0-byte file when -c is set.
-            fprintf(stderr, "Region %s:%" PRIi64 "-%" PRIi64 " not found in taffy index; emitting header-only output\n",
-                    region_seq, region_start, region_start + region_length);
+        TaiIt *tai_it = NULL;
+        TaiRegionsIt *tai_regions_it = NULL;
+        Tai_Parallel_Reader *tai_parallel_reader = NULL;
+        if (region) {
+            int64_t region_start;
+            int64_t region_length;
+            char *region_seq = tai_parse_region(region, &region_start, &region_length);
+            if (region_seq == NULL) {
+                fprintf(stderr, "Invalid region: %s\n", region);
+                return 1;
+            }
+            // apply the name mapping to the region
+            char *mapped_region_seq = genome_name_map != NULL ? apply_genome_name_mapping(genome_name_map, region_seq) : NULL;
+            if (mapped_region_seq != NULL) {
+                free(region_seq);
+                region_seq = mapped_region_seq;
+            }
+
+            st_logInfo("Region: contig=%s start=%" PRIi64 " length=%" PRIi64 "\n", region_seq, region_start, region_length);
+
+            tai_it = tai_iterator(tai, li, run_length_encode_input_bases, region_seq, region_start, region_length);
+            if (!tai_has_next(tai_it)) {
+                // No overlapping blocks were found. This can happen when the contig is missing from the
+                // index, when the index has a stub entry for a contig with no blocks, or when the queried
+                // sub-range simply doesn't intersect any indexed block. In all cases we exit cleanly so
+                // batch callers don't have to special-case empty regions; the header was already written
+                // above and the loop below is a no-op since tai_next returns NULL. We must NOT early-return
+                // here -- the bgzip writer is only flushed/closed by LW_destruct in the cleanup at the end
+                // of the function, so an early return would leave a 0-byte file when -c is set.
+                fprintf(stderr, "Region %s:%" PRIi64 "-%" PRIi64 " not found in taffy index; emitting header-only output\n",
+                        region_seq, region_start, region_start + region_length);
+            }
+            free(region_seq);
+        } else {
+            if (bgzf_threads > 1) { // read the regions on many threads, each with its own handle on the input
+                tai_parallel_reader = tai_parallel_reader_construct(tai, inputFile, run_length_encode_input_bases,
+                                                                    regions, !keep_region_order, bgzf_threads);
+            } else {
+                tai_regions_it = tai_regions_iterator(tai, li, run_length_encode_input_bases, regions, !keep_region_order);
+            }
         }
         Alignment *alignment = NULL;
         Alignment *p_alignment = NULL;
-
-        while ((alignment = tai_next(tai_it, li)) != NULL) {
+        int64_t region_index = -1, p_region_index = -1;
+        LW *block_output = output; // the output of the current region
+        bool *region_written = regions_output_prefix != NULL ? st_calloc(stList_length(regions), sizeof(bool)) : NULL;
+
+        while ((alignment = tai_it != NULL ? tai_next(tai_it, li) :
+                            (tai_parallel_reader != NULL ? tai_parallel_reader_next(tai_parallel_reader, &region_index) :
+                             tai_regions_next(tai_regions_it, li, &region_index))) != NULL) {
+            if (region_index != p_region_index) { // the first block of a region follows on from nothing
+                if (p_alignment) {
+                    alignment_destruct(p_alignment, true);
+                }
+                p_alignment = NULL;
+                p_region_index = region_index;
+                if (regions_output_prefix != NULL) {
+                    if (block_output != output) {
+                        LW_destruct(block_output, true);
+                    }
+                    block_output = region_output_construct(regions_output_prefix, region_index, maf_output, taf_output,
+                                                           use_compression, anchor_every_n_bytes, tag);
+                    region_written[region_index] = true;
+                }
+            }
             modify_alignment(alignment); // Make any changes to the alignment for output
 
             // apply the name mapping to the alignment block
@@ -364,12 +499,12 @@ int taf_view_main(int argc, char *argv[]) {
             }
             if (taf_output) {
                 taf_write_block2(p_alignment, alignment, run_length_encode_output_bases,
-                                 repeat_coordinates_every_n_columns, output, color_bases, omit_coordinates);
+                                 repeat_coordinates_every_n_columns, block_output, color_bases, omit_coordinates);
             } else if (maf_output) {
-                maf_write_block2(alignment, output, color_bases);
+                maf_write_block2(alignment, block_output, color_bases);
             } else {
                 assert(paf_output == true);
-                paf_write_block(alignment, output, all_to_all_paf, paf_cs);
+                paf_write_block(alignment, block_output, all_to_all_paf, paf_cs);
             }
             if (p_alignment) {
                 alignment_destruct(p_alignment, true);
@@ -379,6 +514,31 @@ int taf_view_main(int argc, char *argv[]) {
         if (p_alignment) {
             alignment_destruct(p_alignment, true);
         }
+        if (block_output != output) {
+            LW_destruct(block_output, true);
+        }
+        if (region_written != NULL) { // write the header of any region with no blocks to its file
+            stList *regions_read = tai_regions_to_read(regions, !keep_region_order);
+            for (int64_t i = 0; i < stList_length(regions_read); ++i) {
+                Tai_Region *r = stList_get(regions_read, i);
+                if (!region_written[r->index]) {
+                    LW_destruct(region_output_construct(regions_output_prefix, r->index, maf_output, taf_output,
+                                                        use_compression, anchor_every_n_bytes, tag), true);
+                }
+            }
+            stList_destruct(regions_read);
+            free(region_written);
+        }
+        if (tai_it != NULL) {
+            tai_iterator_destruct(tai_it);
+        } else {
+            if (tai_parallel_reader != NULL) {
+                tai_parallel_reader_destruct(tai_parallel_reader);
+            } else {
+                tai_regions_iterator_destruct(tai_regions_it);
+            }
+            stList_destruct(regions);
+        }
 
         tai_destruct(tai);
 
@@ -389,7 +549,8 @@ int taf_view_main(int argc, char *argv[]) {
     } else if (taf_input) {
         Alignment *alignment = NULL;
         Alignment *p_alignment = NULL;        
-        while((alignment = taf_read_block(p_alignment, run_length_encode_input_bases, li)) != NULL) {
+        Parallel_Reader *reader = taf_parallel_reader_construct(li, run_length_encode_input_bases, 0, bgzf_threads, 0);
+        while((alignment = parallel_reader_next(reader, p_alignment)) != NULL) {
             modify_alignment(alignment); // Make any changes to the alignment for output
 
             // apply the name mapping to the alignment block
@@ -413,10 +574,12 @@ int taf_view_main(int argc, char *argv[]) {
         if (p_alignment) {
             alignment_destruct(p_alignment, true);
         }            
+        parallel_reader_destruct(reader);
     } else {
         assert(maf_input == true);
         Alignment *alignment, *p_alignment = NULL;
-        while((alignment = maf_read_block(li)) != NULL) {
+        Parallel_Reader *reader = maf_parallel_reader_construct(li, 0, bgzf_threads, 0);
+        while((alignment = parallel_reader_next(reader, p_alignment)) != NULL) {
             modify_alignment(alignment); // Make any changes to the alignment for output
 
             // apply the name mapping to the alignment block
@@ -443,17 +606,22 @@ int taf_view_main(int argc, char *argv[]) {
         if(p_alignment != NULL) {
             alignment_destruct(p_alignment, 1);
         }
+        parallel_reader_destruct(reader);
     }
     
     //////////////////////////////////////////////
     // Cleanup
     //////////////////////////////////////////////
 
+    tag_destruct(tag);
     LI_destruct(li);
     if (inputFile != NULL && !input_is_url) {
         fclose(input);
     }
     LW_destruct(output, outputFile != NULL);
+    if (index != NULL) {
+        tai_writer_destruct(index);
+    }
 
     if (genome_name_map != NULL) {
         stHash_destruct(genome_name_map);
@@ -26,8 +26,21 @@ ffibuilder.cdef("""
     typedef struct _LI {
         BGZF *bgzf;
         char *line;
+        char *view;
+        int64_t view_length;
+        char *returned_line;
+        char *line_buffers[2];
+        size_t line_buffer_capacities[2];
+        int64_t line_buffer_index;
         int64_t prev_pos; // position before reading the current buffer
         int64_t pos;      // position after reading the curent buffer    
+        char *buffer;
+        int64_t buffer_length;
+        int64_t buffer_offset;
+        bool buffer_mapped;
+        void *sequence_names;
+        void *arenas;
+        void *read_ahead;
     } LI;
     
     LI *LI_construct(FILE *fh);
@@ -52,11 +65,20 @@ ffibuilder.cdef("""
     
     typedef struct _row Alignment_Row;
     
+    typedef struct _Alignment_Arena Alignment_Arena;
+
+    typedef struct _Packed_Bases Packed_Bases;
+    
     typedef struct _alignment {
         int64_t row_number; // Convenient counter of number rows in the alignment
         int64_t column_number; // Convenient counter of number of columns in this alignment
         Alignment_Row *row; // An alignment is just a sequence of rows
         Tag **column_tags; // The tags for each column, each stored as a sequence of tags
+        char **column_tag_strings; // If not NULL, the unparsed tags of each column
+        Alignment_Arena *arena; // The arena the alignment was allocated from, or NULL
+        char *base_matrix; // If not NULL, the bases of the rows laid out one after another
+        int64_t row_stride; // The distance between the starts of consecutive rows in base_matrix
+        Alignment_Row **rows; // If not NULL, the rows in order, so rows[i] is the i-th row
     } Alignment;
     
     struct _row { // Each row encodes the information about an aligned sequence
@@ -71,6 +93,10 @@ ffibuilder.cdef("""
         Alignment_Row *n_row;  // the next row in the alignment
         int64_t bases_since_coordinates_reported; // this number is used by taf write coordinates to
         // indicate how many bases ago were the row's coordinates printed
+        Alignment_Arena *arena; // The arena the row was allocated from, or NULL
+        Alignment_Arena *bases_arena; // If not NULL, the arena of the base matrix holding the bases
+        int64_t row_index; // The index of the row in the rows array of its alignment
+        Packed_Bases *packed_bases; // If not NULL, the bases of the row in packed form, in which case bases is NULL
     };
     
     /*
@@ -104,6 +130,8 @@ ffibuilder.cdef("""
      * Clean up the memory for an alignment
      */
     void alignment_destruct(Alignment *alignment, bool cleanup_rows);
+
+    Tag *alignment_get_column_tags(Alignment *alignment, int64_t column_index);
     
     /*
      * Use the O(ND) alignment to diff the rows between two alignments and connect together their rows
@@ -111,6 +139,16 @@ ffibuilder.cdef("""
      * left_alignment. We use this for efficiently outputting TAF.
      */
     void alignment_link_adjacent(Alignment *left_alignment, Alignment *right_alignment, bool allow_row_substitutions);
+
+    /*
+     * Rebuild the row index of the alignment from its list of rows, also setting row_number
+     */
+    void alignment_index_rows(Alignment *alignment);
+
+    /*
+     * Get the row of the alignment with the given index, which must be less than row_number
+     */
+    Alignment_Row *alignment_get_row(Alignment *alignment, int64_t row_index);
     
     /*
      * Gets the number of columns in the alignment
@@ -159,6 +197,55 @@ ffibuilder.cdef("""
      */
     int32_t *alignment_get_column_as_int_array(Alignment *alignment, int64_t column_index);
 
+    /*
+     * Read a range of columns of the alignment into the buffer, one column after another
+     */
+    void alignment_get_columns_in_buffer(Alignment *alignment, int64_t column_start, int64_t column_number,
+                                         char *buffer);
+
+    /*
+     * As alignment_get_columns_in_buffer, but with each base encoded as in alignment_get_column_as_int_array
+     */
+    void alignment_get_columns_as_int8_in_buffer(Alignment *alignment, int64_t column_start, int64_t column_number,
+                                                 int8_t *buffer);
+
+    /*
+     * As alignment_get_columns_as_int8_in_buffer, but encoding into 32 bit integers
+     */
+    void alignment_get_columns_as_int32_in_buffer(Alignment *alignment, int64_t column_start, int64_t column_number,
+                                                  int32_t *buffer);
+
+    /*
+     * Get the number of bases (including gaps) that were packed
+     */
+    int64_t packed_bases_length(Packed_Bases *packed_bases);
+
+    /*
+     * Decode the bases of a range of columns into the buffer, which is not null terminated
+     */
+    void packed_bases_decode(Packed_Bases *packed_bases, int64_t column_start, int64_t column_number, char *buffer);
+
+    /*
+     * Count the gaps in a range of columns
+     */
+    int64_t packed_bases_count_gaps(Packed_Bases *packed_bases, int64_t column_start, int64_t column_number);
+
+    /*
+     * Count the columns in which two rows both have a base other than N, and those in which the bases are the same
+     */
+    void packed_bases_compare(Packed_Bases *packed_bases_1, Packed_Bases *packed_bases_2, int64_t *aligned,
+                              int64_t *identical);
+
+    /*
+     * Replace the bases of every row of the alignment with packed bases
+     */
+    void alignment_pack_rows(Alignment *alignment);
+
+    /*
+     * Decode any packed rows of the alignment back into bases
+     */
+    bool alignment_unpack_rows(Alignment *alignment);
+
     /*
      * Returns a pretty-printed string representing the alignment. Useful for debugging.
     */
@@ -181,6 +268,8 @@ ffibuilder.cdef("""
      * Read a maf alignment block from the file stream. Return NULL if none available
      */
     Alignment *maf_read_block(LI *li);
+
+    Alignment *maf_read_block2(LI *li, bool skip_bases);
     
     /*
      * Write a maf header line
@@ -203,6 +292,8 @@ ffibuilder.cdef("""
      * are considered to be part of the block.
      */
     Alignment *taf_read_block(Alignment *p_block, bool run_length_encode_bases, LI *li);
+
+    Alignment *taf_read_block2(Alignment *p_block, bool run_length_encode_bases, bool skip_bases, LI *li);
     
     /*
      * Write a taf header line
@@ -227,6 +318,26 @@ ffibuilder.cdef("""
      * region of it found in the TAF. 
      */
     int tai_create(LI *li, FILE* idx_fh, int64_t index_block_size);
+
+    /*
+     * As tai_create, but if binary is non-zero writes the binary format of the index. If index_every_k_blocks is
+     * greater than zero, which needs the binary format, every index_every_k_blocks-th block between anchor lines is
+     * also indexed, so that a query reads at most that many blocks before those it wants.
+     */
+    int tai_create2(LI *li, FILE* idx_fh, int64_t index_block_size, bool binary, int64_t index_every_k_blocks);
+
+   typedef struct _Tai_Writer Tai_Writer;
+
+    /*
+     * Index the TAF that lw is writing to taf_path as it is written, putting the index in tai_path(taf_path).
+     * Call tai_writer_destruct once lw has been destructed to finish the index.
+     */
+    Tai_Writer *tai_writer_construct_for_lw(LW *lw, const char *taf_path, int64_t index_block_size);
+
+    /*
+     * Finish the index.
+     */
+    void tai_writer_destruct(Tai_Writer *tw);
     
     /*
      * Load the index from disk
@@ -299,15 +410,18 @@ ffibuilder.set_source("taffy._taffy_cffi",
                                "taffy/submodules/sonLib/C/impl/sonLibFile.c",
                                "taffy/impl/line_iterator.c",
                                "taffy/impl/alignment_block.c",
+                               "taffy/impl/alignment_arena.c",
+                               "taffy/impl/packed_bases.c",
                                # "taffy/impl/merge_adjacent_alignments.c" - this is excluded because it uses abPOA
                                "taffy/impl/maf.c",
                                "taffy/impl/ond.c",
                                "taffy/impl/taf.c",
+                               "taffy/impl/parallel_reader.c",
                                "taffy/impl/tai.c",
                                "taffy/impl/remote_io.c",
                                ],
                       extra_compile_args=["-DUSE_HTSLIB"],
-                      libraries=["hts"],
+                      libraries=["hts", "pthread"],
                       )
 
 if __name__ == "__main__":
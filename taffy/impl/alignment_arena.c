@@ -0,0 +1,193 @@
+#include "taf.h"
+#include "sonLib.h"
+#include <pthread.h>
+
+/*
+ * The memory of an arena, as a list of chunks each allocated from in turn. Once an arena is reset the
+ * chunks are replaced by a single one large enough for everything that was allocated from them, so an
+ * arena that is reused for blocks of similar size settles on one chunk that is never reallocated.
+ */
+typedef struct _Arena_Chunk Arena_Chunk;
+
+struct _Arena_Chunk {
+    Arena_Chunk *next; // The previously filled chunk, or NULL
+    int64_t capacity; // Bytes in the chunk, which follow this header
+};
+
+// Allocations are rounded up to a multiple of this so that every structure allocated is aligned
+#define ARENA_ALIGNMENT 16
+#define ARENA_HEADER_SIZE ((sizeof(Arena_Chunk) + ARENA_ALIGNMENT - 1) & ~((size_t)ARENA_ALIGNMENT - 1))
+#define ARENA_MINIMUM_CHUNK_SIZE 65536
+
+struct _Alignment_Arena {
+    int64_t references; // The block and rows allocated from the arena that are yet to be destructed
+    Alignment_Arena_Pool *pool; // The pool the arena is returned to once released, or NULL if it is freed instead
+    Arena_Chunk *chunk; // The chunk being allocated from, followed by any filled chunks
+    int64_t used; // Bytes used in the current chunk
+    int64_t total; // Bytes allocated from all the chunks since the arena was last reset
+    Alignment_Arena *next; // The next free arena in the pool
+};
+
+/*
+ * The released arenas of the blocks read through an LI, ready to be reused. The pool has one reference
+ * for the LI and one for each arena that is in use, so that it outlives the LI if blocks read through
+ * it are still around.
+ */
+struct _Alignment_Arena_Pool {
+    int64_t references;
+    pthread_mutex_t lock; // Blocks may be destructed on a different thread to the one reading them
+    Alignment_Arena *free_arenas;
+};
+
+static inline char *chunk_memory(Arena_Chunk *chunk) {
+    return ((char *)chunk) + ARENA_HEADER_SIZE;
+}
+
+static Arena_Chunk *chunk_construct(int64_t capacity, Arena_Chunk *next) {
+    Arena_Chunk *chunk = st_malloc(ARENA_HEADER_SIZE + capacity);
+    chunk->next = next;
+    chunk->capacity = capacity;
+    return chunk;
+}
+
+static void chunks_destruct(Arena_Chunk *chunk) {
+    while(chunk != NULL) {
+        Arena_Chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+static void pool_release(Alignment_Arena_Pool *pool) {
+    if(__atomic_sub_fetch(&(pool->references), 1, __ATOMIC_ACQ_REL) == 0) {
+        Alignment_Arena *arena = pool->free_arenas;
+        while(arena != NULL) {
+            Alignment_Arena *next = arena->next;
+            chunks_destruct(arena->chunk);
+            free(arena);
+            arena = next;
+        }
+        pthread_mutex_destroy(&(pool->lock));
+        free(pool);
+    }
+}
+
+static Alignment_Arena_Pool *get_pool(LI *li) {
+    Alignment_Arena_Pool *pool = __atomic_load_n(&(li->arenas), __ATOMIC_ACQUIRE);
+    if(pool == NULL) { // Make the pool on first use
+        Alignment_Arena_Pool *new_pool = st_calloc(1, sizeof(Alignment_Arena_Pool));
+        new_pool->references = 1; // For the LI
+        pthread_mutex_init(&(new_pool->lock), NULL);
+        // Threads sharing the pool of the LI (see alignment_arena_pool_share) may race to make it, so it is only
+        // set if no other thread has set it first, else the pool that thread made is used
+        if(__atomic_compare_exchange_n(&(li->arenas), &pool, new_pool, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            pool = new_pool;
+        }
+        else {
+            pthread_mutex_destroy(&(new_pool->lock));
+            free(new_pool);
+        }
+    }
+    return pool;
+}
+
+Alignment_Arena *alignment_arena_construct(LI *li) {
+    Alignment_Arena_Pool *pool = get_pool(li);
+    __atomic_add_fetch(&(pool->references), 1, __ATOMIC_RELAXED);
+    // Take a free arena if there is one, which will be that of the block before the previous block when
+    // streaming through blocks
+    pthread_mutex_lock(&(pool->lock));
+    Alignment_Arena *arena = pool->free_arenas;
+    if(arena != NULL) {
+        pool->free_arenas = arena->next;
+    }
+    pthread_mutex_unlock(&(pool->lock));
+    if(arena == NULL) {
+        arena = st_calloc(1, sizeof(Alignment_Arena));
+        arena->chunk = chunk_construct(ARENA_MINIMUM_CHUNK_SIZE, NULL);
+        arena->pool = pool;
+    }
+    arena->next = NULL;
+    return arena;
+}
+
+Alignment_Arena *alignment_arena_construct_unpooled(int64_t capacity) {
+    Alignment_Arena *arena = st_calloc(1, sizeof(Alignment_Arena));
+    capacity = (capacity + ARENA_ALIGNMENT - 1) & ~((int64_t)ARENA_ALIGNMENT - 1);
+    arena->chunk = chunk_construct(capacity > 0 ? capacity : ARENA_ALIGNMENT, NULL);
+    return arena;
+}
+
+void *alignment_arena_malloc(Alignment_Arena *arena, int64_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~((int64_t)ARENA_ALIGNMENT - 1);
+    if(arena->used + size > arena->chunk->capacity) { // Start a new chunk, at least doubling the memory
+        int64_t capacity = arena->chunk->capacity * 2;
+        arena->chunk = chunk_construct(capacity > size ? capacity : size, arena->chunk);
+        arena->used = 0;
+    }
+    void *memory = chunk_memory(arena->chunk) + arena->used;
+    arena->used += size;
+    arena->total += size;
+    return memory;
+}
+
+void *alignment_arena_calloc(Alignment_Arena *arena, int64_t size) {
+    void *memory = alignment_arena_malloc(arena, size);
+    memset(memory, 0, size);
+    return memory;
+}
+
+void alignment_arena_copy(Alignment_Arena *arena) {
+    __atomic_add_fetch(&(arena->references), 1, __ATOMIC_RELAXED);
+}
+
+void alignment_arena_destruct(Alignment_Arena *arena) {
+    if(__atomic_sub_fetch(&(arena->references), 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    if(arena->pool == NULL) { // Not pooled, so there is nothing to return it to
+        chunks_destruct(arena->chunk);
+        free(arena);
+        return;
+    }
+    // Reset the arena, replacing multiple chunks by one that can hold all their allocations
+    if(arena->chunk->next != NULL) {
+        chunks_destruct(arena->chunk);
+        arena->chunk = chunk_construct(arena->total, NULL);
+    }
+    arena->used = 0;
+    arena->total = 0;
+    // Return it to the pool for reuse
+    Alignment_Arena_Pool *pool = arena->pool;
+    pthread_mutex_lock(&(pool->lock));
+    arena->next = pool->free_arenas;
+    pool->free_arenas = arena;
+    pthread_mutex_unlock(&(pool->lock));
+    pool_release(pool);
+}
+
+bool alignment_arena_owns(Alignment_Arena *arena, void *memory) {
+    for(Arena_Chunk *chunk = arena->chunk; chunk != NULL; chunk = chunk->next) {
+        if((char *)memory >= chunk_memory(chunk) && (char *)memory < chunk_memory(chunk) + chunk->capacity) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void alignment_arena_free(Alignment_Arena *arena, void *memory) {
+    if(arena == NULL || !alignment_arena_owns(arena, memory)) {
+        free(memory);
+    }
+}
+
+void alignment_arena_pool_destruct(Alignment_Arena_Pool *pool) {
+    pool_release(pool);
+}
+
+void alignment_arena_pool_share(LI *li, LI *li2) {
+    Alignment_Arena_Pool *pool = get_pool(li);
+    assert(li2->arenas == NULL); // li2 must not have read any blocks yet
+    __atomic_add_fetch(&(pool->references), 1, __ATOMIC_RELAXED); // For li2
+    li2->arenas = pool;
+}
@@ -2,6 +2,10 @@
 #include "ond.h"
 #include "sonLib.h"
 
+#ifdef USE_SIMDE
+#include "simde/x86/sse2.h"
+#endif
+
 #define ANSI_COLOR_RED     "\x1b[41m"
 #define ANSI_COLOR_GREEN   "\x1b[42m"
 #define ANSI_COLOR_YELLOW  "\x1b[43m"
@@ -104,6 +108,147 @@ Tag *tag_parse(char *tag_string, char *delimiter, Tag *p_tag) {
     return tag;
 }
 
+/*
+ * A sequence name is stored immediately after this header, in the same allocation, so the name
+ * handle is just a pointer to its characters. The hash lets names be looked up in a pool and lets
+ * names that are different be told apart without comparing their characters.
+ */
+typedef struct _Sequence_Name_Header {
+    int64_t references; // Updated atomically, as the rows sharing a name may be destroyed on different threads
+    uint64_t hash;
+    int64_t length;
+} Sequence_Name_Header;
+
+static inline Sequence_Name_Header *sequence_name_header(const char *sequence_name) {
+    return ((Sequence_Name_Header *)sequence_name) - 1;
+}
+
+static uint64_t sequence_name_hash(const char *name, int64_t name_length) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for(int64_t i=0; i<name_length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static char *sequence_name_construct2(const char *name, int64_t name_length, uint64_t hash) {
+    Sequence_Name_Header *header = st_malloc(sizeof(Sequence_Name_Header) + name_length + 1);
+    header->references = 1;
+    header->hash = hash;
+    header->length = name_length;
+    char *sequence_name = (char *)(header + 1);
+    memcpy(sequence_name, name, name_length);
+    sequence_name[name_length] = '\0';
+    return sequence_name;
+}
+
+char *sequence_name_construct(const char *name, int64_t name_length) {
+    return sequence_name_construct2(name, name_length, sequence_name_hash(name, name_length));
+}
+
+char *sequence_name_copy(char *sequence_name) {
+    __atomic_fetch_add(&(sequence_name_header(sequence_name)->references), 1, __ATOMIC_RELAXED);
+    return sequence_name;
+}
+
+void sequence_name_destruct(char *sequence_name) {
+    Sequence_Name_Header *header = sequence_name_header(sequence_name);
+    if(__atomic_sub_fetch(&(header->references), 1, __ATOMIC_ACQ_REL) == 0) {
+        free(header);
+    }
+}
+
+bool sequence_name_equal(char *sequence_name_1, char *sequence_name_2) {
+    if(sequence_name_1 == sequence_name_2) {
+        return true;
+    }
+    Sequence_Name_Header *header_1 = sequence_name_header(sequence_name_1);
+    Sequence_Name_Header *header_2 = sequence_name_header(sequence_name_2);
+    return header_1->hash == header_2->hash && header_1->length == header_2->length &&
+           memcmp(sequence_name_1, sequence_name_2, header_1->length) == 0;
+}
+
+/*
+ * The names interned for an LI, in an open addressing hash table with linear probing. The pool holds
+ * a reference to each of its names.
+ */
+struct _Sequence_Name_Pool {
+    char **names; // capacity slots, each a name or NULL if empty
+    int64_t size, capacity; // capacity is a power of two
+};
+
+static void sequence_name_pool_add(Sequence_Name_Pool *pool, char *sequence_name) {
+    uint64_t i = sequence_name_header(sequence_name)->hash & (pool->capacity - 1);
+    while(pool->names[i] != NULL) {
+        i = (i + 1) & (pool->capacity - 1);
+    }
+    pool->names[i] = sequence_name;
+    pool->size++;
+}
+
+char *sequence_name_intern(LI *li, const char *name, int64_t name_length) {
+    Sequence_Name_Pool *pool = li->sequence_names;
+    if(pool == NULL) { // Make the pool on first use
+        pool = st_calloc(1, sizeof(Sequence_Name_Pool));
+        pool->capacity = 256;
+        pool->names = st_calloc(pool->capacity, sizeof(char *));
+        li->sequence_names = pool;
+    }
+    uint64_t hash = sequence_name_hash(name, name_length);
+    for(uint64_t i=hash & (pool->capacity - 1); pool->names[i] != NULL; i = (i + 1) & (pool->capacity - 1)) {
+        Sequence_Name_Header *header = sequence_name_header(pool->names[i]);
+        if(header->hash == hash && header->length == name_length && memcmp(pool->names[i], name, name_length) == 0) {
+            return sequence_name_copy(pool->names[i]);
+        }
+    }
+    if(2 * (pool->size + 1) > pool->capacity) { // Keep the table at most half full, so probes stay short
+        char **names = pool->names;
+        int64_t capacity = pool->capacity;
+        pool->capacity *= 2;
+        pool->names = st_calloc(pool->capacity, sizeof(char *));
+        pool->size = 0;
+        for(int64_t i=0; i<capacity; i++) {
+            if(names[i] != NULL) {
+                sequence_name_pool_add(pool, names[i]);
+            }
+        }
+        free(names);
+    }
+    char *sequence_name = sequence_name_construct2(name, name_length, hash);
+    sequence_name_pool_add(pool, sequence_name);
+    return sequence_name_copy(sequence_name);
+}
+
+void sequence_name_pool_destruct(Sequence_Name_Pool *pool) {
+    for(int64_t i=0; i<pool->capacity; i++) {
+        if(pool->names[i] != NULL) {
+            sequence_name_destruct(pool->names[i]);
+        }
+    }
+    free(pool->names);
+    free(pool);
+}
+
+Alignment *alignment_construct(Alignment_Arena *arena) {
+    if(arena == NULL) {
+        return st_calloc(1, sizeof(Alignment));
+    }
+    Alignment *alignment = alignment_arena_calloc(arena, sizeof(Alignment));
+    alignment->arena = arena;
+    alignment_arena_copy(arena);
+    return alignment;
+}
+
+Alignment_Row *alignment_row_construct(Alignment_Arena *arena) {
+    if(arena == NULL) {
+        return st_calloc(1, sizeof(Alignment_Row));
+    }
+    Alignment_Row *row = alignment_arena_calloc(arena, sizeof(Alignment_Row));
+    row->arena = arena;
+    alignment_arena_copy(arena);
+    return row;
+}
+
 void alignment_row_destruct(Alignment_Row *row) {
     if(row->l_row != NULL) { // If there is a preceding, left row then unlink it
         assert(row->l_row->r_row == row);
@@ -113,16 +258,20 @@ void alignment_row_destruct(Alignment_Row *row) {
         assert(row->r_row->l_row == row);
         row->r_row->l_row = NULL;
     }
-    if(row->bases != NULL) {
-        free(row->bases);
+    Alignment_Arena *arena = row->arena;
+    if(row->bases != NULL || row->packed_bases != NULL) {
+        alignment_row_free_bases(row);
     }
     if(row->sequence_name != NULL) {
-        free(row->sequence_name);
+        sequence_name_destruct(row->sequence_name);
     }
     if(row->left_gap_sequence != NULL) {
         free(row->left_gap_sequence);
     }
-    free(row);
+    alignment_arena_free(arena, row);
+    if(arena != NULL) {
+        alignment_arena_destruct(arena);
+    }
 }
 
 void alignment_destruct(Alignment *alignment, bool cleanup_rows) {
@@ -138,8 +287,112 @@ void alignment_destruct(Alignment *alignment, bool cleanup_rows) {
     for(int64_t i=0; i<alignment->column_number; i++) {
         tag_destruct(alignment->column_tags[i]);
     }
-    free(alignment->column_tags);
-    free(alignment);
+    Alignment_Arena *arena = alignment->arena;
+    if(alignment->column_tag_strings != NULL) { // And any that were never parsed
+        for(int64_t i=0; i<alignment->column_number; i++) {
+            alignment_arena_free(arena, alignment->column_tag_strings[i]);
+        }
+        alignment_arena_free(arena, alignment->column_tag_strings);
+    }
+    alignment_arena_free(arena, alignment->column_tags);
+    if(alignment->rows != NULL) {
+        alignment_arena_free(arena, alignment->rows);
+    }
+    alignment_arena_free(arena, alignment);
+    if(arena != NULL) {
+        alignment_arena_destruct(arena);
+    }
+}
+
+void alignment_row_free_bases(Alignment_Row *row) {
+    if(row->packed_bases != NULL) {
+        packed_bases_destruct(row->packed_bases);
+        row->packed_bases = NULL;
+    }
+    if(row->bases_arena != NULL) { // The bases are in a base matrix the row holds a reference to
+        alignment_arena_destruct(row->bases_arena);
+        row->bases_arena = NULL;
+    }
+    else if(row->bases != NULL) {
+        alignment_arena_free(row->arena, row->bases);
+    }
+    row->bases = NULL;
+}
+
+int64_t alignment_row_stride(int64_t column_number) {
+    return (column_number + 16) & ~((int64_t)15);
+}
+
+char *alignment_get_base_matrix(Alignment *alignment) {
+    char *base_matrix = alignment->base_matrix;
+    if(base_matrix == NULL || alignment->row_number == 0 || alignment->row_stride <= alignment->column_number) {
+        return NULL;
+    }
+    // The rows may have been changed since the matrix was made, so check each is still in its place
+    Alignment_Row *row = alignment->row;
+    for(int64_t i=0; i<alignment->row_number; i++) {
+        if(row == NULL || row->bases != base_matrix + i * alignment->row_stride) {
+            return NULL;
+        }
+        row = row->n_row;
+    }
+    return row == NULL ? base_matrix : NULL;
+}
+
+bool alignment_pack_bases(Alignment *alignment) {
+    if(alignment_get_base_matrix(alignment) != NULL || alignment->row_number == 0) {
+        return 1;
+    }
+    for(Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
+        if(row->bases == NULL) {
+            return 0;
+        }
+    }
+    // The matrix gets an arena of its own, which the rows keep until their bases are released, so it goes
+    // as soon as the last of them does, whatever happens to the alignment
+    int64_t stride = alignment_row_stride(alignment->column_number);
+    Alignment_Arena *arena = alignment_arena_construct_unpooled(stride * alignment->row_number);
+    char *base_matrix = alignment_arena_malloc(arena, stride * alignment->row_number);
+    char *bases = base_matrix;
+    for(Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
+        assert((int64_t)strlen(row->bases) == alignment->column_number);
+        memcpy(bases, row->bases, alignment->column_number);
+        bases[alignment->column_number] = '\0';
+        alignment_row_free_bases(row);
+        row->bases = bases;
+        row->bases_arena = arena;
+        alignment_arena_copy(arena);
+        bases += stride;
+    }
+    alignment->base_matrix = base_matrix;
+    alignment->row_stride = stride;
+    return 1;
+}
+
+Tag *alignment_get_column_tags(Alignment *alignment, int64_t column_index) {
+    assert(column_index >= 0 && column_index < alignment->column_number);
+    if(alignment->column_tag_strings != NULL && alignment->column_tag_strings[column_index] != NULL) {
+        char *tag_string = alignment->column_tag_strings[column_index];
+        if(alignment->column_tags[column_index] == NULL) {
+            Taf_Line taf_line = { 0 };
+            taf_line.tags = tag_string;
+            taf_line.tags_end = tag_string + strlen(tag_string);
+            alignment->column_tags[column_index] = taf_line_parse_tags(&taf_line);
+        } // else the tags were set directly, which replaces those read
+        alignment->column_tag_strings[column_index] = NULL;
+        alignment_arena_free(alignment->arena, tag_string);
+    }
+    return alignment->column_tags != NULL ? alignment->column_tags[column_index] : NULL;
+}
+
+void alignment_parse_column_tags(Alignment *alignment) {
+    if(alignment->column_tag_strings != NULL) {
+        for(int64_t i=0; i<alignment->column_number; i++) {
+            alignment_get_column_tags(alignment, i);
+        }
+        alignment_arena_free(alignment->arena, alignment->column_tag_strings);
+        alignment->column_tag_strings = NULL;
+    }
 }
 
 stList *alignment_get_rows_in_a_list(Alignment_Row *row) {
@@ -162,6 +415,43 @@ void alignment_set_rows(Alignment *alignment, stList *rows) {
             row->n_row = NULL;
         }
     }
+    alignment_index_rows(alignment);
+}
+
+void alignment_index_rows(Alignment *alignment) {
+    int64_t row_number = 0;
+    for(Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
+        row_number++;
+    }
+    // The first index of a block read from a file is allocated from its arena, a rebuilt index with malloc,
+    // so that an alignment whose rows change over and over (as when merging) doesn't fill up its arena
+    Alignment_Row **rows = alignment->rows == NULL && alignment->arena != NULL ?
+                           alignment_arena_malloc(alignment->arena, sizeof(Alignment_Row *) * (row_number + 1)) :
+                           st_malloc(sizeof(Alignment_Row *) * (row_number + 1));
+    int64_t i = 0;
+    for(Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
+        row->row_index = i;
+        rows[i++] = row;
+    }
+    if(alignment->rows != NULL) {
+        alignment_arena_free(alignment->arena, alignment->rows);
+    }
+    alignment->rows = rows;
+    alignment->row_number = row_number;
+}
+
+Alignment_Row **alignment_get_rows(Alignment *alignment) {
+    if(alignment->rows == NULL) {
+        alignment_index_rows(alignment);
+    }
+    return alignment->rows;
+}
+
+Alignment_Row *alignment_get_row(Alignment *alignment, int64_t row_index) {
+    assert(row_index >= 0 && row_index < alignment->row_number);
+    Alignment_Row *row = alignment_get_rows(alignment)[row_index];
+    assert(row->row_index == row_index);
+    return row;
 }
 
 bool alignment_row_is_predecessor(Alignment_Row *left_row, Alignment_Row *right_row) {
@@ -170,7 +460,7 @@ bool alignment_row_is_predecessor(Alignment_Row *left_row, Alignment_Row *right_
     // apart, and this is called for every pair of rows the row diff considers.
     return left_row->strand == right_row->strand &&
             left_row->start + left_row->length <= right_row->start &&
-            strcmp(left_row->sequence_name, right_row->sequence_name) == 0;
+            sequence_name_equal(left_row->sequence_name, right_row->sequence_name);
 }
 
 bool alignment_row_is_predecessor_2(Alignment_Row **left_row, Alignment_Row **right_row) {
@@ -180,15 +470,26 @@ bool alignment_row_is_predecessor_2(Alignment_Row **left_row, Alignment_Row **ri
 }
 
 char *alignment_row_to_string(Alignment_Row *row) {
-    return stString_print("%s\t%" PRIi64 "\t%" PRIi64 "\t%s\t%" PRIi64 "\t%s",
-                          row->sequence_name, row->start, row->length,
-                          row->strand ? "+" : "-", row->sequence_length, row->bases);
+    char *bases = row->bases;
+    if(bases == NULL && row->packed_bases != NULL) { // Decode packed bases to print them
+        int64_t length = packed_bases_length(row->packed_bases);
+        bases = st_malloc(sizeof(char) * (length + 1));
+        packed_bases_decode(row->packed_bases, 0, length, bases);
+        bases[length] = '\0';
+    }
+    char *row_string = stString_print("%s\t%" PRIi64 "\t%" PRIi64 "\t%s\t%" PRIi64 "\t%s",
+                                      row->sequence_name, row->start, row->length,
+                                      row->strand ? "+" : "-", row->sequence_length, bases);
+    if(bases != row->bases) {
+        free(bases);
+    }
+    return row_string;
 }
 
 void alignment_link_adjacent(Alignment *left_alignment, Alignment *right_alignment, bool allow_row_substitutions) {
-    stList *left_rows = alignment_get_rows_in_a_list(left_alignment->row);
-    stList *right_rows = alignment_get_rows_in_a_list(right_alignment->row);
-    int64_t left_row_number = stList_length(left_rows), right_row_number = stList_length(right_rows);
+    Alignment_Row **left_rows = alignment_get_rows(left_alignment);
+    Alignment_Row **right_rows = alignment_get_rows(right_alignment);
+    int64_t left_row_number = left_alignment->row_number, right_row_number = right_alignment->row_number;
     int64_t aligned_rows[left_row_number];
     // Adjacent blocks usually carry the same rows in the same order. Pairing them off one for one
     // then matches every row and leaves no gaps, which scores zero and so is the optimal alignment,
@@ -196,7 +497,7 @@ void alignment_link_adjacent(Alignment *left_alignment, Alignment *right_alignme
     // row diff below is the most expensive thing taffy norm does.
     bool rows_correspond = left_row_number == right_row_number;
     for(int64_t i=0; rows_correspond && i<left_row_number; i++) {
-        if(!alignment_row_is_predecessor(stList_get(left_rows, i), stList_get(right_rows, i))) {
+        if(!alignment_row_is_predecessor(left_rows[i], right_rows[i])) {
             rows_correspond = 0;
         }
     }
@@ -206,7 +507,7 @@ void alignment_link_adjacent(Alignment *left_alignment, Alignment *right_alignme
         }
     }
     else { // get the alignment of the rows
-        WFA *wfa = WFA_construct(stList_getBackingArray(left_rows), stList_getBackingArray(right_rows),
+        WFA *wfa = WFA_construct(left_rows, right_rows,
                                  left_row_number, right_row_number,
                                  sizeof(void *), (bool (*)(void *, void *))alignment_row_is_predecessor_2, 1,
                                  allow_row_substitutions ? 1 : 100000000); // Use unit gap and mismatch costs for the diff
@@ -230,8 +531,8 @@ void alignment_link_adjacent(Alignment *left_alignment, Alignment *right_alignme
     // connect up the rows according to the alignment
     for(int64_t i=0; i<left_row_number; i++) {
         if(aligned_rows[i] != -1) {
-            Alignment_Row *left_row = stList_get(left_rows, i);
-            Alignment_Row *right_row = stList_get(right_rows, aligned_rows[i]);
+            Alignment_Row *left_row = left_rows[i];
+            Alignment_Row *right_row = right_rows[aligned_rows[i]];
             left_row->r_row = right_row;
             right_row->l_row = left_row;
             if(!allow_row_substitutions) {
@@ -258,9 +559,6 @@ void alignment_link_adjacent(Alignment *left_alignment, Alignment *right_alignme
         }
         row = row->n_row;
     }
-    // clean up
-    stList_destruct(left_rows);
-    stList_destruct(right_rows);
 }
 
 int64_t alignment_length(Alignment *alignment) {
@@ -303,6 +601,7 @@ void alignment_row_mask_identical_bases(Alignment *alignment, Alignment_Row *ref
 }
 
 void alignment_mask_reference_bases(Alignment *alignment, char mask_char) {
+    alignment_unpack_rows(alignment); // The rows are masked in place, so need their bases as strings
     Alignment_Row *ref_row = alignment->row;
     if(ref_row) {
         Alignment_Row *non_ref_row = ref_row->n_row;
@@ -357,7 +656,15 @@ int64_t alignment_number_of_common_rows(Alignment *left_alignment, Alignment *ri
     return shared_rows;
 }
 
-static bool alignment_column_is_all_gaps(Alignment *alignment, int64_t column_index) {
+static bool alignment_column_is_all_gaps(Alignment *alignment, char *base_matrix, int64_t column_index) {
+    if(base_matrix != NULL) { // Step down the column through the matrix
+        for(int64_t i=0; i<alignment->row_number; i++) {
+            if(base_matrix[i * alignment->row_stride + column_index] != '-') {
+                return 0;
+            }
+        }
+        return 1;
+    }
     for(Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
         if(row->bases[column_index] != '-') {
             return 0;
@@ -371,13 +678,15 @@ int64_t alignment_remove_all_gap_columns(Alignment *alignment) {
     if(alignment->row == NULL || column_number == 0) {
         return 0;
     }
+    alignment_unpack_rows(alignment); // The rows are compacted in place below
     // Flag the columns to keep. Scanning column-major with an early exit keeps this
     // O(column_number) in the common case where the first row has a base in every column, and the
     // flags are only allocated once we know there is a gap-only column to remove.
     char *keep_column = NULL;
     int64_t columns_to_remove = 0;
+    char *base_matrix = alignment_get_base_matrix(alignment);
     for(int64_t i=0; i<column_number; i++) {
-        if(alignment_column_is_all_gaps(alignment, i)) {
+        if(alignment_column_is_all_gaps(alignment, base_matrix, i)) {
             if(keep_column == NULL) {
                 keep_column = st_calloc(column_number, sizeof(char));
                 for(int64_t j=0; j<i; j++) { // Every column up to here is being kept
@@ -400,7 +709,7 @@ int64_t alignment_remove_all_gap_columns(Alignment *alignment) {
         keep_column[0] = 1;
         columns_to_remove--;
     }
-    // Compact the bases of each row in place. Note we deliberately do not touch start / length /
+    // Compact the bases of each row in place, which leaves any base matrix as it was. Note we deliberately do not touch start / length /
     // sequence_length or the l_row / r_row links: a gap-only column contains no bases, so removing
     // it leaves every row's coordinates, and hence the linking between blocks, unchanged.
     Alignment_Row *row = alignment->row;
@@ -434,6 +743,20 @@ int64_t alignment_remove_all_gap_columns(Alignment *alignment) {
             alignment->column_tags[j++] = NULL;
         }
     }
+    if(alignment->column_tag_strings != NULL) { // Likewise any tags that are still unparsed
+        int64_t j=0;
+        for(int64_t i=0; i<column_number; i++) {
+            if(keep_column[i]) {
+                alignment->column_tag_strings[j++] = alignment->column_tag_strings[i];
+            }
+            else {
+                alignment_arena_free(alignment->arena, alignment->column_tag_strings[i]);
+            }
+        }
+        while(j < column_number) {
+            alignment->column_tag_strings[j++] = NULL;
+        }
+    }
     alignment->column_number = column_number - columns_to_remove;
     free(keep_column);
     return columns_to_remove;
@@ -443,6 +766,7 @@ stList *alignment_split_at_reference_gaps(Alignment *alignment) {
     if(alignment->row == NULL || alignment->column_number == 0) {
         return NULL;
     }
+    alignment_unpack_rows(alignment); // The segments copy their bases out of the rows' strings
     int64_t column_number = alignment->column_number;
     char *reference_bases = alignment->row->bases;
     bool has_reference_gap = 0;
@@ -487,6 +811,9 @@ stList *alignment_split_at_reference_gaps(Alignment *alignment) {
     int64_t *consumed = st_calloc(row_number, sizeof(int64_t)); // bases of the row already passed over
     int64_t *scanned_to = st_calloc(row_number, sizeof(int64_t)); // column the row has been scanned up to
 
+    // The tags move to the segments, which outlive the input alignment and the arena any unparsed
+    // tags were read into, so parse them first
+    alignment_parse_column_tags(alignment);
     stList *segments = stList_construct();
     for(k=0; k<segment_number; k++) {
         int64_t start = segment_start[k], end = segment_end[k];
@@ -498,6 +825,11 @@ stList *alignment_split_at_reference_gaps(Alignment *alignment) {
             segment->column_tags[i - start] = alignment->column_tags[i];
             alignment->column_tags[i] = NULL;
         }
+        // The rows of the segment are laid out in a base matrix of its own, with room for every row
+        int64_t stride = alignment_row_stride(end - start);
+        Alignment_Arena *arena = alignment_arena_construct_unpooled(stride * row_number);
+        segment->base_matrix = alignment_arena_malloc(arena, stride * row_number);
+        segment->row_stride = stride;
         Alignment_Row **p_row = &(segment->row);
         for(int64_t r=0; r<row_number; r++) {
             Alignment_Row *row = input_rows[r];
@@ -518,18 +850,23 @@ stList *alignment_split_at_reference_gaps(Alignment *alignment) {
                 continue;
             }
             Alignment_Row *new_row = st_calloc(1, sizeof(Alignment_Row));
-            new_row->sequence_name = stString_copy(row->sequence_name);
+            new_row->sequence_name = sequence_name_copy(row->sequence_name);
             new_row->strand = row->strand;
             new_row->sequence_length = row->sequence_length;
             new_row->start = row->start + consumed[r];
             new_row->length = segment_length;
-            new_row->bases = stString_getSubString(row->bases, start, end - start);
+            new_row->bases = segment->base_matrix + segment->row_number * stride;
+            memcpy(new_row->bases, row->bases + start, end - start);
+            new_row->bases[end - start] = '\0';
+            new_row->bases_arena = arena;
+            alignment_arena_copy(arena);
             consumed[r] += segment_length;
             *p_row = new_row;
             p_row = &(new_row->n_row);
             segment->row_number++;
         }
         assert(segment->row_number > 0); // The reference always has bases across a segment
+        alignment_index_rows(segment);
         stList_append(segments, segment);
     }
 
@@ -542,12 +879,153 @@ stList *alignment_split_at_reference_gaps(Alignment *alignment) {
     return segments;
 }
 
+// The edge length of the square tiles the transposes work on. A tile of 16 columns by 16 rows is read as
+// 16 vectors, one per column (or row), and written as 16 vectors, one per row (or column), so each tile
+// touches only 32 cache lines however large the block is.
+#define TRANSPOSE_TILE 16
+
+/*
+ * Transpose one tile of at most TRANSPOSE_TILE x TRANSPOSE_TILE bases a base at a time, used for the
+ * ragged edges of the block and where there is no vector unit to use. If row_lengths is not NULL the
+ * non-gap bases of each row of the tile are added to it.
+ */
+static void transpose_tile(const char *columns, int64_t row_number, int64_t column_start, int64_t columns_in_tile,
+                           int64_t row_start, int64_t rows_in_tile, char **rows, int64_t *row_lengths) {
+    for(int64_t i=row_start; i<row_start+rows_in_tile; i++) {
+        const char *column = columns + column_start * row_number + i;
+        char *row = rows[i] + column_start;
+        int64_t length = 0;
+        for(int64_t j=0; j<columns_in_tile; j++) {
+            row[j] = column[j * row_number];
+            length += row[j] != '-';
+        }
+        row_lengths[i] += length;
+    }
+}
+
+/*
+ * As transpose_tile, but in the other direction, from the rows into the column buffer. The tile's first
+ * column is column_start in the column buffer and rows_offset + column_start in the rows.
+ */
+static void transpose_tile_to_columns(char **rows, int64_t rows_offset, int64_t row_number, int64_t column_start,
+                                      int64_t columns_in_tile, int64_t row_start, int64_t rows_in_tile, char *columns) {
+    for(int64_t i=row_start; i<row_start+rows_in_tile; i++) {
+        const char *row = rows[i] + rows_offset + column_start;
+        char *column = columns + column_start * row_number + i;
+        for(int64_t j=0; j<columns_in_tile; j++) {
+            column[j * row_number] = row[j];
+        }
+    }
+}
+
+#ifdef USE_SIMDE
+/*
+ * Transpose a full TRANSPOSE_TILE x TRANSPOSE_TILE tile of bytes held in registers. Interleaving the
+ * bytes of vectors i and i+8 four times over (log2 of the tile size) moves every byte to its transposed
+ * position.
+ */
+static inline void transpose_registers_16x16(simde__m128i *a) {
+    simde__m128i b[TRANSPOSE_TILE];
+    for(int64_t k=0; k<4; k++) {
+        for(int64_t j=0; j<TRANSPOSE_TILE/2; j++) {
+            b[2*j] = simde_mm_unpacklo_epi8(a[j], a[j + TRANSPOSE_TILE/2]);
+            b[2*j+1] = simde_mm_unpackhi_epi8(a[j], a[j + TRANSPOSE_TILE/2]);
+        }
+        memcpy(a, b, sizeof(b));
+    }
+}
+
+/*
+ * Transpose a full tile from the column buffer into the rows. The gaps in each row of the tile are
+ * counted from a compare mask while the row is still in a register.
+ */
+static void transpose_tile_16x16(const char *columns, int64_t row_number, int64_t column_start,
+                                 int64_t row_start, char **rows, int64_t *row_lengths) {
+    simde__m128i a[TRANSPOSE_TILE];
+    const char *column = columns + column_start * row_number + row_start;
+    for(int64_t j=0; j<TRANSPOSE_TILE; j++) {
+        a[j] = simde_mm_loadu_si128((const simde__m128i *)(column + j * row_number));
+    }
+    transpose_registers_16x16(a);
+    simde__m128i gap = simde_mm_set1_epi8('-');
+    for(int64_t i=0; i<TRANSPOSE_TILE; i++) {
+        simde_mm_storeu_si128((simde__m128i *)(rows[row_start + i] + column_start), a[i]);
+        int gaps = __builtin_popcount((unsigned int)simde_mm_movemask_epi8(simde_mm_cmpeq_epi8(a[i], gap)));
+        row_lengths[row_start + i] += TRANSPOSE_TILE - gaps;
+    }
+}
+
+/*
+ * Transpose a full tile from the rows into the column buffer.
+ */
+static void transpose_tile_16x16_to_columns(char **rows, int64_t rows_offset, int64_t row_number,
+                                            int64_t column_start, int64_t row_start, char *columns) {
+    simde__m128i a[TRANSPOSE_TILE];
+    for(int64_t i=0; i<TRANSPOSE_TILE; i++) {
+        a[i] = simde_mm_loadu_si128((const simde__m128i *)(rows[row_start + i] + rows_offset + column_start));
+    }
+    transpose_registers_16x16(a);
+    char *column = columns + column_start * row_number + row_start;
+    for(int64_t j=0; j<TRANSPOSE_TILE; j++) {
+        simde_mm_storeu_si128((simde__m128i *)(column + j * row_number), a[j]);
+    }
+}
+#endif
+
+void alignment_transpose_columns(const char *columns, int64_t row_number, int64_t column_number,
+                                 char **rows, int64_t *row_lengths) {
+    for(int64_t i=0; i<row_number; i++) {
+        row_lengths[i] = 0;
+    }
+    // Work through the block a band of TRANSPOSE_TILE rows at a time, so the destination rows being
+    // written stay in cache while we sweep across the columns
+    for(int64_t i=0; i<row_number; i+=TRANSPOSE_TILE) {
+        int64_t rows_in_tile = row_number - i < TRANSPOSE_TILE ? row_number - i : TRANSPOSE_TILE;
+        for(int64_t j=0; j<column_number; j+=TRANSPOSE_TILE) {
+            int64_t columns_in_tile = column_number - j < TRANSPOSE_TILE ? column_number - j : TRANSPOSE_TILE;
+#ifdef USE_SIMDE
+            if(rows_in_tile == TRANSPOSE_TILE && columns_in_tile == TRANSPOSE_TILE) {
+                transpose_tile_16x16(columns, row_number, j, i, rows, row_lengths);
+                continue;
+            }
+#endif
+            transpose_tile(columns, row_number, j, columns_in_tile, i, rows_in_tile, rows, row_lengths);
+        }
+    }
+}
+
+void alignment_transpose_rows(char **rows, int64_t row_number, int64_t column_start, int64_t column_number,
+                              char *columns) {
+    // Work through a band of TRANSPOSE_TILE columns at a time, so the destination columns being written
+    // stay in cache while we sweep down the rows
+    for(int64_t j=0; j<column_number; j+=TRANSPOSE_TILE) {
+        int64_t columns_in_tile = column_number - j < TRANSPOSE_TILE ? column_number - j : TRANSPOSE_TILE;
+        for(int64_t i=0; i<row_number; i+=TRANSPOSE_TILE) {
+            int64_t rows_in_tile = row_number - i < TRANSPOSE_TILE ? row_number - i : TRANSPOSE_TILE;
+#ifdef USE_SIMDE
+            if(rows_in_tile == TRANSPOSE_TILE && columns_in_tile == TRANSPOSE_TILE) {
+                transpose_tile_16x16_to_columns(rows, column_start, row_number, j, i, columns);
+                continue;
+            }
+#endif
+            transpose_tile_to_columns(rows, column_start, row_number, j, columns_in_tile, i, rows_in_tile, columns);
+        }
+    }
+}
+
 void alignment_get_column_in_buffer(Alignment *alignment, int64_t column_index, char *buffer) {
     assert(column_index >= 0);
     assert(column_index < alignment->column_number);
+    char *base_matrix = alignment_get_base_matrix(alignment);
+    if(base_matrix != NULL) {
+        for(int64_t i=0; i<alignment->row_number; i++) {
+            buffer[i] = base_matrix[i * alignment->row_stride + column_index];
+        }
+        return;
+    }
     Alignment_Row *row = alignment->row;
     for(int64_t i=0; i<alignment->row_number; i++) {
-        buffer[i] = row->bases[column_index];
+        buffer[i] = row->bases != NULL ? row->bases[column_index] : packed_bases_get_base(row->packed_bases, column_index);
         row = row->n_row;
     }
     assert(row == NULL);
@@ -556,50 +1034,118 @@ void alignment_get_column_in_buffer(Alignment *alignment, int64_t column_index,
 char *alignment_get_column(Alignment *alignment, int64_t column_index) {
     char *column_string = st_malloc(sizeof(char) * (alignment->row_number+1));
     column_string[alignment->row_number] = '\0';
-    assert(column_index >= 0);
-    assert(column_index < alignment->column_number);
+    alignment_get_column_in_buffer(alignment, column_index, column_string);
+    return column_string;
+}
+
+/*
+ * The code of each base for the integer encodings of the columns: A/a=0, C/c=1, G/g=2, T/t=3, -=4, everything else=5
+ */
+static const int8_t base_codes[256] = {
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 4, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 0, 5, 1, 5, 5, 5, 2, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 3, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 0, 5, 1, 5, 5, 5, 2, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 3, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+};
+
+/*
+ * Get the bases of each row in the columns [column_start, column_start + column_number), so rows[i][j] is the
+ * base of row i in column column_start + j, stepping through the base matrix if there is one. Packed rows
+ * are decoded into *decoded, which the caller must free.
+ */
+static char **alignment_get_row_bases(Alignment *alignment, int64_t column_start, int64_t column_number,
+                                      char **decoded) {
+    char **rows = st_malloc(sizeof(char *) * (alignment->row_number + 1));
+    char *base_matrix = alignment_get_base_matrix(alignment);
+    *decoded = NULL;
+    int64_t packed_rows = 0;
     Alignment_Row *row = alignment->row;
     for(int64_t i=0; i<alignment->row_number; i++) {
-        assert(row != NULL);
-        column_string[i] = row->bases[column_index];
+        if(base_matrix != NULL) {
+            rows[i] = base_matrix + i * alignment->row_stride + column_start;
+        }
+        else if(row->bases != NULL) {
+            rows[i] = row->bases + column_start;
+        }
+        else {
+            if(*decoded == NULL) { // Room for the columns of every row that is yet to be got
+                *decoded = st_malloc(sizeof(char) * (column_number * (alignment->row_number - i) + 1));
+            }
+            rows[i] = *decoded + column_number * packed_rows++;
+            packed_bases_decode(row->packed_bases, column_start, column_number, rows[i]);
+        }
         row = row->n_row;
     }
-    assert(row == NULL);
-    return column_string;
+    return rows;
+}
+
+void alignment_get_columns_in_buffer(Alignment *alignment, int64_t column_start, int64_t column_number,
+                                     char *buffer) {
+    assert(column_start >= 0 && column_number >= 0);
+    assert(column_start + column_number <= alignment->column_number);
+    char *decoded;
+    char **rows = alignment_get_row_bases(alignment, column_start, column_number, &decoded);
+    alignment_transpose_rows(rows, alignment->row_number, 0, column_number, buffer);
+    free(rows);
+    free(decoded);
+}
+
+void alignment_get_columns_as_int8_in_buffer(Alignment *alignment, int64_t column_start, int64_t column_number,
+                                             int8_t *buffer) {
+    // Transpose the bases straight into the buffer, then encode them in place
+    alignment_get_columns_in_buffer(alignment, column_start, column_number, (char *)buffer);
+    int64_t length = alignment->row_number * column_number;
+    for(int64_t i=0; i<length; i++) {
+        buffer[i] = base_codes[(uint8_t)buffer[i]];
+    }
+}
+
+void alignment_get_columns_as_int32_in_buffer(Alignment *alignment, int64_t column_start, int64_t column_number,
+                                              int32_t *buffer) {
+    // Transpose a band of TRANSPOSE_TILE columns at a time into a scratch buffer, encoding each band as
+    // it is done, so the scratch buffer stays in cache and is only the size of a band
+    assert(column_start >= 0 && column_number >= 0);
+    assert(column_start + column_number <= alignment->column_number);
+    int64_t row_number = alignment->row_number;
+    char *decoded;
+    char **rows = alignment_get_row_bases(alignment, column_start, column_number, &decoded);
+    char *band = st_malloc(sizeof(char) * (TRANSPOSE_TILE * row_number + 1));
+    for(int64_t j=0; j<column_number; j+=TRANSPOSE_TILE) {
+        int64_t columns_in_band = column_number - j < TRANSPOSE_TILE ? column_number - j : TRANSPOSE_TILE;
+        alignment_transpose_rows(rows, row_number, j, columns_in_band, band);
+        int32_t *encoded = buffer + j * row_number;
+        for(int64_t i=0; i<columns_in_band * row_number; i++) {
+            encoded[i] = base_codes[(uint8_t)band[i]];
+        }
+    }
+    free(band);
+    free(rows);
+    free(decoded);
 }
 
 int32_t *alignment_get_column_as_int_array(Alignment *alignment, int64_t column_index) {
     int32_t *column_array = st_malloc(sizeof(int32_t) * alignment->row_number);
     assert(column_index >= 0);
     assert(column_index < alignment->column_number);
+    char *base_matrix = alignment_get_base_matrix(alignment);
     Alignment_Row *row = alignment->row;
     for(int64_t i=0; i<alignment->row_number; i++) {
         assert(row != NULL);
-        int32_t j;
-        switch(row->bases[column_index]) {
-            case '-':
-                j = 4;
-                break;
-            case 'a':
-            case 'A':
-                j = 0;
-                break;
-            case 'c':
-            case 'C':
-                j = 1;
-                break;
-            case 'g':
-            case 'G':
-                j = 2;
-                break;
-            case 't':
-            case 'T':
-                j = 3;
-                break;
-            default:
-                j = 5;
-        }
-        column_array[i] = j;
+        char base = base_matrix != NULL ? base_matrix[i * alignment->row_stride + column_index] :
+                    row->bases != NULL ? row->bases[column_index] : packed_bases_get_base(row->packed_bases, column_index);
+        column_array[i] = base_codes[(uint8_t)base];
         row = row->n_row;
     }
     assert(row == NULL);
@@ -5,7 +5,9 @@ struct _BlockReader {
     LI *li;
     bool is_maf;
     bool run_length_encode_bases;
+    bool skip_bases;  // if set the blocks are read without their bases, see taf_read_block2
     Tag *header;  // owned until block_reader_take_header is called
+    Parallel_Reader *parallel_reader;  // set if the input is parsed on multiple threads
 };
 
 BlockReader *block_reader_open(LI *li) {
@@ -32,6 +34,20 @@ Tag *block_reader_take_header(BlockReader *r) {
     return tag;
 }
 
+void block_reader_set_skip_bases(BlockReader *r, bool skip_bases) {
+    assert(r->parallel_reader == NULL);
+    r->skip_bases = skip_bases;
+}
+
+void block_reader_set_threads(BlockReader *r, int64_t threads) {
+    if (threads > 1) {
+        assert(r->parallel_reader == NULL);
+        r->parallel_reader = r->is_maf ? maf_parallel_reader_construct(r->li, r->skip_bases, threads, 0) :
+                             taf_parallel_reader_construct(r->li, r->run_length_encode_bases, r->skip_bases,
+                                                           threads, 0);
+    }
+}
+
 bool block_reader_is_maf(const BlockReader *r) {
     return r->is_maf;
 }
@@ -42,13 +58,16 @@ bool block_reader_run_length_encoded(const BlockReader *r) {
 
 Alignment *block_reader_next(BlockReader *r, Alignment *prev_block) {
     Alignment *a;
-    if (r->is_maf) {
-        a = maf_read_block(r->li);
-        if (a != NULL && prev_block != NULL) {
-            alignment_link_adjacent(prev_block, a, 1);
-        }
+    if (r->parallel_reader != NULL) {
+        a = parallel_reader_next(r->parallel_reader, prev_block);
+    } else if (r->is_maf) {
+        a = maf_read_block2(r->li, r->skip_bases);
     } else {
-        a = taf_read_block(prev_block, r->run_length_encode_bases, r->li);
+        a = taf_read_block2(prev_block, r->run_length_encode_bases, r->skip_bases, r->li);
+    }
+    // MAF blocks are parsed independently, so link them to the previous block here, serially
+    if (r->is_maf && a != NULL && prev_block != NULL) {
+        alignment_link_adjacent(prev_block, a, 1);
     }
     return a;
 }
@@ -56,5 +75,8 @@ Alignment *block_reader_next(BlockReader *r, Alignment *prev_block) {
 void block_reader_destruct(BlockReader *r) {
     if (r == NULL) return;
     tag_destruct(r->header);  // tag_destruct accepts NULL
+    if (r->parallel_reader != NULL) {
+        parallel_reader_destruct(r->parallel_reader);
+    }
     free(r);
 }
@@ -1,6 +1,11 @@
 #include "line_iterator.h"
+#include "taf.h"
 #include "sonLib.h"
 
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #ifdef USE_HTSLIB
 #include "htslib/bgzf.h"
 #include "htslib/kstring.h"
@@ -33,6 +38,307 @@ static void maybe_enable_bgzf_threads(BGZF *bgzf, const char *what) {
 }
 #endif
 
+// Process-wide read ahead setting, consulted at LI open time like bgzf_threads.
+static bool read_ahead = 0;
+
+void LI_set_read_ahead(bool b) {
+    read_ahead = b;
+}
+
+/*
+ * Read ahead. A reader thread reads the lines of the file into a ring of buffers, each holding many lines
+ * one after another, together with the position in the file of each line. The consumer takes the lines
+ * from the buffers in turn, handing each buffer back to be refilled once it has taken all its lines.
+ */
+
+#define READ_AHEAD_BUFFERS 4
+#define READ_AHEAD_BUFFER_SIZE (1 << 20) // A buffer is handed over once it holds at least this many bytes
+
+typedef struct _Line_Buffer {
+    char *bytes; // The lines, each NUL terminated, one after another
+    int64_t length, capacity;
+    int64_t *line_offsets; // The offset in bytes of each line
+    int64_t *line_positions; // The position in the file of each line, as LI_tell
+    int64_t line_number, line_capacity;
+    bool end_of_file; // Set if the file ends after the lines of the buffer
+    int64_t end_position; // If end_of_file is set, the position of the end of the file
+    bool full; // Set while the buffer is held by the consumer, rather than being filled
+} Line_Buffer;
+
+struct _Read_Ahead {
+    pthread_t reader;
+    pthread_mutex_t lock; // Guards the full flags of the buffers and stop
+    pthread_cond_t changed; // Broadcast whenever they change
+    bool stop; // Set to stop the reader early
+    Line_Buffer buffers[READ_AHEAD_BUFFERS];
+    int64_t read_index; // The buffer the consumer is taking lines from
+    bool holding; // Set once the consumer has waited for the buffer at read_index to be filled
+    int64_t next_line; // The index of the next line the consumer will take from the buffer at read_index
+    bool releasing; // Set if the buffer at release_index has been emptied, but not yet handed back
+    int64_t release_index;
+};
+
+// Get the position in the file of the next line, as LI_tell would
+static int64_t file_tell(LI *li) {
+#ifdef USE_HTSLIB
+    return bgzf_tell(li->bgzf);
+#else
+    return ftell(li->fh);
+#endif
+}
+
+static void line_buffer_add(Line_Buffer *buffer, const char *line, int64_t length, int64_t position) {
+    if(buffer->length + length + 1 > buffer->capacity) {
+        buffer->capacity = 2 * (buffer->length + length + 1);
+        buffer->bytes = st_realloc(buffer->bytes, buffer->capacity);
+    }
+    if(buffer->line_number == buffer->line_capacity) {
+        buffer->line_capacity = buffer->line_capacity == 0 ? 1024 : 2 * buffer->line_capacity;
+        buffer->line_offsets = st_realloc(buffer->line_offsets, sizeof(int64_t) * buffer->line_capacity);
+        buffer->line_positions = st_realloc(buffer->line_positions, sizeof(int64_t) * buffer->line_capacity);
+    }
+    buffer->line_offsets[buffer->line_number] = buffer->length;
+    buffer->line_positions[buffer->line_number++] = position;
+    memcpy(buffer->bytes + buffer->length, line, length);
+    buffer->bytes[buffer->length + length] = '\0';
+    buffer->length += length + 1;
+}
+
+// Fill the buffer with the next lines of the file, returning non-zero if it reached the end of the file
+static bool line_buffer_fill(Line_Buffer *buffer, LI *li) {
+    buffer->length = 0;
+    buffer->line_number = 0;
+    buffer->end_of_file = 0;
+#ifdef USE_HTSLIB
+    kstring_t ks = KS_INITIALIZE;
+#endif
+    while(buffer->length < READ_AHEAD_BUFFER_SIZE) {
+        int64_t position = file_tell(li);
+#ifdef USE_HTSLIB
+        int64_t length = bgzf_getline(li->bgzf, '\n', &ks);
+        char *line = length >= 0 ? ks.s : NULL;
+#else
+        char *line = stFile_getLineFromFile(li->fh);
+        int64_t length = line != NULL ? strlen(line) : -1;
+#endif
+        if(line == NULL) {
+            buffer->end_of_file = 1;
+            buffer->end_position = position;
+            break;
+        }
+        line_buffer_add(buffer, line, length, position);
+#ifndef USE_HTSLIB
+        free(line);
+#endif
+    }
+#ifdef USE_HTSLIB
+    free(ks.s);
+#endif
+    return buffer->end_of_file;
+}
+
+static void *read_ahead_run(void *arg) {
+    LI *li = arg;
+    Read_Ahead *ra = li->read_ahead;
+    for(int64_t i=0; ; i = (i + 1) % READ_AHEAD_BUFFERS) {
+        Line_Buffer *buffer = &ra->buffers[i];
+        pthread_mutex_lock(&ra->lock);
+        while(buffer->full && !ra->stop) { // Wait for the consumer to hand the buffer back
+            pthread_cond_wait(&ra->changed, &ra->lock);
+        }
+        bool stop = ra->stop;
+        pthread_mutex_unlock(&ra->lock);
+        if(stop) {
+            break;
+        }
+        bool end_of_file = line_buffer_fill(buffer, li);
+        pthread_mutex_lock(&ra->lock);
+        buffer->full = 1;
+        pthread_cond_broadcast(&ra->changed);
+        pthread_mutex_unlock(&ra->lock);
+        if(end_of_file) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void read_ahead_start(LI *li) {
+    Read_Ahead *ra = li->read_ahead;
+    ra->stop = 0;
+    ra->read_index = 0;
+    ra->holding = 0;
+    ra->releasing = 0;
+    for(int64_t i=0; i<READ_AHEAD_BUFFERS; i++) {
+        ra->buffers[i].full = 0;
+    }
+    if(pthread_create(&ra->reader, NULL, read_ahead_run, li) != 0) {
+        st_errAbort("Unable to start read ahead thread\n");
+    }
+}
+
+static void read_ahead_stop(LI *li) {
+    Read_Ahead *ra = li->read_ahead;
+    pthread_mutex_lock(&ra->lock);
+    ra->stop = 1;
+    pthread_cond_broadcast(&ra->changed);
+    pthread_mutex_unlock(&ra->lock);
+    pthread_join(ra->reader, NULL);
+}
+
+static void read_ahead_construct(LI *li) {
+    Read_Ahead *ra = st_calloc(1, sizeof(Read_Ahead));
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->changed, NULL);
+    li->read_ahead = ra;
+    read_ahead_start(li);
+}
+
+static void read_ahead_destruct(LI *li) {
+    Read_Ahead *ra = li->read_ahead;
+    read_ahead_stop(li);
+    for(int64_t i=0; i<READ_AHEAD_BUFFERS; i++) {
+        free(ra->buffers[i].bytes);
+        free(ra->buffers[i].line_offsets);
+        free(ra->buffers[i].line_positions);
+    }
+    pthread_mutex_destroy(&ra->lock);
+    pthread_cond_destroy(&ra->changed);
+    free(ra);
+    li->read_ahead = NULL;
+}
+
+// Set the view to the next line read ahead, or NULL at the end of the file, setting position to its position.
+// A buffer that has been emptied is only handed back on the following call, as the line last returned may
+// still be in it.
+static void read_ahead_get_line(LI *li, int64_t *position) {
+    Read_Ahead *ra = li->read_ahead;
+    if(ra->releasing) { // Hand the buffer emptied by the last call back to be refilled
+        pthread_mutex_lock(&ra->lock);
+        ra->buffers[ra->release_index].full = 0;
+        pthread_cond_broadcast(&ra->changed);
+        pthread_mutex_unlock(&ra->lock);
+        ra->releasing = 0;
+    }
+    while(1) {
+        Line_Buffer *buffer = &ra->buffers[ra->read_index];
+        if(!ra->holding) { // Wait for the reader to fill the buffer
+            pthread_mutex_lock(&ra->lock);
+            while(!buffer->full) {
+                pthread_cond_wait(&ra->changed, &ra->lock);
+            }
+            pthread_mutex_unlock(&ra->lock);
+            ra->holding = 1;
+            ra->next_line = 0;
+        }
+        if(ra->next_line < buffer->line_number) {
+            int64_t offset = buffer->line_offsets[ra->next_line];
+            int64_t end = ra->next_line + 1 < buffer->line_number ? buffer->line_offsets[ra->next_line + 1] : buffer->length;
+            li->view = buffer->bytes + offset;
+            li->view_length = end - offset - 1; // Less the NUL
+            *position = buffer->line_positions[ra->next_line++];
+            return;
+        }
+        if(buffer->end_of_file) {
+            li->view = NULL;
+            li->view_length = 0;
+            *position = buffer->end_position;
+            return;
+        }
+        // Move on to the next buffer, handing this one back on the next call
+        assert(!ra->releasing);
+        ra->releasing = 1;
+        ra->release_index = ra->read_index;
+        ra->holding = 0;
+        ra->read_index = (ra->read_index + 1) % READ_AHEAD_BUFFERS;
+    }
+}
+
+// Set the view to the next line of the file, read on the calling thread, or to NULL at the end of the
+// file, setting position to its position. The line is read into the line buffer not holding the line
+// last returned.
+static void file_get_line(LI *li, int64_t *position) {
+    *position = file_tell(li);
+    int64_t i = li->line_buffer_index = 1 - li->line_buffer_index;
+#ifdef USE_HTSLIB
+    kstring_t ks = { .l = 0, .m = li->line_buffer_capacities[i], .s = li->line_buffers[i] };
+    int64_t length = bgzf_getline(li->bgzf, '\n', &ks);
+    li->line_buffers[i] = ks.s;
+    li->line_buffer_capacities[i] = ks.m;
+#else
+    int64_t length = getline(&li->line_buffers[i], &li->line_buffer_capacities[i], li->fh);
+    if(length > 0 && li->line_buffers[i][length-1] == '\n') {
+        li->line_buffers[i][--length] = '\0';
+    }
+#endif
+    li->view = length >= 0 ? li->line_buffers[i] : NULL;
+    li->view_length = length >= 0 ? length : 0;
+}
+
+// Set the view to the next line of the buffer, or to NULL if there are no more, setting position to its offset
+static void buffer_get_line(LI *li, int64_t *position) {
+    *position = li->buffer_offset;
+    if(li->buffer_offset >= li->buffer_length) {
+        li->view = NULL;
+        li->view_length = 0;
+        return;
+    }
+    char *line = li->buffer + li->buffer_offset;
+    char *end = memchr(line, '\n', li->buffer_length - li->buffer_offset);
+    int64_t length = end == NULL ? li->buffer_length - li->buffer_offset : end - line;
+    li->buffer_offset += end == NULL ? length : length + 1;
+    li->view = line;
+    li->view_length = length;
+}
+
+// Set the view to the next line, setting position to its position
+static void get_line(LI *li, int64_t *position) {
+    if(li->buffer != NULL) {
+        buffer_get_line(li, position);
+    }
+    else if(li->read_ahead != NULL) {
+        read_ahead_get_line(li, position);
+    }
+    else {
+        file_get_line(li, position);
+    }
+}
+
+// Read the first line of a newly opened file, starting the read ahead thread if it is enabled
+static void get_first_line(LI *li) {
+    if(read_ahead && li->buffer == NULL) {
+        read_ahead_construct(li);
+    }
+    get_line(li, &li->pos);
+    li->prev_pos = li->pos;
+}
+
+#ifndef USE_HTSLIB
+// If the file is a regular file, memory map it to use as the buffer, starting from the current position
+// of the file handle, so the lines are found in place rather than read through the handle. Positions are
+// then offsets into the file, as they would be otherwise.
+static void map_file(LI *li) {
+    struct stat st;
+    int fd = fileno(li->fh);
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return;
+    }
+    long offset = ftell(li->fh);
+    if(offset < 0) {
+        return;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED) {
+        return; // Read through the handle instead
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    li->buffer = map;
+    li->buffer_length = st.st_size;
+    li->buffer_offset = offset;
+    li->buffer_mapped = 1;
+}
+#endif
+
 LI *LI_construct(FILE *fh) {
     LI *li = st_calloc(1, sizeof(LI));
 #ifdef USE_HTSLIB
@@ -44,17 +350,11 @@ LI *LI_construct(FILE *fh) {
         }
     }
     maybe_enable_bgzf_threads(li->bgzf, "read");
-    kstring_t ks = KS_INITIALIZE;
-    li->prev_pos = bgzf_tell(li->bgzf);
-    li->pos = li->prev_pos;
-    bgzf_getline(li->bgzf, '\n', &ks);
-    li->line = ks_release(&ks);
 #else
     li->fh = fh;
-    li->prev_pos = ftell(li->fh);
-    li->pos = li->prev_pos;
-    li->line = stFile_getLineFromFile(fh);
+    map_file(li);
 #endif
+    get_first_line(li);
     return li;
 }
 
@@ -76,11 +376,7 @@ LI *LI_construct_from_path(const char *path) {
             assert(false);
         }
     }
-    kstring_t ks = KS_INITIALIZE;
-    li->prev_pos = bgzf_tell(li->bgzf);
-    li->pos = li->prev_pos;
-    bgzf_getline(li->bgzf, '\n', &ks);
-    li->line = ks_release(&ks);
+    get_first_line(li);
     return li;
 }
 #else
@@ -94,16 +390,45 @@ LI *LI_construct_from_path(const char *path) {
 }
 #endif
 
+LI *LI_construct_from_buffer(char *buffer, int64_t length) {
+    LI *li = st_calloc(1, sizeof(LI));
+    li->buffer = buffer;
+    li->buffer_length = length;
+    get_first_line(li);
+    return li;
+}
+
 void LI_destruct(LI *li) {
+    if(li->read_ahead != NULL) {
+        read_ahead_destruct(li);
+    }
 #ifdef USE_HTSLIB
-    bgzf_close(li->bgzf);
+    if(li->buffer == NULL) {
+        bgzf_close(li->bgzf);
+    }
 #endif
+    if(li->buffer_mapped) {
+        munmap(li->buffer, li->buffer_length);
+    }
+    if(li->sequence_names != NULL) {
+        sequence_name_pool_destruct(li->sequence_names);
+    }
+    if(li->arenas != NULL) {
+        alignment_arena_pool_destruct(li->arenas);
+    }
+    free(li->line);
+    free(li->returned_line);
+    free(li->line_buffers[0]);
+    free(li->line_buffers[1]);
     free(li);
 }
 
 bool LI_indexable(LI *li) {
     assert(li != NULL);
 #ifdef USE_HTSLIB
+    if(li->buffer != NULL) {
+        return true;
+    }
     int bc = bgzf_compression(li->bgzf);
     return bc == 0 || bc == 2;
 #else
@@ -111,34 +436,68 @@ bool LI_indexable(LI *li) {
 #endif
 }
 
-char *LI_get_next_line(LI *li) {
-    char *l = li->line;
+char *LI_next_line_view(LI *li, int64_t *length) {
+    free(li->returned_line);
+    li->returned_line = li->line; // A copy made by LI_peek_at_next_line is returned in place of the view
+    li->line = NULL;
+    char *line = li->returned_line != NULL ? li->returned_line : li->view;
+    *length = li->returned_line != NULL ? strlen(li->returned_line) : li->view_length;
     li->prev_pos = li->pos;
-#ifdef USE_HTSLIB
-    kstring_t ks = KS_INITIALIZE;
-    li->pos = bgzf_tell(li->bgzf);
-    bgzf_getline(li->bgzf, '\n', &ks);
-    li->line = ks_release(&ks);
-#else
-    li->pos = ftell(li->fh);
-    li->line = stFile_getLineFromFile(li->fh);
-#endif
+    get_line(li, &li->pos);
+    return line;
+}
+
+char *LI_peek_at_next_line_view(LI *li, int64_t *length) {
+    if(li->line != NULL) {
+        *length = strlen(li->line);
+        return li->line;
+    }
+    *length = li->view_length;
+    return li->view;
+}
+
+char *LI_get_next_line(LI *li) {
+    char *l = LI_peek_at_next_line(li);
+    li->line = NULL; // The copy now belongs to the caller
+    int64_t length;
+    LI_next_line_view(li, &length);
     return l;
 }
 
 char *LI_peek_at_next_line(LI *li) {
+    if(li->line == NULL && li->view != NULL) {
+        li->line = stString_getSubString(li->view, 0, li->view_length);
+    }
     return li->line;
 }
 
+void LI_set_next_line(LI *li, char *line) {
+    free(li->line);
+    li->line = line;
+}
+
 void LI_seek(LI *li, int64_t position) {
+    // The line after the seek is still the one before it, so copy it out of wherever it was read into
+    LI_peek_at_next_line(li);
     li->prev_pos = position;
     li->pos = position;
+    if(li->buffer != NULL) {
+        assert(position >= 0 && position <= li->buffer_length);
+        li->buffer_offset = position;
+        return;
+    }
+    if(li->read_ahead != NULL) { // Discard the lines read ahead, and restart from the new position
+        read_ahead_stop(li);
+    }
 #ifdef USE_HTSLIB
     int ret = bgzf_seek(li->bgzf, position, SEEK_SET);
 #else
     int ret = fseek(li->fh, position, SEEK_SET);
 #endif
     assert(ret == 0);
+    if(li->read_ahead != NULL) {
+        read_ahead_start(li);
+    }
 }
 
 int64_t LI_tell(LI *li) {
@@ -151,6 +510,141 @@ int64_t LI_tell(LI *li) {
 // many emitted fields.
 #define LW_BUF_TARGET (64u * 1024u)
 
+// Process-wide write behind setting, consulted at LW open time like read_ahead.
+static bool write_behind = 0;
+
+void LW_set_write_behind(bool b) {
+    write_behind = b;
+}
+
+/*
+ * Write behind. The formatting thread hands each full buffer to a writer thread, taking in exchange an
+ * empty buffer from a ring, so the buffers are written in the order they were handed over.
+ */
+
+#define WRITE_BEHIND_BUFFERS 4
+
+struct _Write_Behind {
+    pthread_t writer;
+    pthread_mutex_t lock; // Guards the fields below
+    pthread_cond_t changed; // Broadcast whenever they change
+    char *buffers[WRITE_BEHIND_BUFFERS]; // The ring of buffers
+    size_t lengths[WRITE_BEHIND_BUFFERS]; // The number of bytes to write from each queued buffer
+    bool end_blocks[WRITE_BEHIND_BUFFERS]; // Whether to end the BGZF block after each queued buffer
+    size_t capacities[WRITE_BEHIND_BUFFERS];
+    int64_t first; // The index of the oldest buffer queued to be written
+    int64_t queued; // The number of buffers queued, following first round the ring
+    int64_t position; // The position of the stream, as of the last buffer written
+    bool stop; // Set once there is nothing more to write
+};
+
+// Write bytes to the underlying stream, then if end_block is set end the current BGZF block, so the bytes
+// written next start a new one. Updates the position of the stream.
+static void lw_write_bytes(LW *lw, const char *bytes, size_t length, bool end_block) {
+#ifdef USE_HTSLIB
+    if (lw->bgzf) {
+        if (length > 0) {
+            ssize_t n = bgzf_write(lw->bgzf, bytes, length);
+            assert(n == (ssize_t)length);
+        }
+        if (end_block && bgzf_flush(lw->bgzf) != 0) {
+            assert(0); // Flush failed
+        }
+        lw->position = bgzf_tell(lw->bgzf) >> 16; // The compressed bytes written, up to the current block
+        return;
+    }
+#endif
+    size_t n = fwrite(bytes, 1, length, lw->fh);
+    assert(n == length);
+    lw->position += length;
+}
+
+static void *write_behind_run(void *arg) {
+    LW *lw = arg;
+    Write_Behind *wb = lw->write_behind;
+    pthread_mutex_lock(&wb->lock);
+    while(1) {
+        while(wb->queued == 0 && !wb->stop) { // Wait for a buffer to write
+            pthread_cond_wait(&wb->changed, &wb->lock);
+        }
+        if(wb->queued == 0) { // Stopping, with everything written
+            break;
+        }
+        int64_t i = wb->first;
+        pthread_mutex_unlock(&wb->lock);
+        lw_write_bytes(lw, wb->buffers[i], wb->lengths[i], wb->end_blocks[i]);
+        pthread_mutex_lock(&wb->lock);
+        wb->position = lw->position;
+        wb->first = (wb->first + 1) % WRITE_BEHIND_BUFFERS;
+        wb->queued--;
+        pthread_cond_broadcast(&wb->changed);
+    }
+    pthread_mutex_unlock(&wb->lock);
+    return NULL;
+}
+
+static void write_behind_construct(LW *lw) {
+    Write_Behind *wb = st_calloc(1, sizeof(Write_Behind));
+    for(int64_t i=0; i<WRITE_BEHIND_BUFFERS; i++) {
+        wb->capacities[i] = LW_BUF_TARGET;
+        wb->buffers[i] = st_malloc(wb->capacities[i]);
+    }
+    pthread_mutex_init(&wb->lock, NULL);
+    pthread_cond_init(&wb->changed, NULL);
+    lw->write_behind = wb;
+    if(pthread_create(&wb->writer, NULL, write_behind_run, lw) != 0) {
+        st_errAbort("Unable to start write behind thread\n");
+    }
+}
+
+// Hand the buffer to the writer thread, waiting for room in the ring, and take an empty one in exchange
+static void write_behind_hand_over(LW *lw, bool end_block) {
+    Write_Behind *wb = lw->write_behind;
+    pthread_mutex_lock(&wb->lock);
+    while(wb->queued == WRITE_BEHIND_BUFFERS) {
+        pthread_cond_wait(&wb->changed, &wb->lock);
+    }
+    int64_t i = (wb->first + wb->queued) % WRITE_BEHIND_BUFFERS;
+    char *buffer = wb->buffers[i];
+    size_t capacity = wb->capacities[i];
+    wb->buffers[i] = lw->buf;
+    wb->capacities[i] = lw->buf_cap;
+    wb->lengths[i] = lw->buf_pos;
+    wb->end_blocks[i] = end_block;
+    wb->queued++;
+    pthread_cond_broadcast(&wb->changed);
+    pthread_mutex_unlock(&wb->lock);
+    lw->buf = buffer;
+    lw->buf_cap = capacity;
+    lw->buf_pos = 0;
+}
+
+// Wait for everything handed over to have been written
+static void write_behind_drain(LW *lw) {
+    Write_Behind *wb = lw->write_behind;
+    pthread_mutex_lock(&wb->lock);
+    while(wb->queued > 0) {
+        pthread_cond_wait(&wb->changed, &wb->lock);
+    }
+    pthread_mutex_unlock(&wb->lock);
+}
+
+static void write_behind_destruct(LW *lw) {
+    Write_Behind *wb = lw->write_behind;
+    pthread_mutex_lock(&wb->lock);
+    wb->stop = 1;
+    pthread_cond_broadcast(&wb->changed);
+    pthread_mutex_unlock(&wb->lock);
+    pthread_join(wb->writer, NULL);
+    for(int64_t i=0; i<WRITE_BEHIND_BUFFERS; i++) {
+        free(wb->buffers[i]);
+    }
+    pthread_mutex_destroy(&wb->lock);
+    pthread_cond_destroy(&wb->changed);
+    free(wb);
+    lw->write_behind = NULL;
+}
+
 LW *LW_construct(FILE *fh, bool use_compression) {
     LW *lw = st_calloc(1, sizeof(LW));
     lw->fh = fh;
@@ -168,25 +662,77 @@ LW *LW_construct(FILE *fh, bool use_compression) {
         maybe_enable_bgzf_threads(lw->bgzf, "write");
 #endif
     }
+    if(write_behind) {
+        write_behind_construct(lw);
+    }
     return lw;
 }
 
-// Send the coalesced buffer to the underlying stream, then reset.  Callers
-// that emit via the legacy LW_write OR that read back via fileno() must
-// invoke this first so on-disk ordering matches call order.
+// Send the coalesced buffer on to the underlying stream, or to the writer
+// thread if writing behind, then reset.  This is what the LW_put* family
+// calls when the buffer fills.  If end_block is set the BGZF block is ended
+// after the buffer, even if the buffer is empty.
+static void lw_flush_buffer(LW *lw, bool end_block) {
+    if (lw->buf_pos == 0 && !end_block) return;
+    if (lw->write_behind != NULL) {
+        write_behind_hand_over(lw, end_block);
+        return;
+    }
+    lw_write_bytes(lw, lw->buf, lw->buf_pos, end_block);
+    lw->buf_pos = 0;
+}
+
+// Callers that write to the underlying stream themselves OR that read back
+// via fileno() must invoke this first so on-disk ordering matches call order.
 void LW_flush(LW *lw) {
-    if (lw->buf_pos == 0) return;
+    lw_flush_buffer(lw, 0);
+    if (lw->write_behind != NULL) {
+        write_behind_drain(lw);
+    }
+}
+
+// The position of the underlying stream, not counting what is still buffered
+// or waiting to be written behind
+static int64_t lw_position(LW *lw) {
+    if (lw->write_behind == NULL) return lw->position;
+    pthread_mutex_lock(&lw->write_behind->lock);
+    int64_t position = lw->write_behind->position;
+    pthread_mutex_unlock(&lw->write_behind->lock);
+    return position;
+}
+
+void LW_set_block_aligned_anchors(LW *lw, int64_t anchor_every_n_bytes) {
+    lw->block_aligned_anchors = 1;
+    lw->anchor_every_n_bytes = anchor_every_n_bytes;
+}
+
+bool LW_anchor_due(LW *lw) {
+    return lw->block_aligned_anchors && lw->anchor_every_n_bytes > 0 &&
+           lw_position(lw) - lw->anchor_position >= lw->anchor_every_n_bytes;
+}
+
+void LW_start_anchor(LW *lw) {
+    if (lw->block_aligned_anchors) {
+        lw_flush_buffer(lw, 1);
+        lw->anchor_position = lw_position(lw);
+    }
+}
+
+void LW_set_index(LW *lw, Tai_Writer *index) {
+    lw->index = index;
+}
+
+int64_t LW_tell(LW *lw) {
+    lw_flush_buffer(lw, 1);
+    if (lw->write_behind != NULL) {
+        write_behind_drain(lw);
+    }
 #ifdef USE_HTSLIB
     if (lw->bgzf) {
-        ssize_t n = bgzf_write(lw->bgzf, lw->buf, lw->buf_pos);
-        assert(n == (ssize_t)lw->buf_pos);
-    } else
-#endif
-    {
-        size_t n = fwrite(lw->buf, 1, lw->buf_pos, lw->fh);
-        assert(n == lw->buf_pos);
+        return bgzf_tell(lw->bgzf);
     }
-    lw->buf_pos = 0;
+#endif
+    return lw_position(lw);
 }
 
 // Reserve `need` more bytes in the buffer, flushing if doing so would not
@@ -195,7 +741,7 @@ void LW_flush(LW *lw) {
 // sequence name longer than 64 KB) -- the steady state is "flush at full".
 static void lw_reserve(LW *lw, size_t need) {
     if (lw->buf_pos + need <= lw->buf_cap) return;
-    LW_flush(lw);
+    lw_flush_buffer(lw, 0);
     if (need > lw->buf_cap) {
         while (lw->buf_cap < need) lw->buf_cap *= 2;
         lw->buf = st_realloc(lw->buf, lw->buf_cap);
@@ -206,7 +752,7 @@ static void lw_reserve(LW *lw, size_t need) {
 // only branches here when the buffer is full; this flushes (resetting
 // buf_pos to 0) and stores the byte.
 void LW_putc_slow(LW *lw, char c) {
-    LW_flush(lw);
+    lw_flush_buffer(lw, 0);
     lw->buf[lw->buf_pos++] = c;
 }
 
@@ -222,7 +768,7 @@ void LW_puts(LW *lw, const char *s) {
 
 void LW_putrep(LW *lw, char c, size_t n) {
     while (n > 0) {
-        if (lw->buf_pos == lw->buf_cap) LW_flush(lw);
+        if (lw->buf_pos == lw->buf_cap) lw_flush_buffer(lw, 0);
         size_t room = lw->buf_cap - lw->buf_pos;
         size_t k = (n < room) ? n : room;
         memset(lw->buf + lw->buf_pos, (unsigned char)c, k);
@@ -273,6 +819,9 @@ void LW_puti64(LW *lw, int64_t v) {
 
 void LW_destruct(LW *lw, bool clean_up_file_handle) {
     LW_flush(lw);
+    if(lw->write_behind != NULL) {
+        write_behind_destruct(lw);
+    }
     free(lw->buf);
     lw->buf = NULL;
 #ifdef USE_HTSLIB
@@ -292,38 +841,19 @@ void LW_destruct(LW *lw, bool clean_up_file_handle) {
 }
 
 int LW_write(LW *lw, const char *string, ...) {
-    LW_flush(lw); // preserve ordering against any pending LW_put* bytes
-#ifdef USE_HTSLIB
-    int i;
+    // Format straight into the buffer, so the string is written in order with any pending LW_put* bytes
     va_list ap;
-    if(lw->bgzf) { // Use bgzf compression
-        // Figure out how long the string is to build the buffer
-        va_start(ap, string);
-        int j = vsnprintf(NULL, 0, string, ap)+1;
-        assert(j >= 0);
-        va_end(ap);
-        // Now write the string into the buffer
-        va_start(ap, string);
-        char ret[j];
-        i = vsnprintf(ret, j, string, ap);
-        assert(ret[i] == '\0');
-        // Finally, write the buffer to the bgzf stream
-        i = bgzf_write(lw->bgzf, ret, i);
-        assert(i+1 == j);
-        va_end(ap);
-    }
-    else { // No compression, just fprintf to the stream
+    va_start(ap, string);
+    size_t room = lw->buf_cap - lw->buf_pos;
+    int i = vsnprintf(lw->buf + lw->buf_pos, room, string, ap);
+    va_end(ap);
+    assert(i >= 0);
+    if((size_t)i >= room) { // It didn't fit (vsnprintf needs room for the NUL too), so make room and go again
+        lw_reserve(lw, i + 1);
         va_start(ap, string);
-        i = vfprintf(lw->fh, string, ap);
+        vsnprintf(lw->buf + lw->buf_pos, i + 1, string, ap);
         va_end(ap);
     }
+    lw->buf_pos += i;
     return i;
-#else
-    va_list ap;
-    va_start(ap, string);
-    int i = vfprintf(lw->fh, string, ap);
-    va_end(ap);
-    return i;
-#endif
 }
-
@@ -5,60 +5,115 @@
 #include "sonLib.h"
 #include "line_iterator.h"
 
-// Hand-rolled "s name start length strand srcSize bases" parser.  Mutates
-// `line` in place by NUL-terminating field boundaries; returned pointers
-// reference its bytes (the row owns its own strdup'd name + bases though).
-// Returns true on a well-formed s line.
+// Parse a decimal integer starting at *p, not going past end, and advance
+// *p past it.  Stands in for strtoll, which needs a NUL terminated string.
+static int64_t parse_maf_int(char **p, char *end) {
+    char *q = *p;
+    bool negative = q < end && *q == '-';
+    if (negative || (q < end && *q == '+')) q++;
+    int64_t i = 0;
+    while (q < end && *q >= '0' && *q <= '9') {
+        i = i * 10 + (*q++ - '0');
+    }
+    *p = q;
+    return negative ? -i : i;
+}
+
+// Hand-rolled "s name start length strand srcSize bases" parser over the
+// `length` bytes of `line`, which need not be NUL terminated and are not
+// modified (it is a view from LI_next_line_view).  *bases is set to the
+// start of the row's bases within the line, for the caller to copy into the
+// block's base matrix, and *column_number to their count; the name is taken
+// from the LI's pool of interned names.  Returns true on a well-formed s line.
 //
 // Why: stString_split allocated ~7 strings + an stList per s line and
 // freed five immediately after; the per-line malloc/free traffic
 // dominated MAF reads.  This parser walks the line once with no
-// allocations beyond the two strdups we actually keep.
-static bool maf_parse_s_line(char *line, Alignment_Row *row) {
-    char *p = line;
-    if (*p++ != 's') return false;
-    if (*p != '\t' && *p != ' ') return false;
-    while (*p == '\t' || *p == ' ') p++;
+// allocations beyond the copy of the bases we actually keep.
+static bool maf_parse_s_line(char *line, int64_t length, Alignment_Row *row, LI *li,
+                             char **bases, int64_t *column_number) {
+    char *p = line, *end = line + length;
+#define IS_MAF_SPACE(p) ((p) < end && (*(p) == '\t' || *(p) == ' '))
+    if (p == end || *p++ != 's') return false;
+    if (!IS_MAF_SPACE(p)) return false;
+    while (IS_MAF_SPACE(p)) p++;
 
     // Field 1: sequence name (run to next whitespace).
     char *name = p;
-    while (*p && *p != '\t' && *p != ' ') p++;
-    if (!*p) return false;
-    *p++ = '\0';
-    while (*p == '\t' || *p == ' ') p++;
-    row->sequence_name = stString_copy(name);
+    while (p < end && *p != '\t' && *p != ' ') p++;
+    if (p == end) return false;
+    row->sequence_name = sequence_name_intern(li, name, p - name);
+    p++;
+    while (IS_MAF_SPACE(p)) p++;
 
-    // Field 2: start.  strtoll consumes leading whitespace and stops at
-    // the first non-digit, advancing p to that boundary.
-    row->start = (int64_t)strtoll(p, &p, 10);
-    while (*p == '\t' || *p == ' ') p++;
+    // Field 2: start, stopping at the first non-digit.
+    row->start = parse_maf_int(&p, end);
+    while (IS_MAF_SPACE(p)) p++;
 
     // Field 3: alignment length.
-    row->length = (int64_t)strtoll(p, &p, 10);
-    while (*p == '\t' || *p == ' ') p++;
+    row->length = parse_maf_int(&p, end);
+    while (IS_MAF_SPACE(p)) p++;
 
     // Field 4: strand: '+' or '-' (single char, then whitespace).
-    if (*p != '+' && *p != '-') return false;
+    if (p == end || (*p != '+' && *p != '-')) return false;
     row->strand = (*p == '+');
     p++;
-    while (*p == '\t' || *p == ' ') p++;
+    while (IS_MAF_SPACE(p)) p++;
 
     // Field 5: source sequence length.
-    row->sequence_length = (int64_t)strtoll(p, &p, 10);
-    while (*p == '\t' || *p == ' ') p++;
+    row->sequence_length = parse_maf_int(&p, end);
+    while (IS_MAF_SPACE(p)) p++;
+#undef IS_MAF_SPACE
 
-    // Field 6: bases (to end-of-line / NUL).  No internal whitespace.
-    char *bases = p;
-    while (*p && *p != '\n' && *p != '\r') p++;
-    *p = '\0';
-    row->bases = stString_copy(bases);
+    // Field 6: bases (to end-of-line).  No internal whitespace.
+    *bases = p;
+    while (p < end && *p != '\n' && *p != '\r') p++;
+    *column_number = p - *bases;
 
     return true;
 }
 
+// The rows of a block as they are read, laid out one after another in the
+// block's base matrix, which is grown (by doubling the number of rows it
+// has room for) as rows are added.  The matrix is allocated from an arena
+// of its own, of which each row holds a reference, so the bases can be
+// released without the block.
+typedef struct _Row_Matrix {
+    int64_t stride, row_capacity;
+    char *bases;
+    Alignment_Arena *arena;
+} Row_Matrix;
+
+static void row_matrix_add(Row_Matrix *matrix, Alignment *alignment, Alignment_Row *row, char *bases) {
+    int64_t i = alignment->row_number - 1; // The index of the row, which has been counted
+    if(i == matrix->row_capacity) {
+        matrix->row_capacity = matrix->row_capacity == 0 ? 16 : matrix->row_capacity * 2;
+        char *matrix_bases = alignment_arena_malloc(matrix->arena, matrix->stride * matrix->row_capacity);
+        if(i > 0) { // Move the rows so far, and their bases pointers with them
+            memcpy(matrix_bases, matrix->bases, matrix->stride * i);
+            Alignment_Row *r = alignment->row;
+            for(int64_t j=0; j<i; j++) {
+                r->bases = matrix_bases + j * matrix->stride;
+                r = r->n_row;
+            }
+        }
+        matrix->bases = matrix_bases;
+    }
+    row->bases = matrix->bases + i * matrix->stride;
+    row->bases_arena = matrix->arena;
+    alignment_arena_copy(matrix->arena);
+    memcpy(row->bases, bases, alignment->column_number);
+    row->bases[alignment->column_number] = '\0';
+}
+
 Alignment *maf_read_block(LI *li) {
+    return maf_read_block2(li, 0);
+}
+
+Alignment *maf_read_block2(LI *li, bool skip_bases) {
     while(1) {
-        char *line = LI_get_next_line(li);
+        int64_t length;
+        char *line = LI_next_line_view(li, &length);
         if(line == NULL) {
             return NULL;
         }
@@ -66,8 +121,8 @@ Alignment *maf_read_block(LI *li) {
         // following byte is whitespace or end-of-line, so we don't match
         // a sequence name that happens to start with 'a').  The old code
         // tokenised every line via stString_split before testing this.
-        char c = line[0];
-        char c1 = line[1];
+        char c = length > 0 ? line[0] : '\0';
+        char c1 = length > 1 ? line[1] : '\0'; // Don't read past the end of the line
         bool is_a_line = (c == 'a' && (c1 == '\t' || c1 == ' ' ||
                                        c1 == '\n' || c1 == '\r' || c1 == '\0'));
         if (!is_a_line) {
@@ -75,44 +130,54 @@ Alignment *maf_read_block(LI *li) {
             // block.  Out-of-block "s" lines were assertion errors in the
             // previous code path; preserve the same hard failure.
             assert(!(c == 's' && (c1 == '\t' || c1 == ' ')));
-            free(line);
             continue;
         }
-        free(line);
 
-        Alignment *alignment = st_calloc(1, sizeof(Alignment));
+        Alignment_Arena *arena = alignment_arena_construct(li);
+        Alignment *alignment = alignment_construct(arena);
         Alignment_Row **p_row = &(alignment->row);
+        Row_Matrix matrix = { 0, 0, NULL, NULL };
+        if(!skip_bases) { // Hold a reference to the arena of the bases until the rows have theirs
+            matrix.arena = alignment_arena_construct(li);
+            alignment_arena_copy(matrix.arena);
+        }
         while(1) {
-            line = LI_get_next_line(li);
-            if(line == NULL) {
-                return alignment;
-            }
-            c = line[0];
-            c1 = line[1];
-            if (c == '\0' || c == '\n' || c == '\r') { // blank line = block end
-                free(line);
+            line = LI_next_line_view(li, &length);
+            c = line != NULL && length > 0 ? line[0] : '\0';
+            if (line == NULL || c == '\0' || c == '\n' || c == '\r') { // EOF or blank line = block end
+                alignment->base_matrix = matrix.bases;
+                alignment->row_stride = matrix.stride;
+                alignment_index_rows(alignment);
+                if(matrix.arena != NULL) {
+                    alignment_arena_destruct(matrix.arena);
+                }
                 return alignment;
             }
+            c1 = length > 1 ? line[1] : '\0';
             if (c == 's' && (c1 == '\t' || c1 == ' ')) {
-                Alignment_Row *row = st_calloc(1, sizeof(Alignment_Row));
-                bool ok = maf_parse_s_line(line, row);
+                Alignment_Row *row = alignment_row_construct(arena);
+                int64_t column_number;
+                char *bases;
+                bool ok = maf_parse_s_line(line, length, row, li, &bases, &column_number);
                 assert(ok);
                 alignment->row_number++;
                 *p_row = row;
                 p_row = &(row->n_row);
                 if(alignment->row_number == 1) {
-                    alignment->column_number = strlen(row->bases);
-                    alignment->column_tags = st_calloc(alignment->column_number, sizeof(Tag *));
+                    alignment->column_number = column_number;
+                    alignment->column_tags = alignment_arena_calloc(arena, sizeof(Tag *) * alignment->column_number);
+                    matrix.stride = alignment_row_stride(column_number);
                 }
                 else {
-                    assert(alignment->column_number == strlen(row->bases));
+                    assert(alignment->column_number == column_number);
+                }
+                if(!skip_bases) {
+                    row_matrix_add(&matrix, alignment, row, bases);
                 }
-                free(line);
                 continue;
             }
             // i/e/q lines (or anything else) -- ignore, matching prior behaviour.
             assert(c == 'i' || c == 'e' || c == 'q');
-            free(line);
         }
     }
 }
@@ -132,8 +197,20 @@ Tag *maf_read_header(LI *li) {
 void maf_write_block2(Alignment *alignment, LW *lw, bool color_bases) {
     LW_putn(lw, "a\n", 2);
     Alignment_Row *row = alignment->row;
+    char *decoded = NULL; // Packed rows are decoded one at a time into this buffer
     while(row != NULL) {
-        char *bases = color_bases ? color_base_string(row->bases, alignment->column_number) : row->bases;
+        char *bases = row->bases;
+        if(bases == NULL) {
+            if(decoded == NULL) {
+                decoded = st_malloc(sizeof(char) * (alignment->column_number + 1));
+            }
+            packed_bases_decode(row->packed_bases, 0, alignment->column_number, decoded);
+            decoded[alignment->column_number] = '\0';
+            bases = decoded;
+        }
+        if(color_bases) {
+            bases = color_base_string(bases, alignment->column_number);
+        }
         // "s\t%s\t%" PRIi64 "\t%" PRIi64 "\t%s\t%" PRIi64 "\t%s\n"
         LW_putn(lw, "s\t", 2);
         LW_puts(lw, row->sequence_name);
@@ -153,6 +230,7 @@ void maf_write_block2(Alignment *alignment, LW *lw, bool color_bases) {
             free(bases);
         }
     }
+    free(decoded);
     LW_putc(lw, '\n'); // Add a blank line at the end of the block
 }
 
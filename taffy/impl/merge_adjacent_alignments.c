@@ -15,6 +15,30 @@ static char *make_run(int64_t length, char c) {
     return run;
 }
 
+/*
+ * Copies the first column_number bases of the row, which may be held in either form, into buffer.
+ */
+static void copy_row_bases(Alignment_Row *row, char *buffer, int64_t column_number) {
+    if(row->bases != NULL) {
+        memcpy(buffer, row->bases, column_number);
+    }
+    else {
+        packed_bases_decode(row->packed_bases, 0, column_number, buffer);
+    }
+}
+
+/*
+ * Is true if the left row, once merged with its right row (if any), will have fewer than one base in four
+ * of the merged columns, so is worth keeping in the sparse packed form.
+ */
+static bool merged_row_is_sparse(Alignment_Row *l_row, int64_t total_column_number) {
+    int64_t merged_length = l_row->length;
+    if(l_row->r_row != NULL) {
+        merged_length = l_row->r_row->start + l_row->r_row->length - l_row->start;
+    }
+    return 4 * merged_length < total_column_number;
+}
+
 int64_t make_msa(int64_t string_no, int64_t column_no, int64_t max_alignment_length,
                  int64_t **msa, char **strings, int64_t *string_lengths,
                  char **msa_strings) {
@@ -435,22 +459,11 @@ int64_t align_interstitial_gaps_abpoa(Alignment *alignment) {
     return msa_length;
 }
 
-/*
- * Join up to three strings whose lengths are already known. The row strings here are all exactly as
- * long as their block's column count, so going through stString_print only to have vsnprintf walk
- * them again with strlen is wasted work, and this is the innermost loop of a merge.
- */
-static char *concat_known(const char *a, int64_t a_length, const char *b, int64_t b_length,
-                          const char *c, int64_t c_length) {
-    char *joined = st_malloc(sizeof(char) * (a_length + b_length + c_length + 1));
-    memcpy(joined, a, a_length);
-    memcpy(joined + a_length, b, b_length);
-    memcpy(joined + a_length + b_length, c, c_length);
-    joined[a_length + b_length + c_length] = '\0';
-    return joined;
+Alignment *alignment_merge_adjacent(Alignment *left_alignment, Alignment *right_alignment) {
+    return alignment_merge_adjacent2(left_alignment, right_alignment, 0);
 }
 
-Alignment *alignment_merge_adjacent(Alignment *left_alignment, Alignment *right_alignment) {
+Alignment *alignment_merge_adjacent2(Alignment *left_alignment, Alignment *right_alignment, bool pack_gap_rows) {
     // First un-link any rows that are substitutions as these can't be merged
     Alignment_Row *r_row = right_alignment->row;
     while(r_row != NULL) {
@@ -470,12 +483,17 @@ Alignment *alignment_merge_adjacent(Alignment *left_alignment, Alignment *right_
             Alignment_Row *l_row = st_calloc(1, sizeof(Alignment_Row));
 
             // Set coordinates
-            l_row->sequence_name = stString_copy(r_row->sequence_name);
+            l_row->sequence_name = sequence_name_copy(r_row->sequence_name);
             l_row->start = r_row->start;
             l_row->length = 0; // is an empty alignment
             l_row->sequence_length = r_row->sequence_length;
             l_row->strand = r_row->strand;
-            l_row->bases = make_run(left_alignment->column_number, '-');
+            if(pack_gap_rows) {
+                l_row->packed_bases = packed_bases_construct_gaps(left_alignment->column_number);
+            }
+            else {
+                l_row->bases = make_run(left_alignment->column_number, '-');
+            }
 
             // Connect the left and right rows
             l_row->r_row = r_row;
@@ -501,18 +519,43 @@ Alignment *alignment_merge_adjacent(Alignment *left_alignment, Alignment *right_
     // Align the interstitial insert sequences, padding the left_gap_sequence strings with gaps to represent the alignment
     int64_t interstitial_alignment_length = align_interstitial_gaps_abpoa(right_alignment);
 
-    // Now finally extend the left alignment rows to include the right alignment rows
+    // Calculate the number of columns in the merged alignment
+    int64_t total_column_number = left_alignment->column_number + right_alignment->column_number + interstitial_alignment_length;
+
+    // Now finally extend the left alignment rows to include the right alignment rows. The merged rows are written
+    // straight into a new base matrix, which the rows hold a reference to in place of their old bases. If asked,
+    // rows that end up mostly gaps, such as the inserted rows above, are instead written to a scratch row and kept
+    // in the sparse packed form, so padding out a block costs memory in proportion to the sequence it holds.
+    int64_t dense_row_number = 0;
+    for(Alignment_Row *l_row = left_alignment->row; l_row != NULL; l_row = l_row->n_row) {
+        if(!(pack_gap_rows && merged_row_is_sparse(l_row, total_column_number))) {
+            dense_row_number++;
+        }
+    }
+    int64_t stride = alignment_row_stride(total_column_number);
+    Alignment_Arena *arena = alignment_arena_construct_unpooled(stride * dense_row_number);
+    alignment_arena_copy(arena);
+    char *base_matrix = alignment_arena_malloc(arena, stride * dense_row_number);
+    char *merged_bases = base_matrix;
+    char *scratch_bases = NULL;
+    bool has_sparse_rows = 0;
     Alignment_Row *l_row = left_alignment->row;
     int64_t left_column_number = left_alignment->column_number; // every left row is this long
     int64_t right_gap_length = right_alignment->column_number + interstitial_alignment_length;
-    char *right_gap = make_run(right_gap_length, '-'); // any trailing bases needed
     while(l_row != NULL) {
+        bool sparse = pack_gap_rows && merged_row_is_sparse(l_row, total_column_number);
+        char *bases = merged_bases;
+        if(sparse) {
+            if(scratch_bases == NULL) {
+                scratch_bases = st_malloc(sizeof(char) * (total_column_number + 1));
+            }
+            bases = scratch_bases;
+        }
+        copy_row_bases(l_row, bases, left_column_number);
         if(l_row->r_row == NULL) {
             // Is a deletion, so add in trailing gaps equal in length to the right alignment length plus any interstitial
             // gap
-            char *bases = concat_known(l_row->bases, left_column_number, right_gap, right_gap_length, "", 0);
-            free(l_row->bases);
-            l_row->bases = bases;
+            memset(bases + left_column_number, '-', right_gap_length);
         }
         else {
             Alignment_Row *r_row = l_row->r_row;
@@ -525,11 +568,9 @@ Alignment *alignment_merge_adjacent(Alignment *left_alignment, Alignment *right_
             // Is not a deletion, so merge together two adjacent rows
             assert(r_row->left_gap_sequence != NULL);
             assert(strlen(r_row->left_gap_sequence) == interstitial_alignment_length);
-            char *bases = concat_known(l_row->bases, left_column_number,
-                                       r_row->left_gap_sequence, interstitial_alignment_length,
-                                       r_row->bases, right_alignment->column_number);
-            free(l_row->bases); // clean up
-            l_row->bases = bases;
+            memcpy(bases + left_column_number, r_row->left_gap_sequence, interstitial_alignment_length);
+            copy_row_bases(r_row, bases + left_column_number + interstitial_alignment_length,
+                           right_alignment->column_number);
 
             // Update the left row's length coordinate
             int64_t interstitial_bases = r_row->start - (l_row->start + l_row->length);
@@ -546,14 +587,33 @@ Alignment *alignment_merge_adjacent(Alignment *left_alignment, Alignment *right_
             r_row->l_row = NULL;
             r_row->r_row = NULL;
         }
+        bases[total_column_number] = '\0';
+        alignment_row_free_bases(l_row); // clean up
+        if(sparse) {
+            l_row->packed_bases = packed_bases_construct(bases, total_column_number);
+            has_sparse_rows = 1;
+        }
+        else {
+            l_row->bases = merged_bases;
+            l_row->bases_arena = arena;
+            alignment_arena_copy(arena);
+            merged_bases += stride;
+        }
 
         l_row = l_row->n_row; // Move to the next left alignment row
     }
-
-    // Calculate the number of columns in the merged alignment
-    int64_t total_column_number = left_alignment->column_number + right_alignment->column_number + interstitial_alignment_length;
-
-    // Fix the tags
+    free(scratch_bases);
+    alignment_arena_destruct(arena); // Release the reference held while the rows were written, leaving the rows' own
+    // The matrix only describes the block while every row is laid out in it
+    left_alignment->base_matrix = has_sparse_rows ? NULL : base_matrix;
+    left_alignment->row_stride = stride;
+    alignment_index_rows(left_alignment); // Take in any rows inserted above
+
+    // Fix the tags. The right alignment's are moved into the merged alignment, so must be parsed
+    // before its arena goes, and the left alignment's are parsed too so the merged alignment has none
+    // left unparsed
+    alignment_parse_column_tags(left_alignment);
+    alignment_parse_column_tags(right_alignment);
     if(left_alignment->column_tags != NULL) {
         assert(right_alignment->column_tags != NULL);
         Tag **combined_column_tags = st_malloc(sizeof(Tag *) * total_column_number); // Allocate an expanded set of columns
@@ -569,7 +629,7 @@ Alignment *alignment_merge_adjacent(Alignment *left_alignment, Alignment *right_
             right_alignment->column_tags[i] = NULL; // The merged alignment owns them now, so the
             // alignment_destruct below must not free them out from under it
         }
-        free(left_alignment->column_tags); // Cleanup, but not the tag strings which we copied
+        alignment_arena_free(left_alignment->arena, left_alignment->column_tags); // Cleanup, but not the tag strings which we copied
         left_alignment->column_tags = combined_column_tags;
     }
 
@@ -578,7 +638,6 @@ Alignment *alignment_merge_adjacent(Alignment *left_alignment, Alignment *right_
 
     // Clean up
     alignment_destruct(right_alignment, 1);  // Delete the right alignment
-    free(right_gap);
 
     return left_alignment;
 }
@@ -0,0 +1,436 @@
+#include "taf.h"
+#include "sonLib.h"
+#include <ctype.h>
+
+/*
+ * The packed bases of a row, in one of two forms. In the dense form column i has its 2-bit code in bits
+ * 2 * (i % 32) of codes[i / 32], and its bit in each bitmap at bit i % 64 of word i / 64. In the sparse form
+ * there are just the runs of columns that are not gaps, and their bases one after another. Everything is
+ * allocated with the structure, in one block.
+ */
+struct _Packed_Bases {
+    int64_t length; // The number of columns
+    bool sparse; // Which of the two forms the bases are in
+    // The dense form
+    int64_t exception_number; // The number of columns that hold neither a base A/C/G/T nor a gap
+    uint64_t *codes; // A=0, C=1, G=2, T=3 in either case, and 0 for any other column
+    uint64_t *gaps; // Set for every column that is not one of ACGTacgt, i.e. gaps and exceptions, or NULL if none
+    uint64_t *masked; // Set for every column that is one of acgt, or NULL if none
+    int64_t *exception_columns; // The columns of the exceptions, in increasing order
+    char *exception_bases; // The character of each exception
+    // The sparse form
+    int64_t run_number; // The number of runs of columns that are not gaps
+    int64_t *run_starts; // The first column of each run, in increasing order
+    int64_t *run_offsets; // The offset in run_bases of the first base of each run, and then of the end of the last
+    char *run_bases; // The bases of the runs
+};
+
+#define PACKED_EXCEPTION 0
+#define PACKED_GAP 9
+
+/*
+ * The class of each character: 1-4 for A, C, G and T, 5-8 for a, c, g and t, PACKED_GAP for a gap and
+ * PACKED_EXCEPTION for anything else.
+ */
+static const uint8_t base_classes[256] = {
+    ['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4,
+    ['a'] = 5, ['c'] = 6, ['g'] = 7, ['t'] = 8,
+    ['-'] = PACKED_GAP
+};
+
+static inline bool get_bit(uint64_t *bits, int64_t i) {
+    return (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline void set_bit(uint64_t *bits, int64_t i) {
+    bits[i >> 6] |= ((uint64_t)1) << (i & 63);
+}
+
+/*
+ * Get word w of a bitmap, keeping only the bits of the columns in [start, end).
+ */
+static inline uint64_t get_word_in_range(uint64_t *bits, int64_t w, int64_t start, int64_t end) {
+    int64_t lo = start > w * 64 ? start - w * 64 : 0, hi = end < (w + 1) * 64 ? end - w * 64 : 64;
+    if(lo >= hi) {
+        return 0;
+    }
+    uint64_t mask = hi == 64 ? ~((uint64_t)0) : (((uint64_t)1) << hi) - 1;
+    return bits[w] & mask & ~((((uint64_t)1) << lo) - 1);
+}
+
+/*
+ * Gather the even bits of x, i.e. bits 0, 2, ..., 62, into its low 32 bits.
+ */
+static inline uint64_t gather_even_bits(uint64_t x) {
+    x &= 0x5555555555555555ULL;
+    x = (x | (x >> 1)) & 0x3333333333333333ULL;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+    return (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+}
+
+/*
+ * The index of the first exception at or after the given column.
+ */
+static int64_t exception_lower_bound(Packed_Bases *packed_bases, int64_t column_index) {
+    int64_t lo = 0, hi = packed_bases->exception_number;
+    while(lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if(packed_bases->exception_columns[mid] < column_index) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * The index of the last run starting at or before the given column, or -1 if there is none.
+ */
+static int64_t run_at_or_before(Packed_Bases *packed_bases, int64_t column_index) {
+    int64_t lo = 0, hi = packed_bases->run_number;
+    while(lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if(packed_bases->run_starts[mid] <= column_index) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+static inline int64_t run_length(Packed_Bases *packed_bases, int64_t run) {
+    return packed_bases->run_offsets[run + 1] - packed_bases->run_offsets[run];
+}
+
+/*
+ * Allocate packed bases in the sparse form, leaving the runs to be filled in.
+ */
+static Packed_Bases *packed_bases_construct_sparse(int64_t length, int64_t run_number, int64_t base_number) {
+    Packed_Bases *packed_bases = st_calloc(1, sizeof(Packed_Bases) + sizeof(int64_t) * (2 * run_number + 1) +
+                                              sizeof(char) * base_number);
+    packed_bases->length = length;
+    packed_bases->sparse = 1;
+    packed_bases->run_number = run_number;
+    packed_bases->run_starts = (int64_t *)(packed_bases + 1);
+    packed_bases->run_offsets = packed_bases->run_starts + run_number;
+    packed_bases->run_bases = (char *)(packed_bases->run_offsets + run_number + 1);
+    packed_bases->run_offsets[run_number] = base_number;
+    return packed_bases;
+}
+
+Packed_Bases *packed_bases_construct_gaps(int64_t length) {
+    return packed_bases_construct_sparse(length, 0, 0);
+}
+
+Packed_Bases *packed_bases_construct(const char *bases, int64_t length) {
+    // Count the exceptions and find which bitmaps are needed, so everything can be allocated at once, and
+    // count the runs of bases, to see if the sparse form would be smaller
+    int64_t exception_number = 0, run_number = 0, base_number = 0;
+    bool has_gaps = 0, has_masked = 0;
+    for(int64_t i=0; i<length; i++) {
+        uint8_t c = base_classes[(uint8_t)bases[i]];
+        if(c == PACKED_GAP) {
+            has_gaps = 1;
+            continue;
+        }
+        if(i == 0 || bases[i - 1] == '-') {
+            run_number++;
+        }
+        base_number++;
+        if(c == PACKED_EXCEPTION) {
+            exception_number++;
+            has_gaps = 1;
+        }
+        else if(c > 4) {
+            has_masked = 1;
+        }
+    }
+    int64_t code_words = (length + 31) / 32, bit_words = (length + 63) / 64;
+    int64_t words = code_words + (has_gaps ? bit_words : 0) + (has_masked ? bit_words : 0);
+    if((int64_t)(sizeof(int64_t) * 2 * run_number + base_number) <
+       (int64_t)(sizeof(uint64_t) * words + (sizeof(int64_t) + sizeof(char)) * exception_number)) {
+        // Mostly gaps, so keep just the runs of bases
+        Packed_Bases *packed_bases = packed_bases_construct_sparse(length, run_number, base_number);
+        int64_t k = 0, j = 0;
+        for(int64_t i=0; i<length; i++) {
+            if(bases[i] != '-') {
+                if(i == 0 || bases[i - 1] == '-') {
+                    packed_bases->run_starts[k] = i;
+                    packed_bases->run_offsets[k++] = j;
+                }
+                packed_bases->run_bases[j++] = bases[i];
+            }
+        }
+        assert(k == run_number && j == base_number);
+        return packed_bases;
+    }
+    Packed_Bases *packed_bases = st_calloc(1, sizeof(Packed_Bases) + sizeof(uint64_t) * words +
+                                              (sizeof(int64_t) + sizeof(char)) * exception_number);
+    packed_bases->length = length;
+    packed_bases->exception_number = exception_number;
+    uint64_t *w = (uint64_t *)(packed_bases + 1);
+    packed_bases->codes = w;
+    w += code_words;
+    if(has_gaps) {
+        packed_bases->gaps = w;
+        w += bit_words;
+    }
+    if(has_masked) {
+        packed_bases->masked = w;
+        w += bit_words;
+    }
+    packed_bases->exception_columns = (int64_t *)w;
+    packed_bases->exception_bases = (char *)(packed_bases->exception_columns + exception_number);
+
+    // Now fill them in
+    int64_t j = 0;
+    for(int64_t i=0; i<length; i++) {
+        uint8_t c = base_classes[(uint8_t)bases[i]];
+        if(c == PACKED_EXCEPTION || c == PACKED_GAP) {
+            set_bit(packed_bases->gaps, i);
+            if(c == PACKED_EXCEPTION) {
+                packed_bases->exception_columns[j] = i;
+                packed_bases->exception_bases[j++] = bases[i];
+            }
+        }
+        else {
+            packed_bases->codes[i >> 5] |= ((uint64_t)((c - 1) & 3)) << ((i & 31) * 2);
+            if(c > 4) {
+                set_bit(packed_bases->masked, i);
+            }
+        }
+    }
+    assert(j == exception_number);
+    return packed_bases;
+}
+
+void packed_bases_destruct(Packed_Bases *packed_bases) {
+    free(packed_bases);
+}
+
+int64_t packed_bases_length(Packed_Bases *packed_bases) {
+    return packed_bases->length;
+}
+
+bool packed_bases_is_sparse(Packed_Bases *packed_bases) {
+    return packed_bases->sparse;
+}
+
+char packed_bases_get_base(Packed_Bases *packed_bases, int64_t column_index) {
+    assert(column_index >= 0 && column_index < packed_bases->length);
+    if(packed_bases->sparse) {
+        int64_t k = run_at_or_before(packed_bases, column_index);
+        if(k >= 0 && column_index < packed_bases->run_starts[k] + run_length(packed_bases, k)) {
+            return packed_bases->run_bases[packed_bases->run_offsets[k] + column_index - packed_bases->run_starts[k]];
+        }
+        return '-';
+    }
+    if(packed_bases->gaps != NULL && get_bit(packed_bases->gaps, column_index)) {
+        int64_t j = exception_lower_bound(packed_bases, column_index);
+        return j < packed_bases->exception_number && packed_bases->exception_columns[j] == column_index ?
+               packed_bases->exception_bases[j] : '-';
+    }
+    char base = "ACGT"[(packed_bases->codes[column_index >> 5] >> ((column_index & 31) * 2)) & 3];
+    return packed_bases->masked != NULL && get_bit(packed_bases->masked, column_index) ? tolower(base) : base;
+}
+
+void packed_bases_decode(Packed_Bases *packed_bases, int64_t column_start, int64_t column_number, char *buffer) {
+    assert(column_start >= 0 && column_number >= 0);
+    assert(column_start + column_number <= packed_bases->length);
+    if(column_number == 0) {
+        return;
+    }
+    int64_t column_end = column_start + column_number;
+    if(packed_bases->sparse) { // Fill in the gaps, then copy in the parts of the runs in the columns
+        memset(buffer, '-', column_number);
+        int64_t k = run_at_or_before(packed_bases, column_start);
+        for(k = k < 0 ? 0 : k; k<packed_bases->run_number && packed_bases->run_starts[k] < column_end; k++) {
+            int64_t run_start = packed_bases->run_starts[k], run_end = run_start + run_length(packed_bases, k);
+            int64_t start = run_start > column_start ? run_start : column_start;
+            int64_t end = run_end < column_end ? run_end : column_end;
+            if(start < end) {
+                memcpy(buffer + start - column_start,
+                       packed_bases->run_bases + packed_bases->run_offsets[k] + start - run_start, end - start);
+            }
+        }
+        return;
+    }
+    // Decode the codes, then go back over the few columns set in the bitmaps and the exceptions
+    for(int64_t i=column_start; i<column_end; i++) {
+        buffer[i - column_start] = "ACGT"[(packed_bases->codes[i >> 5] >> ((i & 31) * 2)) & 3];
+    }
+    for(int64_t w=column_start >> 6; w<=(column_end - 1) >> 6; w++) {
+        uint64_t masked = packed_bases->masked != NULL ? get_word_in_range(packed_bases->masked, w, column_start, column_end) : 0;
+        while(masked != 0) {
+            buffer[w * 64 + __builtin_ctzll(masked) - column_start] += 'a' - 'A';
+            masked &= masked - 1;
+        }
+        uint64_t gaps = packed_bases->gaps != NULL ? get_word_in_range(packed_bases->gaps, w, column_start, column_end) : 0;
+        while(gaps != 0) {
+            buffer[w * 64 + __builtin_ctzll(gaps) - column_start] = '-';
+            gaps &= gaps - 1;
+        }
+    }
+    for(int64_t j=exception_lower_bound(packed_bases, column_start);
+        j<packed_bases->exception_number && packed_bases->exception_columns[j] < column_end; j++) {
+        buffer[packed_bases->exception_columns[j] - column_start] = packed_bases->exception_bases[j];
+    }
+}
+
+int64_t packed_bases_count_gaps(Packed_Bases *packed_bases, int64_t column_start, int64_t column_number) {
+    assert(column_start >= 0 && column_number >= 0);
+    assert(column_start + column_number <= packed_bases->length);
+    int64_t column_end = column_start + column_number, gaps = 0;
+    if(packed_bases->sparse) { // Count the columns of the runs in the range, the rest being gaps
+        gaps = column_number;
+        int64_t k = run_at_or_before(packed_bases, column_start);
+        for(k = k < 0 ? 0 : k; k<packed_bases->run_number && packed_bases->run_starts[k] < column_end; k++) {
+            int64_t run_start = packed_bases->run_starts[k], run_end = run_start + run_length(packed_bases, k);
+            int64_t start = run_start > column_start ? run_start : column_start;
+            int64_t end = run_end < column_end ? run_end : column_end;
+            gaps -= start < end ? end - start : 0;
+        }
+        return gaps;
+    }
+    if(packed_bases->gaps == NULL || column_number == 0) {
+        return 0;
+    }
+    // Count the bits set, which include the exceptions, then take the exceptions away
+    for(int64_t w=column_start >> 6; w<=(column_end - 1) >> 6; w++) {
+        gaps += __builtin_popcountll(get_word_in_range(packed_bases->gaps, w, column_start, column_end));
+    }
+    return gaps - (exception_lower_bound(packed_bases, column_end) - exception_lower_bound(packed_bases, column_start));
+}
+
+static inline bool is_aligned_base(char base) {
+    return base != '-' && base != 'N' && base != 'n';
+}
+
+void packed_bases_compare(Packed_Bases *packed_bases_1, Packed_Bases *packed_bases_2, int64_t *aligned,
+                          int64_t *identical) {
+    assert(packed_bases_1->length == packed_bases_2->length);
+    int64_t length = packed_bases_1->length, code_words = (length + 31) / 32;
+    *aligned = 0;
+    *identical = 0;
+    if(packed_bases_2->sparse && !packed_bases_1->sparse) { // The comparison is symmetric
+        Packed_Bases *p = packed_bases_1;
+        packed_bases_1 = packed_bases_2;
+        packed_bases_2 = p;
+    }
+    if(packed_bases_1->sparse) { // Only the columns of the runs can be aligned, so just compare those
+        int64_t longest_run = 0;
+        for(int64_t k=0; k<packed_bases_1->run_number; k++) {
+            longest_run = run_length(packed_bases_1, k) > longest_run ? run_length(packed_bases_1, k) : longest_run;
+        }
+        char *bases_2 = st_malloc(sizeof(char) * (longest_run + 1));
+        for(int64_t k=0; k<packed_bases_1->run_number; k++) {
+            packed_bases_decode(packed_bases_2, packed_bases_1->run_starts[k], run_length(packed_bases_1, k), bases_2);
+            char *bases_1 = packed_bases_1->run_bases + packed_bases_1->run_offsets[k];
+            for(int64_t i=0; i<run_length(packed_bases_1, k); i++) {
+                if(is_aligned_base(bases_1[i]) && is_aligned_base(bases_2[i])) {
+                    (*aligned)++;
+                    if(toupper(bases_1[i]) == toupper(bases_2[i])) {
+                        (*identical)++;
+                    }
+                }
+            }
+        }
+        free(bases_2);
+        return;
+    }
+    // Count the columns in which both have one of ACGTacgt, 64 at a time, comparing the 2-bit codes of each
+    for(int64_t w=0; w<(length + 63) / 64; w++) {
+        int64_t columns = length - w * 64; // The columns in the word, only fewer than 64 for the last one
+        uint64_t both = columns >= 64 ? ~((uint64_t)0) : (((uint64_t)1) << columns) - 1;
+        if(packed_bases_1->gaps != NULL) {
+            both &= ~packed_bases_1->gaps[w];
+        }
+        if(packed_bases_2->gaps != NULL) {
+            both &= ~packed_bases_2->gaps[w];
+        }
+        uint64_t equal = 0;
+        for(int64_t k=0; k<2 && 2 * w + k < code_words; k++) {
+            uint64_t x = packed_bases_1->codes[2 * w + k] ^ packed_bases_2->codes[2 * w + k];
+            equal |= gather_even_bits(~(x | (x >> 1))) << (32 * k);
+        }
+        *aligned += __builtin_popcountll(both);
+        *identical += __builtin_popcountll(both & equal);
+    }
+    // Then the columns in which either has an exception, which are few, a base at a time
+    int64_t j1 = 0, j2 = 0;
+    while(j1 < packed_bases_1->exception_number || j2 < packed_bases_2->exception_number) {
+        int64_t column_index;
+        if(j2 == packed_bases_2->exception_number || (j1 < packed_bases_1->exception_number &&
+           packed_bases_1->exception_columns[j1] <= packed_bases_2->exception_columns[j2])) {
+            column_index = packed_bases_1->exception_columns[j1++];
+            if(j2 < packed_bases_2->exception_number && packed_bases_2->exception_columns[j2] == column_index) {
+                j2++;
+            }
+        }
+        else {
+            column_index = packed_bases_2->exception_columns[j2++];
+        }
+        char base_1 = packed_bases_get_base(packed_bases_1, column_index);
+        char base_2 = packed_bases_get_base(packed_bases_2, column_index);
+        if(is_aligned_base(base_1) && is_aligned_base(base_2)) {
+            (*aligned)++;
+            if(toupper(base_1) == toupper(base_2)) {
+                (*identical)++;
+            }
+        }
+    }
+}
+
+void alignment_pack_rows(Alignment *alignment) {
+    for(Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
+        if(row->bases != NULL) {
+            assert((int64_t)strlen(row->bases) == alignment->column_number);
+            Packed_Bases *packed_bases = packed_bases_construct(row->bases, alignment->column_number);
+            alignment_row_free_bases(row);
+            row->packed_bases = packed_bases;
+        }
+    }
+}
+
+bool alignment_unpack_rows(Alignment *alignment) {
+    bool packed = 0;
+    for(Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
+        if(row->packed_bases != NULL) {
+            packed = 1;
+        }
+        else if(row->bases == NULL) {
+            return 0;
+        }
+    }
+    if(!packed) {
+        return 1;
+    }
+    // As in alignment_pack_bases, the matrix gets an arena of its own, released along with the last of the rows
+    int64_t stride = alignment_row_stride(alignment->column_number);
+    Alignment_Arena *arena = alignment_arena_construct_unpooled(stride * alignment->row_number);
+    char *base_matrix = alignment_arena_malloc(arena, stride * alignment->row_number);
+    char *bases = base_matrix;
+    for(Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
+        if(row->packed_bases != NULL) {
+            packed_bases_decode(row->packed_bases, 0, alignment->column_number, bases);
+        }
+        else {
+            memcpy(bases, row->bases, alignment->column_number);
+        }
+        bases[alignment->column_number] = '\0';
+        alignment_row_free_bases(row);
+        row->bases = bases;
+        row->bases_arena = arena;
+        alignment_arena_copy(arena);
+        bases += stride;
+    }
+    alignment->base_matrix = base_matrix;
+    alignment->row_stride = stride;
+    return 1;
+}
@@ -156,6 +156,7 @@ static void paf_write_row(Alignment_Row *q_row, Alignment_Row *t_row, int64_t nu
 }
 
 void paf_write_block(Alignment *alignment, LW *lw, bool all_to_all, bool cs_cigar) {
+    alignment_unpack_rows(alignment); // The pairs of rows are walked through as strings
     for (Alignment_Row *t_row = alignment->row; t_row != NULL; t_row = t_row->n_row) {
         for (Alignment_Row *q_row = t_row->n_row; q_row != NULL; q_row = q_row->n_row) {            
             paf_write_row(q_row, t_row, alignment->column_number, cs_cigar, lw);
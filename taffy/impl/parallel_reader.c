@@ -0,0 +1,315 @@
+#include "taf.h"
+#include "sonLib.h"
+#include <pthread.h>
+
+// By default chunks are cut at the first line that can start one after they reach this many bytes
+#define DEFAULT_CHUNK_SIZE (4 * 1024 * 1024)
+
+// The number of chunks that may be read ahead of the consumer, per worker thread
+#define CHUNKS_PER_THREAD 2
+
+/*
+ * A run of lines of the input, starting at a taf anchor line or maf block, and the blocks decoded from it.
+ */
+typedef struct _Taf_Chunk {
+    char *lines; // The lines, each terminated by a newline, with the first line of a taf chunk rewritten to have
+    // only insertions
+    int64_t length, capacity;
+    char *anchor_line; // For a taf, the first line as it was in the input, or NULL for the first chunk
+    stList *blocks; // The decoded blocks, once decoded is set
+    int64_t next_block; // The index of the next block to return
+    bool claimed; // Set once a worker has taken the chunk to decode
+    bool decoded;
+} Taf_Chunk;
+
+struct _Parallel_Reader {
+    LI *li;
+    bool maf; // If true the input is a maf, else a taf
+    bool run_length_encode_bases;
+    bool skip_bases; // If true the bases of the blocks are not kept, see taf_read_block2
+    int64_t thread_number; // The number of worker threads, or zero if reading on the calling thread
+    int64_t chunk_size;
+    pthread_t *workers;
+    pthread_t producer; // Reads li and cuts it into chunks
+    pthread_mutex_t lock; // Guards the fields below
+    pthread_cond_t changed; // Broadcast whenever the fields below change
+    stList *chunks; // The chunks read but not yet returned to the consumer, in order
+    bool end_of_input; // Set once the producer has added the last chunk
+    bool stop; // Set to stop the threads early
+    Taf_Chunk *chunk; // The chunk whose blocks are being returned, owned by the consumer
+};
+
+static Taf_Chunk *chunk_construct(int64_t chunk_size, char *anchor_line) {
+    Taf_Chunk *chunk = st_calloc(1, sizeof(Taf_Chunk));
+    chunk->capacity = chunk_size + 65536;
+    chunk->lines = st_malloc(chunk->capacity);
+    chunk->anchor_line = anchor_line;
+    return chunk;
+}
+
+static void chunk_destruct(Taf_Chunk *chunk) {
+    if(chunk->blocks != NULL) { // Clean up any blocks that were not returned
+        for(int64_t i=stList_length(chunk->blocks)-1; i>=chunk->next_block; i--) {
+            alignment_destruct(stList_get(chunk->blocks, i), 1);
+        }
+        stList_destruct(chunk->blocks);
+    }
+    free(chunk->lines);
+    free(chunk->anchor_line);
+    free(chunk);
+}
+
+static void chunk_add_line(Taf_Chunk *chunk, char *line, int64_t length) {
+    if(chunk->length + length + 1 > chunk->capacity) {
+        chunk->capacity = (chunk->length + length + 1) * 2;
+        chunk->lines = st_realloc(chunk->lines, chunk->capacity);
+    }
+    memcpy(chunk->lines + chunk->length, line, length);
+    chunk->lines[chunk->length + length] = '\n';
+    chunk->length += length + 1;
+}
+
+/*
+ * Add a chunk to the end of the queue, waiting while the queue is full. Returns false if the reader is stopping.
+ */
+static bool add_chunk(Parallel_Reader *reader, Taf_Chunk *chunk) {
+    pthread_mutex_lock(&reader->lock);
+    while(!reader->stop && stList_length(reader->chunks) >= CHUNKS_PER_THREAD * reader->thread_number) {
+        pthread_cond_wait(&reader->changed, &reader->lock);
+    }
+    bool stop = reader->stop;
+    if(!stop) {
+        stList_append(reader->chunks, chunk);
+        pthread_cond_broadcast(&reader->changed);
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return !stop;
+}
+
+/*
+ * Returns non-zero if a chunk can start with the line, which for a maf is the "a" line starting a block and
+ * for a taf is an anchor line.
+ */
+static bool starts_chunk(Parallel_Reader *reader, char *line, int64_t length) {
+    if(reader->maf) {
+        return length > 0 && line[0] == 'a' &&
+               (length == 1 || line[1] == '\t' || line[1] == ' ' || line[1] == '\r' || line[1] == '\0');
+    }
+    Taf_Line taf_line;
+    return taf_line_scan2(line, length, &taf_line) && taf_line_is_anchor(&taf_line, reader->run_length_encode_bases);
+}
+
+static void *produce_chunks(void *arg) {
+    Parallel_Reader *reader = arg;
+    Taf_Chunk *chunk = chunk_construct(reader->chunk_size, NULL);
+    char *line;
+    int64_t length;
+    while((line = LI_next_line_view(reader->li, &length)) != NULL) { // The lines are copied into the chunks
+        if(chunk->length >= reader->chunk_size && starts_chunk(reader, line, length)) {
+            if(!add_chunk(reader, chunk)) {
+                chunk_destruct(chunk);
+                return NULL;
+            }
+            if(reader->maf) {
+                chunk = chunk_construct(reader->chunk_size, NULL);
+            } else {
+                chunk = chunk_construct(reader->chunk_size, stString_getSubString(line, 0, length));
+                // The first line of the chunk is decoded without the previous block, so make its rows insertions
+                line = stString_copy(chunk->anchor_line);
+                taf_line_substitutions_to_insertions(line);
+                chunk_add_line(chunk, line, strlen(line));
+                free(line);
+                continue;
+            }
+        }
+        chunk_add_line(chunk, line, length);
+    }
+    if(!add_chunk(reader, chunk)) {
+        chunk_destruct(chunk);
+    }
+    pthread_mutex_lock(&reader->lock);
+    reader->end_of_input = 1;
+    pthread_cond_broadcast(&reader->changed);
+    pthread_mutex_unlock(&reader->lock);
+    return NULL;
+}
+
+static Alignment *read_block(Parallel_Reader *reader, Alignment *p_block, LI *li) {
+    return reader->maf ? maf_read_block2(li, reader->skip_bases) :
+           taf_read_block2(p_block, reader->run_length_encode_bases, reader->skip_bases, li);
+}
+
+static void decode_chunk(Parallel_Reader *reader, Taf_Chunk *chunk) {
+    LI *li = LI_construct_from_buffer(chunk->lines, chunk->length);
+    alignment_arena_pool_share(reader->li, li);
+    chunk->blocks = stList_construct();
+    Alignment *block = NULL;
+    while((block = read_block(reader, block, li)) != NULL) {
+        stList_append(chunk->blocks, block);
+    }
+    LI_destruct(li);
+    free(chunk->lines); // The lines are no longer needed
+    chunk->lines = NULL;
+}
+
+static void *decode_chunks(void *arg) {
+    Parallel_Reader *reader = arg;
+    pthread_mutex_lock(&reader->lock);
+    while(!reader->stop) {
+        // Find the first chunk that has not been claimed
+        Taf_Chunk *chunk = NULL;
+        for(int64_t i=0; i<stList_length(reader->chunks); i++) {
+            Taf_Chunk *c = stList_get(reader->chunks, i);
+            if(!c->claimed) {
+                chunk = c;
+                break;
+            }
+        }
+        if(chunk == NULL) {
+            if(reader->end_of_input) {
+                break;
+            }
+            pthread_cond_wait(&reader->changed, &reader->lock);
+            continue;
+        }
+        chunk->claimed = 1;
+        pthread_mutex_unlock(&reader->lock);
+        decode_chunk(reader, chunk);
+        pthread_mutex_lock(&reader->lock);
+        chunk->decoded = 1;
+        pthread_cond_broadcast(&reader->changed);
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return NULL;
+}
+
+/*
+ * Link the rows of the first block of a chunk to those of the previous block, by replaying the operations of
+ * the chunk's anchor line on the rows of the previous block as taf_read_block would have. The deletions come
+ * first, after which the substituted rows of the block are the remaining rows of the previous block in order.
+ */
+static void link_anchor_block(Alignment *p_block, Alignment *block, char *anchor_line) {
+    Alignment_Row **p_rows = st_malloc(sizeof(Alignment_Row *) * (p_block->row_number + 1));
+    int64_t p_row_number = 0;
+    for(Alignment_Row *p_row = p_block->row; p_row != NULL; p_row = p_row->n_row) {
+        p_rows[p_row_number++] = p_row;
+    }
+    Taf_Line taf_line;
+    taf_line_scan(anchor_line, &taf_line);
+    Taf_Coordinate_Op op;
+    char *cursor = taf_line.coordinates;
+    Alignment_Row *row = block->row;
+    int64_t j = 0; // The next remaining row of the previous block
+    while(taf_line_next_coordinate_op(&taf_line, &cursor, &op)) {
+        if(op.type == 'd') {
+            assert(op.row_index < p_row_number);
+            memmove(p_rows + op.row_index, p_rows + op.row_index + 1,
+                    sizeof(Alignment_Row *) * (p_row_number - op.row_index - 1));
+            p_row_number--;
+            continue;
+        }
+        assert(row != NULL);
+        if(op.type == 's') {
+            assert(j < p_row_number);
+            p_rows[j]->r_row = row;
+            row->l_row = p_rows[j++];
+        }
+        row = row->n_row;
+    }
+    assert(row == NULL && j == p_row_number);
+    free(p_rows);
+}
+
+static Parallel_Reader *parallel_reader_construct(LI *li, bool maf, bool run_length_encode_bases, bool skip_bases,
+                                                  int64_t threads, int64_t chunk_size) {
+    Parallel_Reader *reader = st_calloc(1, sizeof(Parallel_Reader));
+    reader->li = li;
+    reader->maf = maf;
+    reader->run_length_encode_bases = run_length_encode_bases;
+    reader->skip_bases = skip_bases;
+    if(threads < 2) { // Read the blocks on the calling thread
+        return reader;
+    }
+    reader->thread_number = threads;
+    reader->chunk_size = chunk_size > 0 ? chunk_size : DEFAULT_CHUNK_SIZE;
+    reader->chunks = stList_construct();
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->changed, NULL);
+    reader->workers = st_malloc(sizeof(pthread_t) * threads);
+    for(int64_t i=0; i<threads; i++) {
+        if(pthread_create(&reader->workers[i], NULL, decode_chunks, reader) != 0) {
+            st_errAbort("Unable to start decoding thread\n");
+        }
+    }
+    if(pthread_create(&reader->producer, NULL, produce_chunks, reader) != 0) {
+        st_errAbort("Unable to start reading thread\n");
+    }
+    return reader;
+}
+
+Parallel_Reader *taf_parallel_reader_construct(LI *li, bool run_length_encode_bases, bool skip_bases, int64_t threads,
+                                               int64_t chunk_size) {
+    return parallel_reader_construct(li, 0, run_length_encode_bases, skip_bases, threads, chunk_size);
+}
+
+Parallel_Reader *maf_parallel_reader_construct(LI *li, bool skip_bases, int64_t threads, int64_t chunk_size) {
+    return parallel_reader_construct(li, 1, 0, skip_bases, threads, chunk_size);
+}
+
+Alignment *parallel_reader_next(Parallel_Reader *reader, Alignment *p_block) {
+    if(reader->thread_number == 0) {
+        return read_block(reader, p_block, reader->li);
+    }
+    bool first_block_of_chunk = 0;
+    while(reader->chunk == NULL || reader->chunk->next_block == stList_length(reader->chunk->blocks)) {
+        if(reader->chunk != NULL) {
+            chunk_destruct(reader->chunk);
+            reader->chunk = NULL;
+        }
+        // Wait for the next chunk to be decoded
+        pthread_mutex_lock(&reader->lock);
+        while(stList_length(reader->chunks) == 0 ? !reader->end_of_input :
+              !((Taf_Chunk *)stList_get(reader->chunks, 0))->decoded) {
+            pthread_cond_wait(&reader->changed, &reader->lock);
+        }
+        if(stList_length(reader->chunks) > 0) {
+            reader->chunk = stList_remove(reader->chunks, 0);
+            pthread_cond_broadcast(&reader->changed); // There is now room for another chunk
+        }
+        pthread_mutex_unlock(&reader->lock);
+        if(reader->chunk == NULL) { // There are no more chunks
+            return NULL;
+        }
+        first_block_of_chunk = 1;
+    }
+    Alignment *block = stList_get(reader->chunk->blocks, reader->chunk->next_block++);
+    if(first_block_of_chunk && p_block != NULL && reader->chunk->anchor_line != NULL) {
+        link_anchor_block(p_block, block, reader->chunk->anchor_line);
+    }
+    return block;
+}
+
+void parallel_reader_destruct(Parallel_Reader *reader) {
+    if(reader->thread_number > 0) {
+        pthread_mutex_lock(&reader->lock);
+        reader->stop = 1;
+        pthread_cond_broadcast(&reader->changed);
+        pthread_mutex_unlock(&reader->lock);
+        pthread_join(reader->producer, NULL);
+        for(int64_t i=0; i<reader->thread_number; i++) {
+            pthread_join(reader->workers[i], NULL);
+        }
+        // Clean up the chunks that were not returned
+        for(int64_t i=0; i<stList_length(reader->chunks); i++) {
+            chunk_destruct(stList_get(reader->chunks, i));
+        }
+        if(reader->chunk != NULL) {
+            chunk_destruct(reader->chunk);
+        }
+        stList_destruct(reader->chunks);
+        free(reader->workers);
+        pthread_mutex_destroy(&reader->lock);
+        pthread_cond_destroy(&reader->changed);
+    }
+    free(reader);
+}
@@ -143,6 +143,7 @@ static void remove_rows(Alignment *alignment, int (*delete_row)(Alignment_Row *,
             row = row->n_row;
         }
     }
+    alignment_index_rows(alignment);
 }
 
 static int alignment_filter_fn(Alignment_Row *row, stList *prefixes_to_filter_by) {
@@ -155,6 +156,7 @@ void alignment_filter_the_rows(Alignment *alignment, stList *prefixes_to_filter_
 }
 
 void alignment_show_only_lineage_differences(Alignment *alignment, char mask_char, stList *sequence_prefixes, stList *tree_nodes) {
+    alignment_unpack_rows(alignment); // The rows are masked in place, so need their bases as strings
     // First create map of tree nodes to bases
     stHash *tree_nodes_to_bases = stHash_construct2(NULL, (void (*)(void *))stList_destruct);
     Alignment_Row *row = alignment->row;
@@ -227,17 +229,25 @@ static int get_closest_row_cmp_fn(Sequence_Prefix *p, Alignment_Row *r) {
     return i;
 }
 
-static int alignment_row_cmp_fn(Alignment_Row *r1, Alignment_Row *r2) {
-    return strcmp(r1->sequence_name, r2->sequence_name);
+static int alignment_row_cmp_fn(const void *r1, const void *r2) {
+    return strcmp((*(Alignment_Row **)r1)->sequence_name, (*(Alignment_Row **)r2)->sequence_name);
+}
+
+static int get_closest_row_in_array_cmp_fn(const void *p, const void *r) {
+    return get_closest_row_cmp_fn((Sequence_Prefix *)p, *(Alignment_Row **)r);
 }
 
 void alignment_pad_the_rows(Alignment *p_alignment, Alignment *alignment, stList *sequence_prefixes) {
-    // Get the rows in a list
-    stList *rows = alignment_get_rows_in_a_list(alignment->row);
-    assert(stList_length(rows) == (alignment->row_number)); // Quick sanity check
+    alignment_pad_the_rows2(p_alignment, alignment, sequence_prefixes, 0);
+}
 
-    // Sort the rows by name
-    stList_sort(rows, (int (*)(const void *, const void *))alignment_row_cmp_fn);
+void alignment_pad_the_rows2(Alignment *p_alignment, Alignment *alignment, stList *sequence_prefixes,
+                             bool pack_gap_rows) {
+    // Get the rows sorted by name, copying the row index so the alignment's rows are left in order
+    int64_t row_number = alignment->row_number;
+    Alignment_Row **rows = st_malloc(sizeof(Alignment_Row *) * (row_number + 1));
+    memcpy(rows, alignment_get_rows(alignment), sizeof(Alignment_Row *) * row_number);
+    qsort(rows, row_number, sizeof(Alignment_Row *), alignment_row_cmp_fn);
 
     // Get the pointer to the last row of the alignment so we can add rows
     Alignment_Row **p_r = &(alignment->row);
@@ -250,17 +260,22 @@ void alignment_pad_the_rows(Alignment *p_alignment, Alignment *alignment, stList
         Sequence_Prefix *sp = stList_get(sequence_prefixes, i);
 
         // Check if there is a corresponding sequence name using binary search
-        Alignment_Row *r = stList_binarySearch(rows, sp,(int (*)(const void *a, const void *b))get_closest_row_cmp_fn);
+        Alignment_Row **r_in_rows = bsearch(sp, rows, row_number, sizeof(Alignment_Row *), get_closest_row_in_array_cmp_fn);
 
-        if(r == NULL) { // If there isn't a corresponding row, add one to the alignment at the end setting the coordinates to zero
-            r = st_calloc(1, sizeof(Alignment_Row));
+        if(r_in_rows == NULL) { // If there isn't a corresponding row, add one to the alignment at the end setting the coordinates to zero
+            Alignment_Row *r = st_calloc(1, sizeof(Alignment_Row));
             alignment->row_number++; // Increment the row number
-            r->sequence_name = stString_copy(sp->prefix);
-            r->bases = st_calloc(alignment->column_number+1, sizeof(char));
-            for(int64_t j=0; j<alignment->column_number; j++) {
-                r->bases[j] = '-';
+            r->sequence_name = sequence_name_construct(sp->prefix, strlen(sp->prefix));
+            if(pack_gap_rows) {
+                r->packed_bases = packed_bases_construct_gaps(alignment->column_number); // Costs nothing per column
+            }
+            else {
+                r->bases = st_calloc(alignment->column_number+1, sizeof(char));
+                for(int64_t j=0; j<alignment->column_number; j++) {
+                    r->bases[j] = '-';
+                }
+                r->bases[alignment->column_number] = '\0';
             }
-            r->bases[alignment->column_number] = '\0';
             r->strand = 1;
             *p_r = r;
             p_r = &(r->n_row);
@@ -268,7 +283,11 @@ void alignment_pad_the_rows(Alignment *p_alignment, Alignment *alignment, stList
     }
 
     // Clean up
-    stList_destruct(rows);
+    free(rows);
+
+    // Index the rows and lay them out in a base matrix again, now that there may be more of them
+    alignment_index_rows(alignment);
+    alignment_pack_bases(alignment);
 
     // Reset the alignment of the rows with the prior row
     if(p_alignment != NULL) {
@@ -1,265 +1,635 @@
 #include "taf.h"
+#include "tai.h"
 #include "sonLib.h"
 
+#ifdef USE_SIMDE
+#include "simde/x86/avx2.h"
+#endif
+
 /*
- * Returns non-zero if the tokens list contains the coordinate marker ':'
+ * The TAF line scanner. A line is walked once, in place, and its fields are returned as slices of the
+ * line buffer, so reading a column needs no tokenizing and no allocation beyond what ends up in the block.
  */
-bool has_coordinates(stList *tokens, int64_t *j) {
-    for(*j=0; *j<stList_length(tokens); (*j)++) {
-        if(strcmp(stList_get(tokens, *j), ";") == 0) {
-            return 1;
+
+static inline bool is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline char *skip_space(char *p, char *end) {
+    while(p < end && is_space(*p)) {
+        p++;
+    }
+    return p;
+}
+
+static inline char *token_end(char *p, char *end) {
+    while(p < end && !is_space(*p)) {
+        p++;
+    }
+    return p;
+}
+
+/*
+ * Parse a non-negative integer token, advancing *p past it and any preceding white space.
+ */
+static inline int64_t parse_int(char **p, char *end) {
+    char *q = skip_space(*p, end);
+    assert(q < end && *q >= '0' && *q <= '9'); // Must be a number
+    int64_t i = 0;
+    while(q < end && *q >= '0' && *q <= '9') {
+        i = i * 10 + (*q++ - '0');
+    }
+    assert(q == end || is_space(*q)); // The number must make up the whole token
+    *p = q;
+    return i;
+}
+
+/*
+ * Get the next token, setting *token to its start and returning its end, or NULL if there isn't one.
+ */
+static inline char *next_token(char **p, char *end, char **token) {
+    *token = skip_space(*p, end);
+    if(*token == end) {
+        return NULL;
+    }
+    *p = token_end(*token, end);
+    return *p;
+}
+
+bool taf_line_scan(char *line, Taf_Line *taf_line) {
+    return taf_line_scan2(line, strlen(line), taf_line);
+}
+
+bool taf_line_scan2(char *line, int64_t length, Taf_Line *taf_line) {
+    char *end = line + length, *p = line, *token, *t_end, *bases_end = NULL;
+    taf_line->bases = skip_space(line, end);
+    taf_line->coordinates = taf_line->coordinates_end = NULL;
+    taf_line->tags = taf_line->tags_end = NULL;
+    while((t_end = next_token(&p, end, &token)) != NULL) {
+        if(t_end - token == 1 && (*token == ';' || *token == '@')) {
+            if(taf_line->coordinates == NULL && taf_line->tags == NULL) {
+                bases_end = bases_end == NULL ? token : bases_end;
+            }
+            if(*token == ';') { // The coordinates follow
+                taf_line->coordinates = t_end;
+            }
+            else { // The tags follow, running to the end of the line
+                if(taf_line->coordinates != NULL) {
+                    taf_line->coordinates_end = token;
+                }
+                taf_line->tags = t_end;
+                taf_line->tags_end = end;
+                break;
+            }
+        }
+        else if(taf_line->coordinates == NULL) { // Still in the bases
+            bases_end = t_end;
         }
     }
-    return 0;
+    if(bases_end == NULL) { // Is a white space only line
+        return 0;
+    }
+    taf_line->bases_end = bases_end;
+    if(taf_line->coordinates != NULL && taf_line->coordinates_end == NULL) {
+        taf_line->coordinates_end = end;
+    }
+    return 1;
+}
+
+bool taf_line_has_coordinates(Taf_Line *taf_line) {
+    return taf_line->coordinates != NULL;
+}
+
+bool taf_line_next_coordinate_op(Taf_Line *taf_line, char **cursor, Taf_Coordinate_Op *op) {
+    char *end = taf_line->coordinates_end, *token, *t_end;
+    if(next_token(cursor, end, &token) == NULL) {
+        return 0;
+    }
+    assert(*cursor - token == 1); // The operation must be a single character in length
+    op->type = *token;
+    op->row_index = parse_int(cursor, end); // Get the index of the affected row
+    if(op->type == 'i' || op->type == 's') { // Parse the sequence_name, start, strand and sequence_length fields
+        t_end = next_token(cursor, end, &token);
+        assert(t_end != NULL);
+        op->sequence_name = token;
+        op->sequence_name_length = t_end - token;
+        op->start = parse_int(cursor, end);
+        t_end = next_token(cursor, end, &token);
+        assert(t_end != NULL && t_end - token == 1 && (*token == '+' || *token == '-'));
+        op->strand = *token == '+';
+        op->sequence_length = parse_int(cursor, end);
+    }
+    else if(op->type == 'g') { // Is a gap without the sequence specified
+        op->gap_length = parse_int(cursor, end);
+    }
+    else if(op->type == 'G') { // Is a gap with the sequence specified
+        t_end = next_token(cursor, end, &token);
+        assert(t_end != NULL);
+        op->gap_sequence = token;
+        op->gap_length = t_end - token;
+    }
+    else {
+        assert(op->type == 'd');
+    }
+    return 1;
+}
+
+int64_t taf_line_column_length(Taf_Line *taf_line, bool run_length_encode_bases) {
+    if(!run_length_encode_bases) {
+        return taf_line->bases_end - taf_line->bases;
+    }
+    char *p = taf_line->bases, *end = taf_line->bases_end, *token;
+    int64_t column_length = 0;
+    while(next_token(&p, end, &token) != NULL) { // Skip the base, then add its count
+        column_length += parse_int(&p, end);
+    }
+    return column_length;
+}
+
+void taf_line_get_bases(Taf_Line *taf_line, bool run_length_encode_bases, char *column, int64_t column_length) {
+    if(run_length_encode_bases) { // Case the bases are encoded using run length encoding
+        char *p = taf_line->bases, *end = taf_line->bases_end, *token;
+        int64_t j = 0;
+        while(j < column_length) {
+            char *t_end = next_token(&p, end, &token);
+            assert(t_end != NULL);
+            assert(t_end - token == 1); // The base must be a single character
+            int64_t k = parse_int(&p, end);
+            assert(k > 0); // Each count must be greater than zero
+            assert(j + k <= column_length);
+            memset(column + j, *token, k);
+            j += k;
+        }
+        assert(j == column_length);
+        assert(skip_space(p, end) == end); // Must be a run of bases equal in length to the number of rows
+        return;
+    }
+    // Otherwise column is just a string of bases without whitespace
+    assert(taf_line->bases_end - taf_line->bases == column_length); // Must be a contiguous run of bases equal
+    // in length to the number of rows
+    memcpy(column, taf_line->bases, column_length);
+}
+
+Tag *taf_line_parse_tags(Taf_Line *taf_line) {
+    Tag *first_tag = NULL, **p_tag = &first_tag;
+    char *p = taf_line->tags, *end = taf_line->tags_end, *token, *t_end;
+    if(p == NULL) {
+        return NULL;
+    }
+    while((t_end = next_token(&p, end, &token)) != NULL) {
+        char *delimiter = memchr(token, ':', t_end - token);
+        if(delimiter == NULL || memchr(delimiter+1, ':', t_end - delimiter - 1) != NULL) {
+            st_errAbort("Tag not separated by ':' character: %.*s\n", (int)(t_end - token), token);
+        }
+        // Allocate the tag with its key and value strings following it, so the tag is one allocation
+        Tag *tag = st_malloc(sizeof(Tag) + (t_end - token) + 1);
+        tag->key = (char *)(tag + 1);
+        memcpy(tag->key, token, t_end - token);
+        tag->key[delimiter - token] = '\0';
+        tag->key[t_end - token] = '\0';
+        tag->value = tag->key + (delimiter - token) + 1;
+        tag->n_tag = NULL;
+        *p_tag = tag;
+        p_tag = &(tag->n_tag);
+    }
+    return first_tag;
+}
+
+bool taf_line_is_anchor(Taf_Line *taf_line, bool run_length_encode_bases) {
+    if(!taf_line_has_coordinates(taf_line)) {
+        return 0;
+    }
+    // Check the operations are any deletions followed by an insertion or substitution of each row in turn,
+    // as taf_write_block writes them, so that the rows do not depend on those of the previous block
+    int64_t rows = 0;
+    Taf_Coordinate_Op op;
+    char *cursor = taf_line->coordinates;
+    while(taf_line_next_coordinate_op(taf_line, &cursor, &op)) {
+        if(op.type == 'i' || op.type == 's') {
+            if(op.row_index != rows++) {
+                return 0;
+            }
+        } else if(op.type != 'd' || rows > 0) {
+            return 0;
+        }
+    }
+    return rows == taf_line_column_length(taf_line, run_length_encode_bases);
+}
+
+void taf_line_substitutions_to_insertions(char *line) {
+    Taf_Line taf_line;
+    if (!taf_line_scan(line, &taf_line) || !taf_line_has_coordinates(&taf_line)) {
+        fprintf(stderr, "Error loading coordinates from taf line: %s\n", line);
+        exit(1);
+    }
+
+    // rewrite the line keeping the bases, the "i"/"s" operations (as "i"s) and the tags, and
+    // dropping any "d", "g" and "G" operations. the result is never longer than the line
+    int64_t line_len = strlen(line);
+    char *rewritten = st_malloc(line_len + 1);
+    int64_t k = 0;
+    bool rewrite = false; // Only needed if there are operations other than insertions
+    k += sprintf(rewritten + k, "%.*s ;", (int)(taf_line.bases_end - taf_line.bases), taf_line.bases);
+    Taf_Coordinate_Op op;
+    char *cursor = taf_line.coordinates;
+    while (taf_line_next_coordinate_op(&taf_line, &cursor, &op)) {
+        rewrite = rewrite || op.type != 'i';
+        if(op.type == 'i' || op.type == 's') { // We have coordinates!
+            k += sprintf(rewritten + k, " i %" PRIi64 " %.*s %" PRIi64 " %c %" PRIi64, op.row_index,
+                         (int)op.sequence_name_length, op.sequence_name, op.start, op.strand ? '+' : '-',
+                         op.sequence_length);
+        }
+    }
+    if (taf_line.tags != NULL) {
+        k += sprintf(rewritten + k, " @%.*s", (int)(taf_line.tags_end - taf_line.tags), taf_line.tags);
+    }
+    assert(k <= line_len);
+
+    if (rewrite) {
+        // overwrite our line
+        memcpy(line, rewritten, k + 1);
+    }
+    free(rewritten);
+}
+
+char *taf_line_with_coordinates(char *line, const char *coordinates) {
+    Taf_Line taf_line;
+    if (!taf_line_scan(line, &taf_line)) {
+        fprintf(stderr, "Error loading coordinates from taf line: %s\n", line);
+        exit(1);
+    }
+    int64_t tags_length = taf_line.tags != NULL ? taf_line.tags_end - taf_line.tags : 0;
+    char *rewritten = st_malloc((taf_line.bases_end - taf_line.bases) + strlen(coordinates) + tags_length + 5);
+    int64_t k = sprintf(rewritten, "%.*s ;%s", (int)(taf_line.bases_end - taf_line.bases), taf_line.bases, coordinates);
+    if (taf_line.tags != NULL) {
+        sprintf(rewritten + k, " @%.*s", (int)tags_length, taf_line.tags);
+    }
+    return rewritten;
+}
+
+static char *copy_span(char *s, int64_t length) {
+    char *c = st_malloc(sizeof(char) * (length + 1));
+    memcpy(c, s, length);
+    c[length] = '\0';
+    return c;
 }
 
 /*
- * Parse the sequence_name, start, strand and sequence_length fields for a row
+ * The rows of the block being parsed, held in a gap buffer: an array of row pointers with a gap at the
+ * cursor, rows [0, before) preceding it and rows [after, capacity) following it. The coordinate
+ * operations of a line come in increasing row order (the deletions and then the other edits), so moving
+ * the cursor from one operation's row to the next costs only the distance between them, and every edit,
+ * insertion and deletion is done at the cursor in constant time. The rows are only linked into a list
+ * once all the operations are applied.
  */
-char *parse_coordinates(int64_t *j, stList *tokens, int64_t *start, bool *strand,
-                        int64_t *sequence_length) {  
-    char *sequence_name = stString_copy(stList_get(tokens, (*j)++));
-    *start = atol(stList_get(tokens, (*j)++));
-    assert(strcmp(stList_get(tokens, (*j)), "+") == 0 || strcmp(stList_get(tokens, (*j)), "-") == 0);
-    *strand = strcmp(stList_get(tokens, (*j)++), "+") == 0;
-    *sequence_length = atol(stList_get(tokens, (*j)++));
-    return sequence_name;
+typedef struct _Row_Buffer {
+    Alignment_Row **rows;
+    int64_t before, after, capacity;
+    Alignment_Arena *arena; // The buffer is allocated from the arena of the block
+} Row_Buffer;
+
+static void row_buffer_move_cursor(Row_Buffer *buffer, int64_t row_index) {
+    if(row_index < buffer->before) { // Move rows from before the gap to after it
+        int64_t n = buffer->before - row_index;
+        buffer->after -= n;
+        buffer->before -= n;
+        memmove(buffer->rows + buffer->after, buffer->rows + buffer->before, sizeof(Alignment_Row *) * n);
+    }
+    else if(row_index > buffer->before) { // Move rows from after the gap to before it
+        int64_t n = row_index - buffer->before;
+        assert(n <= buffer->capacity - buffer->after); // The row index must be within the block
+        memmove(buffer->rows + buffer->before, buffer->rows + buffer->after, sizeof(Alignment_Row *) * n);
+        buffer->before += n;
+        buffer->after += n;
+    }
+}
+
+static void row_buffer_insert(Row_Buffer *buffer, Alignment_Row *row) {
+    if(buffer->before == buffer->after) { // The gap is closed, so double the capacity of the buffer
+        int64_t n = buffer->capacity - buffer->after, capacity = buffer->capacity * 2 + 16;
+        Alignment_Row **rows = alignment_arena_malloc(buffer->arena, sizeof(Alignment_Row *) * capacity);
+        memcpy(rows, buffer->rows, sizeof(Alignment_Row *) * buffer->before);
+        memcpy(rows + capacity - n, buffer->rows + buffer->after, sizeof(Alignment_Row *) * n);
+        buffer->rows = rows;
+        buffer->after = capacity - n;
+        buffer->capacity = capacity;
+    }
+    buffer->rows[buffer->before++] = row;
 }
 
 /*
- * Make the block being parsed by copying the previous block and then editing it with the
- * list of coordinate changes.
+ * Make the block being parsed, allocated from the given arena, by copying the previous block and then
+ * editing it with the list of coordinate changes.
  */
-static Alignment *parse_coordinates_and_establish_block(Alignment *p_block, stList *tokens) {
+static Alignment *parse_coordinates_and_establish_block(Alignment *p_block, Taf_Line *taf_line, LI *li,
+                                                        Alignment_Arena *arena) {
     // Make a new block
-    Alignment *alignment = st_calloc(1, sizeof(Alignment));
+    Alignment *alignment = alignment_construct(arena);
 
-    // Copy the rows of the previous block
-    Alignment_Row **p_row = &(alignment->row), *l_row = p_block == NULL ? NULL : p_block->row;
-    while(l_row != NULL) {
-        Alignment_Row *row = st_calloc(1, sizeof(Alignment_Row));
-        alignment->row_number++; // Increment the row number
+    // Copy the rows of the previous block into the buffer, all initially after the cursor
+    int64_t p_row_number = p_block == NULL ? 0 : p_block->row_number;
+    Row_Buffer buffer = { alignment_arena_malloc(arena, sizeof(Alignment_Row *) * (p_row_number + 16)),
+                          0, 16, p_row_number + 16, arena };
+    Alignment_Row *l_row = p_block == NULL ? NULL : p_block->row;
+    for(int64_t i=buffer.after; l_row != NULL; i++) {
+        assert(i < buffer.capacity);
+        Alignment_Row *row = alignment_row_construct(arena);
         // Copy the relevant fields
         row->start = l_row->start + l_row->length;
-        row->sequence_name = stString_copy(l_row->sequence_name);
+        row->sequence_name = sequence_name_copy(l_row->sequence_name);
         row->sequence_length = l_row->sequence_length;
         row->strand = l_row->strand;
-        // Link up the previous and current rows
-        *p_row = row;
-        p_row = &(row->n_row);
         // Link corresponding left and right rows
         l_row->r_row = row;
         row->l_row = l_row;
+        buffer.rows[i] = row;
         // Get the next row to copy
         l_row = l_row->n_row;
     }
-    assert(p_block == NULL || alignment->row_number == p_block->row_number);
-
-    // Now parse the tokens to edit the rows
-    int64_t j;
-    has_coordinates(tokens, &j); j++; // Get 1+ the coordinate of the ';' token
-    while(j < stList_length(tokens) && strcmp(stList_get(tokens, j), "@") != 0) { // Iterate through the tokens
-        char *op_type = stList_get(tokens, j++); // This is the operation
-        assert(strlen(op_type) == 1); // Must be a single character in length
-        int64_t row_index = atol(stList_get(tokens, j++)); // Get the index of the affected row
-        int64_t i=0;
-        Alignment_Row **row = &(alignment->row); // Get the pointer to the pointer to the row being modded
-        while(i++ < row_index) {
-            assert(*row != NULL);
-            row = &((*row)->n_row);
-        }
-        if(op_type[0] == 'i') { // Is inserting a row
-            alignment->row_number++;
-            Alignment_Row *new_row = st_calloc(1, sizeof(Alignment_Row)); // Make the new row
-            // Connect it up, putting the new row immediately before the old one
-            new_row->n_row = *row;
-            *row = new_row;
+
+    // Now parse the coordinate operations to edit the rows
+    Taf_Coordinate_Op op;
+    char *cursor = taf_line->coordinates;
+    while(taf_line_next_coordinate_op(taf_line, &cursor, &op)) { // Iterate through the operations
+        row_buffer_move_cursor(&buffer, op.row_index); // Get the row being modded, which is the first after the gap
+        if(op.type == 'i') { // Is inserting a row
+            Alignment_Row *new_row = alignment_row_construct(arena); // Make the new row
+            // Put the new row immediately before the old one
+            row_buffer_insert(&buffer, new_row);
             // Fill it out
-            new_row->sequence_name = parse_coordinates(&j, tokens, &new_row->start, &new_row->strand, &new_row->sequence_length);
-        } else if(op_type[0] == 's') { // Is substituting a row
-            free((*row)->sequence_name); // clean up
-            (*row)->sequence_name = parse_coordinates(&j, tokens, &(*row)->start, &(*row)->strand, &(*row)->sequence_length);            
-        } else if(op_type[0] == 'd') { // Is deleting a row
-            // Remove the row from the list of rows
-            alignment->row_number--;
-            Alignment_Row *r = *row;
-            *row = r->n_row;
+            new_row->sequence_name = sequence_name_intern(li, op.sequence_name, op.sequence_name_length);
+            new_row->start = op.start;
+            new_row->strand = op.strand;
+            new_row->sequence_length = op.sequence_length;
+            continue;
+        }
+        assert(buffer.after < buffer.capacity); // There must be a row to edit
+        Alignment_Row *row = buffer.rows[buffer.after];
+        if(op.type == 's') { // Is substituting a row
+            sequence_name_destruct(row->sequence_name); // clean up
+            row->sequence_name = sequence_name_intern(li, op.sequence_name, op.sequence_name_length);
+            row->start = op.start;
+            row->strand = op.strand;
+            row->sequence_length = op.sequence_length;
+        } else if(op.type == 'd') { // Is deleting a row
+            // Remove the row from the buffer
+            buffer.after++;
             // Now delete the row
-            alignment_row_destruct(r);
-        } else if(op_type[0] == 'g') { // Is making a gap without the sequence specified
-            int64_t gap_length = atol(stList_get(tokens, j++)); // Get the index of the affected row
-            (*row)->start += gap_length;
+            alignment_row_destruct(row);
+        } else if(op.type == 'g') { // Is making a gap without the sequence specified
+            row->start += op.gap_length;
         } else { // Is making a gap with the sequence specified
-            assert(op_type[0] == 'G');
-            (*row)->left_gap_sequence = stString_copy(stList_get(tokens, j++));
-            (*row)->start += strlen((*row)->left_gap_sequence);
+            assert(op.type == 'G');
+            row->left_gap_sequence = copy_span(op.gap_sequence, op.gap_length);
+            row->start += op.gap_length;
         }
     }
 
+    // Link the rows together in order
+    row_buffer_move_cursor(&buffer, buffer.before + buffer.capacity - buffer.after); // Close the gap at the end
+    alignment->row_number = buffer.before;
+    Alignment_Row **p_row = &(alignment->row);
+    for(int64_t i=0; i<buffer.before; i++) {
+        *p_row = buffer.rows[i];
+        p_row = &(buffer.rows[i]->n_row);
+        buffer.rows[i]->row_index = i;
+    }
+    *p_row = NULL;
+    alignment->rows = buffer.rows; // The buffer, now holding the rows in order, becomes the row index
+
     return alignment;
 }
 
 /*
- * Parse the base alignment for the column.
+ * The columns of a block as they are read, kept one after another in a single contiguous buffer
+ * together with their tags, so they can be transposed into the rows in one pass once the block is complete.
+ * The tags are kept as the text that was read, not parsed, see alignment_get_column_tags.
  */
-char *get_bases(int64_t column_length, stList *tokens, bool run_length_encode_bases) {
-    if(run_length_encode_bases) { // Case the bases are encoded using run length encoding
-        char *column = st_calloc(column_length+1, sizeof(char));
-        column[column_length] = '\0'; // Make into a properly terminated string
-        int64_t i=0, j=0;
-        while(j < column_length) {
-            assert(i < stList_length(tokens));
-            char *base_token = stList_get(tokens, i++);
-            assert(strlen(base_token) == 1); // The base must be a single character
-            int64_t k = atol(stList_get(tokens, i++));
-            assert(k > 0); // Each count must be greater than zero
-            while(k-- > 0) {
-                column[j++] = base_token[0];
+typedef struct _Column_Buffer {
+    int64_t row_number; // The length of each column
+    int64_t column_number, column_capacity;
+    char *bases; // column_capacity * row_number bases, of which the first column_number columns are used
+    char **column_tag_strings; // The tags of each column, or NULL if no column read so far has any
+    Alignment_Arena *arena; // The tags are allocated from the arena of the block
+    Alignment_Arena *bases_arena; // And the bases from the arena of its bases
+} Column_Buffer;
+
+static void column_buffer_add(Column_Buffer *buffer, Taf_Line *taf_line, bool run_length_encode_bases) {
+    if(buffer->column_number == buffer->column_capacity) { // Grow the buffer
+        buffer->column_capacity = buffer->column_capacity == 0 ? 16 : buffer->column_capacity * 2;
+        char *bases = alignment_arena_malloc(buffer->bases_arena, sizeof(char) * (buffer->column_capacity * buffer->row_number + 1));
+        if(buffer->column_number > 0) {
+            memcpy(bases, buffer->bases, sizeof(char) * buffer->column_number * buffer->row_number);
+        }
+        buffer->bases = bases;
+        if(buffer->column_tag_strings != NULL) {
+            char **column_tag_strings = alignment_arena_calloc(buffer->arena, sizeof(char *) * buffer->column_capacity);
+            memcpy(column_tag_strings, buffer->column_tag_strings, sizeof(char *) * buffer->column_number);
+            buffer->column_tag_strings = column_tag_strings;
+        }
+    }
+    // Decode the bases of the column straight into the buffer
+    taf_line_get_bases(taf_line, run_length_encode_bases, buffer->bases + buffer->column_number * buffer->row_number,
+                       buffer->row_number);
+    // Copy any tags for the column, trimmed of surrounding white space
+    if(taf_line->tags != NULL) {
+        char *tags = skip_space(taf_line->tags, taf_line->tags_end), *tags_end = taf_line->tags_end;
+        while(tags_end > tags && is_space(tags_end[-1])) {
+            tags_end--;
+        }
+        if(tags < tags_end) {
+            if(buffer->column_tag_strings == NULL) {
+                buffer->column_tag_strings = alignment_arena_calloc(buffer->arena, sizeof(char *) * buffer->column_capacity);
             }
-            assert(j <= column_length);
+            char *tag_string = alignment_arena_malloc(buffer->arena, sizeof(char) * (tags_end - tags + 1));
+            memcpy(tag_string, tags, tags_end - tags);
+            tag_string[tags_end - tags] = '\0';
+            buffer->column_tag_strings[buffer->column_number] = tag_string;
         }
-        assert(j == column_length);
-        assert(strlen(column) == column_length); // Final sanity check: Must be a contiguous run of bases equal
-        // in length to the number of rows
-        return column;
     }
-    // Otherwise column is just a string of bases without whitespace
-    char *column = stString_copy(stList_get(tokens, 0));
-    assert(strlen(column) == column_length); // Must be a contiguous run of bases equal in length to the number of rows
-    return column;
+    buffer->column_number++;
 }
 
 /*
- * Gets the first non-empty line, return NULL if reaches end of file
+ * Counts the gaps of each row over the columns of a block, for reading a block without keeping its bases.
+ * The counts of the most recent columns are kept a byte per row, so a column can be counted many rows
+ * at a time, and are added to the totals before they can overflow.
  */
-static stList *get_first_line(LI *li) {
-    stList *tokens = NULL;
-    while(1) { // Loop to find the tokens for the first line
-        // Read column with coordinates first, using previous alignment block and the coordinates
-        // to create the set of rows
-        char *line = LI_get_next_line(li);
+typedef struct _Gap_Counter {
+    int64_t row_number; // The length of each column
+    int64_t column_number;
+    uint8_t *gaps; // The gaps of each row in the columns counted since they were last added to row_gaps
+    int64_t *row_gaps; // The gaps of each row in the earlier columns
+    char *column; // Space to decode a run length encoded column into
+} Gap_Counter;
 
-        if (line == NULL) { // At end of file
-            return NULL;
-        }
-        // Tokenize the line
-        tokens = stString_split(line);
-        free(line);
+static void gap_counter_flush(Gap_Counter *counter) {
+    for(int64_t j=0; j<counter->row_number; j++) {
+        counter->row_gaps[j] += counter->gaps[j];
+    }
+    memset(counter->gaps, 0, sizeof(uint8_t) * counter->row_number);
+}
 
-        if (stList_length(tokens) == 0) { // Is a white space only line, just ignore it
-            stList_destruct(tokens);
-            tokens = NULL;
-            continue;
+static void gap_counter_add(Gap_Counter *counter, Taf_Line *taf_line, bool run_length_encode_bases) {
+    const char *column = taf_line->bases;
+    if(run_length_encode_bases) {
+        taf_line_get_bases(taf_line, 1, counter->column, counter->row_number);
+        column = counter->column;
+    }
+    else {
+        assert(taf_line->bases_end - taf_line->bases == counter->row_number);
+    }
+    int64_t j = 0;
+#ifdef USE_SIMDE
+    simde__m128i gap = simde_mm_set1_epi8('-');
+    for(; j + 16 <= counter->row_number; j += 16) { // A gap compares equal to -1, so subtracting counts it
+        simde__m128i gaps = simde_mm_loadu_si128((const simde__m128i *)(counter->gaps + j));
+        simde__m128i is_gap = simde_mm_cmpeq_epi8(simde_mm_loadu_si128((const simde__m128i *)(column + j)), gap);
+        simde_mm_storeu_si128((simde__m128i *)(counter->gaps + j), simde_mm_sub_epi8(gaps, is_gap));
+    }
+#endif
+    for(; j<counter->row_number; j++) {
+        counter->gaps[j] += column[j] == '-';
+    }
+    if(++counter->column_number % UINT8_MAX == 0) {
+        gap_counter_flush(counter);
+    }
+}
+
+/*
+ * Gets the first line that is neither empty nor a comment, scanning it into taf_line. Returns false if
+ * it reaches the end of file. The line is a view of the LI's, so is only valid until the LI is next read.
+ */
+static bool get_first_line(LI *li, Taf_Line *taf_line) {
+    while(1) {
+        int64_t length;
+        char *line = LI_next_line_view(li, &length);
+        if (line == NULL) { // At end of file
+            return 0;
         }
-        else { // We have the first line of the block
-            break;
+        if(taf_line_scan2(line, length, taf_line) && taf_line->bases[0] != '#') { // We have the first line of the block
+            return 1;
         }
+        // Is a white space only or comment line, just ignore it
     }
-    return tokens;
 }
 
-Tag *parse_tags(stList *tokens, int64_t starting_token, char *delimiter);
-
-static Tag *parse_tags_for_column(stList *tokens) {
-    int64_t i=0;
-    while(i<stList_length(tokens)) {
-        if(strcmp(stList_get(tokens, i++), "@") == 0) {
-            break; // We have found the token representing the start of the tags
+/*
+ * Reads the remaining columns of a block whose first line is taf_line, not keeping their bases, only
+ * the number of bases of each row.
+ */
+static void read_columns_without_bases(Alignment *block, Taf_Line *taf_line, bool run_length_encode_bases,
+                                       LI *li) {
+    int64_t row_number = block->row_number;
+    Gap_Counter counter = { row_number, 0, st_calloc(row_number + 1, sizeof(uint8_t)),
+                            st_calloc(row_number + 1, sizeof(int64_t)),
+                            run_length_encode_bases ? st_malloc(sizeof(char) * (row_number + 1)) : NULL };
+    gap_counter_add(&counter, taf_line, run_length_encode_bases);
+    char *line;
+    int64_t length;
+    while((line = LI_peek_at_next_line_view(li, &length)) != NULL) {
+        if(taf_line_scan2(line, length, taf_line)) {
+            if(taf_line_has_coordinates(taf_line)) { // The start of the next block
+                break;
+            }
+            gap_counter_add(&counter, taf_line, run_length_encode_bases);
         }
+        LI_next_line_view(li, &length);
+    }
+    gap_counter_flush(&counter);
+
+    block->column_number = counter.column_number;
+    block->column_tags = alignment_arena_calloc(block->arena, sizeof(Tag *) * block->column_number);
+    int64_t j = 0;
+    for(Alignment_Row *row = block->row; row != NULL; row = row->n_row) {
+        row->length = counter.column_number - counter.row_gaps[j++];
     }
-    return parse_tags(tokens, i, ":");
+    free(counter.gaps);
+    free(counter.row_gaps);
+    free(counter.column);
 }
 
 Alignment *taf_read_block(Alignment *p_block, bool run_length_encode_bases, LI *li) {
-    stList *tokens = get_first_line(li); // Get the first non-empty line
-    while(1) {
-        if (tokens == NULL) { // If there are no more lines to be had return NULL
-            return NULL;
-        }
-
-        if(((char *) stList_get(tokens, 0))[0] != '#') { // If it is not a comment line
-            break;
-        }
+    return taf_read_block2(p_block, run_length_encode_bases, 0, li);
+}
 
-        stList_destruct(tokens); // Clean up the comment line
-        tokens = get_first_line(li); // Get the next line
+Alignment *taf_read_block2(Alignment *p_block, bool run_length_encode_bases, bool skip_bases, LI *li) {
+    Taf_Line taf_line;
+    if (!get_first_line(li, &taf_line)) { // Get the first non-empty line, or if there are no more lines to be had return NULL
+        return NULL;
     }
 
     // Find the coordinates
-    Alignment *block = parse_coordinates_and_establish_block(p_block, tokens);
+    Alignment_Arena *arena = alignment_arena_construct(li);
+    Alignment *block = parse_coordinates_and_establish_block(p_block, &taf_line, li, arena);
+
+    if(skip_bases) {
+        read_columns_without_bases(block, &taf_line, run_length_encode_bases, li);
+        return block;
+    }
+
+    // The bases go in an arena of their own, so they can be released without the block. The reference taken here
+    // is given up once every row has its own
+    Alignment_Arena *bases_arena = alignment_arena_construct(li);
+    alignment_arena_copy(bases_arena);
 
     // Now add in all subsequent columns until we get one with coordinates, which we push back
-    stList *alignment_columns = stList_construct3(0, free);
-    stList *tag_lists = stList_construct();
-    stList_append(alignment_columns, get_bases(block->row_number, tokens, run_length_encode_bases));
-    stList_append(tag_lists, parse_tags_for_column(tokens)); // Get any tags for the column
-    stList_destruct(tokens); // Clean up the first row
+    Column_Buffer columns = { block->row_number, 0, 0, NULL, NULL, arena, bases_arena };
+    column_buffer_add(&columns, &taf_line, run_length_encode_bases);
     while(1) {
-        char *line = LI_peek_at_next_line(li);
+        int64_t length;
+        char *line = LI_peek_at_next_line_view(li, &length);
 
         if(line == NULL) { // We have reached the end of the file
             break;
         }
 
-        // tokenize the line
-        tokens = stString_split(line);
-
-        if(stList_length(tokens) == 0) { // Is a white space only line, just ignore it
-            free(LI_get_next_line(li)); // pull the line and clean it up
-            stList_destruct(tokens); // clean up
+        if(!taf_line_scan2(line, length, &taf_line)) { // Is a white space only line, just ignore it
+            LI_next_line_view(li, &length); // pull the line
             continue;
         }
 
-        int64_t i;
-        if(has_coordinates(tokens, &i)) { // If it has coordinates we have reached the end of the block, so break
-            // and don't pull the line
-            stList_destruct(tokens); // clean up
+        if(taf_line_has_coordinates(&taf_line)) { // If it has coordinates we have reached the end of the block,
+            // so break and don't pull the line
             break;
         }
 
-        // Add the bases from the line as a column to the alignment
-        stList_append(alignment_columns, get_bases(block->row_number, tokens, run_length_encode_bases));
-
-        // Parse the tags for the column
-        stList_append(tag_lists, parse_tags_for_column(tokens)); // Get any tags for the column
+        // Add the bases and tags from the line as a column to the alignment
+        column_buffer_add(&columns, &taf_line, run_length_encode_bases);
 
-        free(LI_get_next_line(li)); // pull the line and clean up the memory for the line
-        stList_destruct(tokens); // clean up the tokens
+        LI_next_line_view(li, &length); // pull the line, which the LI keeps
     }
 
-    // Set the column number
-    assert(stList_length(tag_lists) == stList_length(alignment_columns));
-    block->column_number = stList_length(alignment_columns);
+    // Set the column number and the tags, which are left unparsed until they are asked for
+    block->column_number = columns.column_number;
+    block->column_tags = alignment_arena_calloc(arena, sizeof(Tag *) * block->column_number);
+    block->column_tag_strings = columns.column_tag_strings;
 
-    // Set the tag strings
-    block->column_tags = st_malloc(sizeof(Tag *) * block->column_number);
-    for(int64_t i=0; i<block->column_number; i++) {
-        block->column_tags[i] = stList_get(tag_lists, i);
-    }
-    stList_destruct(tag_lists);
-
-    //Now parse the actual alignments into the rows
+    // Now transpose the columns into the rows, counting the non-gap bases of each row in the same pass.
+    // The bases of all the rows are allocated together, one row after another, as the block's base matrix.
+    int64_t k = block->column_number, stride = alignment_row_stride(k);
+    char **row_bases = alignment_arena_malloc(bases_arena, sizeof(char *) * (block->row_number + 1));
+    int64_t *row_lengths = alignment_arena_malloc(bases_arena, sizeof(int64_t) * (block->row_number + 1));
+    char *bases = alignment_arena_malloc(bases_arena, sizeof(char) * stride * block->row_number);
+    block->base_matrix = bases;
+    block->row_stride = stride;
     Alignment_Row *row = block->row;
-    int64_t j = 0, k = block->column_number;
-    while(row != NULL) {
-        char *bases = st_malloc(sizeof(char) * (k+1));
-        bases[k] = '\0';
-        int64_t length = 0;
-        for(int64_t i=0; i<k; i++) {
-            char *column = stList_get(alignment_columns, i);
-            bases[i] = column[j];
-            if(bases[i] != '-') {
-                length++;
-            }
-        }
-        row->bases = bases;
-        row->length = length;
-        row = row->n_row; j++;
+    for(int64_t j=0; j<block->row_number; j++) {
+        row->bases = bases + j * stride;
+        row->bases[k] = '\0';
+        row->bases_arena = bases_arena;
+        alignment_arena_copy(bases_arena);
+        row_bases[j] = row->bases;
+        row = row->n_row;
     }
-    assert(j == block->row_number);
-
-    // Clean up
-    stList_destruct(alignment_columns);
+    assert(row == NULL);
+    alignment_transpose_columns(columns.bases, block->row_number, k, row_bases, row_lengths);
+    row = block->row;
+    for(int64_t j=0; j<block->row_number; j++) {
+        row->length = row_lengths[j];
+        row = row->n_row;
+    }
+    alignment_arena_destruct(bases_arena);
 
     return block;
 }
@@ -267,8 +637,17 @@ Alignment *taf_read_block(Alignment *p_block, bool run_length_encode_bases, LI *
 Tag *parse_header(stList *tokens, char *header_prefix, char *delimiter);
 
 Tag *taf_read_header(LI *li) {
-    stList *tokens = get_first_line(li);
-    assert(tokens != NULL); // There has to be a valid header line
+    stList *tokens = NULL;
+    while(1) { // Get the first non-empty line, which must be the header
+        char *line = LI_get_next_line(li);
+        assert(line != NULL); // There has to be a valid header line
+        tokens = stString_split(line);
+        free(line);
+        if(stList_length(tokens) > 0) {
+            break;
+        }
+        stList_destruct(tokens); // Is a white space only line, just ignore it
+    }
     Tag *tag = parse_header(tokens, "#taf", ":");
     stList_destruct(tokens);
 
@@ -309,35 +688,52 @@ static void write_base(char base, int64_t base_count, LW *lw, bool run_length_en
     }
 }
 
-void write_column(Alignment_Row *row, int64_t column, LW *lw, bool run_length_encode_bases, bool color_bases) {
-    // Fast unencoded, non-coloured path -- no run tracking, just emit
-    // each row's base as a byte.  This is the steady-state TAF write at
-    // default settings.  Skipping the run-counting if/else per row was a
-    // measurable win in callgrind.
-    if (!run_length_encode_bases && !color_bases) {
-        while (row != NULL) {
-            LW_putc(lw, row->bases[column]);
-            row = row->n_row;
+/*
+ * Returns the end of the run of bases equal to column[i] that starts at i. Runs in padded and sorted
+ * alignments are often hundreds of rows long, so the column is compared 32 and then 16 bytes at a time.
+ */
+static inline int64_t run_end(const char *column, int64_t i, int64_t length) {
+    char base = column[i++];
+#ifdef USE_SIMDE
+    simde__m256i b32 = simde_mm256_set1_epi8(base);
+    while(i + 32 <= length) {
+        uint32_t mismatches = ~(uint32_t)simde_mm256_movemask_epi8(
+                simde_mm256_cmpeq_epi8(simde_mm256_loadu_si256((const simde__m256i *)(column + i)), b32));
+        if(mismatches != 0) {
+            return i + __builtin_ctz(mismatches);
         }
-        return;
+        i += 32;
     }
-    // Run-length-encoded or coloured: walk rows accumulating runs of
-    // equal bases, then defer the actual emission to write_base which
-    // handles both encodings.
-    char base = '\0';
-    int64_t base_count = 0;
-    while(row != NULL) {
-        if(row->bases[column] == base) {
-            base_count++;
+    simde__m128i b16 = simde_mm_set1_epi8(base);
+    if(i + 16 <= length) {
+        uint32_t mismatches = ~(uint32_t)simde_mm_movemask_epi8(
+                simde_mm_cmpeq_epi8(simde_mm_loadu_si128((const simde__m128i *)(column + i)), b16)) & 0xFFFF;
+        if(mismatches != 0) {
+            return i + __builtin_ctz(mismatches);
         }
-        else {
-            write_base(base, base_count, lw, run_length_encode_bases, color_bases);
-            base = row->bases[column];
-            base_count = 1;
-        }
-        row = row->n_row;
+        i += 16;
+    }
+#endif
+    while(i < length && column[i] == base) {
+        i++;
+    }
+    return i;
+}
+
+static void write_column(const char *column, int64_t length, LW *lw, bool run_length_encode_bases, bool color_bases) {
+    // Fast unencoded, non-coloured path -- the column is already contiguous, so just copy it out.
+    // This is the steady-state TAF write at default settings.
+    if (!run_length_encode_bases && !color_bases) {
+        LW_putn(lw, column, length);
+        return;
+    }
+    // Run-length-encoded or coloured: find the runs of equal bases, then defer the actual emission
+    // to write_base which handles both encodings.
+    for(int64_t i=0; i<length;) {
+        int64_t j = run_end(column, i, length);
+        write_base(column[i], j - i, lw, run_length_encode_bases, color_bases);
+        i = j;
     }
-    write_base(base, base_count, lw, run_length_encode_bases, color_bases);
 }
 
 // " i/s %" PRIi64 " %s %" PRIi64 " %c %" PRIi64 ""
@@ -359,7 +755,20 @@ static inline void write_row_anchor(LW *lw, char kind, int64_t i,
     LW_puti64(lw, seq_length);
 }
 
-void write_coordinates(Alignment_Row *p_row, Alignment_Row *row, int64_t repeat_coordinates_every_n_columns, LW *lw) {
+/*
+ * Returns non-zero if write_coordinates will write an anchor for the rows, reporting the coordinates of every row,
+ * which it decides from the first row.
+ */
+static bool coordinates_are_anchor(Alignment_Row *row, int64_t repeat_coordinates_every_n_columns) {
+    if(row->l_row == NULL || !alignment_row_is_predecessor(row->l_row, row)) {
+        return 1;
+    }
+    return repeat_coordinates_every_n_columns > 0 &&
+           row->l_row->bases_since_coordinates_reported + row->l_row->length > repeat_coordinates_every_n_columns;
+}
+
+void write_coordinates(Alignment_Row *p_row, Alignment_Row *row, int64_t repeat_coordinates_every_n_columns,
+                       bool report_everything, LW *lw) {
     int64_t i = 0;
     LW_putn(lw, " ;", 2);
     while(p_row != NULL) { // Write any row deletions
@@ -378,8 +787,7 @@ void write_coordinates(Alignment_Row *p_row, Alignment_Row *row, int64_t repeat_
     // have coordinates for every base. in particular, we need such rows at the beginning of every
     // reference contig, and somewhat evenly spaced along every reference contig.
     // this flag detects such cases (looking at row 0) and then triggers every other row to report
-    // coordinates if it is set.
-    bool report_everything = false;
+    // coordinates if it is set. it can also be set by the caller to force an anchor.
     while(row != NULL) { // Now write the new rows
         if(row->l_row == NULL) { // if the row is inserted
             write_row_anchor(lw, 'i', i, row->sequence_name, row->start,
@@ -439,30 +847,91 @@ void write_coordinates(Alignment_Row *p_row, Alignment_Row *row, int64_t repeat_
 
 void write_header(Tag *tag, LW *lw, char *header_prefix, char *delimiter, char *end);
 
+static void write_column_tags(Alignment *alignment, int64_t column_index, LW *lw) {
+    if(alignment->column_tags != NULL && alignment->column_tags[column_index] != NULL) {
+        // Either parsed or set directly, which replaces any tags read
+        write_header(alignment->column_tags[column_index], lw, " @", ":", "");
+    }
+    else if(alignment->column_tag_strings != NULL && alignment->column_tag_strings[column_index] != NULL) {
+        // The tags have not been parsed, so cannot have been changed, write them as they were read
+        LW_puts(lw, " @ ");
+        LW_puts(lw, alignment->column_tag_strings[column_index]);
+    }
+}
+
+// The number of columns taf_write_block2 transposes out of the rows at a time, which bounds the size of
+// the column buffer for very long blocks.
+#define WRITE_COLUMN_CHUNK 256
+
 void taf_write_block2(Alignment *p_alignment, Alignment *alignment, bool run_length_encode_bases,
                      int64_t repeat_coordinates_every_n_columns, LW *lw, bool color_bases, bool omit_coordinates) {
     Alignment_Row *row = alignment->row;
     if(row != NULL) {
-        int64_t column_no = strlen(row->bases);
+        int64_t column_no = row->bases != NULL ? strlen(row->bases) : alignment->column_number;
         assert(column_no > 0);
-        write_column(row, 0, lw, run_length_encode_bases, color_bases);
-        if(!omit_coordinates) {
-            write_coordinates(p_alignment != NULL ? p_alignment->row : NULL, row, repeat_coordinates_every_n_columns,
-                              lw);
-            if (alignment->column_tags != NULL && alignment->column_tags[0] != NULL) {
-                write_header(alignment->column_tags[0], lw, " @", ":", "");
+
+        // Get the bases of the rows, so the columns can be transposed out of them a chunk at a time. If any
+        // rows are packed the chunks are instead decoded by alignment_get_columns_in_buffer, so the block is
+        // never expanded in full
+        int64_t row_number = 0;
+        for(Alignment_Row *r = row; r != NULL; r = r->n_row) {
+            row_number++;
+        }
+        char **row_bases = st_malloc(sizeof(char *) * row_number);
+        bool has_packed_rows = 0;
+        row_number = 0;
+        for(Alignment_Row *r = row; r != NULL; r = r->n_row) {
+            row_bases[row_number++] = r->bases;
+            if(r->bases == NULL) {
+                assert(r->packed_bases != NULL);
+                has_packed_rows = 1;
             }
-            LW_putc(lw, '\n');
         }
-        for(int64_t i=1; i<column_no; i++) {
-            write_column(row, i, lw, run_length_encode_bases, color_bases);
-            if(!omit_coordinates) {
-                if (alignment->column_tags != NULL && alignment->column_tags[i] != NULL) {
-                    write_header(alignment->column_tags[i], lw, " @", ":", "");
+        assert(!has_packed_rows || (row_number == alignment->row_number && column_no == alignment->column_number));
+        int64_t chunk = column_no < WRITE_COLUMN_CHUNK ? column_no : WRITE_COLUMN_CHUNK;
+        char *columns = st_malloc(sizeof(char) * chunk * row_number + 1);
+
+        // Work out if the first line is an anchor, so that it can be started in a new BGZF block and indexed
+        bool force_anchor = !omit_coordinates && LW_anchor_due(lw);
+        if(!omit_coordinates && (force_anchor || coordinates_are_anchor(row, repeat_coordinates_every_n_columns))) {
+            LW_start_anchor(lw);
+            if(lw->index != NULL && tai_writer_wants(lw->index, row->sequence_name, row->start)) {
+                if(!row->strand) {
+                    fprintf(stderr, "Can't index taf because reference (row 0) sequence found on negative strand\n");
+                    exit(1);
+                }
+                tai_writer_add(lw->index, row->sequence_name, row->start, LW_tell(lw));
+            }
+        }
+
+        for(int64_t i=0; i<column_no; i++) {
+            if(i % chunk == 0) { // Get the next chunk of columns
+                int64_t n = column_no - i < chunk ? column_no - i : chunk;
+                if(has_packed_rows) {
+                    alignment_get_columns_in_buffer(alignment, i, n, columns);
+                }
+                else {
+                    alignment_transpose_rows(row_bases, row_number, i, n, columns);
+                }
+            }
+            write_column(columns + (i % chunk) * row_number, row_number, lw, run_length_encode_bases, color_bases);
+            if(i == 0) {
+                if(!omit_coordinates) {
+                    write_coordinates(p_alignment != NULL ? p_alignment->row : NULL, row,
+                                      repeat_coordinates_every_n_columns, force_anchor, lw);
+                    write_column_tags(alignment, 0, lw);
+                    LW_putc(lw, '\n');
                 }
+                continue;
+            }
+            if(!omit_coordinates) {
+                write_column_tags(alignment, i, lw);
             }
             LW_putc(lw, '\n');
         }
+
+        free(columns);
+        free(row_bases);
     }
 }
 
@@ -590,8 +1059,9 @@ void apply_genome_name_mapping_to_alignment(stHash *genome_name_map, Alignment *
     for (Alignment_Row *row = aln->row; row != NULL; row = row->n_row) {
         char *mapped_sequence_name = apply_genome_name_mapping(genome_name_map, row->sequence_name);
         if (mapped_sequence_name != NULL) {
-            free(row->sequence_name);
-            row->sequence_name = mapped_sequence_name;
+            sequence_name_destruct(row->sequence_name);
+            row->sequence_name = sequence_name_construct(mapped_sequence_name, strlen(mapped_sequence_name));
+            free(mapped_sequence_name);
         }
     }
 }
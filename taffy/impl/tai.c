@@ -1,9 +1,16 @@
 #include "taf.h"
 #include "tai.h"
+#include "remote_io.h"
 #include "htslib/bgzf.h"
 #include "htslib/kstring.h"
 #include <ctype.h>
 #include <time.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 char *tai_path(const char *taf_path) {
     assert(taf_path != NULL);
@@ -60,55 +67,28 @@ char *tai_parse_region(const char *region, int64_t *start, int64_t *length) {
 // but only returns everything if there's a coordinate for every row in the column
 // this can happen when everything is an "i" like on the first line
 // or when everything is an "s" like on a repeat-coordinates-every-n-columns line
-static char *parse_coordinates_line(stList *tokens, int64_t *start, bool *strand,
+static char *parse_coordinates_line(char *line, int64_t length, int64_t *start, bool *strand,
                                     bool run_length_encode_bases) {
-    int64_t j = -1;
-    if (!has_coordinates(tokens, &j)) {
+    Taf_Line taf_line;
+    if (!taf_line_scan2(line, length, &taf_line) || !taf_line_has_coordinates(&taf_line)) {
         return NULL;
     }
 
-    int64_t num_bases = 0;
-    // todo: really should go through api for this one
-    if (run_length_encode_bases) {
-        assert(j > 1);
-        for (int64_t i = 0; i < j; ++i) {
-            char *token = (char*)stList_get(tokens, i);
-            if (isdigit(token[0])) {
-                num_bases += atol(token);
-            }
-        }
-    } else {
-        assert(j == 1);
-        num_bases = strlen(stList_get(tokens, 0));
-    }
+    int64_t num_bases = taf_line_column_length(&taf_line, run_length_encode_bases);
     int64_t num_coordinates = 0;
     char *seq = NULL;
-    int64_t sequence_length;
-    bool dummy;
-    int64_t n = stList_length(tokens);
-
-    ++j;
-    while (j < n && strcmp(stList_get(tokens, j), "@") != 0) {
-        // copied from taf.c
-        char *op_type = stList_get(tokens, j++); // This is the operation
-        assert(strlen(op_type) == 1); // Must be a single character in length
-        int64_t row_index = atol(stList_get(tokens, j++)); // Get the index of the affected row
-        if(op_type[0] == 'i' || op_type[0] == 's') { // We have coordinates!
+
+    Taf_Coordinate_Op op;
+    char *cursor = taf_line.coordinates;
+    while (taf_line_next_coordinate_op(&taf_line, &cursor, &op)) {
+        if(op.type == 'i' || op.type == 's') { // We have coordinates!
             num_coordinates++;
-            if (row_index == 0) {
-                seq = parse_coordinates(&j, tokens, start, strand, &sequence_length);
-            } else {
-                // we parse but don't use
-                // todo: smoother api
-                char *s = parse_coordinates(&j, tokens, &sequence_length, &dummy, &sequence_length);
-                free(s);
+            if (op.row_index == 0) {
+                free(seq);
+                seq = stString_getSubString(op.sequence_name, 0, op.sequence_name_length);
+                *start = op.start;
+                *strand = op.strand;
             }
-        } else if (op_type[0] == 'd') {
-        } else if (op_type[0] == 'g') {
-            j++;
-        } else {
-            assert(op_type[0] == 'G');
-            j++;
         }
     }
 
@@ -117,127 +97,601 @@ static char *parse_coordinates_line(stList *tokens, int64_t *start, bool *strand
         return seq;
     }
 
+    free(seq);
     *start = -1;
     return NULL;
 }
 
-// this is rather hacky: because our index points to
-// taf lines where all coordinates are listed as "s", but we
-// want to start new block parsers on these lines, we have to
-// convert the s's to i's to pretend we're starting new files
-static void change_s_coordinates_to_i(char *line) {
-    stList* tokens = stString_split(line);
-
-    int64_t j = -1;
-    bool hc = has_coordinates(tokens, &j);
-    int64_t dummy_int;
-    bool dummy_bool;
-    bool found_s = false;
-
-    if (hc) {
-        int64_t n = stList_length(tokens);
-        bool *mask = st_calloc(n, sizeof(bool));        
-        ++j;
-        while (j < n && strcmp(stList_get(tokens, j), "@") != 0) {
-            char *op_type = stList_get(tokens, j++); // This is the operation
-            j++; // the row index;
-            assert(strlen(op_type) == 1); // Must be a single character in length
-            if(op_type[0] == 'i' || op_type[0] == 's') { // We have coordinates!
-                found_s = found_s || op_type[0] == 's';
-                op_type[0] = 'i';
-                // only parse to increment j (would rather use api than just add 4)
-                parse_coordinates(&j, tokens, &dummy_int, &dummy_bool, &dummy_int);
-            } else if (op_type[0] == 'd') {
-                mask[j-2] = true;
-                mask[j-1] = true;
-            } else if (op_type[0] == 'g') {
-                mask[j-2] = true;
-                mask[j-1] = true;
-                mask[j] = true;
-                j++;
-            } else {
-                assert(op_type[0] == 'G');
-                mask[j-2] = true;
-                mask[j-1] = true;
-                mask[j] = true;
-                j++;
-            }
+// The binary index starts with this header, followed by the arrays of the Tai, each 8 byte aligned:
+// contig_starts (contig_number + 1 entries), contig_name_offsets (contig_number), seq_pos, file_pos and
+// state_offsets (record_number each), then the NUL terminated contig names (names_length bytes, in the same
+// order) and then the NUL terminated states (states_length bytes). Version 1 has neither states_length in its
+// header nor the states.
+#define TAI_BINARY_MAGIC "\211TAI"
+#define TAI_BINARY_VERSION 2
+
+typedef struct _Tai_Header {
+    char magic[4];
+    uint32_t version;
+    int64_t contig_number;
+    int64_t record_number;
+    int64_t names_length;
+    int64_t states_length;
+} Tai_Header;
+
+static int64_t tai_header_length(Tai_Header *header) {
+    return header->version == 1 ? offsetof(Tai_Header, states_length) : sizeof(Tai_Header);
+}
+
+// Get the length of the binary index with the given header, or -1 if the counts are not valid
+static int64_t tai_image_length(Tai_Header *header) {
+    int64_t states_length = header->version == 1 ? 0 : header->states_length;
+    if (header->contig_number < 0 || header->record_number < header->contig_number || header->names_length < 0 ||
+        states_length < 0) {
+        return -1;
+    }
+    int64_t arrays = header->version == 1 ? 2 : 3;
+    return tai_header_length(header) +
+           sizeof(int64_t) * (2 * header->contig_number + 1 + arrays * header->record_number) +
+           header->names_length + states_length;
+}
+
+// Point the arrays of the tai into the binary index, checking it is one
+static void tai_set_image(Tai *tai, char *image, int64_t image_length) {
+    Tai_Header *header = (Tai_Header *)image;
+    if (image_length < sizeof(Tai_Header) || memcmp(header->magic, TAI_BINARY_MAGIC, 4) != 0) {
+        fprintf(stderr, "Invalid binary .tai index\n");
+        exit(1);
+    }
+    if (header->version != 1 && header->version != TAI_BINARY_VERSION) {
+        fprintf(stderr, "Unsupported binary .tai index version: %" PRIi64 "\n", (int64_t)header->version);
+        exit(1);
+    }
+    int64_t length = tai_image_length(header);
+    if (length < 0 || length > image_length) {
+        fprintf(stderr, "Binary .tai index is truncated\n");
+        exit(1);
+    }
+    tai->image = image;
+    tai->image_length = image_length;
+    tai->contig_number = header->contig_number;
+    tai->record_number = header->record_number;
+    tai->contig_starts = (int64_t *)(image + tai_header_length(header));
+    tai->contig_name_offsets = tai->contig_starts + tai->contig_number + 1;
+    tai->seq_pos = tai->contig_name_offsets + tai->contig_number;
+    tai->file_pos = tai->seq_pos + tai->record_number;
+    if (header->version == 1) {
+        tai->state_offsets = NULL;
+        tai->names = (char *)(tai->file_pos + tai->record_number);
+        tai->states = NULL;
+    } else {
+        tai->state_offsets = tai->file_pos + tai->record_number;
+        tai->names = (char *)(tai->state_offsets + tai->record_number);
+        tai->states = tai->names + header->names_length;
+    }
+}
+
+/*
+ * Collects the records of an index, in any order, to make the binary index from
+ */
+typedef struct _Tai_Builder {
+    stList *names; // the contig names in the order first seen
+    stHash *contigs; // from each contig name to its index in names, plus one
+    int64_t record_number;
+    int64_t record_capacity;
+    int64_t *record_contigs;
+    int64_t *seq_pos;
+    int64_t *file_pos;
+    int64_t *state_offsets; // the offset of each record's state in states, or -1 if it has none
+    char *states;
+    int64_t states_length;
+    int64_t states_capacity;
+} Tai_Builder;
+
+static Tai_Builder *tai_builder_construct(void) {
+    Tai_Builder *builder = st_calloc(1, sizeof(Tai_Builder));
+    builder->names = stList_construct3(0, free);
+    builder->contigs = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL, NULL);
+    return builder;
+}
+
+static void tai_builder_destruct(Tai_Builder *builder) {
+    stHash_destruct(builder->contigs);
+    stList_destruct(builder->names);
+    free(builder->record_contigs);
+    free(builder->seq_pos);
+    free(builder->file_pos);
+    free(builder->state_offsets);
+    free(builder->states);
+    free(builder);
+}
+
+static void tai_builder_add(Tai_Builder *builder, const char *name, int64_t name_length, int64_t seq_pos,
+                            int64_t file_pos, const char *state) {
+    int64_t contig = stList_length(builder->names) - 1;
+    if (contig < 0 || strncmp(stList_get(builder->names, contig), name, name_length) != 0 ||
+        ((char *)stList_get(builder->names, contig))[name_length] != '\0') { // Not the same contig as the last record
+        char *contig_name = stString_getSubString(name, 0, name_length);
+        contig = (int64_t)stHash_search(builder->contigs, contig_name) - 1;
+        if (contig < 0) {
+            contig = stList_length(builder->names);
+            stList_append(builder->names, contig_name);
+            stHash_insert(builder->contigs, contig_name, (void *)(contig + 1));
+        } else {
+            free(contig_name);
         }
-        
-        if (found_s) {
-            // overwrite our line
-            int64_t line_len = strlen(line);
-            int64_t k = 0;
-            int64_t n = stList_length(tokens);
-            assert(mask[0] == false);
-            for (j = 0; j < n; ++j) {
-                char *token = (char*)stList_get(tokens, j);
-                if (mask[j] == false) {
-                    int64_t token_len = strlen(token);
-                    char *spacer = j == 0 ? "" : " ";
-                    assert(k + token_len + strlen(spacer) <= line_len);
-                    sprintf(line + k, "%s%s", spacer, token);
-                    k += strlen(token) + strlen(spacer);
-                }
-            }
+    }
+    if (builder->record_number == builder->record_capacity) {
+        builder->record_capacity = builder->record_capacity * 2 + 64;
+        builder->record_contigs = st_realloc(builder->record_contigs, sizeof(int64_t) * builder->record_capacity);
+        builder->seq_pos = st_realloc(builder->seq_pos, sizeof(int64_t) * builder->record_capacity);
+        builder->file_pos = st_realloc(builder->file_pos, sizeof(int64_t) * builder->record_capacity);
+        builder->state_offsets = st_realloc(builder->state_offsets, sizeof(int64_t) * builder->record_capacity);
+    }
+    builder->state_offsets[builder->record_number] = -1;
+    if (state != NULL) {
+        int64_t state_length = strlen(state) + 1;
+        if (builder->states_length + state_length > builder->states_capacity) {
+            builder->states_capacity = (builder->states_length + state_length) * 2;
+            builder->states = st_realloc(builder->states, builder->states_capacity);
         }
-    } else {
-        fprintf(stderr, "Error loading coordinates from indexed taf line: %s\n", line);
+        memcpy(builder->states + builder->states_length, state, state_length);
+        builder->state_offsets[builder->record_number] = builder->states_length;
+        builder->states_length += state_length;
+    }
+    builder->record_contigs[builder->record_number] = contig;
+    builder->seq_pos[builder->record_number] = seq_pos;
+    builder->file_pos[builder->record_number++] = file_pos;
+}
+
+typedef struct _Tai_Sort_Rec {
+    int64_t contig; // the rank of the contig name
+    int64_t seq_pos;
+    int64_t file_pos;
+    int64_t state_offset;
+    int64_t order; // the order the record was added in
+} Tai_Sort_Rec;
+
+static int tai_sort_rec_cmp(const void *v1, const void *v2) {
+    const Tai_Sort_Rec *r1 = v1, *r2 = v2;
+    if (r1->contig != r2->contig) {
+        return r1->contig < r2->contig ? -1 : 1;
+    }
+    if (r1->seq_pos != r2->seq_pos) {
+        return r1->seq_pos < r2->seq_pos ? -1 : 1;
+    }
+    return r1->order < r2->order ? -1 : (r1->order > r2->order ? 1 : 0);
+}
+
+static int tai_name_cmp(const void *v1, const void *v2) {
+    return strcmp(*(char **)v1, *(char **)v2);
+}
+
+// Make the binary index of the records, sorted by contig name and then position, keeping the last record
+// added for any position given more than once
+static char *tai_builder_make_image(Tai_Builder *builder, int64_t *image_length) {
+    int64_t contig_number = stList_length(builder->names);
+    char **names = st_malloc(sizeof(char *) * (contig_number + 1));
+    for (int64_t i = 0; i < contig_number; i++) {
+        names[i] = stList_get(builder->names, i);
+    }
+    qsort(names, contig_number, sizeof(char *), tai_name_cmp);
+    int64_t *ranks = st_malloc(sizeof(int64_t) * (contig_number + 1));
+    int64_t names_length = 0;
+    for (int64_t i = 0; i < contig_number; i++) {
+        ranks[(int64_t)stHash_search(builder->contigs, names[i]) - 1] = i;
+        names_length += strlen(names[i]) + 1;
+    }
+
+    Tai_Sort_Rec *recs = st_malloc(sizeof(Tai_Sort_Rec) * (builder->record_number + 1));
+    for (int64_t i = 0; i < builder->record_number; i++) {
+        recs[i].contig = ranks[builder->record_contigs[i]];
+        recs[i].seq_pos = builder->seq_pos[i];
+        recs[i].file_pos = builder->file_pos[i];
+        recs[i].state_offset = builder->state_offsets[i];
+        recs[i].order = i;
+    }
+    qsort(recs, builder->record_number, sizeof(Tai_Sort_Rec), tai_sort_rec_cmp);
+    int64_t record_number = 0;
+    for (int64_t i = 0; i < builder->record_number; i++) {
+        if (record_number > 0 && recs[record_number-1].contig == recs[i].contig &&
+            recs[record_number-1].seq_pos == recs[i].seq_pos) {
+            record_number--; // replace the earlier record for the same position
+        }
+        recs[record_number++] = recs[i];
+    }
+
+    Tai_Header header;
+    memcpy(header.magic, TAI_BINARY_MAGIC, 4);
+    header.version = TAI_BINARY_VERSION;
+    header.contig_number = contig_number;
+    header.record_number = record_number;
+    header.names_length = names_length;
+    header.states_length = builder->states_length;
+    *image_length = tai_image_length(&header);
+    char *image = st_calloc(*image_length, 1);
+    memcpy(image, &header, sizeof(Tai_Header));
+    Tai tai;
+    tai_set_image(&tai, image, *image_length);
+    int64_t names_offset = 0, record = 0;
+    for (int64_t i = 0; i < contig_number; i++) {
+        tai.contig_starts[i] = record;
+        while (record < record_number && recs[record].contig == i) {
+            tai.seq_pos[record] = recs[record].seq_pos;
+            tai.file_pos[record] = recs[record].file_pos;
+            tai.state_offsets[record] = recs[record].state_offset;
+            record++;
+        }
+        tai.contig_name_offsets[i] = names_offset;
+        strcpy(tai.names + names_offset, names[i]);
+        names_offset += strlen(names[i]) + 1;
+    }
+    tai.contig_starts[contig_number] = record;
+    assert(record == record_number);
+    if (builder->states_length > 0) {
+        memcpy(tai.states, builder->states, builder->states_length);
+    }
+
+    free(recs);
+    free(ranks);
+    free(names);
+    return image;
+}
+
+struct _Tai_Writer {
+    FILE *idx_fh;
+    int64_t index_block_size;
+    char *prev_ref;
+    int64_t prev_pos;
+    int64_t prev_file_pos;
+    char *taf_path; // if not NULL, the taf is indexed by tai_writer_destruct once written, see tai_writer_construct_for_lw
+    Tai_Builder *binary; // if not NULL, the records are collected here to write the binary index when finished
+};
+
+Tai_Writer *tai_writer_construct(FILE *idx_fh, int64_t index_block_size, bool binary) {
+    Tai_Writer *tw = st_calloc(1, sizeof(Tai_Writer));
+    tw->idx_fh = idx_fh;
+    tw->index_block_size = index_block_size;
+    tw->binary = binary ? tai_builder_construct() : NULL;
+    return tw;
+}
+
+// Write out the binary index if making one, and free the writer, but don't close idx_fh
+static void tai_writer_finish(Tai_Writer *tw) {
+    if (tw->binary != NULL) {
+        int64_t image_length;
+        char *image = tai_builder_make_image(tw->binary, &image_length);
+        if (fwrite(image, 1, image_length, tw->idx_fh) != image_length) {
+            fprintf(stderr, "Unable to write the binary .tai index\n");
+            exit(1);
+        }
+        free(image);
+        tai_builder_destruct(tw->binary);
+    }
+    free(tw->prev_ref);
+    free(tw);
+}
+
+Tai_Writer *tai_writer_construct_for_lw(LW *lw, const char *taf_path, int64_t index_block_size) {
+    char *idx_path = tai_path(taf_path);
+    FILE *idx_fh = fopen(idx_path, "w");
+    if (idx_fh == NULL) {
+        fprintf(stderr, "Unable to open index file for writing: %s\n", idx_path);
         exit(1);
     }
+    free(idx_path);
+    Tai_Writer *tw = tai_writer_construct(idx_fh, index_block_size, 0);
+#ifdef USE_HTSLIB
+    if (lw->bgzf == NULL) {
+        // htslib's positions in an uncompressed file are not byte offsets, so they can't be known as it is
+        // written, instead index it once it has been written
+        tw->taf_path = stString_copy(taf_path);
+    }
+#endif
+    LW_set_index(lw, tw);
+    return tw;
+}
 
-    stList_destruct(tokens);
+void tai_writer_destruct(Tai_Writer *tw) {
+    if (tw->taf_path != NULL) {
+        LI *li = LI_construct_from_path(tw->taf_path);
+        if (li == NULL) {
+            exit(1);
+        }
+        tai_create(li, tw->idx_fh, tw->index_block_size);
+        LI_destruct(li);
+        free(tw->taf_path);
+    }
+    FILE *idx_fh = tw->idx_fh;
+    tai_writer_finish(tw);
+    fclose(idx_fh);
 }
 
-static int tai_create_taf(LI *li, FILE *idx_fh, int64_t index_block_size, bool run_length_encode_bases) {
-    char *prev_ref = NULL;
-    int64_t prev_pos = 0;
-    int64_t prev_file_pos = 0;
+bool tai_writer_wants(Tai_Writer *tw, const char *ref, int64_t pos) {
+    if (tw->taf_path != NULL) {
+        return 0;
+    }
+    // we need to update our index if we're on a new reference contig
+    // or we're on the same contig but >= index_block_size bases away
+    bool same_ref = tw->prev_ref && strcmp(ref, tw->prev_ref) == 0;
+    return !same_ref || pos - tw->prev_pos >= tw->index_block_size;
+}
+
+void tai_writer_add(Tai_Writer *tw, const char *ref, int64_t pos, int64_t file_pos) {
+    if (tw->binary != NULL) {
+        tai_builder_add(tw->binary, ref, strlen(ref), pos, file_pos, NULL);
+        if (tw->prev_ref == NULL || strcmp(ref, tw->prev_ref) != 0) {
+            free(tw->prev_ref);
+            tw->prev_ref = stString_copy(ref);
+        }
+    } else if (tw->prev_ref && strcmp(ref, tw->prev_ref) == 0) {
+        // save a little space by writing relative coordinates
+        fprintf(tw->idx_fh, "*\t%" PRIi64 "\t%" PRIi64 "\n", pos - tw->prev_pos, file_pos - tw->prev_file_pos);
+    } else {
+        fprintf(tw->idx_fh, "%s\t%" PRIi64 "\t%" PRIi64 "\n", ref, pos, file_pos);
+        free(tw->prev_ref);
+        tw->prev_ref = stString_copy(ref);
+    }
+    tw->prev_pos = pos;
+    tw->prev_file_pos = file_pos;
+}
 
-    // scan the taf line by line
-    for (char *line = LI_get_next_line(li); line != NULL; line = LI_get_next_line(li)) {
-        stList* tokens = stString_split(line);
-        int64_t pos;
+// Add a record for a block that does not start with an anchor line, which can be read from as if it did by giving
+// it the coordinates of its rows as insertions, see tai_seek. Only the binary index has these records.
+static void tai_writer_add_state(Tai_Writer *tw, Alignment *alignment, int64_t file_pos) {
+    assert(tw->binary != NULL);
+    // the coordinates, as an anchor line written with every row inserted would have them
+    int64_t length = 0;
+    for (Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
+        length += strlen(row->sequence_name) + 80;
+    }
+    char *state = st_malloc(length + 1), *p = state;
+    int64_t i = 0;
+    for (Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
+        p += sprintf(p, " i %" PRIi64 " %s %" PRIi64 " %c %" PRIi64, i++, row->sequence_name, row->start,
+                     row->strand ? '+' : '-', row->sequence_length);
+    }
+    tai_builder_add(tw->binary, alignment->row->sequence_name, strlen(alignment->row->sequence_name),
+                    alignment->row->start, file_pos, state);
+    free(state);
+}
+
+// As tai_create_taf, but reading the blocks so that every index_every_k_blocks-th block after an anchor line is
+// also indexed, with the coordinates of its rows
+static int tai_create_taf_dense(LI *li, Tai_Writer *tw, bool run_length_encode_bases, int64_t index_every_k_blocks) {
+    Alignment *alignment, *p_alignment = NULL;
+    int64_t blocks = 0; // the blocks since the last anchor line or record
+    while (1) {
+        int64_t file_pos = li->pos, length; // the position of the next line, which LI_tell gives once it is got
+        char *line = LI_peek_at_next_line_view(li, &length);
+        if (line == NULL) {
+            break;
+        }
+        int64_t pos = -1;
+        bool strand;
+        char *ref = parse_coordinates_line(line, length, &pos, &strand, run_length_encode_bases);
+        if ((alignment = taf_read_block2(p_alignment, run_length_encode_bases, 1, li)) == NULL) {
+            free(ref);
+            break;
+        }
+        if (ref != NULL) {
+            assert(strand == true);
+            if (tai_writer_wants(tw, ref, pos)) {
+                tai_writer_add(tw, ref, pos, file_pos);
+            }
+            free(ref);
+            blocks = 0;
+        } else if (++blocks >= index_every_k_blocks && alignment->row->strand) {
+            tai_writer_add_state(tw, alignment, file_pos);
+            blocks = 0;
+        }
+        if (p_alignment != NULL) {
+            alignment_destruct(p_alignment, 1);
+        }
+        p_alignment = alignment;
+    }
+    if (p_alignment != NULL) {
+        alignment_destruct(p_alignment, 1);
+    }
+    return 0;
+}
+
+static int tai_create_taf(LI *li, Tai_Writer *tw, bool run_length_encode_bases) {
+    // scan the taf line by line, looking at each line in place rather than copying it
+    int64_t length;
+    for (char *line = LI_next_line_view(li, &length); line != NULL; line = LI_next_line_view(li, &length)) {
+        int64_t pos = -1;
         assert(sizeof(int64_t) == sizeof(off_t));
         bool strand;
-        char *ref = parse_coordinates_line(tokens, &pos, &strand, run_length_encode_bases);
+        char *ref = parse_coordinates_line(line, length, &pos, &strand, run_length_encode_bases);
         if (ref != NULL) {
             // shouldn't need to handle negative strand on reference, right?
             assert(strand == true);
+            if (tai_writer_wants(tw, ref, pos)) {
+                tai_writer_add(tw, ref, pos, LI_tell(li));
+            }
+            free(ref);
+        }
+    }
+    return 0;
+}
 
-            // we need to update our index if we're on a new reference contig
-            // or we're on the same contig but >= index_block_size bases away
-            bool same_ref = prev_ref && strcmp(ref, prev_ref) == 0;
-            if (!same_ref || pos - prev_pos >= index_block_size) {
-                int64_t file_pos = LI_tell(li);
-                if (same_ref) {
-                    // save a little space by writing relative coordinates
-                    fprintf(idx_fh, "*\t%" PRIi64 "\t%" PRIi64 "\n", pos-prev_pos, file_pos-prev_file_pos);
-                } else {
-                    fprintf(idx_fh, "%s\t%" PRIi64 "\t%" PRIi64 "\n", ref, pos, file_pos);
+// A candidate record of the index, found by a worker of tai_create_taf_parallel
+typedef struct _Tai_Candidate {
+    char *ref;
+    int64_t seq_pos;
+    int64_t file_pos;
+    bool strand;
+} Tai_Candidate;
+
+static void tai_candidate_destruct(Tai_Candidate *candidate) {
+    free(candidate->ref);
+    free(candidate);
+}
+
+// A range of the lines of a taf, scanned for candidate records by a worker of tai_create_taf_parallel
+typedef struct _Tai_Range {
+    const char *path;
+    bool run_length_encode_bases;
+    int64_t start; // the position to start reading at, which may be in the middle of a line
+    bool skip_first_line; // set if start may be in the middle of a line, in which case the line at start is
+                          // skipped and if it is whole it is scanned by the range before, as the line at its end
+    int64_t end; // the position of the start of the next range, or -1 for the end of the file
+    stList *candidates; // the coordinates lines found, in order
+} Tai_Range;
+
+static void *tai_scan_range(void *arg) {
+    Tai_Range *range = arg;
+    FILE *fh = fopen(range->path, "r");
+    if (fh == NULL) {
+        st_errAbort("Unable to open %s to index it\n", range->path);
+    }
+    LI *li = LI_construct(fh);
+    LI_seek(li, range->start);
+    free(LI_get_next_line(li)); // the line that was peeked at before the seek
+    int64_t length;
+    if (range->skip_first_line) {
+        LI_next_line_view(li, &length);
+    }
+    for (char *line = LI_next_line_view(li, &length); line != NULL; line = LI_next_line_view(li, &length)) {
+        int64_t file_pos = LI_tell(li);
+        if (range->end >= 0 && file_pos > range->end) {
+            break;
+        }
+        int64_t pos = -1;
+        bool strand;
+        char *ref = parse_coordinates_line(line, length, &pos, &strand, range->run_length_encode_bases);
+        if (ref != NULL) {
+            Tai_Candidate *candidate = st_malloc(sizeof(Tai_Candidate));
+            candidate->ref = ref;
+            candidate->seq_pos = pos;
+            candidate->file_pos = file_pos;
+            candidate->strand = strand;
+            stList_append(range->candidates, candidate);
+        }
+    }
+    LI_destruct(li);
+    fclose(fh);
+    return NULL;
+}
+
+// Returns non-zero if the bytes are the header of a BGZF block, setting block_size to the size of the block
+static bool is_bgzf_header(const unsigned char *b, int64_t *block_size) {
+    if (b[0] != 31 || b[1] != 139 || b[2] != 8 || (b[3] & 4) == 0 || b[10] != 6 || b[11] != 0 ||
+        b[12] != 'B' || b[13] != 'C' || b[14] != 2 || b[15] != 0) {
+        return 0;
+    }
+    *block_size = (b[16] | (b[17] << 8)) + 1;
+    return 1;
+}
+
+// Get the offset of the first BGZF block starting at or after offset, or -1 if there is none. A block is only
+// accepted if the next follows right after it, as the bytes of a header could appear in compressed data.
+static int64_t next_bgzf_block(int fd, int64_t offset, int64_t file_size) {
+    int64_t window = 1 << 20;
+    unsigned char *buffer = st_malloc(window + 18);
+    while (offset + 18 <= file_size) {
+        int64_t n = pread(fd, buffer, window + 18, offset);
+        if (n < 18) {
+            break;
+        }
+        for (int64_t i = 0; i + 18 <= n; ++i) {
+            int64_t block_size;
+            unsigned char next[18];
+            if (is_bgzf_header(buffer + i, &block_size)) {
+                int64_t next_offset = offset + i + block_size;
+                if (next_offset == file_size ||
+                    (pread(fd, next, 18, next_offset) == 18 && is_bgzf_header(next, &block_size))) {
+                    free(buffer);
+                    return offset + i;
                 }
-                free(prev_ref);
-                prev_ref = ref;
-                prev_pos = pos;
-                prev_file_pos = file_pos;
             }
         }
-        stList_destruct(tokens);
-        free(line);
+        offset += n - 17;
     }
-    free(prev_ref);
-    return 0;
+    free(buffer);
+    return -1;
 }
 
-static int tai_create_maf(LI *li, FILE *idx_fh, int64_t index_block_size) {
-    char *prev_ref = NULL;
-    int64_t prev_pos = 0;
-    int64_t prev_file_pos = 0;
+// Get the positions, as taken by LI_seek, at which to split the file after start into about the given number of
+// parts of equal size, each at the start of a BGZF block if the file is bgzipped. Returns the number of positions.
+static int64_t tai_split_file(const char *path, int64_t start, int64_t parts, int64_t *split_positions) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        st_errAbort("Unable to open %s to index it\n", path);
+    }
+    unsigned char magic[2] = { 0, 0 };
+    bool bgzf = pread(fd, magic, 2, 0) == 2 && magic[0] == 31 && magic[1] == 139;
+    // positions in a bgzipped file are virtual offsets, the offset of the block shifted up 16 bits
+    int64_t p_offset = bgzf ? start >> 16 : start, n = 0;
+    for (int64_t i = 1; i < parts; ++i) {
+        int64_t offset = st.st_size * i / parts;
+        if (bgzf) {
+            offset = next_bgzf_block(fd, offset, st.st_size);
+        }
+        if (offset > p_offset && offset < st.st_size) {
+            split_positions[n++] = bgzf ? offset << 16 : offset;
+            p_offset = offset;
+        }
+    }
+    close(fd);
+    return n;
+}
 
+// As tai_create_taf, but splitting the file into ranges that are scanned for coordinates lines on threads, each
+// with its own handle on the file, before the records are picked from the lines found in order
+static int tai_create_taf_parallel(LI *li, Tai_Writer *tw, bool run_length_encode_bases, const char *path,
+                                   int64_t threads) {
+#ifdef USE_HTSLIB
+    if (bgzf_compression(li->bgzf) != 2) {
+        // htslib's positions in a file that is not bgzipped are not byte offsets, so the ranges can't be found
+        // from the size of the file, instead index it in one pass (as tai_writer_construct_for_lw does)
+        return tai_create_taf(li, tw, run_length_encode_bases);
+    }
+#endif
+    int64_t *split_positions = st_malloc(sizeof(int64_t) * threads);
+    int64_t range_number = tai_split_file(path, li->pos, threads, split_positions) + 1;
+    Tai_Range *ranges = st_calloc(range_number, sizeof(Tai_Range));
+    pthread_t *workers = st_malloc(sizeof(pthread_t) * range_number);
+    for (int64_t i = 0; i < range_number; ++i) {
+        ranges[i].path = path;
+        ranges[i].run_length_encode_bases = run_length_encode_bases;
+        ranges[i].start = i == 0 ? li->pos : split_positions[i-1];
+        ranges[i].skip_first_line = i > 0;
+        ranges[i].end = i + 1 < range_number ? split_positions[i] : -1;
+        ranges[i].candidates = stList_construct3(0, (void (*)(void *))tai_candidate_destruct);
+        if (pthread_create(&workers[i], NULL, tai_scan_range, &ranges[i]) != 0) {
+            st_errAbort("Unable to start a thread to index the file\n");
+        }
+    }
+    st_logInfo("Indexing %s in %" PRIi64 " ranges\n", path, range_number);
+    for (int64_t i = 0; i < range_number; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+    for (int64_t i = 0; i < range_number; ++i) {
+        for (int64_t j = 0; j < stList_length(ranges[i].candidates); ++j) {
+            Tai_Candidate *candidate = stList_get(ranges[i].candidates, j);
+            // shouldn't need to handle negative strand on reference, right?
+            assert(candidate->strand == true);
+            if (tai_writer_wants(tw, candidate->ref, candidate->seq_pos)) {
+                tai_writer_add(tw, candidate->ref, candidate->seq_pos, candidate->file_pos);
+            }
+        }
+        stList_destruct(ranges[i].candidates);
+    }
+    free(ranges);
+    free(workers);
+    free(split_positions);
+    return 0;
+}
+
+static int tai_create_maf(LI *li, Tai_Writer *tw, int64_t index_every_k_blocks) {
     // scan the maf block by block line by line
     Alignment *alignment, *p_alignment = NULL;
     int64_t file_pos = LI_tell(li);
-    while((alignment = maf_read_block(li)) != NULL) {
+    int64_t blocks = 0; // the blocks since the last record
+    while((alignment = maf_read_block2(li, 1)) != NULL) { // Only the coordinates are needed
         if(p_alignment != NULL) {
             alignment_link_adjacent(p_alignment, alignment, 1);
         }
@@ -246,20 +700,14 @@ static int tai_create_maf(LI *li, FILE *idx_fh, int64_t index_block_size) {
             exit(1);
         }
         // todo: error message when out of order
-        bool same_ref = prev_ref && strcmp(alignment->row->sequence_name, prev_ref) == 0;
-        int64_t pos = alignment->row->start;
-        char *ref = alignment->row->sequence_name;
-        if (!same_ref || pos - prev_pos >= index_block_size) {
-            if (same_ref) {
-                // save a little space by writing relative coordinates
-                fprintf(idx_fh, "*\t%" PRIi64 "\t%" PRIi64 "\n", pos-prev_pos, file_pos-prev_file_pos);
-            } else {
-                fprintf(idx_fh, "%s\t%" PRIi64 "\t%" PRIi64 "\n", ref, pos, file_pos);
-            }
-            free(prev_ref);
-            prev_ref = stString_copy(ref);
-            prev_pos = pos;
-            prev_file_pos = file_pos;
+        if (tai_writer_wants(tw, alignment->row->sequence_name, alignment->row->start)) {
+            tai_writer_add(tw, alignment->row->sequence_name, alignment->row->start, file_pos);
+            blocks = 0;
+        } else if (index_every_k_blocks > 0 && ++blocks >= index_every_k_blocks) {
+            // maf blocks don't depend on those before, so no state is needed to read from one
+            tai_builder_add(tw->binary, alignment->row->sequence_name, strlen(alignment->row->sequence_name),
+                            alignment->row->start, file_pos, NULL);
+            blocks = 0;
         }
         if(p_alignment != NULL) {
             alignment_destruct(p_alignment, 1);
@@ -270,11 +718,23 @@ static int tai_create_maf(LI *li, FILE *idx_fh, int64_t index_block_size) {
     if(p_alignment != NULL) {
         alignment_destruct(p_alignment, 1);
     }
-    free(prev_ref);
     return 0;
 }
     
 int tai_create(LI *li, FILE* idx_fh, int64_t index_block_size) {
+    return tai_create2(li, idx_fh, index_block_size, 0, 0);
+}
+
+int tai_create2(LI *li, FILE* idx_fh, int64_t index_block_size, bool binary, int64_t index_every_k_blocks) {
+    return tai_create3(li, NULL, idx_fh, index_block_size, binary, index_every_k_blocks, 1);
+}
+
+int tai_create3(LI *li, const char *path, FILE* idx_fh, int64_t index_block_size, bool binary,
+                int64_t index_every_k_blocks, int64_t threads) {
+    if (index_every_k_blocks > 0 && !binary) {
+        fprintf(stderr, "Only the binary index can index the blocks between anchors\n");
+        return 1;
+    }
 
     int input_format = check_input_format(LI_peek_at_next_line(li));
     assert(input_format == 0 || input_format == 1);
@@ -293,85 +753,145 @@ int tai_create(LI *li, FILE* idx_fh, int64_t index_block_size) {
     }
     tag_destruct(tag);
 
-    if (input_format == 0) {
-        return tai_create_taf(li, idx_fh, index_block_size, run_length_encode_bases);
+    Tai_Writer *tw = tai_writer_construct(idx_fh, index_block_size, binary);
+    int ret = input_format == 1 ? tai_create_maf(li, tw, index_every_k_blocks) :
+              index_every_k_blocks > 0 ? tai_create_taf_dense(li, tw, run_length_encode_bases, index_every_k_blocks) :
+              path != NULL && threads > 1 ? tai_create_taf_parallel(li, tw, run_length_encode_bases, path, threads) :
+              tai_create_taf(li, tw, run_length_encode_bases);
+    tai_writer_finish(tw); // Not tai_writer_destruct, as the caller closes idx_fh
+    return ret;
+}
+
+void tai_destruct(Tai* tai) {
+    if (tai->mapped) {
+        munmap(tai->image, tai->image_length);
     } else {
-        return tai_create_maf(li, idx_fh, index_block_size);
+        free(tai->image);
     }
+    free(tai);
+}
 
-    return -1;
+// Returns non-zero if the index file is in the binary format
+static bool tai_file_is_binary(FILE *idx_fh) {
+    // read the magic number without moving the file position, as the text index is read from the file descriptor
+    char magic[4];
+    return pread(fileno(idx_fh), magic, 4, 0) == 4 && memcmp(magic, TAI_BINARY_MAGIC, 4) == 0;
 }
 
-// basically all the information in the index file
-typedef struct _TaiRec {
-    char *name;
-    int64_t seq_pos;
-    int64_t file_pos;
-} TaiRec;
+static void tai_load_binary(Tai *tai, FILE *idx_fh) {
+    struct stat st;
+    if (fstat(fileno(idx_fh), &st) != 0) {
+        fprintf(stderr, "Unable to stat the binary .tai index\n");
+        exit(1);
+    }
+    // the mapping outlives the file handle, so the caller is free to close it
+    char *image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(idx_fh), 0);
+    if (image == MAP_FAILED) {
+        fprintf(stderr, "Unable to memory map the binary .tai index\n");
+        exit(1);
+    }
+    tai->mapped = 1;
+    tai_set_image(tai, image, st.st_size);
+}
 
-static int tai_record_cmp(const void *v1, const void *v2) {
-    TaiRec *tr1 = (TaiRec*)v1;
-    TaiRec *tr2 = (TaiRec*)v2;
-    int ret = strcmp(tr1->name, tr2->name);
-    if (ret == 0) {
-        if (tr1->seq_pos < tr2->seq_pos) {
-            ret = -1;
-        } else if (tr1->seq_pos > tr2->seq_pos) {
-            ret = 1;
+static void tai_load_text(Tai *tai, FILE *idx_fh) {
+    Tai_Builder *builder = tai_builder_construct();
+    LI* li = LI_construct(idx_fh);
+    char *line, *prev_name = NULL;
+    int64_t length, prev_name_length = 0, prev_seq_pos = 0, prev_file_pos = 0;
+    while ((line = LI_next_line_view(li, &length)) != NULL) {
+        char *tab = memchr(line, '\t', length), *tab2 = tab == NULL ? NULL : memchr(tab + 1, '\t', line + length - tab - 1);
+        if (tab2 == NULL || memchr(tab2 + 1, '\t', line + length - tab2 - 1) != NULL) {
+            fprintf(stderr, "Skipping tai line that does not have 3 columns: %.*s\n", (int)length, line);
+            continue;
         }
+        char *name = line;
+        int64_t name_length = tab - line;
+        int64_t seq_pos = strtoll(tab + 1, NULL, 10);
+        int64_t file_pos = strtoll(tab2 + 1, NULL, 10);
+        if (name_length == 1 && name[0] == '*') {
+            if (prev_name == NULL) {
+                fprintf(stderr, "Unable to deduce name from tai line: %.*s\n", (int)length, line);
+                exit(1);
+            }
+            name = prev_name;
+            name_length = prev_name_length;
+            seq_pos += prev_seq_pos;
+            file_pos += prev_file_pos;
+        }
+        tai_builder_add(builder, name, name_length, seq_pos, file_pos, NULL);
+        prev_name = stList_get(builder->names, builder->record_contigs[builder->record_number-1]);
+        prev_name_length = strlen(prev_name);
+        prev_seq_pos = seq_pos;
+        prev_file_pos = file_pos;
     }
-    return ret;
+    LI_destruct(li);
+    int64_t image_length;
+    char *image = tai_builder_make_image(builder, &image_length);
+    tai_builder_destruct(builder);
+    tai_set_image(tai, image, image_length);
 }
 
-static Tai *tai_construct() {
+Tai *tai_load(FILE* idx_fh, bool maf) {
+    time_t start_time = time(NULL);
     Tai *tai = st_calloc(1, sizeof(Tai));
-    tai->idx = stSortedSet_construct3(tai_record_cmp, free);
-    tai->names = stList_construct3(0, free);
+    tai->maf = maf;
+    if (tai_file_is_binary(idx_fh)) {
+        tai_load_binary(tai, idx_fh);
+    } else {
+        tai_load_text(tai, idx_fh);
+    }
+    st_logInfo("Loaded .tai index in %" PRIi64 " seconds\n", time(NULL) - start_time);
     return tai;
 }
 
-void tai_destruct(Tai* tai) {
-    stSortedSet_destruct(tai->idx);
-    stList_destruct(tai->names);
-    free(tai);
+// Get the index of the named contig in the index, or -1 if it is not there
+static int64_t tai_find_contig(Tai *tai, const char *name) {
+    int64_t lo = 0, hi = tai->contig_number;
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(tai->names + tai->contig_name_offsets[mid], name);
+        if (cmp == 0) {
+            return mid;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
 }
 
-Tai *tai_load(FILE* idx_fh, bool maf) {
-    time_t start_time = time(NULL);
-    Tai *tai = tai_construct();
-    tai->maf = maf;
-    LI* li = LI_construct(idx_fh);
-    char *line;
-    TaiRec *prev_rec = NULL;
-    while ((line = LI_get_next_line(li)) != NULL) {
-        stList* tokens = stString_splitByString(line, "\t");
-        if (stList_length(tokens) != 3) {
-            fprintf(stderr, "Skipping tai line that does not have 3 columns: %s\n", line);
-            continue;
+// Get the first record in [first, last) with a position greater than or equal to seq_pos, or last if none
+static int64_t tai_search(Tai *tai, int64_t first, int64_t last, int64_t seq_pos) {
+    while (first < last) {
+        int64_t mid = first + (last - first) / 2;
+        if (tai->seq_pos[mid] < seq_pos) {
+            first = mid + 1;
+        } else {
+            last = mid;
         }
-        TaiRec* rec = (TaiRec*)st_calloc(1, sizeof(TaiRec));
-        rec->seq_pos = atol(stList_get(tokens, 1));
-        rec->file_pos = atol(stList_get(tokens, 2));
-        char *name = (char*)stList_get(tokens, 0);
-        if (strcmp(name, "*") == 0) {
-            if (prev_rec == NULL) {
-                fprintf(stderr, "Unable to deduce name from tai line: %s\n", line);
-                exit(1);
-            }
-            rec->name = prev_rec->name;
-            rec->seq_pos += prev_rec->seq_pos;
-            rec->file_pos += prev_rec->file_pos;
+    }
+    return first;
+}
+
+// Seek to the record, so that the next block read starts a new alignment from it
+static void tai_seek(Tai *tai, LI *li, int64_t record) {
+    LI_seek(li, tai->file_pos[record]);
+    free(LI_get_next_line(li)); // the line from before the seek
+
+    if (!tai->maf) {
+        if (tai->state_offsets != NULL && tai->state_offsets[record] >= 0) {
+            // the record is of a block between anchors, so give its first line the coordinates of its rows
+            LI_set_next_line(li, taf_line_with_coordinates(LI_peek_at_next_line(li),
+                                                           tai->states + tai->state_offsets[record]));
         } else {
-            rec->name = stString_copy(stList_get(tokens, 0));
-            stList_append(tai->names, rec->name);
+            // force taf to start a new alignment at our current file position by making
+            // sure all coordinates are expressed as insertions
+            taf_line_substitutions_to_insertions(LI_peek_at_next_line(li));
         }
-        stSortedSet_insert(tai->idx, rec);
-        stList_destruct(tokens);
-        prev_rec = rec;
     }
-    LI_destruct(li);
-    st_logInfo("Loaded .tai index in %" PRIi64 " seconds\n", time(NULL) - start_time);
-    return tai;
 }
 
 // dummy function to let us toggle between maf/taf reading at runtime (by providing a
@@ -385,6 +905,21 @@ static Alignment *maf_read_block_3(Alignment *p_block, bool run_length_encode_ba
 }
 
 TaiIt *tai_iterator(Tai* tai, LI *li, bool run_length_encode_bases, const char *contig, int64_t start, int64_t length) {
+    return tai_iterator2(tai, li, run_length_encode_bases, contig, start, length, NULL, 0);
+}
+
+// unlink the rows of the block from those of the block before it
+static void unlink_left(Alignment *alignment) {
+    for (Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
+        if (row->l_row != NULL) {
+            row->l_row->r_row = NULL;
+            row->l_row = NULL;
+        }
+    }
+}
+
+TaiIt *tai_iterator2(Tai* tai, LI *li, bool run_length_encode_bases, const char *contig, int64_t start, int64_t length,
+                     TaiIt *p_tai_it, bool keep_next) {
     time_t start_time = time(NULL);
     TaiIt *tai_it = st_calloc(1, sizeof(TaiIt));
     tai_it->maf = tai->maf;
@@ -396,74 +931,70 @@ TaiIt *tai_iterator(Tai* tai, LI *li, bool run_length_encode_bases, const char *
     tai_it->run_length_encode_bases = run_length_encode_bases;
     tai_it->alignment = NULL;
     tai_it->p_alignment = NULL;
+    tai_it->keep_next = keep_next;
 
     // no sense querying anything if length is empty
     if (length <= 0) {
         return tai_it;
     }
 
-    // look up the region in the taf index, which takes a dummy record
-    TaiRec qr;
-    qr.name = tai_it->name;
-    qr.seq_pos = tai_it->start;
-
-    TaiRec *tair_1 = stSortedSet_searchLessThanOrEqual(tai->idx, &qr);
-    // When tair_1 doesn't match our contig (either NULL because we sort before any
-    // record, or pointing at a record from a lexicographically-smaller contig) we
-    // need to fall through to the contig's first record instead. Without this fallback,
-    // `searchGreaterThanOrEqual` below can return our contig's very first record
-    // and the scan loop then skips it because `file_pos >= tair_2->file_pos` fires
-    // immediately. (Bug 3 in tests/tai-bug-fix.)
-    if (tair_1 == NULL || strcmp(tair_1->name, tai_it->name) != 0) {
-        TaiRec qr0;
-        qr0.name = tai_it->name;
-        qr0.seq_pos = 0;
-        tair_1 = stSortedSet_searchGreaterThanOrEqual(tai->idx, &qr0);
-        if (tair_1 == NULL || strcmp(tair_1->name, tai_it->name) != 0 || tai_it->end <= tair_1->seq_pos) {
-            // contig isn't in the index, or its first record starts past our query end
+    // look up the region's contig in the taf index
+    int64_t contig_index = tai_find_contig(tai, tai_it->name);
+    if (contig_index < 0) {
+        return tai_it; // contig isn't in the index
+    }
+    int64_t first = tai->contig_starts[contig_index], last = tai->contig_starts[contig_index+1];
+
+    // the last record of the contig at or before the start of our region, or the contig's first record
+    // if there is none
+    int64_t rec_1 = tai_search(tai, first, last, tai_it->start + 1) - 1;
+    if (rec_1 < first) {
+        rec_1 = first;
+        if (tai_it->end <= tai->seq_pos[rec_1]) {
+            // the contig's first record starts past our query end
             return tai_it;
         }
     }
 
-    // sorted set doesn't let us iterate, so we use a second lookup to get
-    // the next record. By the checks above, tai_it->end > tair_1->seq_pos always.
-    TaiRec qr2;
-    qr2.name = tai_it->name;
-    qr2.seq_pos = tai_it->end;
-    TaiRec *tair_2 = stSortedSet_searchGreaterThanOrEqual(tai->idx, &qr2);
+    // the first record at or after the end of our region, which may be the first record of the next contig,
+    // or none if rec_2 == record_number. By the checks above, tai_it->end > seq_pos[rec_1] always.
+    int64_t rec_2 = tai_search(tai, first, last, tai_it->end);
     st_logInfo("Queried the in-memory .tai index in %" PRIi64 " seconds\n", time(NULL) - start_time);
 
-    // now we know that the start of our region is somewhere in [tair_1, tair_2)
-    // (with the possibility of tair_2 not existing)
-
-    // move to the first record in our file
-    start_time = time(NULL);
-    LI_seek(li, tair_1->file_pos);
-    st_logInfo("Seeked to the queried anchor position with taf file in %" PRIi64 " seconds\n", time(NULL) - start_time);
-    LI_get_next_line(li);
+    // now we know that the start of our region is somewhere in [rec_1, rec_2)
+    // (with the possibility of rec_2 not existing)
 
     // all maf / taf logic toggling is handled right here
-    Alignment* (*maftaf_read_block)(Alignment*, bool, LI*) = maf_read_block_3;
-    if (!tai_it->maf) {
-        maftaf_read_block = taf_read_block;
-        // force taf to start a new alignment at our current file position by making
-        // sure all coordinates are expressed as insertions
-        change_s_coordinates_to_i(LI_peek_at_next_line(li));
+    Alignment* (*maftaf_read_block)(Alignment*, bool, LI*) = tai_it->maf ? maf_read_block_3 : taf_read_block;
+
+    Alignment *alignment = NULL;
+    int64_t file_pos;
+    if (p_tai_it != NULL && p_tai_it->held != NULL && strcmp(p_tai_it->name, tai_it->name) == 0 &&
+        p_tai_it->p_end <= tai_it->start && tai->file_pos[rec_1] <= p_tai_it->held_start_pos) {
+        // the region starts after the blocks of the previous region and there is no record between the block
+        // read after them and the region, so keep reading from that block rather than seeking
+        alignment = p_tai_it->held;
+        p_tai_it->held = NULL;
+        unlink_left(alignment); // from the last block of the previous region
+        file_pos = p_tai_it->held_file_pos;
+        st_logInfo("Reading on from the previous region rather than seeking\n");
+    } else {
+        // move to the first record in our file
+        start_time = time(NULL);
+        tai_seek(tai, li, rec_1);
+        st_logInfo("Seeked to the queried anchor position with taf file in %" PRIi64 " seconds\n", time(NULL) - start_time);
+        file_pos = LI_tell(li);
+        alignment = maftaf_read_block(NULL, tai_it->run_length_encode_bases, li);
     }
-    
-    // now we have to scan forward until we overlap actually the region
-    // TODO: this will surely need speeding up with binary search for giant files...
-    //       but i think that's best done once tests are set up based on the simpler version
+
+    // now we have to scan forward until we overlap actually the region, which is at most
+    // index_every_k_blocks blocks if the binary index was made with them
     start_time = time(NULL);
     size_t scan_block_count = 0;
-    tai_it->alignment = NULL;
-    tai_it->p_alignment = NULL;
-    Alignment *alignment = NULL;
     Alignment *p_alignment = NULL;
-    int64_t file_pos = LI_tell(li);
-    while((alignment = maftaf_read_block(p_alignment, tai_it->run_length_encode_bases, li)) != NULL) {
+    while(alignment != NULL) {
         ++scan_block_count;
-        if (tair_2 && file_pos >= tair_2->file_pos) {
+        if (rec_2 < tai->record_number && file_pos >= tai->file_pos[rec_2]) {
             // we've gone past our query region: there's no hope
             alignment_destruct(alignment, true);
             if (p_alignment) {
@@ -477,7 +1008,7 @@ TaiIt *tai_iterator(Tai* tai, LI *li, bool run_length_encode_bases, const char *
                 alignment_destruct(p_alignment, true);
             }
             p_alignment = alignment;
-            if (strcmp(alignment->row->sequence_name, qr.name) == 0 &&
+            if (strcmp(alignment->row->sequence_name, tai_it->name) == 0 &&
                 alignment->row->start < tai_it->end &&
                 (alignment->row->start + alignment->row->length) > tai_it->start) {
                 // important: need to cut off p_alignment to get our absolute coordinates
@@ -491,6 +1022,7 @@ TaiIt *tai_iterator(Tai* tai, LI *li, bool run_length_encode_bases, const char *
             }
         }
         file_pos = LI_tell(li);
+        alignment = maftaf_read_block(p_alignment, tai_it->run_length_encode_bases, li);
     }
     if (p_alignment != NULL) {
         alignment_destruct(p_alignment, true);
@@ -537,10 +1069,8 @@ static unsigned int clip_alignment(Alignment *aln, Alignment *p_aln, int64_t sta
             }
             if (row->length == 0) {
                 row->bases[0] = '\0';
-            } else {
-                char *bases = row->bases;
-                row->bases = stString_getSubString(bases, cut_point, strlen(row->bases) - cut_point);
-                free(bases);
+            } else { // Shift the bases left in place, so they stay wherever they were, e.g. in the base matrix
+                memmove(row->bases, row->bases + cut_point, strlen(row->bases) - cut_point + 1);
             }
             assert(strlen(row->bases) >= row->length);            
         }
@@ -570,9 +1100,7 @@ static unsigned int clip_alignment(Alignment *aln, Alignment *p_aln, int64_t sta
             if (row->length == 0) {
                 row->bases[0] = '\0';
             } else {
-                char *bases = row->bases;
-                row->bases = stString_getSubString(bases, 0, cut_point + 1);
-                free(bases);
+                row->bases[cut_point + 1] = '\0';
             }
             assert(strlen(row->bases) >= row->length);
         }
@@ -595,14 +1123,11 @@ static unsigned int clip_alignment(Alignment *aln, Alignment *p_aln, int64_t sta
     // ran the block is unchanged and any pre-existing length==0 rows already carry their
     // original all-gap bases, which we must leave alone. When ret != 0 the clip code above
     // has already zeroed bases for every length==0 row, so we can refill unconditionally.
+    // Clipping only shortens the rows, so each is refilled in place.
     if (ret != 0) {
         for (Alignment_Row *row = aln->row; row != NULL; row = row->n_row) {
             if (row->length == 0) {
-                free(row->bases);
-                row->bases = (char*)st_calloc(aln->column_number + 1, sizeof(char));
-                for (int64_t i = 0; i < aln->column_number; ++i) {
-                    row->bases[i] = '-';
-                }
+                memset(row->bases, '-', aln->column_number);
                 row->bases[aln->column_number] = '\0';
             }
         }
@@ -628,14 +1153,21 @@ Alignment *tai_next(TaiIt *tai_it, LI *li) {
     }
     
     // scan forward
-    if (tai_it->alignment->row->start + tai_it->alignment->row->length > tai_it->end) {
+    tai_it->p_end = tai_it->alignment->row->start + tai_it->alignment->row->length;
+    if (tai_it->p_end > tai_it->end && !tai_it->keep_next) {
         tai_it->alignment = NULL;
     } else {
+        tai_it->held_file_pos = LI_tell(li);
+        tai_it->held_start_pos = li->pos;
         tai_it->alignment = maftaf_read_block(tai_it->p_alignment, tai_it->run_length_encode_bases, li);
         if (tai_it->alignment != NULL &&
             (strcmp(tai_it->alignment->row->sequence_name, tai_it->name) != 0 ||
-             tai_it->alignment->row->start >= tai_it->end)) {
-            alignment_destruct(tai_it->alignment, true);
+             tai_it->alignment->row->start >= tai_it->end || tai_it->p_end > tai_it->end)) {
+            if (tai_it->keep_next) { // keep it for the next region, see tai_iterator2
+                tai_it->held = tai_it->alignment;
+            } else {
+                alignment_destruct(tai_it->alignment, true);
+            }
             tai_it->alignment = NULL;
         }
     }
@@ -651,10 +1183,297 @@ bool tai_has_next(TaiIt *tai_it) {
 }
 
 void tai_iterator_destruct(TaiIt *tai_it) {
+    if (tai_it->held != NULL) {
+        alignment_destruct(tai_it->held, true);
+    }
     free(tai_it->name);
     free(tai_it);
 }
 
+Tai_Region *tai_region_construct(const char *contig, int64_t start, int64_t end, int64_t index) {
+    Tai_Region *region = st_malloc(sizeof(Tai_Region));
+    region->contig = stString_copy(contig);
+    region->start = start;
+    region->end = end;
+    region->index = index;
+    return region;
+}
+
+void tai_region_destruct(Tai_Region *region) {
+    free(region->contig);
+    free(region);
+}
+
+static Tai_Region *tai_region_copy(Tai_Region *region) {
+    return tai_region_construct(region->contig, region->start, region->end, region->index);
+}
+
+static int tai_region_cmp(const void *a, const void *b) {
+    Tai_Region *r1 = (Tai_Region *)a, *r2 = (Tai_Region *)b;
+    int i = strcmp(r1->contig, r2->contig);
+    if (i != 0) {
+        return i;
+    }
+    if (r1->start != r2->start) {
+        return r1->start < r2->start ? -1 : 1;
+    }
+    return r1->end < r2->end ? -1 : (r1->end > r2->end ? 1 : 0);
+}
+
+stList *tai_read_bed(FILE *bed_fh) {
+    stList *regions = stList_construct3(0, (void (*)(void *))tai_region_destruct);
+    char *line;
+    int64_t line_number = 0;
+    while ((line = stFile_getLineFromFile(bed_fh)) != NULL) {
+        ++line_number;
+        stList *tokens = stString_split(line);
+        if (stList_length(tokens) > 0 && ((char *)stList_get(tokens, 0))[0] != '#' &&
+            strcmp(stList_get(tokens, 0), "track") != 0 && strcmp(stList_get(tokens, 0), "browser") != 0) {
+            char *end_ptr;
+            int64_t start = -1, end = -1;
+            if (stList_length(tokens) >= 3) {
+                start = strtol(stList_get(tokens, 1), &end_ptr, 10);
+                if (*end_ptr != '\0') {
+                    start = -1;
+                }
+                end = strtol(stList_get(tokens, 2), &end_ptr, 10);
+                if (*end_ptr != '\0') {
+                    end = -1;
+                }
+            }
+            if (start < 0 || end < start) {
+                st_errAbort("Invalid BED region on line %" PRIi64 ": %s\n", line_number, line);
+            }
+            stList_append(regions, tai_region_construct(stList_get(tokens, 0), start, end, stList_length(regions)));
+        }
+        stList_destruct(tokens);
+        free(line);
+    }
+    return regions;
+}
+
+stList *tai_regions_to_read(stList *regions, bool sorted) {
+    stList *to_read = stList_construct3(0, (void (*)(void *))tai_region_destruct);
+    for (int64_t i = 0; i < stList_length(regions); ++i) {
+        Tai_Region *region = stList_get(regions, i);
+        if (region->end > region->start) { // empty regions have no blocks
+            stList_append(to_read, tai_region_copy(region));
+        }
+    }
+    if (sorted) {
+        // sort the regions, then merge each into the one before it if they overlap or touch
+        stList_sort(to_read, tai_region_cmp);
+        stList *merged = stList_construct3(0, (void (*)(void *))tai_region_destruct);
+        Tai_Region *p_region = NULL;
+        while (stList_length(to_read) > 0) {
+            Tai_Region *region = stList_remove(to_read, 0);
+            if (p_region != NULL && strcmp(p_region->contig, region->contig) == 0 && region->start <= p_region->end) {
+                p_region->end = region->end > p_region->end ? region->end : p_region->end;
+                p_region->index = region->index < p_region->index ? region->index : p_region->index;
+                tai_region_destruct(region);
+            } else {
+                stList_append(merged, region);
+                p_region = region;
+            }
+        }
+        stList_destruct(to_read);
+        to_read = merged;
+    }
+    return to_read;
+}
+
+TaiRegionsIt *tai_regions_iterator(Tai *tai, LI *li, bool run_length_encode_bases, stList *regions, bool sorted) {
+    TaiRegionsIt *tai_regions_it = st_calloc(1, sizeof(TaiRegionsIt));
+    tai_regions_it->tai = tai;
+    tai_regions_it->run_length_encode_bases = run_length_encode_bases;
+    tai_regions_it->regions = tai_regions_to_read(regions, sorted);
+    tai_regions_it->region_index = -1;
+    return tai_regions_it;
+}
+
+Alignment *tai_regions_next(TaiRegionsIt *tai_regions_it, LI *li, int64_t *region_index) {
+    while (tai_regions_it->tai_it == NULL || !tai_has_next(tai_regions_it->tai_it)) {
+        // move to the next region with any blocks, reading on from the last where possible
+        if (++tai_regions_it->region_index >= stList_length(tai_regions_it->regions)) {
+            return NULL;
+        }
+        Tai_Region *region = stList_get(tai_regions_it->regions, tai_regions_it->region_index);
+        bool keep_next = tai_regions_it->region_index + 1 < stList_length(tai_regions_it->regions);
+        TaiIt *tai_it = tai_iterator2(tai_regions_it->tai, li, tai_regions_it->run_length_encode_bases,
+                                      region->contig, region->start, region->end - region->start,
+                                      tai_regions_it->tai_it, keep_next);
+        if (tai_regions_it->tai_it != NULL) {
+            tai_iterator_destruct(tai_regions_it->tai_it);
+        }
+        tai_regions_it->tai_it = tai_it;
+    }
+    if (region_index != NULL) {
+        *region_index = ((Tai_Region *)stList_get(tai_regions_it->regions, tai_regions_it->region_index))->index;
+    }
+    return tai_next(tai_regions_it->tai_it, li);
+}
+
+void tai_regions_iterator_destruct(TaiRegionsIt *tai_regions_it) {
+    if (tai_regions_it->tai_it != NULL) {
+        tai_iterator_destruct(tai_regions_it->tai_it);
+    }
+    stList_destruct(tai_regions_it->regions);
+    free(tai_regions_it);
+}
+
+// The number of regions that may be read ahead of the region being returned, per worker thread
+#define REGIONS_PER_THREAD 4
+
+struct _Tai_Parallel_Reader {
+    Tai *tai;
+    char *path;
+    bool run_length_encode_bases;
+    stList *regions; // the regions to read, in the order they are returned
+    stList **blocks; // for each region, its blocks once they are read, else NULL
+    int64_t thread_number;
+    pthread_t *workers;
+    pthread_mutex_t lock; // guards the fields below and blocks
+    pthread_cond_t changed; // broadcast whenever the fields below or blocks change
+    int64_t next_to_read; // the index of the next region for a worker to take
+    int64_t region_index; // the index of the region whose blocks are being returned
+    bool stop; // set to stop the workers early
+    int64_t next_block; // the index in its blocks of the next block to return, used only by the consumer
+};
+
+static void *read_regions(void *arg) {
+    Tai_Parallel_Reader *reader = arg;
+    FILE *fh = NULL;
+    LI *li;
+    if (is_url(reader->path)) {
+        li = LI_construct_from_path(reader->path);
+    } else {
+        fh = fopen(reader->path, "r");
+        li = fh != NULL ? LI_construct(fh) : NULL;
+    }
+    if (li == NULL) {
+        st_errAbort("Unable to open %s to read regions from\n", reader->path);
+    }
+    TaiIt *p_tai_it = NULL;
+    while (1) {
+        // take the next region, if it is not too far ahead of the one being returned
+        pthread_mutex_lock(&reader->lock);
+        while (!reader->stop && reader->next_to_read < stList_length(reader->regions) &&
+               reader->next_to_read >= reader->region_index + REGIONS_PER_THREAD * reader->thread_number) {
+            pthread_cond_wait(&reader->changed, &reader->lock);
+        }
+        if (reader->stop || reader->next_to_read >= stList_length(reader->regions)) {
+            pthread_mutex_unlock(&reader->lock);
+            break;
+        }
+        int64_t i = reader->next_to_read++;
+        pthread_mutex_unlock(&reader->lock);
+
+        // read its blocks, reading on from this worker's last region if it can
+        Tai_Region *region = stList_get(reader->regions, i);
+        TaiIt *tai_it = tai_iterator2(reader->tai, li, reader->run_length_encode_bases, region->contig,
+                                      region->start, region->end - region->start, p_tai_it, 1);
+        if (p_tai_it != NULL) {
+            tai_iterator_destruct(p_tai_it);
+        }
+        stList *blocks = stList_construct();
+        Alignment *alignment;
+        while ((alignment = tai_next(tai_it, li)) != NULL) {
+            stList_append(blocks, alignment);
+        }
+        if (tai_it->held != NULL) { // the blocks are destructed by the consumer, so must not link to held
+            unlink_left(tai_it->held);
+        }
+        p_tai_it = tai_it;
+
+        pthread_mutex_lock(&reader->lock);
+        reader->blocks[i] = blocks;
+        pthread_cond_broadcast(&reader->changed);
+        pthread_mutex_unlock(&reader->lock);
+    }
+    if (p_tai_it != NULL) {
+        tai_iterator_destruct(p_tai_it);
+    }
+    LI_destruct(li);
+    if (fh != NULL) {
+        fclose(fh);
+    }
+    return NULL;
+}
+
+Tai_Parallel_Reader *tai_parallel_reader_construct(Tai *tai, const char *path, bool run_length_encode_bases,
+                                                   stList *regions, bool sorted, int64_t threads) {
+    Tai_Parallel_Reader *reader = st_calloc(1, sizeof(Tai_Parallel_Reader));
+    reader->tai = tai;
+    reader->path = stString_copy(path);
+    reader->run_length_encode_bases = run_length_encode_bases;
+    reader->regions = tai_regions_to_read(regions, sorted);
+    reader->blocks = st_calloc(stList_length(reader->regions) + 1, sizeof(stList *));
+    reader->thread_number = threads > 1 ? threads : 1;
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->changed, NULL);
+    reader->workers = st_malloc(sizeof(pthread_t) * reader->thread_number);
+    for (int64_t i = 0; i < reader->thread_number; ++i) {
+        if (pthread_create(&reader->workers[i], NULL, read_regions, reader) != 0) {
+            st_errAbort("Unable to start a thread to read regions\n");
+        }
+    }
+    return reader;
+}
+
+Alignment *tai_parallel_reader_next(Tai_Parallel_Reader *reader, int64_t *region_index) {
+    while (reader->region_index < stList_length(reader->regions)) {
+        // wait for the current region to be read
+        pthread_mutex_lock(&reader->lock);
+        while (reader->blocks[reader->region_index] == NULL) {
+            pthread_cond_wait(&reader->changed, &reader->lock);
+        }
+        stList *blocks = reader->blocks[reader->region_index];
+        pthread_mutex_unlock(&reader->lock);
+
+        if (reader->next_block < stList_length(blocks)) {
+            if (region_index != NULL) {
+                *region_index = ((Tai_Region *)stList_get(reader->regions, reader->region_index))->index;
+            }
+            return stList_get(blocks, reader->next_block++);
+        }
+
+        // move on to the next region, letting the workers read further ahead
+        stList_destruct(blocks);
+        pthread_mutex_lock(&reader->lock);
+        reader->blocks[reader->region_index++] = NULL;
+        pthread_cond_broadcast(&reader->changed);
+        pthread_mutex_unlock(&reader->lock);
+        reader->next_block = 0;
+    }
+    return NULL;
+}
+
+void tai_parallel_reader_destruct(Tai_Parallel_Reader *reader) {
+    pthread_mutex_lock(&reader->lock);
+    reader->stop = 1;
+    pthread_cond_broadcast(&reader->changed);
+    pthread_mutex_unlock(&reader->lock);
+    for (int64_t i = 0; i < reader->thread_number; ++i) {
+        pthread_join(reader->workers[i], NULL);
+    }
+    // clean up the blocks of any regions that were read but not returned
+    for (int64_t i = reader->region_index; i < stList_length(reader->regions); ++i) {
+        if (reader->blocks[i] != NULL) {
+            for (int64_t j = stList_length(reader->blocks[i]) - 1; j >= (i == reader->region_index ? reader->next_block : 0); j--) {
+                alignment_destruct(stList_get(reader->blocks[i], j), 1);
+            }
+            stList_destruct(reader->blocks[i]);
+        }
+    }
+    pthread_mutex_destroy(&reader->lock);
+    pthread_cond_destroy(&reader->changed);
+    free(reader->workers);
+    free(reader->blocks);
+    stList_destruct(reader->regions);
+    free(reader->path);
+    free(reader);
+}
+
 stHash *tai_sequence_lengths(Tai *tai, LI *li) {
     // read the header
     LI_seek(li, 0);
@@ -675,36 +1494,18 @@ stHash *tai_sequence_lengths(Tai *tai, LI *li) {
     }
     tag_destruct(tag);
 
-    Alignment* (*maftaf_read_block)(Alignment*, bool, LI*) = maf_read_block_3;
-    if (!tai->maf) {
-        maftaf_read_block = taf_read_block;
-    }
-    
     stHash *seq_to_len = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, NULL);
 
-    // dummy record for querying the set
-    TaiRec qr;
-    qr.seq_pos = 0;
-
-    // the index keeps a set of sequence names, which is handy here
+    // the index keeps a table of sequence names, which is handy here
     // we iterate that, using the position index to hook into the first occurrence of
     // each name.  but we add every sequence name we can find for each block, not just reference
-    for (int64_t i = 0; i < stList_length(tai->names); ++i) {
-        char *seq = (char*)stList_get(tai->names, i);
+    for (int64_t i = 0; i < tai->contig_number; ++i) {
+        char *seq = tai->names + tai->contig_name_offsets[i];
         if (stHash_search(seq_to_len, seq) == NULL) {
-            qr.name = seq;
-            TaiRec *tair = stSortedSet_searchGreaterThanOrEqual(tai->idx, &qr);
-            assert(tair != NULL);
-            LI_seek(li, tair->file_pos);
-            LI_get_next_line(li);
-
-            if (!tai->maf) {
-                // force taf to start a new alignment at our current file position by making
-                // sure all coordinates are expressed as insertions
-                change_s_coordinates_to_i(LI_peek_at_next_line(li));
-            }
-            
-            Alignment *alignment = maftaf_read_block(NULL, run_length_encode_bases, li);
+            tai_seek(tai, li, tai->contig_starts[i]);
+
+            // Only the coordinates are needed, so don't keep the bases
+            Alignment *alignment = tai->maf ? maf_read_block2(li, 1) : taf_read_block2(NULL, run_length_encode_bases, 1, li);
             assert(alignment != NULL);
 
             Alignment_Row *row = alignment->row;
@@ -714,6 +1515,6 @@ stHash *tai_sequence_lengths(Tai *tai, LI *li) {
         }
     }
 
-    assert(stHash_size(seq_to_len) == stList_length(tai->names));
+    assert(stHash_size(seq_to_len) == tai->contig_number);
     return seq_to_len;
 }
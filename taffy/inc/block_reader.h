@@ -34,6 +34,19 @@ BlockReader *block_reader_open(LI *li);
  */
 Tag *block_reader_take_header(BlockReader *r);
 
+/*
+ * Read the blocks without their bases, keeping only the coordinates and lengths of the rows (see
+ * taf_read_block2). Must be called before block_reader_set_threads and before the first block is read.
+ */
+void block_reader_set_skip_bases(BlockReader *r, bool skip_bases);
+
+/*
+ * Parse the input on the given number of threads, using a Parallel_Reader (see taf.h). Must be
+ * called before the first block is read. MAF blocks are still linked one after another on the
+ * calling thread.
+ */
+void block_reader_set_threads(BlockReader *r, int64_t threads);
+
 bool block_reader_is_maf(const BlockReader *r);
 bool block_reader_run_length_encoded(const BlockReader *r);
 
@@ -14,15 +14,32 @@ typedef struct BGZF BGZF;
 
 struct BGZF;
 
+typedef struct _Sequence_Name_Pool Sequence_Name_Pool;
+typedef struct _Alignment_Arena_Pool Alignment_Arena_Pool;
+typedef struct _Read_Ahead Read_Ahead;
+
 typedef struct _LI {
 #ifdef USE_HTSLIB
     BGZF *bgzf;
 #else
     FILE *fh;
 #endif
-    char *line;
+    char *line; // if not NULL, a copy of the next line made by LI_peek_at_next_line
+    char *view; // the next line where it was read into, or NULL at the end of the file, see LI_next_line_view
+    int64_t view_length;
+    char *returned_line; // if not NULL, the copy of the line last returned by LI_next_line_view, freed on the next call
+    char *line_buffers[2]; // the lines read from the file by the calling thread go into these in turn,
+    size_t line_buffer_capacities[2]; // so that the line last returned stays valid while the next is read
+    int64_t line_buffer_index; // the line buffer holding the next line
     int64_t prev_pos; // position before reading the current buffer
     int64_t pos;      // position after reading the curent buffer    
+    char *buffer; // if not NULL, the lines are read from this buffer rather than the file, see LI_construct_from_buffer
+    int64_t buffer_length;
+    int64_t buffer_offset; // the offset in the buffer of the line after the current one
+    bool buffer_mapped; // if set, the buffer is the whole file, memory mapped by LI_construct
+    Sequence_Name_Pool *sequence_names; // the sequence names of the rows read, see sequence_name_intern in taf.h
+    Alignment_Arena_Pool *arenas; // the arenas of the blocks read, see alignment_arena_construct in taf.h
+    Read_Ahead *read_ahead; // if not NULL, the lines are read by a background thread, see LI_set_read_ahead
 } LI;
 
 
@@ -35,6 +52,19 @@ typedef struct _LI {
  */
 void LI_set_bgzf_threads(int n);
 
+/*
+ * Set whether LIs read ahead of the caller. If set, each LI made by LI_construct or LI_construct_from_path
+ * reads, decompresses and splits its lines on a background thread, filling a small ring of large buffers
+ * ahead of the lines being asked for, so that I/O overlaps with parsing. The LI behaves exactly as it
+ * otherwise would, including LI_tell, and LI_seek discards the lines read ahead and restarts the thread
+ * at the new position. Like LI_set_bgzf_threads this only affects LIs made after the call. Default is off.
+ */
+void LI_set_read_ahead(bool read_ahead);
+
+/*
+ * Construct an LI over the file. When built without htslib, an uncompressed regular file is memory mapped and
+ * its lines found in the mapping, rather than read through the file handle.
+ */
 LI *LI_construct(FILE *fh);
 
 /*
@@ -45,6 +75,12 @@ LI *LI_construct(FILE *fh);
  */
 LI *LI_construct_from_path(const char *path);
 
+/*
+ * Construct an LI over the lines in the given buffer of length bytes, whose positions are offsets into the buffer.
+ * The buffer is not copied, and must not be changed or freed until the LI is destructed.
+ */
+LI *LI_construct_from_buffer(char *buffer, int64_t length);
+
 void LI_destruct(LI *li);
 
 /*
@@ -64,6 +100,24 @@ char *LI_get_next_line(LI *li);
  */
 char *LI_peek_at_next_line(LI *li);
 
+/*
+ * Get the next line from the file without copying it, or NULL if at EOF, setting length to its length.
+ * The line belongs to the LI and is only valid until the next call on the LI. It is not NUL terminated,
+ * and must not be changed, unless it was changed in place through LI_peek_at_next_line, in which case the
+ * changed copy is returned. Use this rather than LI_get_next_line on hot paths, as it does not allocate.
+ */
+char *LI_next_line_view(LI *li, int64_t *length);
+
+/*
+ * As LI_next_line_view, but without moving on to the line after, as LI_peek_at_next_line.
+ */
+char *LI_peek_at_next_line_view(LI *li, int64_t *length);
+
+/*
+ * Replace the next line with the given line, which the LI takes ownership of, as if it had been read from the
+ * file. Like changing the line returned by LI_peek_at_next_line in place, but the line can be longer.
+ */
+void LI_set_next_line(LI *li, char *line);
 
 /*
  * Go to position in file
@@ -80,6 +134,9 @@ int64_t LI_tell(LI *li);
  * Writer for maf and taf block and header writing
  */
 
+typedef struct _Write_Behind Write_Behind;
+typedef struct _Tai_Writer Tai_Writer;
+
 typedef struct _LW {
     FILE *fh;
 #ifdef USE_HTSLIB
@@ -92,8 +149,24 @@ typedef struct _LW {
     char  *buf;
     size_t buf_pos;
     size_t buf_cap;
+    Write_Behind *write_behind; // if not NULL, full buffers are written by a background thread, see LW_set_write_behind
+    int64_t position; // the bytes written to the underlying stream, after compression
+    bool block_aligned_anchors; // see LW_set_block_aligned_anchors
+    int64_t anchor_every_n_bytes;
+    int64_t anchor_position; // the position of the stream at the last anchor
+    Tai_Writer *index; // if not NULL, the index the TAF writer adds its anchors to, see LW_set_index
 } LW;
 
+/*
+ * Set whether LWs write behind the caller. If set, each LW made by LW_construct hands its buffer, each time
+ * it fills, to a background thread that compresses and writes it, taking an empty buffer from a small ring
+ * in exchange, and waiting only if all the buffers of the ring are still to be written. Formatting then
+ * overlaps with compression and I/O. The bytes written and their order are unchanged, and LW_flush and
+ * LW_destruct wait for everything handed over to be written. Like LI_set_read_ahead this only affects LWs
+ * made after the call. Default is off.
+ */
+void LW_set_write_behind(bool write_behind);
+
 /*
  * Make a LW object. If use_compression is true and compiled with htslib will use bgzf compression on the stream.
  */
@@ -101,6 +174,44 @@ LW *LW_construct(FILE *fh, bool use_compression);
 
 void LW_destruct(LW *lw, bool clean_up_file_handle);
 
+/*
+ * Start each anchor line the TAF writer writes (see taf_line_is_anchor) in a new BGZF block, so that seeking to
+ * an anchor, as the index does, only decompresses from there on. If anchor_every_n_bytes is greater than zero,
+ * the writer also makes the first line of a block an anchor once about that many bytes have been written
+ * since the last, counting compressed bytes if compressing, in addition to anchoring every
+ * repeat_coordinates_every_n_columns.
+ */
+void LW_set_block_aligned_anchors(LW *lw, int64_t anchor_every_n_bytes);
+
+/*
+ * Returns non-zero if the next block's first line should be an anchor as anchor_every_n_bytes have been
+ * written since the last, see LW_set_block_aligned_anchors.
+ */
+bool LW_anchor_due(LW *lw);
+
+/*
+ * Called by the TAF writer before it writes an anchor line, which it then starts in a new BGZF block if
+ * set by LW_set_block_aligned_anchors.
+ */
+void LW_start_anchor(LW *lw);
+
+/*
+ * Have the TAF writer add the anchors it writes to the index as it writes them, see
+ * tai_writer_construct_for_lw in tai.h.
+ */
+void LW_set_index(LW *lw, Tai_Writer *index);
+
+/*
+ * Get the position in the file of the next byte to be written, as LI_tell would give for it when reading
+ * the file back. This flushes everything buffered, ending the current BGZF block so the position is exact
+ * even if bgzf is compressing on other threads, so should only be used occasionally.
+ */
+int64_t LW_tell(LW *lw);
+
+/*
+ * Write the formatted string, as fprintf. It goes through the same buffer as the LW_put* functions, so
+ * the two may be mixed freely.
+ */
 int LW_write(LW *lw, const char *string, ...);
 
 /*
@@ -132,6 +243,11 @@ void LW_putn(LW *lw, const char *s, size_t n);
  * dramatically cheaper than n function calls + branches. */
 void LW_putrep(LW *lw, char c, size_t n);
 void LW_puti64(LW *lw, int64_t v);
+
+/*
+ * Write out everything buffered, waiting for it to have been written if writing behind, so the underlying
+ * stream can be used directly afterwards.
+ */
 void LW_flush(LW *lw);
 
 #endif /* STLINE_ITERATOR_H_ */
@@ -21,15 +21,24 @@ struct _tag {
 
 typedef struct _row Alignment_Row;
 
+typedef struct _Alignment_Arena Alignment_Arena;
+
+typedef struct _Packed_Bases Packed_Bases;
+
 typedef struct _alignment {
     int64_t row_number; // Convenient counter of number rows in the alignment
     int64_t column_number; // Convenient counter of number of columns in this alignment
     Alignment_Row *row; // An alignment is just a sequence of rows
     Tag **column_tags; // The tags for each column, each stored as a sequence of tags
+    char **column_tag_strings; // If not NULL, the unparsed tags of each column, see alignment_get_column_tags
+    Alignment_Arena *arena; // The arena the alignment was allocated from, or NULL (see below)
+    char *base_matrix; // If not NULL, the bases of the rows laid out one after another, see alignment_get_base_matrix
+    int64_t row_stride; // The distance between the starts of consecutive rows in base_matrix
+    Alignment_Row **rows; // If not NULL, the rows in order, so rows[i] is the i-th row, see alignment_get_row
 } Alignment;
 
 struct _row { // Each row encodes the information about an aligned sequence
-    char *sequence_name; // name of sequence
+    char *sequence_name; // name of sequence, a shared handle made with sequence_name_construct (see below)
     int64_t start, length, sequence_length; // zero based, half open coordinates, length is the number of non gap bases in the row
     bool strand; // nonzero is "+" else "-"
     char *bases; // [A-Za-z*+]* string of bases and gaps representing the alignment of the row
@@ -40,8 +49,133 @@ struct _row { // Each row encodes the information about an aligned sequence
     Alignment_Row *n_row;  // the next row in the alignment
     int64_t bases_since_coordinates_reported; // this number is used by taf write coordinates to
     // indicate how many bases ago were the row's coordinates printed
+    Alignment_Arena *arena; // The arena the row was allocated from, or NULL (see below)
+    Alignment_Arena *bases_arena; // If not NULL, the arena of the base matrix holding the bases, when that is
+    // not the arena of the row, of which the row holds a reference (see alignment_get_base_matrix)
+    int64_t row_index; // The index of the row in the rows array of its alignment
+    Packed_Bases *packed_bases; // If not NULL, the bases of the row in packed form, in which case bases is NULL,
+    // see alignment_pack_rows
 };
 
+/*
+ * Sequence names. The name of a row is an immutable, reference counted string, so that the rows of
+ * consecutive blocks and the rows made from one another share a single copy of it rather than each
+ * allocating their own. A name is an ordinary NUL-terminated string to read, but it must only be made
+ * with sequence_name_construct or sequence_name_copy and released with sequence_name_destruct (which
+ * alignment_row_destruct does), never with free.
+ */
+
+/*
+ * Make a sequence name from the first name_length characters of name.
+ */
+char *sequence_name_construct(const char *name, int64_t name_length);
+
+/*
+ * Get another reference to a sequence name, without copying it.
+ */
+char *sequence_name_copy(char *sequence_name);
+
+/*
+ * Release a reference to a sequence name, freeing it when there are no more.
+ */
+void sequence_name_destruct(char *sequence_name);
+
+/*
+ * Returns true if the two sequence names are the same. Names that are the same handle, as all names read
+ * through the same LI are (see sequence_name_intern), are recognised without comparing any characters.
+ */
+bool sequence_name_equal(char *sequence_name_1, char *sequence_name_2);
+
+/*
+ * Get a reference to the name of the name_length characters of name from the pool of names of the LI,
+ * adding it if not already present. Each distinct name is thereby allocated just once per LI, however
+ * many rows of however many blocks carry it. The pool is freed by LI_destruct.
+ */
+char *sequence_name_intern(LI *li, const char *name, int64_t name_length);
+
+/*
+ * Release the pool of names of an LI, as done by LI_destruct.
+ */
+void sequence_name_pool_destruct(Sequence_Name_Pool *pool);
+
+/*
+ * Block arenas. The blocks read by taf_read_block and maf_read_block are allocated from an arena, which
+ * holds the alignment, its rows and the column tag array, and their bases from a second arena, so reading a
+ * block makes a handful of allocations rather than several per row. Each arena is released once everything
+ * allocated from it has been destructed, and is then reused for a later block read through the same LI; when
+ * streaming through a file the block being read reuses the arenas of the block before the previous one.
+ * Keeping the bases apart means they can be released, e.g. by alignment_pack_rows, while the block is kept.
+ *
+ * The destructors work as before, whether or not a structure is in an arena. Code that replaces the bases of
+ * a row must release the old bases with alignment_row_free_bases, and code that replaces the column tag array
+ * of an alignment must release the old array with alignment_arena_free, using the arena of the alignment,
+ * rather than free.
+ */
+
+/*
+ * Get an arena to allocate a block from, reusing a released arena of the LI if there is one.
+ */
+Alignment_Arena *alignment_arena_construct(LI *li);
+
+/*
+ * Get an arena that belongs to no LI, with room for capacity bytes, which is freed once released rather
+ * than being reused. Used for the blocks made by merging and splitting other blocks.
+ */
+Alignment_Arena *alignment_arena_construct_unpooled(int64_t capacity);
+
+/*
+ * Allocate memory from the arena, which is released with the arena.
+ */
+void *alignment_arena_malloc(Alignment_Arena *arena, int64_t size);
+
+/*
+ * As alignment_arena_malloc, but zeroing the memory.
+ */
+void *alignment_arena_calloc(Alignment_Arena *arena, int64_t size);
+
+/*
+ * Add a reference to the arena, which must be matched by a call to alignment_arena_destruct. An alignment
+ * or row allocated from an arena holds one reference.
+ */
+void alignment_arena_copy(Alignment_Arena *arena);
+
+/*
+ * Release a reference to the arena, releasing the arena for reuse when there are no more.
+ */
+void alignment_arena_destruct(Alignment_Arena *arena);
+
+/*
+ * Returns true if the memory was allocated from the arena.
+ */
+bool alignment_arena_owns(Alignment_Arena *arena, void *memory);
+
+/*
+ * Free memory of a block, unless it was allocated from the arena (which may be NULL).
+ */
+void alignment_arena_free(Alignment_Arena *arena, void *memory);
+
+/*
+ * Release the pool of arenas of an LI, as done by LI_destruct. Arenas still in use are freed once released.
+ */
+void alignment_arena_pool_destruct(Alignment_Arena_Pool *pool);
+
+/*
+ * Make li2 return its blocks' arenas to the same pool as li, so that blocks read through li2 on another thread
+ * reuse the memory of those read through li and vice versa. May be called on several threads at once for the
+ * same li.
+ */
+void alignment_arena_pool_share(LI *li, LI *li2);
+
+/*
+ * Make an empty alignment, allocated from the arena if it is not NULL.
+ */
+Alignment *alignment_construct(Alignment_Arena *arena);
+
+/*
+ * Make an empty row, allocated from the arena if it is not NULL.
+ */
+Alignment_Row *alignment_row_construct(Alignment_Arena *arena);
+
 /*
  * Add nucleotide coloring to a character for pretty printing
  */
@@ -84,6 +218,22 @@ Tag *tag_parse(char *tag_string, char *delimiter, Tag *p_tag);
  */
 void alignment_destruct(Alignment *alignment, bool cleanup_rows);
 
+/*
+ * Get the tags of a column of the alignment. taf_read_block keeps the tags of each column as the text
+ * it read, in column_tag_strings, and they are only parsed into column_tags the first time they are
+ * asked for here, so column_tags[column_index] must not be read directly for a block read from a taf
+ * without calling this first. Once parsed the tags may be modified in place like any others. Tags set
+ * directly in column_tags[column_index] replace the unparsed tags of the column, which are then dropped.
+ * Unparsed tags are written back out by taf_write_block exactly as they were read.
+ */
+Tag *alignment_get_column_tags(Alignment *alignment, int64_t column_index);
+
+/*
+ * Parse the tags of every column of the alignment, as alignment_get_column_tags, so that column_tags
+ * can then be used directly.
+ */
+void alignment_parse_column_tags(Alignment *alignment);
+
 /*
  * Use the O(ND) alignment to diff the rows between two alignments and connect together their rows
  * so that we can determine which rows in the right_alignment are a continuation of rows in the
@@ -114,16 +264,46 @@ int64_t alignment_number_of_common_rows(Alignment *left_alignment, Alignment *ri
  */
 Alignment *alignment_merge_adjacent(Alignment *left_alignment, Alignment *right_alignment);
 
+/*
+ * As alignment_merge_adjacent, but if pack_gap_rows is true the merged rows that are mostly gaps are kept
+ * in the sparse packed form (see packed bases below), with row->bases NULL, rather than as strings.
+ */
+Alignment *alignment_merge_adjacent2(Alignment *left_alignment, Alignment *right_alignment, bool pack_gap_rows);
+
 /*
  * Get the rows of the alignment in a list.
  */
 stList *alignment_get_rows_in_a_list(Alignment_Row *row);
 
 /*
- * Set the rows in the alignment given a list of rows
+ * Set the rows in the alignment given a list of rows, updating the row index (see alignment_index_rows).
  */
 void alignment_set_rows(Alignment *alignment, stList *rows);
 
+/*
+ * Row index. Alongside the linked list of rows starting at alignment->row, an alignment keeps an array of
+ * its rows, alignment->rows, and each row its index in that array, row->row_index, so that rows can be
+ * looked up by index in constant time. The readers, alignment_set_rows, alignment_merge_adjacent,
+ * alignment_split_at_reference_gaps, the row filters and alignment_pad_the_rows keep the index in step with
+ * the list. Code that otherwise adds, removes or reorders the rows of an alignment must call
+ * alignment_index_rows once it is done. An alignment made by hand with no index gets one when first needed.
+ */
+
+/*
+ * Rebuild the row index of the alignment from its list of rows, also setting row_number.
+ */
+void alignment_index_rows(Alignment *alignment);
+
+/*
+ * Get the array of the rows of the alignment, in order, building the row index if it has none.
+ */
+Alignment_Row **alignment_get_rows(Alignment *alignment);
+
+/*
+ * Get the row of the alignment with the given index, which must be less than row_number.
+ */
+Alignment_Row *alignment_get_row(Alignment *alignment, int64_t row_index);
+
 /*
  * Remove any column of the alignment that consists entirely of gaps, e.g. as left behind when the
  * only row with a base in that column has been filtered out. The bases of each row and the column
@@ -150,6 +330,62 @@ int64_t alignment_remove_all_gap_columns(Alignment *alignment);
  */
 stList *alignment_split_at_reference_gaps(Alignment *alignment);
 
+/*
+ * Base matrices. The bases of the rows of a block may be held in one contiguous row-major matrix, with
+ * the bases of the i-th row starting at base_matrix + i * row_stride, so a pass over the columns of a block
+ * can step through the rows by adding the stride rather than following n_row. Each row is still null
+ * terminated, and the bytes between the end of a row and the start of the next are unused padding.
+ *
+ * The blocks returned by taf_read_block and maf_read_block have a base matrix, and alignment_merge_adjacent,
+ * alignment_split_at_reference_gaps, alignment_pad_the_rows, alignment_remove_all_gap_columns and the
+ * clipping done by tai_next keep it, unless asked to pack rows that are mostly gaps (see below). Anything else
+ * that adds, removes, reorders or replaces the bases of rows leaves base_matrix stale, which
+ * alignment_get_base_matrix detects, and can call alignment_pack_bases or alignment_unpack_rows to lay the rows
+ * out again.
+ */
+
+/*
+ * The row stride of the base matrix of a block with the given number of columns. This is at least
+ * column_number + 1, rounded up so that every row starts on a 16 byte boundary.
+ */
+int64_t alignment_row_stride(int64_t column_number);
+
+/*
+ * Get the base matrix of the alignment, checking that it is current, i.e. that the bases of every row
+ * are where the matrix says they are. Returns NULL if the alignment has no rows or no current base matrix.
+ */
+char *alignment_get_base_matrix(Alignment *alignment);
+
+/*
+ * Copy the bases of the rows into a new base matrix, unless they are already in one. Returns false, leaving the
+ * alignment as it is, if a row has no bases, see taf_read_block2.
+ */
+bool alignment_pack_bases(Alignment *alignment);
+
+/*
+ * Release the bases of a row, wherever they were allocated and whether or not they are packed, and set them
+ * to NULL.
+ */
+void alignment_row_free_bases(Alignment_Row *row);
+
+/*
+ * Transpose column_number columns of bases, stored one after another in a single buffer (each column
+ * being row_number bytes long), into the given row buffers, so that rows[i][j] is the base of row i in
+ * column j. Each row buffer must be at least column_number long and is not null terminated. Sets
+ * row_lengths[i] to the number of non-gap bases in row i. The transpose is done in tiles, using vector
+ * instructions where available, so it stays cache friendly for blocks with thousands of rows.
+ */
+void alignment_transpose_columns(const char *columns, int64_t row_number, int64_t column_number,
+                                 char **rows, int64_t *row_lengths);
+
+/*
+ * The reverse of alignment_transpose_columns: copy the bases of columns [column_start, column_start +
+ * column_number) out of the given row buffers into a single buffer, one column after another, so that
+ * columns[j * row_number + i] is rows[i][column_start + j].
+ */
+void alignment_transpose_rows(char **rows, int64_t row_number, int64_t column_start, int64_t column_number,
+                              char *columns);
+
 /*
  * Read a column of the alignment into the buffer. The buffer must be initialized and be at least
  * of length alignment->row_number.
@@ -166,6 +402,109 @@ char *alignment_get_column(Alignment *alignment, int64_t column_index);
  */
 int32_t *alignment_get_column_as_int_array(Alignment *alignment, int64_t column_index);
 
+/*
+ * Read the columns [column_start, column_start + column_number) of the alignment into the buffer, one column
+ * after another, so buffer[j * row_number + i] is the base of row i in column column_start + j. The buffer must
+ * be at least row_number * column_number long, and is not null terminated. The block is transposed in one
+ * cache friendly pass (see alignment_transpose_rows), so this is much faster than reading it a column at a time.
+ */
+void alignment_get_columns_in_buffer(Alignment *alignment, int64_t column_start, int64_t column_number,
+                                     char *buffer);
+
+/*
+ * As alignment_get_columns_in_buffer, but with each base encoded as in alignment_get_column_as_int_array.
+ */
+void alignment_get_columns_as_int8_in_buffer(Alignment *alignment, int64_t column_start, int64_t column_number,
+                                             int8_t *buffer);
+
+/*
+ * As alignment_get_columns_as_int8_in_buffer, but encoding into 32 bit integers.
+ */
+void alignment_get_columns_as_int32_in_buffer(Alignment *alignment, int64_t column_start, int64_t column_number,
+                                              int32_t *buffer);
+
+/*
+ * Packed bases. The bases of a row may be held packed rather than as a string, at two bits a base for
+ * A, C, G and T, plus a bitmap of the columns that are not one of those, a bitmap of the columns that
+ * are soft-masked (lower case) and a sorted list of the few columns holding anything other than a base
+ * or a gap, such as N, IUPAC codes or *, together with their characters. The bitmaps are left out when
+ * they would be empty, so an upper case block without gaps takes a quarter of the memory of its string.
+ *
+ * A row that is mostly gaps, such as the rows added by alignment_pad_the_rows2 and those alignment_merge_adjacent2
+ * fills out with gaps when asked to pack them, is instead held sparse, as the list of its runs of columns that
+ * are not gaps together with their bases, so takes memory in proportion to its bases rather than its columns.
+ *
+ * Packing is lossless: decoding gives back exactly the string that was packed.
+ */
+
+/*
+ * Pack the first length characters of bases, in whichever of the two forms is smaller.
+ */
+Packed_Bases *packed_bases_construct(const char *bases, int64_t length);
+
+/*
+ * Make packed bases for a row of length gaps, in the sparse form.
+ */
+Packed_Bases *packed_bases_construct_gaps(int64_t length);
+
+/*
+ * Cleanup packed bases.
+ */
+void packed_bases_destruct(Packed_Bases *packed_bases);
+
+/*
+ * Get the number of bases (including gaps) that were packed.
+ */
+int64_t packed_bases_length(Packed_Bases *packed_bases);
+
+/*
+ * Returns true if the bases are in the sparse form.
+ */
+bool packed_bases_is_sparse(Packed_Bases *packed_bases);
+
+/*
+ * Get the base in the given column.
+ */
+char packed_bases_get_base(Packed_Bases *packed_bases, int64_t column_index);
+
+/*
+ * Decode the bases of the columns [column_start, column_start + column_number) into the buffer, which
+ * must be at least column_number long and is not null terminated.
+ */
+void packed_bases_decode(Packed_Bases *packed_bases, int64_t column_start, int64_t column_number, char *buffer);
+
+/*
+ * Count the gaps in the columns [column_start, column_start + column_number), working on the gap bitmap
+ * a word at a time rather than decoding the bases.
+ */
+int64_t packed_bases_count_gaps(Packed_Bases *packed_bases, int64_t column_start, int64_t column_number);
+
+/*
+ * Compare two equal length rows of packed bases, as taffy coverage does a column at a time. Sets *aligned to
+ * the number of columns in which both have a base other than N (in either case) and *identical to the number
+ * of those in which the two bases are the same, ignoring case. The bitmaps and 2-bit codes are compared a word
+ * at a time, only the exceptional columns being decoded.
+ */
+void packed_bases_compare(Packed_Bases *packed_bases_1, Packed_Bases *packed_bases_2, int64_t *aligned,
+                          int64_t *identical);
+
+/*
+ * Replace the bases of every row of the alignment that has them with packed bases, releasing the bases.
+ * The column accessors (alignment_get_column_in_buffer and the like) and the taf and maf writers decode
+ * packed rows as they go, and alignment_merge_adjacent and alignment_pad_the_rows take blocks with packed
+ * rows, so a packed block can be kept, read from and written in a quarter of the memory or less, e.g. when
+ * loading many blocks at once. The other functions that change the bases of a block, such as
+ * alignment_remove_all_gap_columns, alignment_split_at_reference_gaps and the masking functions, first
+ * unpack it with alignment_unpack_rows.
+ */
+void alignment_pack_rows(Alignment *alignment);
+
+/*
+ * Decode any packed rows of the alignment back into bases, laying out the rows in a new base matrix. Returns
+ * false, leaving the alignment as it is, if a row has neither bases nor packed bases, see taf_read_block2.
+ */
+bool alignment_unpack_rows(Alignment *alignment);
+
 /*
  * Cleanup a row
  */
@@ -207,6 +546,11 @@ Tag *maf_read_header(LI *li);
  */
 Alignment *maf_read_block(LI *li);
 
+/*
+ * As maf_read_block, but if skip_bases is non-zero the bases of the rows are not kept, as taf_read_block2.
+ */
+Alignment *maf_read_block2(LI *li, bool skip_bases);
+
 /*
  * Write a maf header line
  */
@@ -245,6 +589,52 @@ Tag *taf_read_header_2(LI *li, bool *run_length_encode_bases);
  */
 Alignment *taf_read_block(Alignment *p_block, bool run_length_encode_bases, LI *li);
 
+/*
+ * As taf_read_block, but if skip_bases is non-zero the bases of the block are not kept. The rows have their
+ * coordinates and lengths, and the block its column number, as usual, but the bases of each row are NULL and
+ * any column tags are dropped. This is much cheaper for passes over an alignment that only need coordinates.
+ * The block can be linked to others and destructed as normal, but must not be written out.
+ */
+Alignment *taf_read_block2(Alignment *p_block, bool run_length_encode_bases, bool skip_bases, LI *li);
+
+/*
+ * Reads the blocks of a taf or maf on multiple threads. A producer thread cuts the input into chunks of lines,
+ * the chunks are parsed by a pool of worker threads and the blocks are returned in order. At most a couple of
+ * chunks per worker are read ahead of the blocks being returned.
+ *
+ * A taf is cut at anchor lines (see taf_line_is_anchor), and the rows of the first block of each chunk are
+ * linked to those of the last block of the previous chunk, just as taf_read_block would link them. Chunks only
+ * end at anchors, so a taf with none is decoded by one thread. A maf is cut at the start of a block, and as with
+ * maf_read_block the blocks are not linked, which is left to the caller (see alignment_link_adjacent).
+ */
+typedef struct _Parallel_Reader Parallel_Reader;
+
+/*
+ * Start reading taf blocks from li, whose header must already have been read, using the given number of worker
+ * threads. With fewer than two threads the blocks are read by taf_read_block2 on the calling thread. A chunk
+ * is ended at the first anchor after it reaches chunk_size bytes, or a default of a few megabytes if chunk_size
+ * is 0. The reader reads li on its own thread, so li must not be used until the reader is destructed.
+ * If skip_bases is non-zero the blocks are read without their bases, as taf_read_block2.
+ */
+Parallel_Reader *taf_parallel_reader_construct(LI *li, bool run_length_encode_bases, bool skip_bases, int64_t threads,
+                                               int64_t chunk_size);
+
+/*
+ * As taf_parallel_reader_construct, but reading maf blocks, as maf_read_block2.
+ */
+Parallel_Reader *maf_parallel_reader_construct(LI *li, bool skip_bases, int64_t threads, int64_t chunk_size);
+
+/*
+ * Get the next block, or NULL if there are no more. As for taf_read_block, p_block is the previous block
+ * returned, to which the rows of a taf block are linked, or NULL for the first block.
+ */
+Alignment *parallel_reader_next(Parallel_Reader *reader, Alignment *p_block);
+
+/*
+ * Stop the threads and clean up the reader, including any blocks that were decoded but not returned.
+ */
+void parallel_reader_destruct(Parallel_Reader *reader);
+
 /*
  * Write a taf header line
  */
@@ -266,20 +656,89 @@ void taf_write_block2(Alignment *p_alignment, Alignment *alignment, bool run_len
 // the following are low-level functions used in indexing.  they could
 // potentially be better put in an "internal" header
 
-/**
- * Check if a tokenized TAF line has coordinates (ie search for ;)
- * If coordinates found, the position of the simicolon in the list is set in j
+/*
+ * A TAF line scanned in place. Each field is a borrowed [start, end) slice of the line buffer, which
+ * must outlive it and is not modified. A field that is not present on the line is left as NULL.
  */
-bool has_coordinates(stList *tokens, int64_t *j);
+typedef struct _Taf_Line {
+    char *bases, *bases_end; // the bases of the column, either a single token or run length encoded "base count" pairs
+    char *coordinates, *coordinates_end; // the coordinate operations following the ";" token
+    char *tags, *tags_end; // the key:value tags following the "@" token
+} Taf_Line;
 
-/**
- * Parse the coordinates coming after an "i" or "s" field on a TAF line
- * Returns the sequence name (newly allocated) and sets the strand and
- * position and length in the parameters. *j is the position of the "i" 
- * or "s" in the tokenized line, and will be incremented for each field read
+/*
+ * A single coordinate operation from a TAF line. Names and gap sequences are borrowed from the line.
  */
-char *parse_coordinates(int64_t *j, stList *tokens, int64_t *start, bool *strand,
-                        int64_t *sequence_length);
+typedef struct _Taf_Coordinate_Op {
+    char type; // One of 'i' (insert row), 's' (substitute row), 'd' (delete row), 'g' (gap) or 'G' (gap with sequence)
+    int64_t row_index; // The index of the affected row
+    char *sequence_name; // For 'i' and 's', the sequence name, which is sequence_name_length long
+    int64_t sequence_name_length;
+    int64_t start, sequence_length; // For 'i' and 's'
+    bool strand; // For 'i' and 's', nonzero is "+" else "-"
+    char *gap_sequence; // For 'G', the interstitial gap sequence
+    int64_t gap_length; // For 'g' and 'G', the length of the gap
+} Taf_Coordinate_Op;
+
+/*
+ * Scan a TAF line in a single pass, without copying or allocating, filling out taf_line. Returns false if
+ * the line contains only white space.
+ */
+bool taf_line_scan(char *line, Taf_Line *taf_line);
+
+/*
+ * As taf_line_scan, but for a line of the given length, which need not be NUL terminated, such as one
+ * from LI_next_line_view.
+ */
+bool taf_line_scan2(char *line, int64_t length, Taf_Line *taf_line);
+
+/*
+ * Returns non-zero if the scanned line has coordinates (ie has a ";" token)
+ */
+bool taf_line_has_coordinates(Taf_Line *taf_line);
+
+/*
+ * Parse the next coordinate operation, starting at *cursor, which is initially taf_line->coordinates,
+ * and advances *cursor past it. Returns false when there are no further operations.
+ */
+bool taf_line_next_coordinate_op(Taf_Line *taf_line, char **cursor, Taf_Coordinate_Op *op);
+
+/*
+ * The number of bases in the column, ie the number of rows of the block it belongs to.
+ */
+int64_t taf_line_column_length(Taf_Line *taf_line, bool run_length_encode_bases);
+
+/*
+ * Decode the bases of the column into the given buffer, which must be at least column_length long. The
+ * column must have exactly column_length bases. The buffer is not null terminated.
+ */
+void taf_line_get_bases(Taf_Line *taf_line, bool run_length_encode_bases, char *column, int64_t column_length);
+
+/*
+ * Parse the column tags of the line, returning NULL if there are none. Each tag, including its key and
+ * value, is a single allocation, so is freed by tag_destruct.
+ */
+Tag *taf_line_parse_tags(Taf_Line *taf_line);
+
+/*
+ * Returns non-zero if the scanned line is an anchor, that is its coordinate operations are any row deletions
+ * followed by an insertion or substitution of every row of its block in order, as taf_write_block writes
+ * them at the start of a contig and every repeat_coordinates_every_n_columns. The rows of an anchor do not
+ * depend on those of the previous block, so decoding can start from it.
+ */
+bool taf_line_is_anchor(Taf_Line *taf_line, bool run_length_encode_bases);
+
+/*
+ * Rewrite the line in place so that its substitutions are insertions and any other coordinate operations
+ * are dropped, so it can be read as the first line of a file.
+ */
+void taf_line_substitutions_to_insertions(char *line);
+
+/*
+ * Get a copy of the line with its coordinate operations replaced by the given ones, which should start with
+ * a space, keeping its bases and tags.
+ */
+char *taf_line_with_coordinates(char *line, const char *coordinates);
 
 /**
  * Sniff file format from header line.  returns:
@@ -385,6 +844,13 @@ void alignment_filter_duplicate_rows(Alignment *alignment, stList *prefixes_to_m
  */
 void alignment_pad_the_rows(Alignment *p_alignment, Alignment *alignment, stList *sequence_prefixes);
 
+/*
+ * As alignment_pad_the_rows, but if pack_gap_rows is true the padding rows are added in the sparse packed
+ * form, with row->bases NULL, so take no memory per column.
+ */
+void alignment_pad_the_rows2(Alignment *p_alignment, Alignment *alignment, stList *sequence_prefixes,
+                             bool pack_gap_rows);
+
 /*
  * Load sequences in fasta files into a hash from sequence names to sequences
  */
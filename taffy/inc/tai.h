@@ -36,13 +36,28 @@ Anc0.Anc0refChr11	10007	1447404025502
 Anc0.Anc0refChr11	20008	30064728450
 Anc0.Anc0refChr11	30085	30064782171
  *
+ * An index can instead be written in a binary format (see tai_create2), which holds the same records in flat
+ * arrays sorted by contig name and then position, after a header with a version number. It is loaded by memory
+ * mapping it rather than parsing it, so loading it takes the same time however large it is. It is written in
+ * the byte order of the machine that made it. tai_load reads either format.
  */
 
 #include "line_iterator.h"
 
 typedef struct _Tai {
-    stSortedSet *idx;
-    stList *names; // just to keep track of memory -- we only keep one instance of each sequence name
+    char *image; // the binary index, which the arrays below point into
+    int64_t image_length;
+    bool mapped; // if set, image is memory mapped from the index file, else it was made from the text index
+    int64_t contig_number;
+    int64_t record_number;
+    int64_t *contig_starts; // the records of contig i are contig_starts[i] to contig_starts[i+1]-1
+    int64_t *contig_name_offsets; // the name of contig i is names + contig_name_offsets[i]
+    int64_t *seq_pos; // the position in its contig of each record, the records being sorted by contig name and then position
+    int64_t *file_pos; // the offset in the file of each record
+    int64_t *state_offsets; // if not NULL, for each record of a block between anchors the offset in states of the
+                            // coordinates of its rows, else -1, see tai_create2
+    char *names;
+    char *states;
     bool maf;
 } Tai;
 
@@ -55,8 +70,29 @@ typedef struct _TaiIt {
     Alignment *p_alignment;
     bool run_length_encode_bases;
     bool maf;
+    bool keep_next; // if set, the block read after the region is kept in held, see tai_iterator2
+    int64_t p_end; // the reference end of the last block returned, before it was clipped
+    Alignment *held; // the block read after the region, from which a following region can be read without seeking
+    int64_t held_file_pos; // the position of the line before held
+    int64_t held_start_pos; // the position of the first line of held
 } TaiIt;
 
+typedef struct _Tai_Region {
+    char *contig;
+    // these are bed-like 0-based half-open
+    int64_t start;
+    int64_t end;
+    int64_t index; // the position of the region in the list it was given in
+} Tai_Region;
+
+typedef struct _TaiRegionsIt {
+    Tai *tai;
+    bool run_length_encode_bases;
+    stList *regions; // the regions to read, in the order they are read
+    int64_t region_index; // the index in regions of the current region
+    TaiIt *tai_it; // the iterator of the current region
+} TaiRegionsIt;
+
 
 /* Return taf_path + .tai 
  */
@@ -79,7 +115,58 @@ char *tai_parse_region(const char* region, int64_t *start, int64_t *length);
 int tai_create(LI *li, FILE* idx_fh, int64_t index_block_size);
 
 /*
- * Load the index from disk
+ * As tai_create, but if binary is non-zero writes the binary format of the index. If index_every_k_blocks is
+ * greater than zero, which needs the binary format, every index_every_k_blocks-th block between anchor lines is
+ * also indexed, together with the coordinates of its rows so that reading can start from it, so that a query
+ * reads at most that many blocks before those it wants.
+ */
+int tai_create2(LI *li, FILE* idx_fh, int64_t index_block_size, bool binary, int64_t index_every_k_blocks);
+
+/*
+ * As tai_create2, but if threads is greater than one and path is the path of the file li reads, an index of a TAF
+ * that does not index the blocks between anchors is made on that many threads. The file is split into ranges,
+ * at the start of BGZF blocks if it is bgzipped, and each is scanned for coordinates lines by a thread with its
+ * own handle on the file, before the index records are picked from those found, in order, as tai_create2 does.
+ * The index is the same as tai_create2 makes.
+ */
+int tai_create3(LI *li, const char *path, FILE* idx_fh, int64_t index_block_size, bool binary,
+                int64_t index_every_k_blocks, int64_t threads);
+
+/*
+ * Writes the lines of an index one at a time, as tai_create does, and as the TAF writer does when making
+ * the index of a TAF as it is written (see LW_set_index). If binary is non-zero, the lines are kept until
+ * the writer is destructed and then written in the binary format.
+ */
+Tai_Writer *tai_writer_construct(FILE *idx_fh, int64_t index_block_size, bool binary);
+
+/*
+ * Index the TAF that lw is writing to taf_path as it is written, putting the index in tai_path(taf_path).
+ * This saves reading the TAF back to index it. Call tai_writer_destruct once lw has been destructed to
+ * finish the index. If built with htslib and lw is not compressing, the positions of the lines in the
+ * file are not known as they are written, so the TAF is indexed by tai_writer_destruct instead.
+ */
+Tai_Writer *tai_writer_construct_for_lw(LW *lw, const char *taf_path, int64_t index_block_size);
+
+/*
+ * Finish the index, closing idx_fh.
+ */
+void tai_writer_destruct(Tai_Writer *tw);
+
+/*
+ * Returns non-zero if a line at position pos of the reference sequence ref should be indexed: the first line of
+ * each reference sequence and then lines at least index_block_size bases on.
+ */
+bool tai_writer_wants(Tai_Writer *tw, const char *ref, int64_t pos);
+
+/*
+ * Add the index line for a line at position pos of the reference sequence ref, which is at file_pos in the
+ * file (as LI_tell), using the relative "*" encoding if ref is that of the previous line.
+ */
+void tai_writer_add(Tai_Writer *tw, const char *ref, int64_t pos, int64_t file_pos);
+
+/*
+ * Load the index from disk, in either format. A binary index is memory mapped, and the mapping is kept
+ * after idx_fh is closed.
  */
 Tai *tai_load(FILE* idx_fh, bool maf);
 
@@ -96,6 +183,16 @@ void tai_destruct(Tai* idx);
  */
 TaiIt *tai_iterator(Tai* idx, LI *li, bool run_length_encode_bases, const char *contig, int64_t start, int64_t length);
 
+/*
+ * As tai_iterator, but if p_tai_it is not NULL it is the iterator of the region read just before this one from
+ * the same file, and if it was constructed with keep_next set and the region starts after it on the same
+ * contig the blocks are read on from where it stopped, rather than seeking back through the index.
+ * Set keep_next if another region may be read after this one, so that the block read past the end of the
+ * region is kept for it. If p_tai_it is not NULL it must be destroyed after the returned iterator is constructed.
+ */
+TaiIt *tai_iterator2(Tai* idx, LI *li, bool run_length_encode_bases, const char *contig, int64_t start, int64_t length,
+                     TaiIt *p_tai_it, bool keep_next);
+
 /*
  * Iterate through a region as obtained via the iterator
  */
@@ -111,6 +208,68 @@ bool tai_has_next(TaiIt *tai_it);
  */
 void tai_iterator_destruct(TaiIt *tai_it);
 
+/*
+ * Construct / destruct a region, copying the contig name
+ */
+Tai_Region *tai_region_construct(const char *contig, int64_t start, int64_t end, int64_t index);
+
+void tai_region_destruct(Tai_Region *region);
+
+/*
+ * Read the regions of a BED file, one from the first three columns of each line, skipping empty, comment,
+ * "track" and "browser" lines. Exits with an error for a line that is not a region.
+ * Returns a list of Tai_Region, indexed in the order they are in the file.
+ */
+stList *tai_read_bed(FILE *bed_fh);
+
+/*
+ * Get the regions as tai_regions_iterator reads them: those that are not empty, sorted and merged if sorted is
+ * set, else in the order given. Returns a list of copies of the regions.
+ */
+stList *tai_regions_to_read(stList *regions, bool sorted);
+
+/*
+ * Iterate through the blocks of a list of regions, as tai_iterator would for each in turn.
+ * If sorted is set the regions are read in [contig, start] order, with overlapping and adjacent regions merged
+ * into one (the index of the merged region being the smallest of those merged), so that the file is read
+ * forward and regions near each other are read without seeking between them. Else they are read in the order
+ * given, each region being returned whole even if it overlaps others.
+ * The regions list is not modified, and can be destroyed after this returns.
+ */
+TaiRegionsIt *tai_regions_iterator(Tai *idx, LI *li, bool run_length_encode_bases, stList *regions, bool sorted);
+
+/*
+ * Get the next block, or NULL when all the regions are done. If region_index is not NULL it is set to the index
+ * of the region the block is in. Consecutive blocks of the same region are linked as tai_next links them, but the
+ * first block of each region is not linked to the blocks before it.
+ */
+Alignment *tai_regions_next(TaiRegionsIt *tai_regions_it, LI *li, int64_t *region_index);
+
+void tai_regions_iterator_destruct(TaiRegionsIt *tai_regions_it);
+
+/*
+ * Reads the blocks of a list of regions on multiple threads, returning them as tai_regions_next would. Each worker
+ * thread opens its own LI on the file at path (a local path or a URL), shares the index, which is only read,
+ * and reads whole regions, taking the next region not yet read. The blocks of each region are kept until
+ * the consumer has got them, and the regions are returned in order, at most a few regions per worker being read
+ * ahead of the one being returned. Reading regions on many threads hides the latency of reading a remote or
+ * network file.
+ */
+typedef struct _Tai_Parallel_Reader Tai_Parallel_Reader;
+
+Tai_Parallel_Reader *tai_parallel_reader_construct(Tai *idx, const char *path, bool run_length_encode_bases,
+                                                   stList *regions, bool sorted, int64_t threads);
+
+/*
+ * Get the next block, or NULL when all the regions are done, as tai_regions_next.
+ */
+Alignment *tai_parallel_reader_next(Tai_Parallel_Reader *reader, int64_t *region_index);
+
+/*
+ * Stop the threads and clean up the reader, including any blocks that were read but not returned.
+ */
+void tai_parallel_reader_destruct(Tai_Parallel_Reader *reader);
+
 /**
  * Return a map of Sequence name to Length. Only reference (ie indexed) sequences are returned
  */
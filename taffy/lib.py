@@ -91,13 +91,12 @@ class Alignment:
     def column_tags(self, column_index):
         """ The tags for the given column index, represented as a dictionary of strings """
         assert 0 <= column_index < self.column_number()  # Check column index is valid
-        return _c_tags_to_dictionary(self._c_alignment.column_tags[column_index]) \
-            if self._c_alignment.column_tags != ffi.NULL else {}
+        return _c_tags_to_dictionary(lib.alignment_get_column_tags(self._c_alignment, column_index))
 
     def set_column_tags(self, column_index, tags):
         """ Set the tags for a given column index using a dictionary of tags """
         assert 0 <= column_index < self.column_number()  # Check column index is valid
-        lib.tag_destruct(self._c_alignment.column_tags[column_index])  # Clean up the old tags
+        lib.tag_destruct(lib.alignment_get_column_tags(self._c_alignment, column_index))  # Clean up the old tags
         self._c_alignment.column_tags[column_index] = _dictionary_to_c_tags(tags)
 
     def get_column(self, column_index):
@@ -133,6 +132,33 @@ class Alignment:
         column_np_one_hot[np.arange(len(column_np)), column_np] = 1.0
         return column_np_one_hot
 
+    def get_columns(self, column_start=0, column_number=None):
+        """ Get the columns [column_start, column_start + column_number) of the alignment as a list of strings,
+        reading the block once rather than once per column as get_column does. By default gets every column from
+        column_start to the end of the block """
+        column_number = self.column_number() - column_start if column_number is None else column_number
+        assert 0 <= column_start and 0 <= column_number and column_start + column_number <= self.column_number()
+        row_number = self.row_number()
+        buffer = ffi.new("char[]", row_number * column_number + 1)
+        lib.alignment_get_columns_in_buffer(self._c_alignment, column_start, column_number, buffer)
+        columns = ffi.buffer(buffer, row_number * column_number)[:].decode("utf-8")
+        return [columns[i*row_number:(i+1)*row_number] for i in range(column_number)]
+
+    def get_columns_as_np_array(self, column_start=0, column_number=None, dtype=np.int32):
+        """ As get_columns, but as a two dimensional numpy array of shape (column_number, row_number), with the
+        bases encoded as in get_column_as_np_array. The dtype may be np.int32 or np.int8 """
+        column_number = self.column_number() - column_start if column_number is None else column_number
+        assert 0 <= column_start and 0 <= column_number and column_start + column_number <= self.column_number()
+        columns = np.empty((column_number, self.row_number()), dtype=dtype)
+        if dtype == np.int8:
+            lib.alignment_get_columns_as_int8_in_buffer(self._c_alignment, column_start, column_number,
+                                                        ffi.cast("int8_t *", ffi.from_buffer(columns)))
+        else:
+            assert dtype == np.int32
+            lib.alignment_get_columns_as_int32_in_buffer(self._c_alignment, column_start, column_number,
+                                                         ffi.cast("int32_t *", ffi.from_buffer(columns)))
+        return columns
+
     def get_column_sequences(self):
         """ Get the names of the sequences in the alignment in order as a list """
         row = self.first_row()
@@ -196,8 +222,14 @@ class Row:
         return self._c_row.strand
 
     def bases(self):
-        """ The alignment of the row, consisting of the sequence and gap characters """
-        return _to_py_string(self._c_row.bases)
+        """ The alignment of the row, consisting of the sequence and gap characters, or None if the
+        bases were not read (see AlignmentReader). If the bases are packed they are decoded """
+        if self._c_row.packed_bases != ffi.NULL:
+            length = lib.packed_bases_length(self._c_row.packed_bases)
+            buffer = ffi.new("char[]", length + 1)
+            lib.packed_bases_decode(self._c_row.packed_bases, 0, length, buffer)
+            return ffi.buffer(buffer, length)[:].decode("utf-8")
+        return _to_py_string(self._c_row.bases) if self._c_row.bases != ffi.NULL else None
 
     def left_gap_sequence(self):
         """ The sequence of any unaligned bases in this row between this block and the previous
@@ -258,7 +290,8 @@ class AlignmentReader:
     """ Taf or maf alignment parser.
     """
 
-    def __init__(self, file, taf_index=None,  sequence_intervals=None, make_row_links=False):
+    def __init__(self, file, taf_index=None,  sequence_intervals=None, make_row_links=False, skip_bases=False,
+                 pack_bases=False):
         """
         :param file: File can be either a Python file handle or a string giving a path to the file.
         The underlying file can be either maf or taf. Handing in the file name is much faster as it avoids using a
@@ -270,11 +303,19 @@ class AlignmentReader:
         that specify the range to retrieve. Will be retrieved in order.
         :param make_row_links: Link rows adjacent together - use carefully as can cause the whole
         alignment to be stored in memory
+        :param skip_bases: Don't read the bases of the rows, only their coordinates, which is much faster for a
+        pass that only needs the coordinates of the blocks. The bases() of each row is then None. Ignored if
+        reading through a taf index.
+        :param pack_bases: Keep the bases of each block packed, at two bits a base plus bitmaps of the gaps and
+        soft-masked bases, which takes a quarter of the memory or less when holding many blocks, e.g. to load them
+        for training. The bases are decoded as they are asked for, by bases() and the column methods.
         """
         self.p_c_alignment = ffi.NULL  # The previous C alignment returned
         self.p_c_rows_to_py_rows = {}  # Hash from C rows to Python rows of the previous
         # alignment block, allowing linking of rows between blocks
         self.make_row_links = make_row_links  # Optionally store links between rows
+        self.skip_bases = skip_bases  # Optionally don't read the bases
+        self.pack_bases = pack_bases  # Optionally keep the bases packed
         _check_file_exists(file)
         self.file = file
         self.file_string_not_handle = isinstance(file, str)  # Will be true if the file is a string, not a file handle
@@ -344,10 +385,10 @@ class AlignmentReader:
         if self.taf_not_maf:  # Is a taf block
             # Use the taf index if present
             c_alignment = lib.tai_next(self._c_taf_index_it, self.c_li_handle) if self.taf_index else \
-                lib.taf_read_block(self.p_c_alignment, self.use_run_length_encoding, self.c_li_handle)
+                lib.taf_read_block2(self.p_c_alignment, self.use_run_length_encoding, self.skip_bases, self.c_li_handle)
         else:  # Is a maf block
             c_alignment = lib.tai_next(self._c_taf_index_it, self.c_li_handle) if self.taf_index else \
-                lib.maf_read_block(self.c_li_handle)
+                lib.maf_read_block2(self.c_li_handle, self.skip_bases)
 
         if c_alignment == ffi.NULL:  # If the c_alignment is null
             self.sequence_interval_index += 1
@@ -368,6 +409,9 @@ class AlignmentReader:
         if (not self.taf_not_maf) and self.p_c_alignment != ffi.NULL:
             lib.alignment_link_adjacent(self.p_c_alignment, c_alignment, 1)
 
+        if self.pack_bases:  # Pack the bases, releasing them as read
+            lib.alignment_pack_rows(c_alignment)
+
         # Now add in the rows
         c_row, p_py_row, c_rows_to_py_rows = c_alignment.row, None, {}
         while c_row != ffi.NULL:
@@ -421,7 +465,8 @@ class AlignmentReader:
 def get_reference_sequence_intervals(alignment_reader):
     """ Generates a sequence of reference sequence intervals by scanning through the alignment_reader.
     Each generated value is of the form (seq_name, start, length). Length is the number of
-    reference bases in blocks within the interval (e.g. ignores unaligned ref gaps).
+    reference bases in blocks within the interval (e.g. ignores unaligned ref gaps). Only the coordinates
+    are used, so the alignment_reader can be made with skip_bases=True to make the scan much faster.
     """
     seq_intervals = []
     p_ref_seq, p_ref_start, p_ref_length = None, 0, 0
@@ -476,13 +521,14 @@ def get_column_iterator(alignment_reader,
         ref_index = ref_row.start()
         ref_bases = ref_row.bases()
 
-        # Determine the kind of column to return
+        # Determine the kind of column to return, reading all the columns of the block at once
         if column_as_int_array:
-            get_column = alignment.get_column_as_np_array
+            get_column = alignment.get_columns_as_np_array().__getitem__
         elif column_as_int_array_one_hot:
-            get_column = alignment.get_column_as_np_array_one_hot
+            one_hot = np.eye(6, dtype=np.float32)[alignment.get_columns_as_np_array()]
+            get_column = one_hot.__getitem__
         else:
-            get_column = alignment.get_column
+            get_column = alignment.get_columns().__getitem__
 
         # If the output wants to match the column entries to the sequences
         if include_sequence_names:
@@ -594,12 +640,15 @@ def get_window_iterator(alignment_reader,
                     q.popleft()  # Remove from the left end of the window
 
 
-def write_taf_index_file(taf_file, index_file, index_block_size=10000):
-    """ Create a taf index file """
+def write_taf_index_file(taf_file, index_file, index_block_size=10000, binary=False, index_every_k_blocks=0):
+    """ Create a taf index file. If binary is True the index is written in the binary format, which is
+    memory mapped rather than parsed when loaded by TafIndex. If index_every_k_blocks is greater than zero,
+    which requires binary, every k-th block between anchors is indexed too, so region queries read at most
+    k blocks before the region. """
     c_taf_file_handle = _get_c_file_handle(taf_file)
     c_li_handle = lib.LI_construct(c_taf_file_handle)
     c_index_file_handle = _get_c_file_handle(index_file, "w")
-    lib.tai_create(c_li_handle, c_index_file_handle, index_block_size)
+    lib.tai_create2(c_li_handle, c_index_file_handle, index_block_size, binary, index_every_k_blocks)
     lib.LI_destruct(c_li_handle)  # Cleanup the allocated line iterator
     if isinstance(taf_file, str):  # Close the underlying file handle if opened
         lib.fclose(c_taf_file_handle)
@@ -612,7 +661,7 @@ class AlignmentWriter:
     """
 
     def __init__(self, file, taf_not_maf=True, header_tags=None, repeat_coordinates_every_n_columns=-1,
-                 use_compression=False):
+                 use_compression=False, index_block_size=0):
         """ Use taf_not_maf to switch between MAF or TAF writing.
 
         File can be either a Python file handle or a file string.
@@ -622,13 +671,22 @@ class AlignmentWriter:
         If using taf, to run length encode the bases include a tag in the header tags:
          "run_length_encode_bases"=1
 
-        If use_compression is True then will use bgzf compression on output."""
+        If use_compression is True then will use bgzf compression on output.
+
+        If index_block_size is greater than zero then the TAF is indexed as it is written, as taffy index would
+        with the same block size, putting the index alongside it. This requires the file to be a file string."""
         self.taf_not_maf = taf_not_maf
         self.header_tags = {} if header_tags is None else header_tags
         self.p_py_alignment = None  # The previous alignment
         self.c_lw_handle = lib.LW_construct(_get_c_file_handle(file, "w"), use_compression)
         self.file_string_not_handle = isinstance(file, str)
         self.repeat_coordinates_every_n_columns = repeat_coordinates_every_n_columns
+        self.c_tai_writer_handle = ffi.NULL
+        if index_block_size > 0:
+            if not taf_not_maf or not self.file_string_not_handle:
+                raise ValueError("Indexing as written requires TAF output to a file string")
+            self.c_tai_writer_handle = lib.tai_writer_construct_for_lw(self.c_lw_handle, _to_c_string(file),
+                                                                       index_block_size)
 
     def write_header(self):
         """ Write the header line """
@@ -654,6 +712,8 @@ class AlignmentWriter:
     def close(self):
         """ Close any associated file """
         lib.LW_destruct(self.c_lw_handle, self.file_string_not_handle)
+        if self.c_tai_writer_handle != ffi.NULL:
+            lib.tai_writer_destruct(self.c_tai_writer_handle)
 
     def __enter__(self):
         return self
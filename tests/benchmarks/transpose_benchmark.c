@@ -0,0 +1,90 @@
+/*
+ * Times alignment_transpose_columns, which taf_read_block uses to turn columns into rows, and
+ * alignment_transpose_rows, which the TAF writer uses to go back, against a base at a time copy, for
+ * blocks with as many rows as typical small, 447-way and very wide alignments.
+ *
+ * Usage: transposeBenchmark [COLUMN_NUMBER [REPEATS]]
+ *
+ *  Released under the MIT license, see LICENSE.txt
+*/
+
+#include "taf.h"
+#include "sonLib.h"
+#include <time.h>
+
+static double seconds_since(clock_t start) {
+    return ((double)(clock() - start)) / CLOCKS_PER_SEC;
+}
+
+static void print_timing(const char *name, int64_t row_number, int64_t column_number, int64_t repeats,
+                         double seconds) {
+    fprintf(stdout, "%-16s %6" PRIi64 " rows x %6" PRIi64 " columns x %4" PRIi64 " repeats: %8.4f seconds, %8.1f MB/s\n",
+            name, row_number, column_number, repeats, seconds,
+            seconds > 0 ? (row_number * column_number * repeats) / (seconds * 1000000) : 0.0);
+}
+
+int main(int argc, char *argv[]) {
+    int64_t row_numbers[] = { 100, 447, 2000 };
+    int64_t column_number = argc > 1 ? atol(argv[1]) : 1000;
+    int64_t repeats = argc > 2 ? atol(argv[2]) : 100;
+    if(column_number <= 0 || repeats <= 0) {
+        fprintf(stderr, "Usage: transposeBenchmark [COLUMN_NUMBER [REPEATS]]\n");
+        return 1;
+    }
+
+    for(int64_t n=0; n<sizeof(row_numbers)/sizeof(int64_t); n++) {
+        int64_t row_number = row_numbers[n];
+        char *columns = st_malloc(row_number * column_number);
+        for(int64_t i=0; i<row_number * column_number; i++) {
+            columns[i] = st_random() > 0.3 ? "ACGT"[st_randomInt(0, 4)] : '-';
+        }
+        char *columns2 = st_malloc(row_number * column_number);
+        char **rows = st_malloc(sizeof(char *) * row_number);
+        int64_t *row_lengths = st_malloc(sizeof(int64_t) * row_number);
+        for(int64_t i=0; i<row_number; i++) {
+            rows[i] = st_malloc(column_number);
+        }
+
+        // The base at a time copy the transposes replace, as a baseline
+        clock_t start = clock();
+        for(int64_t k=0; k<repeats; k++) {
+            for(int64_t i=0; i<row_number; i++) {
+                int64_t length = 0;
+                for(int64_t j=0; j<column_number; j++) {
+                    char base = columns[j * row_number + i];
+                    rows[i][j] = base;
+                    length += base != '-';
+                }
+                row_lengths[i] = length;
+            }
+        }
+        print_timing("base at a time", row_number, column_number, repeats, seconds_since(start));
+
+        start = clock();
+        for(int64_t k=0; k<repeats; k++) {
+            alignment_transpose_columns(columns, row_number, column_number, rows, row_lengths);
+        }
+        print_timing("columns to rows", row_number, column_number, repeats, seconds_since(start));
+
+        start = clock();
+        for(int64_t k=0; k<repeats; k++) {
+            alignment_transpose_rows(rows, row_number, 0, column_number, columns2);
+        }
+        print_timing("rows to columns", row_number, column_number, repeats, seconds_since(start));
+
+        // Check the round trip, so a broken transpose does not go unnoticed behind a fast time
+        if(memcmp(columns, columns2, row_number * column_number) != 0) {
+            fprintf(stderr, "The transposed rows do not match the columns for %" PRIi64 " rows\n", row_number);
+            return 1;
+        }
+
+        for(int64_t i=0; i<row_number; i++) {
+            free(rows[i]);
+        }
+        free(rows);
+        free(row_lengths);
+        free(columns2);
+        free(columns);
+    }
+    return 0;
+}
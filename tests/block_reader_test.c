@@ -114,6 +114,62 @@ static void test_block_reader_header_take(CuTest *tc) {
     st_system("rm -f ./tests/block_reader_test_rle.taf");
 }
 
+// Walk a file twice in step, once reading the bases and once skipping them, checking the blocks
+// have the same coordinates and links.
+static void check_skipping_bases(CuTest *tc, const char *path, int64_t threads) {
+    FILE *fh = fopen(path, "r"), *fh2 = fopen(path, "r");
+    LI *li = LI_construct(fh), *li2 = LI_construct(fh2);
+    BlockReader *r = block_reader_open(li), *r2 = block_reader_open(li2);
+    block_reader_set_skip_bases(r2, 1);
+    block_reader_set_threads(r2, threads);
+
+    int64_t blocks = 0;
+    Alignment *prev = NULL, *prev2 = NULL, *a, *a2;
+    while ((a = block_reader_next(r, prev)) != NULL) {
+        a2 = block_reader_next(r2, prev2);
+        CuAssertPtrNotNull(tc, a2);
+        CuAssertIntEquals(tc, a->column_number, a2->column_number);
+        CuAssertIntEquals(tc, a->row_number, a2->row_number);
+        Alignment_Row *row = a->row, *row2 = a2->row;
+        while (row != NULL) {
+            CuAssertPtrNotNull(tc, row2);
+            CuAssertStrEquals(tc, row->sequence_name, row2->sequence_name);
+            CuAssertIntEquals(tc, row->start, row2->start);
+            CuAssertIntEquals(tc, row->length, row2->length);
+            CuAssertIntEquals(tc, row->sequence_length, row2->sequence_length);
+            CuAssertIntEquals(tc, row->strand, row2->strand);
+            CuAssertTrue(tc, (row->l_row == NULL) == (row2->l_row == NULL));
+            CuAssertPtrEquals(tc, NULL, row2->bases);
+            row = row->n_row; row2 = row2->n_row;
+        }
+        CuAssertPtrEquals(tc, NULL, row2);
+        if (prev != NULL) {
+            alignment_destruct(prev, 1);
+            alignment_destruct(prev2, 1);
+        }
+        prev = a; prev2 = a2;
+        blocks++;
+    }
+    CuAssertTrue(tc, blocks > 0);
+    CuAssertPtrEquals(tc, NULL, block_reader_next(r2, prev2));
+    alignment_destruct(prev, 1);
+    alignment_destruct(prev2, 1);
+    block_reader_destruct(r); block_reader_destruct(r2);
+    LI_destruct(li); LI_destruct(li2);
+    fclose(fh); fclose(fh2);
+}
+
+static void test_block_reader_skip_bases(CuTest *tc) {
+    CuAssertIntEquals(tc, 0, st_system("./bin/taffy view -i ./tests/evolverMammals.maf -o ./tests/block_reader_test.taf"));
+    CuAssertIntEquals(tc, 0, st_system("./bin/taffy view -i ./tests/evolverMammals.maf -u -o ./tests/block_reader_test_rle.taf"));
+    for (int64_t threads = 1; threads <= 3; threads += 2) {
+        check_skipping_bases(tc, "./tests/evolverMammals.maf", threads);
+        check_skipping_bases(tc, "./tests/block_reader_test.taf", threads);
+        check_skipping_bases(tc, "./tests/block_reader_test_rle.taf", threads);
+    }
+    st_system("rm -f ./tests/block_reader_test.taf ./tests/block_reader_test_rle.taf");
+}
+
 CuSuite *block_reader_test_suite(void) {
     CuSuite *suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, test_block_reader_maf_input);
@@ -121,5 +177,6 @@ CuSuite *block_reader_test_suite(void) {
     SUITE_ADD_TEST(suite, test_block_reader_maf_and_taf_match);
     SUITE_ADD_TEST(suite, test_block_reader_unrecognized_format);
     SUITE_ADD_TEST(suite, test_block_reader_header_take);
+    SUITE_ADD_TEST(suite, test_block_reader_skip_bases);
     return suite;
 }
@@ -65,9 +65,68 @@ static void test_maf_without_compression(CuTest *testCase) {
     test_maf(testCase, 0);
 }
 
+static int64_t row_index(Alignment *alignment, Alignment_Row *row) {
+    int64_t i = 0;
+    for(Alignment_Row *r = alignment->row; r != row; r = r->n_row) {
+        i++;
+    }
+    return i;
+}
+
+static void test_maf_parallel_reader(CuTest *testCase) {
+    // Read the maf sequentially and in parallel, with a chunk for each block, linking the blocks as they are returned
+    char *example_file = "./tests/evolverMammals.maf.mini";
+    LI *li = LI_construct(fopen(example_file, "r"));
+    tag_destruct(maf_read_header(li));
+    LI *li2 = LI_construct(fopen(example_file, "r"));
+    tag_destruct(maf_read_header(li2));
+    Parallel_Reader *reader = maf_parallel_reader_construct(li2, 0, 3, 1);
+    Alignment *alignment, *p_alignment = NULL, *alignment2, *p_alignment2 = NULL;
+    int64_t blocks = 0;
+    while((alignment = maf_read_block(li)) != NULL) {
+        alignment2 = parallel_reader_next(reader, p_alignment2);
+        CuAssertTrue(testCase, alignment2 != NULL);
+        if(p_alignment != NULL) {
+            alignment_link_adjacent(p_alignment, alignment, 1);
+            alignment_link_adjacent(p_alignment2, alignment2, 1);
+        }
+        CuAssertIntEquals(testCase, alignment->row_number, alignment2->row_number);
+        CuAssertIntEquals(testCase, alignment->column_number, alignment2->column_number);
+        Alignment_Row *row = alignment->row, *row2 = alignment2->row;
+        while(row != NULL) {
+            CuAssertStrEquals(testCase, row->sequence_name, row2->sequence_name);
+            CuAssertIntEquals(testCase, row->start, row2->start);
+            CuAssertIntEquals(testCase, row->length, row2->length);
+            CuAssertIntEquals(testCase, row->sequence_length, row2->sequence_length);
+            CuAssertIntEquals(testCase, row->strand, row2->strand);
+            CuAssertStrEquals(testCase, row->bases, row2->bases);
+            CuAssertTrue(testCase, (row->l_row == NULL) == (row2->l_row == NULL));
+            if(row->l_row != NULL) {
+                CuAssertIntEquals(testCase, row_index(p_alignment, row->l_row), row_index(p_alignment2, row2->l_row));
+            }
+            row = row->n_row; row2 = row2->n_row;
+        }
+        if(p_alignment != NULL) {
+            alignment_destruct(p_alignment, 1);
+            alignment_destruct(p_alignment2, 1);
+        }
+        p_alignment = alignment;
+        p_alignment2 = alignment2;
+        blocks++;
+    }
+    CuAssertIntEquals(testCase, 6, blocks);
+    CuAssertTrue(testCase, parallel_reader_next(reader, p_alignment2) == NULL);
+    alignment_destruct(p_alignment, 1);
+    alignment_destruct(p_alignment2, 1);
+    parallel_reader_destruct(reader);
+    LI_destruct(li);
+    LI_destruct(li2);
+}
+
 CuSuite* maf_test_suite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, test_maf_with_compression);
     SUITE_ADD_TEST(suite, test_maf_without_compression);
+    SUITE_ADD_TEST(suite, test_maf_parallel_reader);
     return suite;
 }
@@ -243,6 +243,23 @@ static void test_norm_maf_input(CuTest *testCase) {
     st_system("rm -f %s %s", piped_out, direct_out);
 }
 
+// Checks that holding the mostly-gap rows of merged blocks as runs of gaps with -g leaves the output
+// unchanged, as TAF and as MAF.
+static void test_norm_sparse_gap_rows(CuTest *testCase) {
+    char *example_file = "./tests/evolverMammals.maf";
+    char *dense_out = "./tests/norm.dense.out";
+    char *sparse_out = "./tests/norm.sparse.out";
+    for(int64_t maf=0; maf<2; maf++) {
+        int i = st_system("./bin/taffy norm -i %s %s -o %s", example_file, maf ? "-k" : "", dense_out);
+        CuAssertIntEquals(testCase, 0, i);
+        int j = st_system("./bin/taffy norm -i %s %s --sparseGapRows -o %s", example_file, maf ? "-k" : "", sparse_out);
+        CuAssertIntEquals(testCase, 0, j);
+        int diff_ret = st_system("diff %s %s", dense_out, sparse_out);
+        CuAssertIntEquals(testCase, 0, diff_ret);
+    }
+    st_system("rm -f %s %s", dense_out, sparse_out);
+}
+
 // Checks alignment_remove_all_gap_columns directly: the gap-only columns go, the remaining bases
 // keep their order, the column tags follow the columns they belong to, and the row coordinates are
 // left alone.
@@ -312,12 +329,12 @@ static void test_remove_all_gap_columns_all_gap_block(CuTest *testCase) {
     alignment->column_tags = st_calloc(3, sizeof(Tag *));
     alignment->row_number = 2;
     Alignment_Row *row_1 = st_calloc(1, sizeof(Alignment_Row));
-    row_1->sequence_name = stString_copy("simCow.chr1");
+    row_1->sequence_name = sequence_name_construct("simCow.chr1", strlen("simCow.chr1"));
     row_1->bases = stString_copy("---");
     row_1->strand = 1;
     row_1->sequence_length = 100;
     Alignment_Row *row_2 = st_calloc(1, sizeof(Alignment_Row));
-    row_2->sequence_name = stString_copy("simDog.chr1");
+    row_2->sequence_name = sequence_name_construct("simDog.chr1", strlen("simDog.chr1"));
     row_2->bases = stString_copy("---");
     row_2->strand = 1;
     row_2->sequence_length = 100;
@@ -858,6 +875,7 @@ CuSuite* normalize_test_suite(void) {
     SUITE_ADD_TEST(suite, test_dupe_filter);
     SUITE_ADD_TEST(suite, test_norm_pipeline);
     SUITE_ADD_TEST(suite, test_norm_maf_input);
+    SUITE_ADD_TEST(suite, test_norm_sparse_gap_rows);
     SUITE_ADD_TEST(suite, test_add_gap_bases_maf_input);
     return suite;
 }
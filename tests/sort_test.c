@@ -79,6 +79,31 @@ static void test_sort_filter_pad_and_dup_filter(CuTest *testCase) {
     }
 }
 
+// Checks that holding the padding rows as runs of gaps with -g leaves the output unchanged, both when
+// the rows are sorted after padding and when the padded block is relinked to the one before it.
+static void test_sort_sparse_gap_rows(CuTest *testCase) {
+    char *example_file = "./tests/evolverMammals.maf.mini";
+    char *sort_file = "./tests/sort_file.txt";
+    char *filter_file = "./tests/filter_file_2.txt";
+    char *output_file = "./tests/sort_test.maf.out";
+    char *truth_file = "./tests/evolverMammals.maf.mini.sorted.padded.dup_filtered";
+    int i = st_system("./bin/taffy sort -i %s -n %s -f %s -p %s -d %s -r -g | ./bin/taffy view -m > %s",
+                      example_file, sort_file, filter_file, sort_file, sort_file, output_file);
+    CuAssertIntEquals(testCase, 0, i);
+    int diff_ret = st_system("diff %s %s", output_file, truth_file);
+    CuAssertIntEquals(testCase, 0, diff_ret);
+
+    char *dense_out = "./tests/sort.dense.taf";
+    char *sparse_out = "./tests/sort.sparse.taf";
+    int j = st_system("./bin/taffy sort -i %s -p %s -o %s", example_file, sort_file, dense_out);
+    CuAssertIntEquals(testCase, 0, j);
+    int k = st_system("./bin/taffy sort -i %s -p %s --sparseGapRows -o %s", example_file, sort_file, sparse_out);
+    CuAssertIntEquals(testCase, 0, k);
+    diff_ret = st_system("diff %s %s", dense_out, sparse_out);
+    CuAssertIntEquals(testCase, 0, diff_ret);
+    st_system("rm -f %s %s %s", output_file, dense_out, sparse_out);
+}
+
 // Verifies that taffy sort -i x.maf produces output identical to
 // taffy view -i x.maf | taffy sort. Per-tool dual-input regression
 // for the BlockReader migration.
@@ -105,6 +130,7 @@ CuSuite* sort_test_suite(void) {
     SUITE_ADD_TEST(suite, test_filter);
     SUITE_ADD_TEST(suite, test_filter_ignore_first_row);
     SUITE_ADD_TEST(suite, test_sort_filter_pad_and_dup_filter);
+    SUITE_ADD_TEST(suite, test_sort_sparse_gap_rows);
     SUITE_ADD_TEST(suite, test_sort_maf_input);
     return suite;
 }
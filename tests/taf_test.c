@@ -1,6 +1,9 @@
 #include "CuTest.h"
 #include "taf.h"
+#include "tai.h"
 #include "sonLib.h"
+#include <ctype.h>
+#include <pthread.h>
 
 #ifdef USE_HTSLIB
     #include "htslib/bgzf.h"
@@ -104,7 +107,7 @@ static void test_taf(CuTest *testCase) {
 
         // Check the tags are the same
         for(int64_t i=0; i<alignment2->column_number; i++) {
-            check_tags(testCase, alignment2->column_tags[i], stList_get(column_tags, column_index++));
+            check_tags(testCase, alignment_get_column_tags(alignment2, i), stList_get(column_tags, column_index++));
         }
 
         alignment_destruct(alignment, 1);
@@ -125,8 +128,1500 @@ static void test_taf(CuTest *testCase) {
     LI_destruct(li_maf);
 }
 
+static void test_taf_line_scan(CuTest *testCase) {
+    // A plain line with coordinates and tags
+    char line[] = "AC-T ; i 0 hg38.chr1 10 + 1000 s 1 mm10.chr2 5 - 200 d 2 g 3 7 G 1 ACG @ a:1 b:two";
+    Taf_Line taf_line;
+    CuAssertTrue(testCase, taf_line_scan(line, &taf_line));
+    CuAssertTrue(testCase, taf_line_has_coordinates(&taf_line));
+    CuAssertIntEquals(testCase, 4, taf_line_column_length(&taf_line, 0));
+    char column[4];
+    taf_line_get_bases(&taf_line, 0, column, 4);
+    CuAssertTrue(testCase, memcmp(column, "AC-T", 4) == 0);
+
+    Taf_Coordinate_Op op;
+    char *cursor = taf_line.coordinates;
+    CuAssertTrue(testCase, taf_line_next_coordinate_op(&taf_line, &cursor, &op));
+    CuAssertTrue(testCase, op.type == 'i' && op.row_index == 0 && op.start == 10 && op.strand && op.sequence_length == 1000);
+    CuAssertTrue(testCase, op.sequence_name_length == 9 && strncmp(op.sequence_name, "hg38.chr1", 9) == 0);
+    CuAssertTrue(testCase, taf_line_next_coordinate_op(&taf_line, &cursor, &op));
+    CuAssertTrue(testCase, op.type == 's' && op.row_index == 1 && op.start == 5 && !op.strand && op.sequence_length == 200);
+    CuAssertTrue(testCase, taf_line_next_coordinate_op(&taf_line, &cursor, &op));
+    CuAssertTrue(testCase, op.type == 'd' && op.row_index == 2);
+    CuAssertTrue(testCase, taf_line_next_coordinate_op(&taf_line, &cursor, &op));
+    CuAssertTrue(testCase, op.type == 'g' && op.row_index == 3 && op.gap_length == 7);
+    CuAssertTrue(testCase, taf_line_next_coordinate_op(&taf_line, &cursor, &op));
+    CuAssertTrue(testCase, op.type == 'G' && op.row_index == 1 && op.gap_length == 3 && strncmp(op.gap_sequence, "ACG", 3) == 0);
+    CuAssertTrue(testCase, !taf_line_next_coordinate_op(&taf_line, &cursor, &op));
+
+    Tag *tags = taf_line_parse_tags(&taf_line);
+    Tag *expected = tag_construct("a", "1", tag_construct("b", "two", NULL));
+    check_tags(testCase, tags, expected);
+    tag_destruct(tags);
+    tag_destruct(expected);
+
+    // A run length encoded line with only tags, which is not a coordinate line
+    char rle_line[] = "A 3 - 2\tT 1 @ k:v";
+    CuAssertTrue(testCase, taf_line_scan(rle_line, &taf_line));
+    CuAssertTrue(testCase, !taf_line_has_coordinates(&taf_line));
+    CuAssertIntEquals(testCase, 6, taf_line_column_length(&taf_line, 1));
+    char rle_column[6];
+    taf_line_get_bases(&taf_line, 1, rle_column, 6);
+    CuAssertTrue(testCase, memcmp(rle_column, "AAA--T", 6) == 0);
+    tags = taf_line_parse_tags(&taf_line);
+    CuAssertStrEquals(testCase, "k", tags->key);
+    CuAssertStrEquals(testCase, "v", tags->value);
+    CuAssertTrue(testCase, tags->n_tag == NULL);
+    tag_destruct(tags);
+
+    // White space only lines are reported as empty
+    char empty_line[] = " \t ";
+    CuAssertTrue(testCase, !taf_line_scan(empty_line, &taf_line));
+}
+
+/*
+ * Coordinate operations are applied in the order given, each row index referring to the rows as left by
+ * the operations before it, so check reading a block whose operations go back and forth over the rows.
+ */
+static void test_taf_read_unordered_coordinate_operations(CuTest *testCase) {
+    char *temp_file = "./tests/taf_unordered_ops_test.taf";
+    FILE *fh = fopen(temp_file, "w");
+    fprintf(fh, "ACG ; i 0 a 0 + 10 i 1 b 0 + 10 i 2 c 0 + 10\n");
+    fprintf(fh, "TA- ; d 2 i 0 x 4 - 20 d 1 i 2 y 7 + 30 g 1 2 s 0 z 1 + 15\n");
+    fprintf(fh, "-C-\n");
+    fclose(fh);
+
+    LI *li = LI_construct(fopen(temp_file, "r"));
+    Alignment *alignment = taf_read_block(NULL, 0, li);
+    CuAssertIntEquals(testCase, 3, alignment->row_number);
+    Alignment *alignment2 = taf_read_block(alignment, 0, li);
+    CuAssertTrue(testCase, taf_read_block(alignment2, 0, li) == NULL);
+    // d 2 -> a b; i 0 x -> x a b; d 1 -> x b; i 2 y -> x b y; g 1 2 -> b starts 2 later; s 0 z -> z b y
+    CuAssertIntEquals(testCase, 3, alignment2->row_number);
+    CuAssertIntEquals(testCase, 2, alignment2->column_number);
+    Alignment_Row *row = alignment2->row;
+    CuAssertStrEquals(testCase, "z", row->sequence_name);
+    CuAssertIntEquals(testCase, 1, row->start);
+    CuAssertStrEquals(testCase, "T-", row->bases);
+    CuAssertIntEquals(testCase, 1, row->length);
+    row = row->n_row;
+    CuAssertStrEquals(testCase, "b", row->sequence_name);
+    CuAssertIntEquals(testCase, 3, row->start);
+    CuAssertStrEquals(testCase, "AC", row->bases);
+    CuAssertTrue(testCase, row->l_row == alignment->row->n_row); // Still linked to its previous row
+    row = row->n_row;
+    CuAssertStrEquals(testCase, "y", row->sequence_name);
+    CuAssertIntEquals(testCase, 7, row->start);
+    CuAssertStrEquals(testCase, "--", row->bases);
+    CuAssertTrue(testCase, row->n_row == NULL);
+
+    alignment_destruct(alignment, 1);
+    alignment_destruct(alignment2, 1);
+    LI_destruct(li);
+    st_system("rm -f %s", temp_file);
+}
+
+/*
+ * Checks that column tags are kept as the text read until they are asked for, that tags never
+ * asked for are written back out exactly as they were read, and that tags set directly replace them.
+ */
+static void test_taf_lazy_column_tags(CuTest *testCase) {
+    char *temp_file = "./tests/taf_lazy_tags_test.taf";
+    char *temp_out = "./tests/taf_lazy_tags_out.taf";
+    FILE *fh = fopen(temp_file, "w");
+    fprintf(fh, "AC ; i 0 a 0 + 10 i 1 b 0 + 10 @ x:1  y:2 \n");
+    fprintf(fh, "CG @ z:3  w:4\n");
+    fprintf(fh, "G-\n");
+    fclose(fh);
+
+    LI *li = LI_construct(fopen(temp_file, "r"));
+    Alignment *alignment = taf_read_block(NULL, 0, li);
+    CuAssertIntEquals(testCase, 3, alignment->column_number);
+    CuAssertTrue(testCase, alignment->column_tags[0] == NULL); // Nothing is parsed yet
+    CuAssertStrEquals(testCase, "x:1  y:2", alignment->column_tag_strings[0]);
+    CuAssertStrEquals(testCase, "z:3  w:4", alignment->column_tag_strings[1]);
+    CuAssertTrue(testCase, alignment->column_tag_strings[2] == NULL);
+
+    Tag *tag = alignment_get_column_tags(alignment, 0);
+    CuAssertTrue(testCase, tag == alignment->column_tags[0]);
+    CuAssertTrue(testCase, alignment->column_tag_strings[0] == NULL);
+    CuAssertStrEquals(testCase, "x", tag->key);
+    CuAssertStrEquals(testCase, "1", tag->value);
+    CuAssertStrEquals(testCase, "y", tag->n_tag->key);
+    CuAssertStrEquals(testCase, "2", tag->n_tag->value);
+    CuAssertTrue(testCase, tag->n_tag->n_tag == NULL);
+    CuAssertTrue(testCase, alignment_get_column_tags(alignment, 2) == NULL);
+
+    // The parsed tags are written from the tags, the unparsed ones as they were read
+    LW *lw = LW_construct(fopen(temp_out, "w"), 0);
+    taf_write_block(NULL, alignment, 0, 0, lw);
+    LW_destruct(lw, 1);
+    LI *li2 = LI_construct(fopen(temp_out, "r"));
+    char *line = LI_get_next_line(li2);
+    CuAssertTrue(testCase, strstr(line, " @ x:1 y:2") != NULL);
+    free(line);
+    line = LI_get_next_line(li2);
+    CuAssertStrEquals(testCase, "CG @ z:3  w:4", line);
+    free(line);
+    line = LI_get_next_line(li2);
+    CuAssertStrEquals(testCase, "G-", line);
+    free(line);
+    LI_destruct(li2);
+    alignment_destruct(alignment, 1);
+    LI_destruct(li);
+
+    // Tags set directly in column_tags replace the unparsed tags of the column, and are written and read back
+    li = LI_construct(fopen(temp_file, "r"));
+    alignment = taf_read_block(NULL, 0, li);
+    LI_destruct(li);
+    alignment->column_tags[1] = tag_construct("v", "5", NULL);
+    lw = LW_construct(fopen(temp_out, "w"), 0);
+    taf_write_block(NULL, alignment, 0, 0, lw);
+    LW_destruct(lw, 1);
+    tag = alignment_get_column_tags(alignment, 1);
+    CuAssertTrue(testCase, alignment->column_tag_strings[1] == NULL);
+    CuAssertStrEquals(testCase, "v", tag->key);
+    alignment_destruct(alignment, 1);
+    li = LI_construct(fopen(temp_out, "r"));
+    alignment = taf_read_block(NULL, 0, li);
+    LI_destruct(li);
+    tag = alignment_get_column_tags(alignment, 0);
+    CuAssertStrEquals(testCase, "x", tag->key);
+    CuAssertStrEquals(testCase, "y", tag->n_tag->key);
+    tag = alignment_get_column_tags(alignment, 1);
+    CuAssertStrEquals(testCase, "v", tag->key);
+    CuAssertStrEquals(testCase, "5", tag->value);
+    CuAssertTrue(testCase, tag->n_tag == NULL);
+    CuAssertTrue(testCase, alignment_get_column_tags(alignment, 2) == NULL);
+    alignment_destruct(alignment, 1);
+
+    st_system("rm -f %s %s", temp_file, temp_out);
+}
+
+/*
+ * Checks that the rows read carry one shared copy of each sequence name, whether the row is carried over
+ * from the previous block or inserted again later, and that the names outlive the rows they were read with.
+ */
+static void test_sequence_names(CuTest *testCase) {
+    char *temp_file = "./tests/taf_sequence_names_test.taf";
+    FILE *fh = fopen(temp_file, "w");
+    fprintf(fh, "AC ; i 0 a 0 + 10 i 1 b 0 + 10\n");
+    fprintf(fh, "A ; d 1\n");
+    fprintf(fh, "ACG ; i 1 b 5 + 10 i 2 b.1 0 + 10\n");
+    fclose(fh);
+
+    LI *li = LI_construct(fopen(temp_file, "r"));
+    Alignment *alignment = taf_read_block(NULL, 0, li);
+    Alignment *alignment2 = taf_read_block(alignment, 0, li);
+    Alignment *alignment3 = taf_read_block(alignment2, 0, li);
+    CuAssertIntEquals(testCase, 3, alignment3->row_number);
+    CuAssertTrue(testCase, alignment->row->sequence_name == alignment3->row->sequence_name); // Carried over
+    CuAssertTrue(testCase, alignment->row->n_row->sequence_name == alignment3->row->n_row->sequence_name); // Inserted again
+    CuAssertTrue(testCase, !sequence_name_equal(alignment3->row->n_row->sequence_name,
+                                                alignment3->row->n_row->n_row->sequence_name));
+    alignment_destruct(alignment, 1);
+    alignment_destruct(alignment2, 1);
+    LI_destruct(li);
+    CuAssertStrEquals(testCase, "a", alignment3->row->sequence_name);
+    CuAssertStrEquals(testCase, "b", alignment3->row->n_row->sequence_name);
+    CuAssertStrEquals(testCase, "b.1", alignment3->row->n_row->n_row->sequence_name);
+
+    // Names made separately are still compared by their characters
+    char *name = sequence_name_construct("b.12", 3);
+    CuAssertStrEquals(testCase, "b.1", name);
+    CuAssertTrue(testCase, sequence_name_equal(name, alignment3->row->n_row->n_row->sequence_name));
+    CuAssertTrue(testCase, !sequence_name_equal(name, alignment3->row->n_row->sequence_name));
+    sequence_name_destruct(name);
+
+    alignment_destruct(alignment3, 1);
+    st_system("rm -f %s", temp_file);
+}
+
+typedef struct _Arena_Share {
+    LI *li;
+    LI *li2;
+} Arena_Share;
+
+static void *share_arena_pool(void *arg) {
+    Arena_Share *share = arg;
+    alignment_arena_pool_share(share->li, share->li2);
+    return NULL;
+}
+
+/*
+ * Checks that streaming through blocks reuses the arena of the block before the previous one, that the
+ * bases of the block are in an arena of their own, and that the rows of a block read from an arena can
+ * still be destructed after their alignment, or be given bases that are not in the arena.
+ */
+static void test_block_arenas(CuTest *testCase) {
+    char *temp_file = "./tests/taf_block_arenas_test.taf";
+    FILE *fh = fopen(temp_file, "w");
+    fprintf(fh, "ACG ; i 0 a 0 + 100 i 1 b 0 + 100 i 2 c 0 + 10\n");
+    fprintf(fh, "T-T\n");
+    for(int64_t i=0; i<3; i++) {
+        fprintf(fh, "ACG ; g 0 1\n");
+        fprintf(fh, "T-T\n");
+    }
+    fclose(fh);
+
+    LI *li = LI_construct(fopen(temp_file, "r"));
+    Alignment *alignment = taf_read_block(NULL, 0, li);
+    CuAssertTrue(testCase, alignment->arena != NULL);
+    CuAssertTrue(testCase, alignment_arena_owns(alignment->arena, alignment->row));
+    // The bases are in an arena of their own, shared by the rows
+    CuAssertTrue(testCase, alignment->row->bases_arena != NULL && alignment->row->bases_arena != alignment->arena);
+    CuAssertTrue(testCase, alignment->row->n_row->bases_arena == alignment->row->bases_arena);
+    CuAssertTrue(testCase, alignment_arena_owns(alignment->row->bases_arena, alignment->row->bases));
+    Alignment *alignment2 = taf_read_block(alignment, 0, li);
+    CuAssertTrue(testCase, alignment2->arena != alignment->arena);
+    Alignment_Arena *first_arena = alignment->arena;
+    alignment_destruct(alignment, 1); // Stream through the blocks, keeping only the previous block
+    Alignment *alignment3 = taf_read_block(alignment2, 0, li);
+    CuAssertTrue(testCase, alignment3->arena == first_arena); // Reused two blocks on
+    Alignment *alignment4 = taf_read_block(alignment3, 0, li);
+    CuAssertTrue(testCase, taf_read_block(alignment4, 0, li) == NULL);
+    alignment_destruct(alignment2, 1);
+    alignment_destruct(alignment3, 1);
+    LI_destruct(li); // The arenas of blocks still in use outlive the LI
+
+    // Destruct the alignment before its rows, as the Python bindings do
+    Alignment_Row *row = alignment4->row;
+    alignment_destruct(alignment4, 0);
+    CuAssertStrEquals(testCase, "AT", row->bases);
+    CuAssertIntEquals(testCase, 9, row->start);
+    alignment_row_free_bases(row); // Replace the bases of the first row
+    row->bases = stString_copy("A-");
+    CuAssertTrue(testCase, !alignment_arena_owns(row->arena, row->bases));
+    while(row != NULL) {
+        Alignment_Row *n_row = row->n_row;
+        alignment_row_destruct(row);
+        row = n_row;
+    }
+    st_system("rm -f %s", temp_file);
+
+    // LIs sharing the pool of an LI on many threads at once, as the workers of the parallel reader do, all get
+    // the same pool
+    for(int64_t k=0; k<100; k++) {
+        li = LI_construct_from_buffer("", 0);
+        Arena_Share shares[8];
+        pthread_t threads[8];
+        for(int64_t i=0; i<8; i++) {
+            shares[i].li = li;
+            shares[i].li2 = LI_construct_from_buffer("", 0);
+            pthread_create(&threads[i], NULL, share_arena_pool, &shares[i]);
+        }
+        for(int64_t i=0; i<8; i++) {
+            pthread_join(threads[i], NULL);
+            CuAssertTrue(testCase, li->arenas != NULL && shares[i].li2->arenas == li->arenas);
+            LI_destruct(shares[i].li2);
+        }
+        LI_destruct(li);
+    }
+}
+
+/*
+ * Checks the row index of the alignment matches its list of rows.
+ */
+static void check_row_index(CuTest *testCase, Alignment *alignment) {
+    CuAssertTrue(testCase, alignment->rows != NULL);
+    int64_t i = 0;
+    for(Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
+        CuAssertTrue(testCase, alignment->rows[i] == row);
+        CuAssertIntEquals(testCase, i, row->row_index);
+        CuAssertTrue(testCase, alignment_get_row(alignment, i++) == row);
+    }
+    CuAssertIntEquals(testCase, alignment->row_number, i);
+}
+
+/*
+ * Checks the rows of the alignment are laid out in its base matrix.
+ */
+static void check_base_matrix(CuTest *testCase, Alignment *alignment) {
+    char *base_matrix = alignment_get_base_matrix(alignment);
+    CuAssertTrue(testCase, base_matrix != NULL);
+    CuAssertTrue(testCase, alignment->row_stride > alignment->column_number);
+    CuAssertIntEquals(testCase, 0, ((uintptr_t)base_matrix) % 16);
+    int64_t i = 0;
+    for(Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
+        CuAssertTrue(testCase, row->bases == base_matrix + i++ * alignment->row_stride);
+        CuAssertIntEquals(testCase, alignment->column_number, strlen(row->bases));
+    }
+}
+
+static void test_base_matrix(CuTest *testCase) {
+    char *temp_file = "./tests/taf_base_matrix_test.taf";
+    FILE *fh = fopen(temp_file, "w");
+    fprintf(fh, "ACG ; i 0 a 0 + 100 i 1 b 0 + 100 i 2 c 0 + 10\n");
+    fprintf(fh, "T-T\n");
+    fprintf(fh, "ACG ; s 0 a 2 + 100 s 1 b 1 + 100 s 2 c 2 + 10\n");
+    fprintf(fh, "-AA\n");
+    fprintf(fh, "TT-\n");
+    fclose(fh);
+
+    // Blocks read from a TAF have a base matrix
+    LI *li = LI_construct(fopen(temp_file, "r"));
+    Alignment *alignment = taf_read_block(NULL, 0, li);
+    check_base_matrix(testCase, alignment);
+    Alignment *alignment2 = taf_read_block(alignment, 0, li);
+    check_base_matrix(testCase, alignment2);
+    CuAssertTrue(testCase, taf_read_block(alignment2, 0, li) == NULL);
+    LI_destruct(li);
+
+    // Splitting at the reference gap makes blocks with base matrices of their own
+    stList *segments = alignment_split_at_reference_gaps(alignment2);
+    CuAssertIntEquals(testCase, 2, stList_length(segments));
+    for(int64_t i=0; i<stList_length(segments); i++) {
+        Alignment *segment = stList_get(segments, i);
+        check_base_matrix(testCase, segment);
+        check_row_index(testCase, segment);
+        CuAssertIntEquals(testCase, 3 - i, segment->row_number);
+        CuAssertStrEquals(testCase, i == 0 ? "A" : "T", segment->row->bases);
+        alignment_destruct(segment, 1);
+    }
+    stList_destruct(segments);
+
+    // Merging writes the merged rows into a new base matrix
+    Alignment *merged = alignment_merge_adjacent(alignment, alignment2);
+    check_base_matrix(testCase, merged);
+    check_row_index(testCase, merged);
+    CuAssertIntEquals(testCase, 5, merged->column_number);
+    CuAssertStrEquals(testCase, "ATA-T", merged->row->bases);
+    CuAssertStrEquals(testCase, "C-CAT", merged->row->n_row->bases);
+
+    // A stale base matrix is noticed, and the rows can be laid out again
+    Alignment_Row *row = merged->row;
+    merged->row = row->n_row;
+    merged->row_number--;
+    row->n_row = NULL;
+    alignment_row_destruct(row);
+    alignment_index_rows(merged);
+    CuAssertTrue(testCase, alignment_get_base_matrix(merged) == NULL);
+    CuAssertTrue(testCase, alignment_pack_bases(merged));
+    check_base_matrix(testCase, merged);
+
+    // Padding adds rows to the matrix
+    stList *prefixes = stList_construct3(0, (void (*)(void *))sequence_prefix_destruct);
+    stList_append(prefixes, sequence_prefix_construct(stString_copy("b"), 0));
+    stList_append(prefixes, sequence_prefix_construct(stString_copy("d"), 1));
+    alignment_pad_the_rows(NULL, merged, prefixes);
+    CuAssertIntEquals(testCase, 3, merged->row_number);
+    check_base_matrix(testCase, merged);
+    CuAssertStrEquals(testCase, "-----", merged->row->n_row->n_row->bases);
+
+    // Unless asked to add the rows of gaps in the sparse packed form, which leaves the matrix stale
+    stList_append(prefixes, sequence_prefix_construct(stString_copy("e"), 2));
+    alignment_pad_the_rows2(NULL, merged, prefixes, 1);
+    CuAssertIntEquals(testCase, 4, merged->row_number);
+    check_row_index(testCase, merged);
+    CuAssertTrue(testCase, alignment_get_base_matrix(merged) == NULL);
+    row = merged->row->n_row->n_row->n_row;
+    CuAssertTrue(testCase, row->bases == NULL && packed_bases_is_sparse(row->packed_bases));
+    char column[5];
+    alignment_get_column_in_buffer(merged, 1, column);
+    CuAssertTrue(testCase, memcmp("-T--", column, 4) == 0);
+    char *row_string = alignment_row_to_string(row);
+    CuAssertStrEquals(testCase, "e\t0\t0\t+\t0\t-----", row_string);
+    free(row_string);
+    stList_destruct(prefixes);
+
+    // The writers decode the packed rows as they go
+    char *temp_out = "./tests/taf_base_matrix_test.maf";
+    for(int64_t i=0; i<2; i++) {
+        LW *lw = LW_construct(fopen(temp_out, "w"), 0);
+        if(i == 0) {
+            taf_write_block(NULL, merged, 0, 0, lw);
+        }
+        else {
+            maf_write_block(merged, lw);
+        }
+        LW_destruct(lw, 1);
+        li = LI_construct(fopen(temp_out, "r"));
+        Alignment *written = i == 0 ? taf_read_block(NULL, 0, li) : maf_read_block(li);
+        CuAssertIntEquals(testCase, 4, written->row_number);
+        CuAssertStrEquals(testCase, "C-CAT", written->row->bases);
+        CuAssertStrEquals(testCase, "-----", written->row->n_row->n_row->n_row->bases);
+        alignment_destruct(written, 1);
+        LI_destruct(li);
+    }
+
+    // Removing gap-only columns unpacks the rows into a new matrix
+    CuAssertIntEquals(testCase, 0, alignment_remove_all_gap_columns(merged));
+    check_base_matrix(testCase, merged);
+    CuAssertStrEquals(testCase, "-----", merged->row->n_row->n_row->n_row->bases);
+
+    // The rows hold on to the matrix after the alignment is gone, as with the Python bindings
+    row = merged->row;
+    alignment_destruct(merged, 0);
+    CuAssertStrEquals(testCase, "C-CAT", row->bases);
+    while(row != NULL) {
+        Alignment_Row *n_row = row->n_row;
+        alignment_row_destruct(row);
+        row = n_row;
+    }
+
+    // Blocks read from a MAF have a base matrix
+    li = LI_construct(fopen("./tests/evolverMammals.maf", "r"));
+    Tag *tags = maf_read_header(li);
+    tag_destruct(tags);
+    while((alignment = maf_read_block(li)) != NULL) {
+        check_base_matrix(testCase, alignment);
+        alignment_destruct(alignment, 1);
+    }
+    LI_destruct(li);
+
+    // As do the blocks clipped to a region
+    char *taf_file = "./tests/base_matrix_test.taf";
+    CuAssertIntEquals(testCase, 0, st_system("./bin/taffy view -i ./tests/evolverMammals.maf -o %s", taf_file));
+    CuAssertIntEquals(testCase, 0, st_system("./bin/taffy index -i %s -b 1000", taf_file));
+    char *idx_file = stString_print("%s.tai", taf_file);
+    fh = fopen(idx_file, "r");
+    Tai *tai = tai_load(fh, 0);
+    fclose(fh);
+    li = LI_construct(fopen(taf_file, "r"));
+    tags = taf_read_header(li);
+    tag_destruct(tags);
+    TaiIt *tai_it = tai_iterator(tai, li, 0, tai->names + tai->contig_name_offsets[0],
+                                 tai->seq_pos[tai->contig_starts[0]] + 1003, 5000);
+    int64_t blocks = 0;
+    while((alignment = tai_next(tai_it, li)) != NULL) {
+        check_base_matrix(testCase, alignment);
+        alignment_destruct(alignment, 1);
+        blocks++;
+    }
+    CuAssertTrue(testCase, blocks > 1);
+    tai_iterator_destruct(tai_it);
+    LI_destruct(li);
+    tai_destruct(tai);
+    st_system("rm -f %s %s %s %s", temp_file, temp_out, taf_file, idx_file);
+    free(idx_file);
+}
+
+static int64_t row_index(Alignment *alignment, Alignment_Row *row) {
+    int64_t i = 0;
+    for(Alignment_Row *r = alignment->row; r != row; r = r->n_row) {
+        i++;
+    }
+    return i;
+}
+
+static void test_taf_parallel_reader(CuTest *testCase) {
+    // Make a taf with anchors of substituted rows, of inserted rows and of deleted and inserted rows,
+    // between which rows are gapped, deleted and inserted
+    char *temp_file = "./tests/taf_parallel_reader_test.taf";
+    FILE *fh = fopen(temp_file, "w");
+    fprintf(fh, "#taf version:1\n");
+    fprintf(fh, "ACG ; i 0 a 0 + 100000 i 1 b 0 + 100000 i 2 c 0 - 100000\n");
+    for(int64_t i=1; i<2000; i++) {
+        if(i % 7 == 0) {
+            fprintf(fh, "ACG ; s 0 a %" PRIi64 " + 100000 s 1 b %" PRIi64 " + 100000 s 2 c %" PRIi64 " - 100000\n",
+                    i * 10, i * 5, i * 3);
+        } else if(i % 29 == 0) {
+            fprintf(fh, "AC-G ; d 1 s 0 a %" PRIi64 " + 100000 i 1 e %" PRIi64 " + 1000 s 2 c 7 - 100000 "
+                    "i 3 f 0 + 1000\n", i * 10, i);
+            fprintf(fh, "ACG ; d 3\n");
+        } else if(i % 31 == 0) {
+            fprintf(fh, "ACG ; d 0 d 0 d 0 i 0 a %" PRIi64 " + 100000 i 1 b 0 + 100000 i 2 c 0 - 100000\n", i);
+        } else if(i % 11 == 0) {
+            fprintf(fh, "ACGT ; i 3 d %" PRIi64 " + 1000\n", i);
+            fprintf(fh, "ACG ; d 3 g 1 2\n");
+        } else {
+            fprintf(fh, "ACG ; g 0 2 G 2 AT\n");
+        }
+        fprintf(fh, "A-T\nAC-\n");
+    }
+    fclose(fh);
+
+    for(int64_t threads=1; threads<=4; threads+=3) {
+        // Read the blocks sequentially and in parallel, with a chunk for each few anchors
+        LI *li = LI_construct(fopen(temp_file, "r"));
+        tag_destruct(taf_read_header(li));
+        LI *li2 = LI_construct(fopen(temp_file, "r"));
+        tag_destruct(taf_read_header(li2));
+        Parallel_Reader *reader = taf_parallel_reader_construct(li2, 0, 0, threads, 500);
+        Alignment *alignment, *p_alignment = NULL, *alignment2, *p_alignment2 = NULL;
+        int64_t blocks = 0;
+        while((alignment = taf_read_block(p_alignment, 0, li)) != NULL) {
+            alignment2 = parallel_reader_next(reader, p_alignment2);
+            CuAssertTrue(testCase, alignment2 != NULL);
+            CuAssertIntEquals(testCase, alignment->row_number, alignment2->row_number);
+            CuAssertIntEquals(testCase, alignment->column_number, alignment2->column_number);
+            Alignment_Row *row = alignment->row, *row2 = alignment2->row;
+            while(row != NULL) {
+                CuAssertStrEquals(testCase, row->sequence_name, row2->sequence_name);
+                CuAssertIntEquals(testCase, row->start, row2->start);
+                CuAssertIntEquals(testCase, row->length, row2->length);
+                CuAssertIntEquals(testCase, row->strand, row2->strand);
+                CuAssertStrEquals(testCase, row->bases, row2->bases);
+                CuAssertStrEquals(testCase, row->left_gap_sequence, row2->left_gap_sequence);
+                // Check the rows are linked to the same rows of the previous block
+                CuAssertTrue(testCase, (row->l_row == NULL) == (row2->l_row == NULL));
+                if(row->l_row != NULL) {
+                    CuAssertIntEquals(testCase, row_index(p_alignment, row->l_row),
+                                      row_index(p_alignment2, row2->l_row));
+                    CuAssertTrue(testCase, row2->l_row->r_row == row2);
+                }
+                row = row->n_row; row2 = row2->n_row;
+            }
+            if(p_alignment != NULL) {
+                alignment_destruct(p_alignment, 1);
+                alignment_destruct(p_alignment2, 1);
+            }
+            p_alignment = alignment;
+            p_alignment2 = alignment2;
+            blocks++;
+        }
+        CuAssertTrue(testCase, blocks > 2000);
+        CuAssertTrue(testCase, parallel_reader_next(reader, p_alignment2) == NULL);
+        alignment_destruct(p_alignment, 1);
+        alignment_destruct(p_alignment2, 1);
+        parallel_reader_destruct(reader);
+        LI_destruct(li);
+        LI_destruct(li2);
+
+        // Stop reading part way through, leaving blocks that have been decoded but not returned
+        li = LI_construct(fopen(temp_file, "r"));
+        tag_destruct(taf_read_header(li));
+        reader = taf_parallel_reader_construct(li, 0, 0, threads, 500);
+        p_alignment = NULL;
+        for(int64_t i=0; i<100; i++) {
+            alignment = parallel_reader_next(reader, p_alignment);
+            if(p_alignment != NULL) {
+                alignment_destruct(p_alignment, 1);
+            }
+            p_alignment = alignment;
+        }
+        parallel_reader_destruct(reader);
+        alignment_destruct(p_alignment, 1);
+        LI_destruct(li);
+    }
+    st_system("rm -f %s", temp_file);
+}
+
+/*
+ * Checks that an LI reading ahead on a background thread returns the same lines and positions as one that
+ * doesn't, across many of its buffers and after seeking back and forth.
+ */
+static void test_li_read_ahead(CuTest *testCase) {
+    char *temp_file = "./tests/li_read_ahead_test.txt";
+    FILE *fh = fopen(temp_file, "w");
+    int64_t line_number = 300000;
+    for(int64_t i=0; i<line_number; i++) {
+        if(i % 1000 == 0) { // Include some empty lines
+            fprintf(fh, "\n");
+        }
+        else {
+            fprintf(fh, "line %" PRIi64 " %s\n", i, i % 7 == 0 ? "ACGTACGTACGTACGT" : "");
+        }
+    }
+    fclose(fh);
+
+    char **lines = st_malloc(sizeof(char *) * line_number);
+    int64_t *positions = st_malloc(sizeof(int64_t) * line_number);
+    LI *li = LI_construct(fopen(temp_file, "r"));
+    for(int64_t i=0; i<line_number; i++) {
+        lines[i] = LI_get_next_line(li);
+        positions[i] = LI_tell(li);
+    }
+    CuAssertTrue(testCase, LI_get_next_line(li) == NULL);
+    LI_destruct(li);
+
+    LI_set_read_ahead(1);
+    li = LI_construct(fopen(temp_file, "r"));
+    LI_set_read_ahead(0);
+#ifdef USE_HTSLIB
+    CuAssertTrue(testCase, li->read_ahead != NULL);
+#else
+    CuAssertTrue(testCase, li->buffer_mapped); // A regular file is memory mapped instead, see test_li_next_line_view
+#endif
+    for(int64_t i=0; i<line_number; i++) {
+        CuAssertStrEquals(testCase, lines[i], LI_peek_at_next_line(li));
+        char *line = LI_get_next_line(li);
+        CuAssertStrEquals(testCase, lines[i], line);
+        CuAssertIntEquals(testCase, positions[i], LI_tell(li));
+        free(line);
+    }
+    CuAssertTrue(testCase, LI_get_next_line(li) == NULL);
+    CuAssertTrue(testCase, LI_get_next_line(li) == NULL);
+
+    // Seek to lines in turn, as the index does, and read on from them
+    int64_t seeks[] = { 5, line_number - 3, 150001, 0, 123456 };
+    for(int64_t k=0; k<5; k++) {
+        LI_seek(li, positions[seeks[k]]);
+        free(LI_get_next_line(li)); // The line peeked at before the seek
+        for(int64_t i=seeks[k]; i<line_number && i<seeks[k] + 100000; i++) {
+            char *line = LI_get_next_line(li);
+            CuAssertStrEquals(testCase, lines[i], line);
+            CuAssertIntEquals(testCase, positions[i], LI_tell(li));
+            free(line);
+        }
+    }
+    LI_destruct(li);
+
+    for(int64_t i=0; i<line_number; i++) {
+        free(lines[i]);
+    }
+    free(lines);
+    free(positions);
+    st_system("rm -f %s", temp_file);
+}
+
+/*
+ * Checks that the lines got with LI_next_line_view are the lines of the file, whether it is memory mapped,
+ * read ahead through a pipe, read through a pipe on the calling thread or read from a buffer, and that a line
+ * changed in place through LI_peek_at_next_line is returned changed.
+ */
+static void test_li_next_line_view(CuTest *testCase) {
+    char *temp_file = "./tests/li_next_line_view_test.txt";
+    FILE *fh = fopen(temp_file, "w");
+    int64_t line_number = 300000;
+    for(int64_t i=0; i<line_number; i++) {
+        fprintf(fh, "line %" PRIi64 " %s\n", i, i % 5 == 0 ? "" : "ACGTACGTACGTACGT");
+    }
+    fprintf(fh, "last line without a newline");
+    fclose(fh);
+
+    for(int64_t mode=0; mode<4; mode++) {
+        LI *li;
+        FILE *pipe = NULL;
+        char *bytes = NULL;
+        if(mode == 0) { // From the file, which is memory mapped if built without htslib
+            li = LI_construct(fopen(temp_file, "r"));
+        }
+        else if(mode == 1 || mode == 2) { // From a pipe, which can't be mapped, reading ahead or not
+            char *command = stString_print("cat %s", temp_file);
+            pipe = popen(command, "r");
+            free(command);
+            LI_set_read_ahead(mode == 1);
+            li = LI_construct(pipe);
+            LI_set_read_ahead(0);
+            CuAssertTrue(testCase, (li->read_ahead != NULL) == (mode == 1));
+        }
+        else { // From a buffer holding the file
+            fh = fopen(temp_file, "r");
+            fseek(fh, 0, SEEK_END);
+            int64_t length = ftell(fh);
+            fseek(fh, 0, SEEK_SET);
+            bytes = st_malloc(length);
+            CuAssertIntEquals(testCase, length, fread(bytes, 1, length, fh));
+            fclose(fh);
+            li = LI_construct_from_buffer(bytes, length);
+        }
+        for(int64_t i=0; i<line_number; i++) {
+            char *expected = stString_print("line %" PRIi64 " %s", i, i % 5 == 0 ? "" : "ACGTACGTACGTACGT");
+            int64_t length, peek_length;
+            char *peek = LI_peek_at_next_line_view(li, &peek_length);
+            CuAssertTrue(testCase, peek != NULL && memcmp(expected, peek, peek_length) == 0);
+            if(i % 1000 == 0) { // Change the line in place as the index does, which the view must then return
+                char *l = LI_peek_at_next_line(li);
+                CuAssertStrEquals(testCase, expected, l);
+                l[0] = 'L';
+                expected[0] = 'L';
+            }
+            char *line = LI_next_line_view(li, &length);
+            CuAssertIntEquals(testCase, strlen(expected), peek_length);
+            CuAssertIntEquals(testCase, strlen(expected), length);
+            CuAssertTrue(testCase, memcmp(expected, line, length) == 0);
+            free(expected);
+        }
+        int64_t length;
+        char *line = LI_next_line_view(li, &length);
+        CuAssertTrue(testCase, line != NULL && length == strlen("last line without a newline"));
+        CuAssertTrue(testCase, memcmp(line, "last line without a newline", length) == 0);
+        CuAssertTrue(testCase, LI_next_line_view(li, &length) == NULL);
+        CuAssertTrue(testCase, LI_peek_at_next_line_view(li, &length) == NULL);
+        CuAssertTrue(testCase, LI_get_next_line(li) == NULL);
+        LI_destruct(li);
+        if(pipe != NULL) {
+            pclose(pipe);
+        }
+        free(bytes);
+    }
+    st_system("rm -f %s", temp_file);
+}
+
+// Writes many lines through the LW, mixing LW_write with the LW_put* functions, and flushing part way to write
+// to the file handle directly
+static void write_lw_test_file(char *file, bool write_behind, bool use_compression) {
+    LW_set_write_behind(write_behind);
+    LW *lw = LW_construct(fopen(file, "w"), use_compression);
+    LW_set_write_behind(0);
+    for(int64_t i=0; i<200000; i++) {
+        LW_write(lw, "line %" PRIi64 "\t", i);
+        LW_puti64(lw, i * 7919);
+        LW_putc(lw, ' ');
+        if(i % 10000 == 0) { // A field longer than the buffer
+            LW_putrep(lw, 'N', 100000);
+            LW_write(lw, "%s", "");
+        }
+        LW_puts(lw, i % 3 == 0 ? "ACGT" : "--");
+        LW_putc(lw, '\n');
+        if(i == 100000 && !use_compression) {
+            LW_flush(lw);
+            fprintf(lw->fh, "written directly\n");
+        }
+    }
+    LW_destruct(lw, 1);
+}
+
+/*
+ * Checks that an LW writing behind on a background thread writes the same bytes as one that doesn't.
+ */
+static void test_lw_write_behind(CuTest *testCase) {
+    char *temp_file = "./tests/lw_write_behind_test.txt", *temp_file_2 = "./tests/lw_write_behind_test_2.txt";
+    for(int64_t use_compression=0; use_compression<2; use_compression++) {
+        write_lw_test_file(temp_file, 0, use_compression);
+        write_lw_test_file(temp_file_2, 1, use_compression);
+        LI *li = LI_construct(fopen(temp_file, "r")), *li_2 = LI_construct(fopen(temp_file_2, "r"));
+        int64_t line_number = 0;
+        char *line;
+        while((line = LI_get_next_line(li)) != NULL) {
+            char *line_2 = LI_get_next_line(li_2);
+            CuAssertTrue(testCase, line_2 != NULL);
+            CuAssertStrEquals(testCase, line, line_2);
+            free(line);
+            free(line_2);
+            line_number++;
+        }
+        CuAssertTrue(testCase, LI_get_next_line(li_2) == NULL);
+        CuAssertIntEquals(testCase, use_compression ? 200000 : 200001, line_number);
+        LI_destruct(li);
+        LI_destruct(li_2);
+    }
+    st_system("rm -f %s %s", temp_file, temp_file_2);
+}
+
+// Converts the maf to a compressed taf with block aligned anchors, returning the number of anchor lines in it
+static int64_t write_taf_with_block_aligned_anchors(CuTest *testCase, char *maf_file, char *taf_file,
+                                                    int64_t anchor_every_n_bytes) {
+    LI *li = LI_construct(fopen(maf_file, "r"));
+    LW *lw = LW_construct(fopen(taf_file, "w"), 1);
+    LW_set_block_aligned_anchors(lw, anchor_every_n_bytes);
+    Tag *tags = maf_read_header(li);
+    taf_write_header(tags, lw);
+    tag_destruct(tags);
+    Alignment *alignment, *p_alignment = NULL;
+    while((alignment = maf_read_block(li)) != NULL) {
+        if(p_alignment != NULL) {
+            alignment_link_adjacent(p_alignment, alignment, 1);
+        }
+        taf_write_block(p_alignment, alignment, 0, -1, lw); // Only anchor where the bytes say so
+        if(p_alignment != NULL) {
+            alignment_destruct(p_alignment, 1);
+        }
+        p_alignment = alignment;
+    }
+    alignment_destruct(p_alignment, 1);
+    LW_destruct(lw, 1);
+    LI_destruct(li);
+
+    // Count the anchors, checking each starts a BGZF block
+    li = LI_construct(fopen(taf_file, "r"));
+    int64_t anchors = 0;
+    char *line;
+    while((line = LI_get_next_line(li)) != NULL) {
+        Taf_Line taf_line;
+        if(taf_line_scan(line, &taf_line) && taf_line_is_anchor(&taf_line, 0)) {
+            anchors++;
+#ifdef USE_HTSLIB
+            CuAssertIntEquals(testCase, 0, LI_tell(li) & 0xFFFF);
+#endif
+        }
+        free(line);
+    }
+    LI_destruct(li);
+    return anchors;
+}
+
+/*
+ * Checks that writing anchors every so many bytes adds anchors, each starting a BGZF block, and that the taf
+ * still reads back as the maf it was made from.
+ */
+static void test_taf_block_aligned_anchors(CuTest *testCase) {
+    char *maf_file = "./tests/evolverMammals.maf", *taf_file = "./tests/block_aligned_anchors_test.taf.gz";
+    int64_t anchors = write_taf_with_block_aligned_anchors(testCase, maf_file, taf_file, 0);
+    int64_t more_anchors = write_taf_with_block_aligned_anchors(testCase, maf_file, taf_file, 2000);
+    st_logInfo("Got %" PRIi64 " anchors, and %" PRIi64 " anchoring every 2000 bytes\n", anchors, more_anchors);
+    CuAssertTrue(testCase, anchors > 0);
+    CuAssertTrue(testCase, more_anchors > anchors);
+
+    LI *li_maf = LI_construct(fopen(maf_file, "r")), *li = LI_construct(fopen(taf_file, "r"));
+    Tag *tags = taf_read_header(li);
+    tag_destruct(tags);
+    Alignment *alignment, *alignment2, *p_alignment2 = NULL;
+    while((alignment = maf_read_block(li_maf)) != NULL) {
+        alignment2 = taf_read_block(p_alignment2, 0, li);
+        CuAssertTrue(testCase, alignment2 != NULL);
+        CuAssertIntEquals(testCase, alignment->row_number, alignment2->row_number);
+        for(Alignment_Row *row = alignment->row, *row2 = alignment2->row; row != NULL;
+            row = row->n_row, row2 = row2->n_row) {
+            CuAssertStrEquals(testCase, row->sequence_name, row2->sequence_name);
+            CuAssertIntEquals(testCase, row->start, row2->start);
+            CuAssertIntEquals(testCase, row->length, row2->length);
+            CuAssertStrEquals(testCase, row->bases, row2->bases);
+        }
+        alignment_destruct(alignment, 1);
+        if(p_alignment2 != NULL) {
+            alignment_destruct(p_alignment2, 1);
+        }
+        p_alignment2 = alignment2;
+    }
+    CuAssertTrue(testCase, taf_read_block(p_alignment2, 0, li) == NULL);
+    alignment_destruct(p_alignment2, 1);
+    LI_destruct(li);
+    LI_destruct(li_maf);
+    st_system("rm -f %s", taf_file);
+}
+
+/*
+ * Checks that indexing a taf as it is written, with and without compression and write behind, gives the same index
+ * as indexing it afterwards with tai_create.
+ */
+static void test_tai_index_as_written(CuTest *testCase) {
+    char *maf_file = "./tests/evolverMammals.maf", *taf_file = "./tests/index_as_written_test.taf";
+    char *idx_file = "./tests/index_as_written_test.taf.tai", *idx_file_2 = "./tests/index_as_written_test.tai";
+    for(int64_t i=0; i<4; i++) {
+        bool use_compression = i % 2, write_behind = i / 2;
+        LW_set_write_behind(write_behind);
+        LI *li = LI_construct(fopen(maf_file, "r"));
+        LW *lw = LW_construct(fopen(taf_file, "w"), use_compression);
+        LW_set_write_behind(0);
+        Tai_Writer *tw = tai_writer_construct_for_lw(lw, taf_file, 1000);
+        Tag *tags = maf_read_header(li);
+        taf_write_header(tags, lw);
+        tag_destruct(tags);
+        Alignment *alignment, *p_alignment = NULL;
+        while((alignment = maf_read_block(li)) != NULL) {
+            if(p_alignment != NULL) {
+                alignment_link_adjacent(p_alignment, alignment, 1);
+            }
+            taf_write_block(p_alignment, alignment, 0, 500, lw);
+            if(p_alignment != NULL) {
+                alignment_destruct(p_alignment, 1);
+            }
+            p_alignment = alignment;
+        }
+        alignment_destruct(p_alignment, 1);
+        LW_destruct(lw, 1);
+        tai_writer_destruct(tw);
+        LI_destruct(li);
+
+        // Index it again the usual way
+        li = LI_construct(fopen(taf_file, "r"));
+        FILE *idx_fh = fopen(idx_file_2, "w");
+        tai_create(li, idx_fh, 1000);
+        fclose(idx_fh);
+        LI_destruct(li);
+
+        LI *li_idx = LI_construct(fopen(idx_file, "r")), *li_idx_2 = LI_construct(fopen(idx_file_2, "r"));
+        int64_t lines = 0;
+        char *line;
+        while((line = LI_get_next_line(li_idx)) != NULL) {
+            char *line_2 = LI_get_next_line(li_idx_2);
+            CuAssertTrue(testCase, line_2 != NULL);
+            CuAssertStrEquals(testCase, line_2, line);
+            free(line);
+            free(line_2);
+            lines++;
+        }
+        CuAssertTrue(testCase, LI_get_next_line(li_idx_2) == NULL);
+        CuAssertTrue(testCase, lines > 1);
+        LI_destruct(li_idx);
+        LI_destruct(li_idx_2);
+    }
+    st_system("rm -f %s %s %s", taf_file, idx_file, idx_file_2);
+}
+
+// Gets the blocks of the region from the taf using the index, as a string of their reference coordinates
+static char *get_region_coordinates(Tai *tai, char *taf_file, const char *contig, int64_t start, int64_t length) {
+    LI *li = LI_construct(fopen(taf_file, "r"));
+    Tag *tags = taf_read_header(li);
+    tag_destruct(tags);
+    TaiIt *tai_it = tai_iterator(tai, li, 0, contig, start, length);
+    char *coordinates = stString_copy("");
+    Alignment *alignment;
+    while((alignment = tai_next(tai_it, li)) != NULL) {
+        char *c = stString_print("%s %s:%" PRIi64 "-%" PRIi64, coordinates, alignment->row->sequence_name,
+                                 alignment->row->start, alignment->row->start + alignment->row->length);
+        free(coordinates);
+        coordinates = c;
+        alignment_destruct(alignment, 1);
+    }
+    tai_iterator_destruct(tai_it);
+    LI_destruct(li);
+    return coordinates;
+}
+
+/*
+ * Checks that the binary index loads as the same index as the text index, and gives the same regions, as does
+ * the binary index that also indexes blocks between anchors.
+ */
+static void test_tai_binary_index(CuTest *testCase) {
+    char *taf_file = "./tests/binary_index_test.taf", *idx_file = "./tests/binary_index_test.taf.tai";
+    char *text_idx_file = "./tests/binary_index_test.text.tai", *dense_idx_file = "./tests/binary_index_test.dense.tai";
+    CuAssertIntEquals(testCase, 0, st_system("./bin/taffy view -i ./tests/evolverMammals.maf -s 1000 -o %s", taf_file));
+    CuAssertIntEquals(testCase, 0, st_system("./bin/taffy index -i %s -b 1000", taf_file));
+    CuAssertIntEquals(testCase, 0, st_system("mv %s %s", idx_file, text_idx_file));
+    CuAssertIntEquals(testCase, 0, st_system("./bin/taffy index -i %s -b 1000 -B -k 2", taf_file));
+    CuAssertIntEquals(testCase, 0, st_system("mv %s %s", idx_file, dense_idx_file));
+    CuAssertIntEquals(testCase, 0, st_system("./bin/taffy index -i %s -b 1000 -B", taf_file));
+
+    FILE *fh = fopen(text_idx_file, "r"), *fh_2 = fopen(idx_file, "r"), *fh_3 = fopen(dense_idx_file, "r");
+    Tai *tai = tai_load(fh, 0), *tai_2 = tai_load(fh_2, 0), *tai_3 = tai_load(fh_3, 0);
+    fclose(fh);
+    fclose(fh_2); // The binary index stays mapped after its file is closed
+    fclose(fh_3);
+    CuAssertTrue(testCase, tai_3->record_number > tai->record_number);
+    CuAssertTrue(testCase, !tai->mapped);
+    CuAssertTrue(testCase, tai_2->mapped);
+    CuAssertTrue(testCase, tai->contig_number > 0);
+    CuAssertTrue(testCase, tai->record_number > tai->contig_number);
+    CuAssertIntEquals(testCase, tai->image_length, tai_2->image_length);
+    CuAssertTrue(testCase, memcmp(tai->image, tai_2->image, tai->image_length) == 0);
+
+    for(int64_t i=0; i<tai->contig_number; i++) {
+        char *contig = tai->names + tai->contig_name_offsets[i];
+        if(i > 0) { // The contigs are sorted
+            CuAssertTrue(testCase, strcmp(tai->names + tai->contig_name_offsets[i-1], contig) < 0);
+        }
+        int64_t end = tai->seq_pos[tai->contig_starts[i+1]-1] + 2000;
+        for(int64_t start=0; start<end; start+=777) {
+            char *coordinates = get_region_coordinates(tai, taf_file, contig, start, 500);
+            char *coordinates_2 = get_region_coordinates(tai_2, taf_file, contig, start, 500);
+            char *coordinates_3 = get_region_coordinates(tai_3, taf_file, contig, start, 500);
+            CuAssertStrEquals(testCase, coordinates, coordinates_2);
+            CuAssertStrEquals(testCase, coordinates, coordinates_3);
+            free(coordinates);
+            free(coordinates_2);
+            free(coordinates_3);
+        }
+    }
+    tai_destruct(tai);
+    tai_destruct(tai_2);
+    tai_destruct(tai_3);
+    st_system("rm -f %s %s %s %s", taf_file, idx_file, text_idx_file, dense_idx_file);
+}
+
+// Gets the blocks of the regions from the taf using the index, as a string of their region indexes and reference
+// coordinates, reading them with the given number of threads if more than zero
+static char *get_regions_coordinates(Tai *tai, char *taf_file, stList *regions, bool sorted, int64_t threads) {
+    LI *li = LI_construct(fopen(taf_file, "r"));
+    Tag *tags = taf_read_header(li);
+    tag_destruct(tags);
+    TaiRegionsIt *tai_regions_it = threads > 0 ? NULL : tai_regions_iterator(tai, li, 0, regions, sorted);
+    Tai_Parallel_Reader *reader = threads > 0 ? tai_parallel_reader_construct(tai, taf_file, 0, regions, sorted, threads) : NULL;
+    char *coordinates = stString_copy("");
+    Alignment *alignment;
+    int64_t region_index;
+    while((alignment = reader != NULL ? tai_parallel_reader_next(reader, &region_index) :
+                       tai_regions_next(tai_regions_it, li, &region_index)) != NULL) {
+        char *c = stString_print("%s %" PRIi64 " %s:%" PRIi64 "-%" PRIi64, coordinates, region_index,
+                                 alignment->row->sequence_name, alignment->row->start,
+                                 alignment->row->start + alignment->row->length);
+        free(coordinates);
+        coordinates = c;
+        alignment_destruct(alignment, 1);
+    }
+    if(reader != NULL) {
+        tai_parallel_reader_destruct(reader);
+    } else {
+        tai_regions_iterator_destruct(tai_regions_it);
+    }
+    LI_destruct(li);
+    return coordinates;
+}
+
+/*
+ * Checks that reading a list of regions gives the blocks of each region as reading them one at a time does, both
+ * in the order given and sorted with overlapping regions merged, with and without reading on between regions,
+ * and on one thread or many.
+ */
+static void test_tai_regions(CuTest *testCase) {
+    char *taf_file = "./tests/regions_test.taf", *idx_file = "./tests/regions_test.taf.tai";
+    char *bed_file = "./tests/regions_test.bed";
+    CuAssertIntEquals(testCase, 0, st_system("./bin/taffy view -i ./tests/evolverMammals.maf -s 1000 -o %s", taf_file));
+    for(int64_t dense=0; dense<2; dense++) {
+        CuAssertIntEquals(testCase, 0, st_system("./bin/taffy index -i %s -b 1000 %s", taf_file, dense ? "-B -k 2" : ""));
+        FILE *fh = fopen(idx_file, "r");
+        Tai *tai = tai_load(fh, 0);
+        fclose(fh);
+
+        // Make a bed of regions in reverse order, every third of which is overlapped by the region after it
+        FILE *bed_fh = fopen(bed_file, "w");
+        fprintf(bed_fh, "# regions\n");
+        for(int64_t i=tai->contig_number-1; i>=0; i--) {
+            char *contig = tai->names + tai->contig_name_offsets[i];
+            int64_t end = tai->seq_pos[tai->contig_starts[i+1]-1] + 2000;
+            for(int64_t start=end-(end % 777); start>=0; start-=777) {
+                if((start / 777) % 3 == 0) {
+                    fprintf(bed_fh, "%s\t%" PRIi64 "\t%" PRIi64 "\n", contig, start + 400, start + 600);
+                }
+                fprintf(bed_fh, "%s\t%" PRIi64 "\t%" PRIi64 "\tname\n", contig, start, start + 500);
+            }
+        }
+        fclose(bed_fh);
+        bed_fh = fopen(bed_file, "r");
+        stList *regions = tai_read_bed(bed_fh);
+        fclose(bed_fh);
+        CuAssertTrue(testCase, stList_length(regions) > 10);
+
+        // In the order given, each region is read whole
+        char *expected = stString_copy("");
+        for(int64_t i=0; i<stList_length(regions); i++) {
+            Tai_Region *region = stList_get(regions, i);
+            CuAssertIntEquals(testCase, i, region->index);
+            char *coordinates = get_region_coordinates(tai, taf_file, region->contig, region->start,
+                                                       region->end - region->start);
+            stList *blocks = stString_splitByString(coordinates, " ");
+            for(int64_t j=1; j<stList_length(blocks); j++) {
+                char *e = stString_print("%s %" PRIi64 " %s", expected, i, (char *)stList_get(blocks, j));
+                free(expected);
+                expected = e;
+            }
+            stList_destruct(blocks);
+            free(coordinates);
+        }
+        for(int64_t threads=0; threads<5; threads+=2) {
+            char *coordinates = get_regions_coordinates(tai, taf_file, regions, 0, threads);
+            CuAssertStrEquals(testCase, expected, coordinates);
+            free(coordinates);
+        }
+        free(expected);
+
+        // Sorted, the overlapping regions are merged, keeping the index of the first given
+        expected = stString_copy("");
+        for(int64_t i=stList_length(regions)-1; i>=0; i--) {
+            Tai_Region *region = stList_get(regions, i);
+            if(region->end - region->start == 200) {
+                continue; // merged into the region after it
+            }
+            int64_t merged = (region->start / 777) % 3 == 0;
+            char *c = get_region_coordinates(tai, taf_file, region->contig, region->start, merged ? 600 : 500);
+            stList *blocks = stString_splitByString(c, " ");
+            for(int64_t j=1; j<stList_length(blocks); j++) {
+                char *e = stString_print("%s %" PRIi64 " %s", expected, merged ? i - 1 : i, (char *)stList_get(blocks, j));
+                free(expected);
+                expected = e;
+            }
+            stList_destruct(blocks);
+            free(c);
+        }
+        for(int64_t threads=0; threads<5; threads+=2) {
+            char *coordinates = get_regions_coordinates(tai, taf_file, regions, 1, threads);
+            CuAssertStrEquals(testCase, expected, coordinates);
+            free(coordinates);
+        }
+        free(expected);
+
+        // Every region but the last, the first included, keeps the block read past its end for the region after it
+        LI *li = LI_construct(fopen(taf_file, "r"));
+        Tag *tags = taf_read_header(li);
+        tag_destruct(tags);
+        TaiRegionsIt *tai_regions_it = tai_regions_iterator(tai, li, 0, regions, 1);
+        Alignment *alignment = tai_regions_next(tai_regions_it, li, NULL);
+        CuAssertTrue(testCase, alignment != NULL && tai_regions_it->region_index == 0);
+        CuAssertTrue(testCase, tai_regions_it->tai_it->keep_next);
+        alignment_destruct(alignment, 1);
+        tai_regions_iterator_destruct(tai_regions_it);
+        LI_destruct(li);
+
+        stList_destruct(regions);
+        tai_destruct(tai);
+    }
+    st_system("rm -f %s %s %s", taf_file, idx_file, bed_file);
+}
+
+/*
+ * Checks that overlapping regions written with -O each get their own file, holding the same columns as the region
+ * viewed alone.
+ */
+static void test_tai_regions_output_prefix(CuTest *testCase) {
+    char *taf_file = "./tests/regions_output_test.taf", *idx_file = "./tests/regions_output_test.taf.tai";
+    char *bed_file = "./tests/regions_output_test.bed", *prefix = "./tests/regions_output_test.";
+    CuAssertIntEquals(testCase, 0, st_system("./bin/taffy view -i ./tests/evolverMammals.maf -s 1000 -o %s", taf_file));
+    CuAssertIntEquals(testCase, 0, st_system("./bin/taffy index -i %s -b 1000", taf_file));
+    FILE *fh = fopen(idx_file, "r");
+    Tai *tai = tai_load(fh, 0);
+    fclose(fh);
+    char *contig = tai->names + tai->contig_name_offsets[0];
+
+    int64_t starts[] = { 100, 200 }, ends[] = { 300, 400 };
+    FILE *bed_fh = fopen(bed_file, "w");
+    for(int64_t i=0; i<2; i++) {
+        fprintf(bed_fh, "%s\t%" PRIi64 "\t%" PRIi64 "\n", contig, starts[i], ends[i]);
+    }
+    fclose(bed_fh);
+    CuAssertIntEquals(testCase, 0, st_system("./bin/taffy view -i %s -R %s -O %s", taf_file, bed_file, prefix));
+    for(int64_t i=0; i<2; i++) {
+        CuAssertIntEquals(testCase, 0, st_system("./bin/taffy view -i %s -r %s:%" PRIi64 "-%" PRIi64 " -o %sexpected.taf",
+                                                 taf_file, contig, starts[i], ends[i], prefix));
+        CuAssertIntEquals(testCase, 0, st_system("cmp -s %s%" PRIi64 ".taf %sexpected.taf", prefix, i, prefix));
+    }
+
+    tai_destruct(tai);
+    st_system("rm -f %s %s %s %s*.taf", taf_file, idx_file, bed_file, prefix);
+}
+
+/*
+ * Checks that indexing on many threads gives the same index as indexing on one, including when the file is split
+ * into ranges shorter than its lines.
+ */
+static void test_tai_parallel_index(CuTest *testCase) {
+    char *taf_file = "./tests/parallel_index_test.taf", *idx_file = "./tests/parallel_index_test.taf.tai";
+    char *idx_file_2 = "./tests/parallel_index_test.1.tai";
+    // Both uncompressed and bgzipped, with an anchor in a new BGZF block about every 1000 bytes so that the
+    // file is split between many blocks (built without htslib the second file is uncompressed too)
+    for(int64_t compressed=0; compressed<2; compressed++) {
+        CuAssertIntEquals(testCase, 0, st_system("./bin/taffy view -i ./tests/evolverMammals.maf -s 7 -u %s -o %s",
+                                                 compressed ? "-c -A 1000" : "", taf_file));
+        for(int64_t binary=0; binary<2; binary++) {
+            CuAssertIntEquals(testCase, 0, st_system("./bin/taffy index -i %s -b 1 %s", taf_file, binary ? "-B" : ""));
+            CuAssertIntEquals(testCase, 0, st_system("mv %s %s", idx_file, idx_file_2));
+            int64_t threads[] = { 2, 7, 1000 };
+            for(int64_t i=0; i<3; i++) {
+                CuAssertIntEquals(testCase, 0, st_system("./bin/taffy index -i %s -b 1 -c %" PRIi64 " %s", taf_file,
+                                                         threads[i], binary ? "-B" : ""));
+                CuAssertIntEquals(testCase, 0, st_system("cmp -s %s %s", idx_file, idx_file_2));
+            }
+        }
+    }
+    st_system("rm -f %s %s %s", taf_file, idx_file, idx_file_2);
+}
+
+/*
+ * Checks getting a range of columns at once agrees with getting them one at a time, with and without a base matrix.
+ */
+static void check_get_columns(CuTest *testCase, Alignment *alignment, int64_t column_start, int64_t column_number) {
+    int64_t row_number = alignment->row_number;
+    char *columns = st_malloc(row_number * column_number + 1);
+    int8_t *columns_int8 = st_malloc(sizeof(int8_t) * (row_number * column_number + 1));
+    int32_t *columns_int32 = st_malloc(sizeof(int32_t) * (row_number * column_number + 1));
+    alignment_get_columns_in_buffer(alignment, column_start, column_number, columns);
+    alignment_get_columns_as_int8_in_buffer(alignment, column_start, column_number, columns_int8);
+    alignment_get_columns_as_int32_in_buffer(alignment, column_start, column_number, columns_int32);
+    for(int64_t j=0; j<column_number; j++) {
+        char *column = alignment_get_column(alignment, column_start + j);
+        int32_t *column_int32 = alignment_get_column_as_int_array(alignment, column_start + j);
+        for(int64_t i=0; i<row_number; i++) {
+            CuAssertTrue(testCase, columns[j * row_number + i] == column[i]);
+            CuAssertIntEquals(testCase, column_int32[i], columns_int8[j * row_number + i]);
+            CuAssertIntEquals(testCase, column_int32[i], columns_int32[j * row_number + i]);
+        }
+        free(column);
+        free(column_int32);
+    }
+    free(columns);
+    free(columns_int8);
+    free(columns_int32);
+}
+
+static void test_get_columns(CuTest *testCase) {
+    LI *li = LI_construct(fopen("./tests/evolverMammals.maf", "r"));
+    Tag *tags = maf_read_header(li);
+    tag_destruct(tags);
+    Alignment *alignment;
+    int64_t blocks = 0;
+    while((alignment = maf_read_block(li)) != NULL) {
+        CuAssertTrue(testCase, alignment_get_base_matrix(alignment) != NULL);
+        check_get_columns(testCase, alignment, 0, alignment->column_number);
+        check_get_columns(testCase, alignment, alignment->column_number / 3, alignment->column_number / 2);
+        if(alignment->row_number > 1) { // Drop the first row, so the rows are no longer where the matrix has them
+            Alignment_Row *row = alignment->row;
+            alignment->row = row->n_row;
+            alignment->row_number--;
+            row->n_row = NULL;
+            alignment_row_destruct(row);
+            alignment_index_rows(alignment);
+            CuAssertTrue(testCase, alignment_get_base_matrix(alignment) == NULL);
+            check_get_columns(testCase, alignment, 0, alignment->column_number);
+        }
+        alignment_destruct(alignment, 1);
+        blocks++;
+    }
+    CuAssertTrue(testCase, blocks > 0);
+    LI_destruct(li);
+}
+
+static void test_row_index(CuTest *testCase) {
+    char *taf_file = "./tests/row_index_test.taf";
+    CuAssertIntEquals(testCase, 0, st_system("./bin/taffy view -i ./tests/evolverMammals.maf -o %s", taf_file));
+    stList *prefixes = stList_construct3(0, (void (*)(void *))sequence_prefix_destruct);
+    stList_append(prefixes, sequence_prefix_construct(stString_copy("a_sequence_not_in_the_alignment"), 0));
+    for(int64_t maf=0; maf<2; maf++) {
+        LI *li = LI_construct(fopen(maf ? "./tests/evolverMammals.maf" : taf_file, "r"));
+        Tag *tags = maf ? maf_read_header(li) : taf_read_header(li);
+        tag_destruct(tags);
+        Alignment *alignment, *p_alignment = NULL;
+        int64_t blocks = 0;
+        while((alignment = maf ? maf_read_block(li) : taf_read_block(p_alignment, 0, li)) != NULL) {
+            check_row_index(testCase, alignment); // As read
+            if(maf) { // The rows of MAF blocks are linked by the caller, which uses the row index
+                if(p_alignment != NULL) {
+                    alignment_link_adjacent(p_alignment, alignment, 1);
+                }
+                // Sorting the rows other than the first reorders the index
+                alignment_sort_the_rows(p_alignment, alignment, NULL, 1, 1);
+                check_row_index(testCase, alignment);
+                // Filtering out a row removes it from the index
+                Alignment_Row *row = alignment->row;
+                stList *first_prefix = stList_construct3(0, (void (*)(void *))sequence_prefix_destruct);
+                for(Alignment_Row *r = row->n_row; r != NULL; r = r->n_row) {
+                    if(strcmp(r->sequence_name, row->sequence_name) != 0) {
+                        stList_append(first_prefix, sequence_prefix_construct(stString_copy(r->sequence_name), 0));
+                        break;
+                    }
+                }
+                stList_sort(first_prefix, (int (*)(const void *, const void *))sequence_prefix_cmp_fn);
+                alignment_filter_the_rows(alignment, first_prefix, 1);
+                check_row_index(testCase, alignment);
+                stList_destruct(first_prefix);
+                // Padding adds rows to the index
+                int64_t row_number = alignment->row_number;
+                alignment_pad_the_rows(p_alignment, alignment, prefixes);
+                check_row_index(testCase, alignment);
+                CuAssertIntEquals(testCase, row_number + 1, alignment->row_number);
+            }
+            if(p_alignment != NULL) {
+                alignment_destruct(p_alignment, 1);
+            }
+            p_alignment = alignment;
+            blocks++;
+        }
+        CuAssertTrue(testCase, blocks > 1);
+        if(p_alignment != NULL) {
+            alignment_destruct(p_alignment, 1);
+        }
+        LI_destruct(li);
+    }
+    stList_destruct(prefixes);
+    st_system("rm -f %s", taf_file);
+}
+
+static bool is_aligned_base(char base) {
+    return base != '-' && toupper(base) != 'N';
+}
+
+static char random_base(double gap_probability) {
+    const char *alphabet = "ACGTACGTacgt------NnRY*";
+    return st_random() < gap_probability ? '-' : alphabet[st_randomInt(0, strlen(alphabet))];
+}
+
+static void test_packed_bases(CuTest *testCase) {
+    // Random rows of bases, gaps, soft-masked bases and exceptions, of lengths around the word boundaries. The
+    // rows are either dense, mostly gaps, so packed sparse, or one of each, so that every pairing gets compared
+    int64_t lengths[] = { 0, 1, 31, 32, 33, 63, 64, 65, 130, 1000 };
+    for(int64_t t=0; t<3; t++) {
+        double gap_probability = t == 0 ? 0.0 : 0.995, gap_probability_2 = t < 2 ? gap_probability : 0.0;
+        for(int64_t l=0; l<10; l++) {
+            int64_t length = lengths[l];
+            char *bases = st_malloc(length + 1), *bases_2 = st_malloc(length + 1), *decoded = st_malloc(length + 1);
+            for(int64_t i=0; i<length; i++) {
+                bases[i] = random_base(gap_probability);
+                bases_2[i] = t < 2 && st_random() > 0.3 ? bases[i] : random_base(gap_probability_2);
+            }
+            bases[length] = '\0';
+            bases_2[length] = '\0';
+            Packed_Bases *packed_bases = packed_bases_construct(bases, length);
+            Packed_Bases *packed_bases_2 = packed_bases_construct(bases_2, length);
+            CuAssertIntEquals(testCase, length, packed_bases_length(packed_bases));
+            if(t > 0 && length == 1000) {
+                CuAssertTrue(testCase, packed_bases_is_sparse(packed_bases));
+            }
+            if(t == 0 && length >= 64) {
+                CuAssertTrue(testCase, !packed_bases_is_sparse(packed_bases));
+            }
+            // Decoding gives back the bases, whole or in part
+            for(int64_t i=0; i<length; i++) {
+                CuAssertIntEquals(testCase, bases[i], packed_bases_get_base(packed_bases, i));
+            }
+            packed_bases_decode(packed_bases, 0, length, decoded);
+            decoded[length] = '\0';
+            CuAssertStrEquals(testCase, bases, decoded);
+            for(int64_t k=0; k<10 && length > 0; k++) {
+                int64_t column_start = st_randomInt(0, length), column_number = st_randomInt(0, length - column_start + 1);
+                packed_bases_decode(packed_bases, column_start, column_number, decoded);
+                CuAssertTrue(testCase, memcmp(bases + column_start, decoded, column_number) == 0);
+                int64_t gaps = 0;
+                for(int64_t i=column_start; i<column_start + column_number; i++) {
+                    gaps += bases[i] == '-';
+                }
+                CuAssertIntEquals(testCase, gaps, packed_bases_count_gaps(packed_bases, column_start, column_number));
+            }
+            // Comparing the packed rows counts the same columns as comparing the bases
+            int64_t aligned = 0, identical = 0, packed_aligned, packed_identical;
+            for(int64_t i=0; i<length; i++) {
+                if(is_aligned_base(bases[i]) && is_aligned_base(bases_2[i])) {
+                    aligned++;
+                    identical += toupper(bases[i]) == toupper(bases_2[i]);
+                }
+            }
+            packed_bases_compare(packed_bases, packed_bases_2, &packed_aligned, &packed_identical);
+            CuAssertIntEquals(testCase, aligned, packed_aligned);
+            CuAssertIntEquals(testCase, identical, packed_identical);
+            packed_bases_compare(packed_bases_2, packed_bases, &packed_aligned, &packed_identical);
+            CuAssertIntEquals(testCase, aligned, packed_aligned);
+            CuAssertIntEquals(testCase, identical, packed_identical);
+            packed_bases_destruct(packed_bases);
+            packed_bases_destruct(packed_bases_2);
+            free(bases);
+            free(bases_2);
+            free(decoded);
+        }
+    }
+
+    // A row of gaps takes no memory per column
+    Packed_Bases *gaps = packed_bases_construct_gaps(100);
+    CuAssertTrue(testCase, packed_bases_is_sparse(gaps));
+    CuAssertIntEquals(testCase, 100, packed_bases_count_gaps(gaps, 0, 100));
+    CuAssertIntEquals(testCase, '-', packed_bases_get_base(gaps, 99));
+    packed_bases_destruct(gaps);
+
+    // Merging can keep the rows that end up mostly gaps packed, here the row inserted by the second block
+    char *temp_file = "./tests/packed_bases_test.maf";
+    FILE *fh = fopen(temp_file, "w");
+    fprintf(fh, "AC ; i 0 a 0 + 200 i 1 b 0 + 200\n");
+    for(int64_t i=0; i<98; i++) {
+        fprintf(fh, "AC\n");
+    }
+    fprintf(fh, "ACG ; s 0 a 99 + 200 s 1 b 99 + 200 i 2 c 0 + 10\n");
+    fclose(fh);
+    LI *li = LI_construct(fopen(temp_file, "r"));
+    Alignment *left_alignment = taf_read_block(NULL, 0, li);
+    Alignment *right_alignment = taf_read_block(left_alignment, 0, li);
+    LI_destruct(li);
+    Alignment *merged = alignment_merge_adjacent2(left_alignment, right_alignment, 1);
+    CuAssertIntEquals(testCase, 3, merged->row_number);
+    CuAssertIntEquals(testCase, 100, merged->column_number);
+    check_row_index(testCase, merged);
+    CuAssertTrue(testCase, alignment_get_base_matrix(merged) == NULL);
+    CuAssertTrue(testCase, merged->row->bases != NULL && merged->row->n_row->bases != NULL);
+    Alignment_Row *row = merged->row->n_row->n_row;
+    CuAssertTrue(testCase, row->bases == NULL && packed_bases_is_sparse(row->packed_bases));
+    CuAssertIntEquals(testCase, 99, packed_bases_count_gaps(row->packed_bases, 0, 100));
+    CuAssertIntEquals(testCase, 'G', packed_bases_get_base(row->packed_bases, 99));
+    CuAssertTrue(testCase, alignment_unpack_rows(merged));
+    check_base_matrix(testCase, merged);
+    CuAssertIntEquals(testCase, 'G', merged->row->n_row->n_row->bases[99]);
+    alignment_destruct(merged, 1);
+
+    // The columns of a packed block are the same as those of the block, and unpacking gives back its rows
+    li = LI_construct(fopen("./tests/evolverMammals.maf", "r"));
+    Tag *tags = maf_read_header(li);
+    tag_destruct(tags);
+    Alignment *alignment;
+    int64_t blocks = 0;
+    while((alignment = maf_read_block(li)) != NULL) {
+        stList *rows = stList_construct3(0, free);
+        for(Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
+            stList_append(rows, stString_copy(row->bases));
+        }
+        char *columns = st_malloc(alignment->row_number * alignment->column_number + 1);
+        alignment_get_columns_in_buffer(alignment, 0, alignment->column_number, columns);
+        alignment_pack_rows(alignment);
+        CuAssertTrue(testCase, alignment_get_base_matrix(alignment) == NULL);
+        for(Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
+            CuAssertTrue(testCase, row->bases == NULL && row->packed_bases != NULL);
+        }
+        char *packed_columns = st_malloc(alignment->row_number * alignment->column_number + 1);
+        alignment_get_columns_in_buffer(alignment, 0, alignment->column_number, packed_columns);
+        CuAssertTrue(testCase, memcmp(columns, packed_columns, alignment->row_number * alignment->column_number) == 0);
+        check_get_columns(testCase, alignment, 0, alignment->column_number);
+        check_get_columns(testCase, alignment, alignment->column_number / 3, alignment->column_number / 2);
+        // Writing the packed block gives back its rows
+        LW *lw = LW_construct(fopen(temp_file, "w"), 0);
+        maf_write_block(alignment, lw);
+        LW_destruct(lw, 1);
+        LI *li2 = LI_construct(fopen(temp_file, "r"));
+        Alignment *written = maf_read_block(li2);
+        int64_t i = 0;
+        for(Alignment_Row *row = written->row; row != NULL; row = row->n_row) {
+            CuAssertStrEquals(testCase, stList_get(rows, i++), row->bases);
+        }
+        alignment_destruct(written, 1);
+        LI_destruct(li2);
+        CuAssertTrue(testCase, alignment_unpack_rows(alignment));
+        CuAssertTrue(testCase, alignment_get_base_matrix(alignment) != NULL);
+        i = 0;
+        for(Alignment_Row *row = alignment->row; row != NULL; row = row->n_row) {
+            CuAssertTrue(testCase, row->packed_bases == NULL);
+            CuAssertStrEquals(testCase, stList_get(rows, i++), row->bases);
+        }
+        free(columns);
+        free(packed_columns);
+        stList_destruct(rows);
+        alignment_destruct(alignment, 1);
+        blocks++;
+    }
+    CuAssertTrue(testCase, blocks > 0);
+    LI_destruct(li);
+    st_system("rm -f %s", temp_file);
+}
+
+/*
+ * Checks the column transpose used by taf_read_block against a base at a time copy, for row and column
+ * numbers that do and don't fill whole tiles. Then checks the reverse transpose used by the TAF writer.
+ */
+static void test_transpose_columns(CuTest *testCase) {
+    int64_t row_numbers[] = { 1, 17, 64, 100 };
+    int64_t column_number = 333;
+    for(int64_t n=0; n<sizeof(row_numbers)/sizeof(int64_t); n++) {
+        int64_t row_number = row_numbers[n];
+        char *columns = st_malloc(row_number * column_number);
+        for(int64_t i=0; i<row_number * column_number; i++) {
+            columns[i] = st_random() > 0.3 ? "ACGT"[st_randomInt(0, 4)] : '-';
+        }
+        char **rows = st_malloc(sizeof(char *) * row_number);
+        int64_t *row_lengths = st_malloc(sizeof(int64_t) * row_number);
+        for(int64_t i=0; i<row_number; i++) {
+            rows[i] = st_malloc(column_number);
+        }
+        alignment_transpose_columns(columns, row_number, column_number, rows, row_lengths);
+        for(int64_t i=0; i<row_number; i++) {
+            int64_t length = 0;
+            for(int64_t j=0; j<column_number; j++) {
+                CuAssertTrue(testCase, rows[i][j] == columns[j * row_number + i]);
+                length += columns[j * row_number + i] != '-';
+            }
+            CuAssertIntEquals(testCase, length, row_lengths[i]);
+        }
+        // Transpose a range of the columns back out of the rows
+        int64_t column_start = column_number / 3, columns_to_get = column_number / 2;
+        char *columns2 = st_malloc(row_number * columns_to_get);
+        alignment_transpose_rows(rows, row_number, column_start, columns_to_get, columns2);
+        for(int64_t i=0; i<row_number * columns_to_get; i++) {
+            CuAssertTrue(testCase, columns2[i] == columns[column_start * row_number + i]);
+        }
+        free(columns2);
+        for(int64_t i=0; i<row_number; i++) {
+            free(rows[i]);
+        }
+        free(rows);
+        free(row_lengths);
+        free(columns);
+    }
+}
+
 CuSuite* taf_test_suite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, test_taf);
+    SUITE_ADD_TEST(suite, test_taf_line_scan);
+    SUITE_ADD_TEST(suite, test_taf_read_unordered_coordinate_operations);
+    SUITE_ADD_TEST(suite, test_taf_lazy_column_tags);
+    SUITE_ADD_TEST(suite, test_sequence_names);
+    SUITE_ADD_TEST(suite, test_block_arenas);
+    SUITE_ADD_TEST(suite, test_base_matrix);
+    SUITE_ADD_TEST(suite, test_taf_parallel_reader);
+    SUITE_ADD_TEST(suite, test_li_read_ahead);
+    SUITE_ADD_TEST(suite, test_li_next_line_view);
+    SUITE_ADD_TEST(suite, test_lw_write_behind);
+    SUITE_ADD_TEST(suite, test_taf_block_aligned_anchors);
+    SUITE_ADD_TEST(suite, test_tai_index_as_written);
+    SUITE_ADD_TEST(suite, test_tai_binary_index);
+    SUITE_ADD_TEST(suite, test_tai_regions);
+    SUITE_ADD_TEST(suite, test_tai_regions_output_prefix);
+    SUITE_ADD_TEST(suite, test_tai_parallel_index);
+    SUITE_ADD_TEST(suite, test_transpose_columns);
+    SUITE_ADD_TEST(suite, test_get_columns);
+    SUITE_ADD_TEST(suite, test_row_index);
+    SUITE_ADD_TEST(suite, test_packed_bases);
     return suite;
 }
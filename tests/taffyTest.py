@@ -1,4 +1,5 @@
 import torch
+import numpy as np
 import unittest
 import pathlib
 import subprocess
@@ -63,6 +64,15 @@ class TafTest(unittest.TestCase):
             self.assertEqual(a.get_column(a.column_number()-2), "CCTCGTCCC")
             self.assertEqual(a.get_column(-2), "CCTCGTCCC")
 
+            # Check bulk column retrieval agrees with getting the columns one at a time
+            self.assertEqual(a.get_columns(), [a.get_column(i) for i in range(a.column_number())])
+            self.assertEqual(a.get_columns(1, 2), ["TTTTTTTTT", "CCCCGCCCC"])
+            for dtype in (np.int8, np.int32):
+                columns = a.get_columns_as_np_array(dtype=dtype)
+                self.assertEqual(columns.shape, (a.column_number(), a.row_number()))
+                for i in range(a.column_number()):
+                    self.assertTrue(np.array_equal(columns[i], a.get_column_as_np_array(i)))
+
             # The second alignment block
             b = next(mp)
             self.assertEqual(b.row_number(), 9)  # Should be nine rows in block
@@ -110,6 +120,14 @@ class TafTest(unittest.TestCase):
             for column, label in column_it:
                 pass
 
+    def test_pack_bases(self):
+        """ Check blocks read with their bases packed give the same bases and columns """
+        with AlignmentReader(self.test_maf_file) as mp, AlignmentReader(self.test_maf_file, pack_bases=True) as pp:
+            for a, b in zip(mp, pp):
+                self.assertEqual([row.bases() for row in a], [row.bases() for row in b])
+                self.assertEqual(a.get_columns(), b.get_columns())
+                self.assertTrue(np.array_equal(a.get_columns_as_np_array(), b.get_columns_as_np_array()))
+
     def test_maf_to_taf(self, compress_file=False):
         """ Read a maf file, write a taf file, compress it with gzip and then read it back and check
         they are equal. Tests round trip read and write. Writes in random tags to the taf to test tag writing """